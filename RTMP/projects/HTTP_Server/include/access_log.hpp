@@ -0,0 +1,157 @@
+#ifndef HTTP_ACCESS_LOG_HPP
+#define HTTP_ACCESS_LOG_HPP
+
+#include <cstdio>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/tss.hpp>
+
+namespace http {
+namespace server {
+
+struct request;
+
+/// What is logged about one request. Fields are of fixed size so a record is
+/// copied without allocating; longer text is truncated.
+struct access_record
+{
+  /// Construct an empty record.
+  access_record();
+
+  /// Fill in the request, received from address at started.
+  void set_request(const request& req, const boost::asio::ip::address& address,
+      const boost::posix_time::ptime& started);
+
+  /// Fill in the outcome, as the reply completes at now.
+  void set_reply(int reply_status, boost::uint64_t reply_bytes, const boost::posix_time::ptime& now);
+
+  std::time_t time;
+  boost::posix_time::ptime started;
+  unsigned char address[16];
+  bool address_v6;
+  char method[16];
+  char uri[256];
+  int version_major;
+  int version_minor;
+  int status;
+  boost::uint64_t bytes;
+  boost::uint32_t milliseconds;
+};
+
+/// Writes an access log in the Common Log Format, followed by the time taken
+/// in milliseconds.
+///
+/// Logging never blocks the thread serving the request: each thread appends
+/// records to a ring buffer of its own, without locking, and a background
+/// thread drains the rings, formats the records and writes them in large
+/// batches. A record that finds its ring full is dropped and counted, and the
+/// count is written to the log. The log is rotated by renaming it with a
+/// timestamp once it reaches a size or an age.
+class access_log
+  : private boost::noncopyable
+{
+public:
+  /// Construct a log that discards records until it is opened.
+  access_log();
+
+  /// Write the records still buffered and close the log.
+  ~access_log();
+
+  /// Append to the log file at path, starting the writing thread. Throws
+  /// std::runtime_error if the file cannot be opened. Must be called before use.
+  void open(const std::string& path);
+
+  /// Rotate once the log reaches max_bytes, or is max_seconds old; 0 disables
+  /// either. Must be called before use.
+  void set_rotation(boost::uint64_t max_bytes, std::time_t max_seconds);
+
+  /// Whether records are being written.
+  bool is_open() const;
+
+  /// Log a record.
+  void log(const access_record& record);
+
+private:
+  /// Records from one thread. Only that thread moves head and only the writer
+  /// moves tail.
+  struct ring
+  {
+    ring();
+
+    std::vector<access_record> records;
+    volatile std::size_t head;
+    volatile std::size_t tail;
+    volatile std::size_t dropped;
+    std::size_t dropped_reported;
+  };
+
+  /// Cleanup for local_ring_, which leaves the ring to the log.
+  static void keep_ring(ring* r);
+
+  /// The calling thread's ring, created on first use.
+  ring& local_ring();
+
+  /// Drain the rings until the log is closed.
+  void run();
+
+  /// Format everything buffered and write it.
+  void drain();
+
+  /// Write text, rotating first if it is due.
+  void write(const std::string& text);
+
+  /// Rename the log aside and start a new one.
+  void rotate();
+
+  /// Format a record as a line of text.
+  void format(const access_record& record, std::string& out);
+
+  /// Whether open() has been called. Read by logging threads, unlike file_,
+  /// which changes on rotation.
+  bool open_;
+
+  std::string path_;
+  std::FILE* file_;
+  boost::uint64_t max_bytes_;
+  std::time_t max_seconds_;
+
+  /// Bytes in the current file.
+  boost::uint64_t written_;
+
+  /// When the current file was started.
+  std::time_t opened_;
+
+  /// The second time_text_ was formatted for.
+  std::time_t formatted_time_;
+  std::string time_text_;
+
+  /// Text formatted but not yet written.
+  std::string batch_;
+
+  /// The rings of all threads that have logged. Rings outlive their threads
+  /// so records are not lost.
+  std::vector<boost::shared_ptr<ring> > rings_;
+
+  /// Each thread's ring.
+  boost::thread_specific_ptr<ring> local_ring_;
+
+  /// Protects rings_ and stopping_.
+  boost::mutex mutex_;
+  boost::condition_variable wake_;
+  bool stopping_;
+  boost::shared_ptr<boost::thread> thread_;
+};
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_ACCESS_LOG_HPP
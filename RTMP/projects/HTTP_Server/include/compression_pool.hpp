@@ -0,0 +1,66 @@
+#ifndef HTTP_COMPRESSION_POOL_HPP
+#define HTTP_COMPRESSION_POOL_HPP
+
+#include <deque>
+#include <string>
+#include <boost/asio.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace http {
+namespace server {
+
+/// Compresses data with gzip on a background thread, for work slow enough
+/// that it must not hold up an io_service thread, such as compressing files
+/// at a high level for the cache. Completions are posted to the io_service
+/// given with the data.
+class compression_pool
+  : private boost::noncopyable
+{
+public:
+  /// Called with the compressed data.
+  typedef boost::function<void (const boost::shared_ptr<const std::string>&)> compress_handler;
+
+  /// Construct a pool, starting its thread on first use.
+  compression_pool();
+
+  /// Stop the thread. Data still queued is abandoned.
+  ~compression_pool();
+
+  /// Compress data at level, then post handler to io_service.
+  void async_compress(boost::asio::io_service& io_service, const boost::shared_ptr<const std::string>& data,
+      int level, const compress_handler& handler);
+
+private:
+  /// Queued data.
+  struct job
+  {
+    boost::asio::io_service* io_service;
+
+    /// Keeps io_service running until the completion has been posted.
+    boost::shared_ptr<boost::asio::io_service::work> work;
+
+    boost::shared_ptr<const std::string> data;
+    int level;
+    compress_handler handler;
+  };
+
+  /// Serve the queue until the pool stops.
+  void run();
+
+  /// Protects jobs_ and stopping_.
+  boost::mutex mutex_;
+  boost::condition_variable ready_;
+  std::deque<job> jobs_;
+  bool stopping_;
+  boost::shared_ptr<boost::thread> thread_;
+};
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_COMPRESSION_POOL_HPP
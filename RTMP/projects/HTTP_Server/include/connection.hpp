@@ -1,11 +1,15 @@
 #ifndef HTTP_CONNECTION_HPP
 #define HTTP_CONNECTION_HPP
 
+#include <deque>
+#include <vector>
 #include <boost/asio.hpp>
 #include <boost/array.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/enable_shared_from_this.hpp>
+#include "access_log.hpp"
+#include "disk_io_pool.hpp"
 #include "reply.hpp"
 #include "request.hpp"
 #include "request_handler.hpp"
@@ -17,13 +21,23 @@ namespace server {
 class connection_manager;
 
 /// Represents a single connection from a client.
+///
+/// Connections persist between requests (HTTP/1.1 keep-alive) until the
+/// client asks to close or stays idle for longer than the idle timeout.
+/// Pipelined requests are parsed as they arrive and their replies written in
+/// request order, gathering everything ready into one write. A body read from
+/// file ends the gathered write and is then streamed in pieces read by the
+/// disk I/O pool, the next piece being read while the last is written. A
+/// body compressed as it is sent is compressed a piece at a time, each piece
+/// becoming a chunk.
 
 class connection : public boost::enable_shared_from_this<connection>, private boost::noncopyable
 {
 public:
 	/// Construct a connection with the given io_service.
 	explicit connection(boost::asio::io_service& io_service,
-	connection_manager& manager, request_handler& handler);
+	connection_manager& manager, request_handler& handler, disk_io_pool& disk_pool,
+	access_log& log, const boost::posix_time::time_duration& idle_timeout);
 
 	/// Get the socket associated with the connection.
 	boost::asio::ip::tcp::socket& socket();
@@ -35,6 +49,8 @@ public:
 	void stop();
 
 private:
+	struct body_piece;
+
 	/// Handle completion of a read operation.
 	void handle_read(const boost::system::error_code& e,
 	std::size_t bytes_transferred);
@@ -42,6 +58,48 @@ private:
 	/// Handle completion of a write operation.
 	void handle_write(const boost::system::error_code& e);
 
+	/// Handle expiry of the idle timer.
+	void handle_timeout(const boost::system::error_code& e);
+
+	/// Parse received data, queueing a reply for every complete request.
+	void process(const char* begin, const char* end);
+
+	/// Add the connection headers to the last queued reply.
+	void finish_reply(bool keep_alive);
+
+	/// Write queued replies, up to and including the first with a file body.
+	void write_replies();
+
+	/// Handle completion of writing the replies gathered by write_replies.
+	void replies_written();
+
+	/// Log a reply of which body_bytes of body were sent.
+	void log_reply(reply& rep, boost::uint64_t body_bytes);
+
+	/// Start streaming the file body of the last reply being written.
+	void start_body();
+
+	/// Start reading the next piece of the body into a free buffer.
+	void read_body();
+
+	/// Handle completion of reading a piece of the body.
+	void handle_body_read(std::size_t slot, std::size_t bytes_read);
+
+	/// Write the next piece of the body if it has been read.
+	void write_body();
+
+	/// Handle completion of writing a piece of the body.
+	void handle_body_write(const boost::system::error_code& e);
+
+	/// Compress a piece of the body into a chunk, ending the body if last.
+	void encode_piece(body_piece& piece, gzip_encoder& encoder, bool last);
+
+	/// Continue reading from the socket.
+	void read_more();
+
+	/// Whether the client wants the connection kept open after req.
+	static bool keep_alive(const request& req);
+
 	/// Socket for the connection.
 	boost::asio::ip::tcp::socket socket_;
 
@@ -51,6 +109,24 @@ private:
 	/// The handler used to process the incoming request.
 	request_handler& request_handler_;
 
+	/// The io_service file reads complete on.
+	boost::asio::io_service& io_service_;
+
+	/// Reads file bodies off the io_service thread.
+	disk_io_pool& disk_pool_;
+
+	/// Where completed requests are logged.
+	access_log& log_;
+
+	/// The address of the client.
+	boost::asio::ip::address peer_;
+
+	/// Timer closing the connection when it has been idle for too long.
+	boost::asio::deadline_timer timer_;
+
+	/// How long a connection may wait for its next request.
+	boost::posix_time::time_duration idle_timeout_;
+
 	/// Buffer for incoming data.
 	boost::array<char, 8192> buffer_;
 
@@ -60,8 +136,61 @@ private:
 	/// The parser for the incoming request.
 	request_parser request_parser_;
 
-	/// The reply to be sent back to the client.
-	reply reply_;
+	/// Bytes of a request body still to be skipped.
+	std::size_t body_remaining_;
+
+	/// Replies in request order. The first replies_writing_ of them are being
+	/// written; a deque keeps them in place while the rest are appended.
+	std::deque<reply> replies_;
+
+	/// Number of replies in the outstanding write.
+	std::size_t replies_writing_;
+
+	/// The file segment to be read next.
+	std::size_t segment_;
+
+	/// File bytes of that segment already read.
+	boost::uint64_t segment_read_;
+
+	/// Whether a piece has been made for the text of that segment.
+	bool segment_started_;
+
+	/// A piece of body being read or written: optional segment text, then
+	/// length bytes of file data, or the chunk they were compressed into.
+	struct body_piece
+	{
+		body_piece();
+
+		const std::string* text;
+		std::vector<char> data;
+		std::size_t length;
+		std::string chunk;
+		bool in_use;
+		bool ready;
+	};
+
+	enum { body_piece_count = 2 };
+
+	/// Buffers for reading the body while writing it.
+	body_piece body_pieces_[body_piece_count];
+
+	/// Pieces in use, in body order.
+	std::deque<std::size_t> body_order_;
+
+	/// Whether a piece of body is being written.
+	bool body_writing_;
+
+	/// Whether a file body is being streamed.
+	bool body_streaming_;
+
+	/// Bytes of the file body written so far.
+	boost::uint64_t body_sent_;
+
+	/// Whether a read is outstanding.
+	bool reading_;
+
+	/// Whether the last queued reply ends the connection.
+	bool closing_;
 };
 
 typedef boost::shared_ptr<connection> connection_ptr;
@@ -0,0 +1,86 @@
+#ifndef HTTP_DISK_IO_POOL_HPP
+#define HTTP_DISK_IO_POOL_HPP
+
+#include <deque>
+#include <map>
+#include <boost/asio.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include "fd_cache.hpp"
+
+namespace http {
+namespace server {
+
+/// Reads file data on a few threads per storage device, so that a slow
+/// disk delays only the responses reading from it and never blocks an
+/// io_service thread. Each device has its own queue, served in order.
+/// Completions are posted to the io_service given with the read.
+class disk_io_pool
+  : private boost::noncopyable
+{
+public:
+  /// Called with the number of bytes read.
+  typedef boost::function<void (std::size_t)> read_handler;
+
+  /// Construct a pool that starts threads_per_device threads for each device
+  /// as it is first read from.
+  explicit disk_io_pool(std::size_t threads_per_device = 2);
+
+  /// Stop all threads. Reads still queued are abandoned.
+  ~disk_io_pool();
+
+  /// Read length bytes at offset into data, then post handler to io_service.
+  /// data must remain valid until the handler runs.
+  void async_read(boost::asio::io_service& io_service, const open_file_ptr& file,
+      boost::uint64_t offset, char* data, std::size_t length, const read_handler& handler);
+
+private:
+  /// A queued read.
+  struct job
+  {
+    boost::asio::io_service* io_service;
+
+    /// Keeps io_service running until the completion has been posted.
+    boost::shared_ptr<boost::asio::io_service::work> work;
+
+    open_file_ptr file;
+    boost::uint64_t offset;
+    char* data;
+    std::size_t length;
+    read_handler handler;
+  };
+
+  /// The queue and threads of one device.
+  struct device_queue
+  {
+    device_queue();
+
+    boost::mutex mutex;
+    boost::condition_variable ready;
+    std::deque<job> jobs;
+    bool stopping;
+    boost::thread_group threads;
+  };
+
+  /// Serve a device's queue until the pool stops.
+  static void run(device_queue& queue);
+
+  /// Protects devices_.
+  boost::mutex mutex_;
+
+  /// Queues by device.
+  std::map<boost::uint64_t, boost::shared_ptr<device_queue> > devices_;
+
+  /// Threads started per device.
+  std::size_t threads_per_device_;
+};
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_DISK_IO_POOL_HPP
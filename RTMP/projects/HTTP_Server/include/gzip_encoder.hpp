@@ -0,0 +1,57 @@
+#ifndef HTTP_GZIP_ENCODER_HPP
+#define HTTP_GZIP_ENCODER_HPP
+
+#include <string>
+#include <boost/noncopyable.hpp>
+#include <zlib.h>
+
+namespace http {
+namespace server {
+
+/// Compresses data into the gzip format a piece at a time, so a body can be
+/// sent compressed as it is read.
+///
+/// The gzip header and trailer are written here rather than by zlib, which
+/// only learned to write them in version 1.2.
+class gzip_encoder
+  : private boost::noncopyable
+{
+public:
+  /// Construct an encoder compressing at level, from 1 (fastest) to 9 (best).
+  explicit gzip_encoder(int level);
+
+  /// Release the compression state.
+  ~gzip_encoder();
+
+  /// Compress size bytes at data, appending to out everything that can be
+  /// decompressed from the input so far.
+  void write(const char* data, std::size_t size, std::string& out);
+
+  /// End the stream, appending the rest of it to out.
+  void finish(std::string& out);
+
+  /// Compress size bytes at data as a whole gzip stream.
+  static std::string compress(const char* data, std::size_t size, int level);
+
+private:
+  /// Run deflate over the input with the given flush mode, appending the
+  /// output to out.
+  void deflate_to(const char* data, std::size_t size, int flush, std::string& out);
+
+  /// The zlib stream.
+  z_stream stream_;
+
+  /// CRC-32 of the input so far.
+  uLong crc_;
+
+  /// Bytes of input so far.
+  uLong size_;
+
+  /// Whether the gzip header has been written.
+  bool started_;
+};
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_GZIP_ENCODER_HPP
@@ -0,0 +1,87 @@
+#ifndef HTTP_LISTENER_HPP
+#define HTTP_LISTENER_HPP
+
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include "connection.hpp"
+#include "connection_manager.hpp"
+#include "access_log.hpp"
+#include "disk_io_pool.hpp"
+#include "request_handler.hpp"
+
+namespace http {
+namespace server {
+
+/// Accepts connections on a listening socket of its own and serves them on
+/// its own io_service, which is run by a single thread.
+///
+/// Several listeners bound to the same endpoint with SO_REUSEPORT let the
+/// kernel spread incoming connections over the threads. Each keeps several
+/// accepts outstanding, so a burst of connections is not taken one
+/// completion at a time, and a connection stays on the thread that accepted
+/// it.
+class listener
+  : private boost::noncopyable
+{
+public:
+  /// Listen on endpoint with accepts operations outstanding. reuse_port must
+  /// be set on every listener sharing the endpoint.
+  listener(boost::asio::io_service& io_service, const boost::asio::ip::tcp::endpoint& endpoint,
+      std::size_t accepts, bool reuse_port, request_handler& handler, disk_io_pool& disk_pool,
+      access_log& log, const boost::posix_time::time_duration& idle_timeout);
+
+  /// Run the io_service loop until the listener is stopped.
+  void run();
+
+  /// Stop the listener and its connections. Safe to call from any thread.
+  void stop();
+
+private:
+  /// Start accepting into a slot.
+  void start_accept(std::size_t slot);
+
+  /// Handle completion of an asynchronous accept operation.
+  void handle_accept(std::size_t slot, const boost::system::error_code& e);
+
+  /// Handle the end of the pause after an accept failed for want of
+  /// descriptors.
+  void handle_accept_retry(std::size_t slot, const boost::system::error_code& e);
+
+  /// Handle a request to stop the listener.
+  void handle_stop();
+
+  /// The io_service this listener's connections run on.
+  boost::asio::io_service& io_service_;
+
+  /// Acceptor used to listen for incoming connections.
+  boost::asio::ip::tcp::acceptor acceptor_;
+
+  /// The connection manager which owns the connections accepted here.
+  connection_manager connection_manager_;
+
+  /// The connections being accepted, one per outstanding accept.
+  std::vector<connection_ptr> new_connections_;
+
+  /// Timers pausing a slot whose accept failed for want of descriptors, one
+  /// per slot.
+  std::vector<boost::shared_ptr<boost::asio::deadline_timer> > accept_timers_;
+
+  /// The handler for all incoming requests.
+  request_handler& request_handler_;
+
+  /// Threads reading file data.
+  disk_io_pool& disk_pool_;
+
+  /// Where completed requests are logged.
+  access_log& log_;
+
+  /// How long an idle connection is kept open.
+  const boost::posix_time::time_duration& idle_timeout_;
+};
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_LISTENER_HPP
@@ -10,6 +10,9 @@ namespace mime_types {
 /// Convert a file extension into a MIME type.
 std::string extension_to_type(const std::string& extension);
 
+/// Whether content of a MIME type is text that is worth compressing.
+bool is_compressible(const std::string& mime_type);
+
 } // namespace mime_types
 } // namespace server
 } // namespace http
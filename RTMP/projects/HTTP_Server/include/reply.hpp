@@ -1,9 +1,15 @@
 #ifndef HTTP_REPLY_HPP
 #define HTTP_REPLY_HPP
 
+#include <ctime>
 #include <string>
 #include <vector>
 #include <boost/asio.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include "access_log.hpp"
+#include "fd_cache.hpp"
+#include "gzip_encoder.hpp"
 #include "header.hpp"
 
 namespace http {
@@ -19,6 +25,7 @@ struct reply
     created = 201,
     accepted = 202,
     no_content = 204,
+    partial_content = 206,
     multiple_choices = 300,
     moved_permanently = 301,
     moved_temporarily = 302,
@@ -27,6 +34,7 @@ struct reply
     unauthorized = 401,
     forbidden = 403,
     not_found = 404,
+    requested_range_not_satisfiable = 416,
     internal_server_error = 500,
     not_implemented = 501,
     bad_gateway = 502,
@@ -36,18 +44,82 @@ struct reply
   /// The headers to be included in the reply.
   std::vector<header> headers;
 
+  /// Headers already formatted as "Name: value\r\n" lines, sent after the
+  /// status line or shared head and before headers. Cheaper than headers for
+  /// the few that vary per reply.
+  std::string head_patch;
+
   /// The content to be sent in the reply.
   std::string content;
 
+  /// A piece of body read from file while it is being written: text, then
+  /// length bytes of the file starting at offset.
+  struct file_segment
+  {
+    std::string text;
+    boost::uint64_t offset;
+    boost::uint64_t length;
+  };
+
+  /// Status line and headers built in advance and shared between replies,
+  /// e.g. by the file cache. When set, status is not written again and
+  /// headers holds only headers added afterwards.
+  boost::shared_ptr<const std::string> shared_head;
+
+  /// Content shared between replies, sent instead of content when set.
+  boost::shared_ptr<const std::string> shared_content;
+
+  /// The file segments are read from. When set, the body is made of
+  /// segments and content is empty.
+  open_file_ptr file;
+
+  /// The body, when it is read from file.
+  std::vector<file_segment> segments;
+
+  /// When set, the body read from file is compressed with it as it is sent,
+  /// in chunks of the chunked transfer coding.
+  boost::shared_ptr<gzip_encoder> encoder;
+
+  /// What is logged once the reply has been sent.
+  access_record record;
+
+  /// Bytes of body in the reply, including those read from file.
+  boost::uint64_t body_size() const;
+
+  /// Keep the status line and headers, Content-Length included, but send no
+  /// body, as the reply to a HEAD request.
+  void drop_body();
+
+  /// Append a header to head_patch.
+  void patch_header(const char* name, const std::string& value);
+
+  /// Append a Content-Length header to head_patch.
+  void patch_content_length(boost::uint64_t length);
+
   /// Convert the reply into a vector of buffers. The buffers do not own the
   /// underlying memory blocks, therefore the reply object must remain valid and
   /// not be changed until the write operation has completed.
+  /// A body read from file is not included. headers and the Date header are
+  /// added to head_patch, so this is called once per reply.
   std::vector<boost::asio::const_buffer> to_buffers();
 
+  /// Format the status line and headers, without the Date header or the blank
+  /// line that ends them.
+  std::string head_to_string() const;
+
   /// Get a stock reply.
   static reply stock_reply(status_type status);
+
+  /// Get the status line and Content-Type header, with Accept-Ranges if
+  /// accept_ranges is set, for use as a shared head. Each combination is
+  /// formatted once per thread.
+  static boost::shared_ptr<const std::string> head_block(status_type status,
+      const std::string& content_type, bool accept_ranges);
 };
 
+/// Format a time as an HTTP date, e.g. "Sun, 06 Nov 1994 08:49:37 GMT".
+std::string http_date(std::time_t t);
+
 } // namespace server
 } // namespace http
 
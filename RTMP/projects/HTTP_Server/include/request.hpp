@@ -3,6 +3,7 @@
 
 #include <string>
 #include <vector>
+#include <boost/algorithm/string/predicate.hpp>
 #include "header.hpp"
 
 namespace http {
@@ -18,6 +19,20 @@ struct request
   std::vector<header> headers;
 };
 
+/// Find the value of the named header, compared case-insensitively. Returns 0
+/// if the request does not have it.
+inline const std::string* find_header(const request& req, const char* name)
+{
+  for (std::size_t i = 0; i < req.headers.size(); ++i)
+  {
+    if (boost::algorithm::iequals(req.headers[i].name, name))
+    {
+      return &req.headers[i].value;
+    }
+  }
+  return 0;
+}
+
 } // namespace server
 } // namespace http
 
@@ -1,8 +1,20 @@
 #ifndef HTTP_REQUEST_HANDLER_HPP
 #define HTTP_REQUEST_HANDLER_HPP
 
+#include <ctime>
+#include <set>
 #include <string>
+#include <utility>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/cstdint.hpp>
 #include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include "compression_pool.hpp"
+#include "disk_io_pool.hpp"
+#include "fd_cache.hpp"
+#include "file_cache.hpp"
 
 namespace http {
 namespace server {
@@ -11,20 +23,78 @@ struct reply;
 struct request;
 
 /// The common handler for all incoming requests.
+///
+/// Text files are sent gzip-compressed to clients that accept it. Those in
+/// the hot-file cache are compressed once, at a high level, on a background
+/// thread and the result is cached with them; larger ones are compressed at
+/// a low level as they are sent.
 class request_handler
   : private boost::noncopyable
 {
 public:
-  /// Construct with a directory containing files to be served.
-  explicit request_handler(const std::string& doc_root);
+  /// Construct with a directory containing files to be served. Files are
+  /// loaded into the cache by disk_pool, completing on io_service.
+  request_handler(const std::string& doc_root, boost::asio::io_service& io_service, disk_io_pool& disk_pool);
 
   /// Handle a request and produce a reply.
   void handle_request(const request& req, reply& rep);
 
+  /// The cache of small hot files.
+  file_cache& cache();
+
+  /// The cache of open files.
+  fd_cache& files();
+
 private:
   /// The directory containing the files to be served.
   std::string doc_root_;
 
+  /// Where cache fills complete.
+  boost::asio::io_service& io_service_;
+
+  /// Reads files for the cache.
+  disk_io_pool& disk_pool_;
+
+  /// Small files served from memory.
+  file_cache cache_;
+
+  /// Paths being read into the cache.
+  std::set<std::string> filling_;
+
+  /// Protects filling_.
+  boost::mutex filling_mutex_;
+
+  /// Files kept open between requests.
+  fd_cache files_;
+
+  /// Compresses cached files.
+  compression_pool compressor_;
+
+  /// Start reading a file into the cache, unless that is already under way.
+  /// A compressed variant is made too if the file is compressible.
+  void fill_cache(const std::string& path, const open_file_ptr& file, const std::string& etag,
+      const std::string& last_modified, const std::string& content_type, bool compressible);
+
+  /// Handle completion of reading a file for the cache. gzip_rep, if set,
+  /// has the headers of the compressed variant.
+  void handle_fill(const std::string& path, const open_file_ptr& file, const boost::shared_ptr<reply>& rep,
+      const boost::shared_ptr<reply>& gzip_rep, std::size_t bytes_read);
+
+  /// Handle completion of compressing a cached file.
+  void handle_compressed(const std::string& path, std::time_t mtime, boost::uint64_t size,
+      const boost::shared_ptr<reply>& gzip_rep, const boost::shared_ptr<const std::string>& compressed);
+
+  /// Whether the client accepts gzip-compressed content.
+  static bool accepts_gzip(const request& req);
+
+  /// An inclusive range of byte offsets.
+  typedef std::pair<boost::uint64_t, boost::uint64_t> byte_range;
+
+  /// Parse a Range header value for a file of the given size into sorted,
+  /// merged ranges. Returns false if the header is malformed and should be
+  /// ignored; ranges is empty if none of them can be satisfied.
+  static bool parse_ranges(const std::string& value, boost::uint64_t size, std::vector<byte_range>& ranges);
+
   /// Perform URL-decoding on a string. Returns false if the encoding was
   /// invalid.
   static bool url_decode(const std::string& in, std::string& out);
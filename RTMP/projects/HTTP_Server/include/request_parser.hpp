@@ -1,6 +1,9 @@
 #ifndef HTTP_REQUEST_PARSER_HPP
 #define HTTP_REQUEST_PARSER_HPP
 
+#include <cstddef>
+#include <string>
+#include <vector>
 #include <boost/logic/tribool.hpp>
 #include <boost/tuple/tuple.hpp>
 
@@ -10,6 +13,12 @@ namespace server {
 struct request;
 
 /// Parser for incoming requests.
+///
+/// The request head is scanned a line at a time for the next control
+/// character, which must be the line's CR LF, and fields are recorded as
+/// slices of the head until it is complete; only then are they copied into
+/// the request. When a head arrives split across reads, the part already
+/// received is kept and scanning resumes where it stopped.
 class request_parser
 {
 public:
@@ -21,26 +30,36 @@ public:
 
 	/// Parse some data. The tribool return value is true when a complete request
 	/// has been parsed, false if the data is invalid, indeterminate when more
-	/// data is required. The InputIterator return value indicates how much of the
+	/// data is required. The pointer return value indicates how much of the
 	/// input has been consumed.
-	template <typename InputIterator>
-	boost::tuple<boost::tribool, InputIterator> parse(request& req, InputIterator begin, InputIterator end)
-	{
-		while (begin != end)
-		{
-			boost::tribool result = consume(req, *begin++);
-			if (result || !result)
-			{
-				return boost::make_tuple(result, begin);
-			}
-		}
-		boost::tribool result = boost::indeterminate;
-		return boost::make_tuple(result, begin);
-	}
+	boost::tuple<boost::tribool, const char*> parse(request& req, const char* begin, const char* end);
 
 private:
-	/// Handle the next character of input.
-	boost::tribool consume(request& req, char input);
+	/// A field of the head, as an offset from its start.
+	struct slice
+	{
+		std::size_t offset;
+		std::size_t length;
+	};
+
+	/// A header line. A name of zero length marks a continuation line.
+	struct header_slice
+	{
+		slice name;
+		slice value;
+	};
+
+	/// Parse a complete line of the head, without its CR LF.
+	bool parse_line(const char* head, std::size_t begin, std::size_t end);
+
+	/// Parse the request line.
+	bool parse_request_line(const char* head, std::size_t begin, std::size_t end);
+
+	/// Parse a header line.
+	bool parse_header_line(const char* head, std::size_t begin, std::size_t end);
+
+	/// Copy the parsed fields into the request.
+	void fill(request& req, const char* head) const;
 
 	/// Check if a byte is an HTTP character.
 	static bool is_char(int c);
@@ -54,31 +73,26 @@ private:
 	/// Check if a byte is a digit.
 	static bool is_digit(int c);
 
-	/// The current state of the parser.
-	enum state
-	{
-		method_start,
-		method,
-		uri_start,
-		uri,
-		http_version_h,
-		http_version_t_1,
-		http_version_t_2,
-		http_version_p,
-		http_version_slash,
-		http_version_major_start,
-		http_version_major,
-		http_version_minor_start,
-		http_version_minor,
-		expecting_newline_1,
-		header_line_start,
-		header_lws,
-		header_name,
-		space_before_header_value,
-		header_value,
-		expecting_newline_2,
-		expecting_newline_3
-	} state_;
+	/// Check if a byte may appear in a method or header name.
+	static bool is_token(int c);
+
+	/// The start of a head received over more than one read.
+	std::string pending_;
+
+	/// Offset of the line being scanned.
+	std::size_t line_start_;
+
+	/// Offset to resume scanning from.
+	std::size_t scan_;
+
+	/// Whether the request line has been parsed.
+	bool request_line_done_;
+
+	slice method_;
+	slice uri_;
+	int http_version_major_;
+	int http_version_minor_;
+	std::vector<header_slice> headers_;
 };
 
 } // namespace server
@@ -3,9 +3,12 @@
 
 #include <boost/asio.hpp>
 #include <string>
+#include <vector>
 #include <boost/noncopyable.hpp>
-#include "connection.hpp"
-#include "connection_manager.hpp"
+#include <boost/shared_ptr.hpp>
+#include "access_log.hpp"
+#include "disk_io_pool.hpp"
+#include "listener.hpp"
 #include "request_handler.hpp"
 
 namespace http {
@@ -16,37 +19,54 @@ class server : private boost::noncopyable
 {
 public:
 	/// Construct the server to listen on the specified TCP address and port, and
-	/// serve up files from the given directory.
+	/// serve up files from the given directory. Connections are served by
+	/// thread_count threads, each with its own listening socket where the
+	/// platform supports SO_REUSEPORT, and by one thread otherwise.
 	explicit server(const std::string& address, const std::string& port,
-	const std::string& doc_root);
+	const std::string& doc_root, std::size_t thread_count = 1);
 
-	/// Run the server's io_service loop.
+	/// Set how long a persistent connection may wait for its next request.
+	/// Applies to connections accepted afterwards.
+	void set_idle_timeout(const boost::posix_time::time_duration& timeout);
+
+	/// The cache of small hot files, e.g. to change its budget.
+	file_cache& cache();
+
+	/// The cache of open files, e.g. to change how many are kept.
+	fd_cache& files();
+
+	/// The access log, e.g. to open it before the server is run.
+	access_log& log();
+
+	/// Run the listeners' io_service loops, returning when all have stopped.
 	void run();
 
 	/// Stop the server.
 	void stop();
 
 private:
-	/// Handle completion of an asynchronous accept operation.
-	void handle_accept(const boost::system::error_code& e);
+	typedef boost::shared_ptr<boost::asio::io_service> io_service_ptr;
 
-	/// Handle a request to stop the server.
-	void handle_stop();
+	/// Make an io_service for each listener.
+	static std::vector<io_service_ptr> make_io_services(std::size_t thread_count);
 
-	/// The io_service used to perform asynchronous operations.
-	boost::asio::io_service io_service_;
+	/// The io_services of the listeners, one per thread.
+	std::vector<io_service_ptr> io_services_;
 
-	/// Acceptor used to listen for incoming connections.
-	boost::asio::ip::tcp::acceptor acceptor_;
+	/// Threads reading file data, destroyed before the io_services.
+	disk_io_pool disk_pool_;
 
-	/// The connection manager which owns all live connections.
-	connection_manager connection_manager_;
+	/// How long an idle connection is kept open.
+	boost::posix_time::time_duration idle_timeout_;
 
-	/// The next connection to be accepted.
-	connection_ptr new_connection_;
+	/// The access log, which outlives the listeners' connections.
+	access_log log_;
 
 	/// The handler for all incoming requests.
 	request_handler request_handler_;
+
+	/// The listeners, one per io_service.
+	std::vector<boost::shared_ptr<listener> > listeners_;
 };
 
 } // namespace server
@@ -0,0 +1,347 @@
+#include "access_log.hpp"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <boost/bind.hpp>
+#include "request.hpp"
+
+#if defined(__GNUC__)
+#define HTTP_ACCESS_LOG_BARRIER() __sync_synchronize()
+#elif defined(_MSC_VER)
+#include <intrin.h>
+// Volatile accesses are already ordered by MSVC; only the compiler is fenced.
+#define HTTP_ACCESS_LOG_BARRIER() _ReadWriteBarrier()
+#endif
+
+namespace http {
+namespace server {
+
+namespace {
+
+/// Records each thread can buffer before dropping.
+const std::size_t ring_size = 2048;
+
+/// Batches are written once they reach this size.
+const std::size_t batch_size = 256 * 1024;
+
+/// Milliseconds between drains of the rings.
+const long drain_interval = 200;
+
+void copy_text(char* field, std::size_t size, const std::string& text)
+{
+	std::size_t length = std::min(text.size(), size - 1);
+	std::memcpy(field, text.data(), length);
+	field[length] = 0;
+}
+
+void append_number(std::string& out, boost::uint64_t value)
+{
+	char digits[20];
+	char* p = digits + sizeof(digits);
+	do
+	{
+		*--p = static_cast<char>('0' + value % 10);
+		value /= 10;
+	}
+	while (value > 0);
+	out.append(p, digits + sizeof(digits));
+}
+
+std::tm utc_time(std::time_t t)
+{
+	std::tm time;
+#if defined(_WIN32)
+	::gmtime_s(&time, &t);
+#else
+	::gmtime_r(&t, &time);
+#endif
+	return time;
+}
+
+} // namespace
+
+access_record::access_record()
+	: time(0), address_v6(false), version_major(0), version_minor(0), status(0), bytes(0), milliseconds(0)
+{
+	std::memset(address, 0, sizeof(address));
+	method[0] = 0;
+	uri[0] = 0;
+}
+
+void access_record::set_request(const request& req, const boost::asio::ip::address& peer, const boost::posix_time::ptime& now)
+{
+	time = std::time(0);
+	started = now;
+	if (peer.is_v6())
+	{
+		boost::asio::ip::address_v6::bytes_type b = peer.to_v6().to_bytes();
+		std::copy(b.begin(), b.end(), address);
+		address_v6 = true;
+	}
+	else
+	{
+		boost::asio::ip::address_v4::bytes_type b = peer.to_v4().to_bytes();
+		std::copy(b.begin(), b.end(), address);
+		address_v6 = false;
+	}
+	copy_text(method, sizeof(method), req.method);
+	copy_text(uri, sizeof(uri), req.uri);
+	version_major = req.http_version_major;
+	version_minor = req.http_version_minor;
+}
+
+void access_record::set_reply(int reply_status, boost::uint64_t reply_bytes, const boost::posix_time::ptime& now)
+{
+	status = reply_status;
+	bytes = reply_bytes;
+	milliseconds = started.is_not_a_date_time() ? 0 : static_cast<boost::uint32_t>((now - started).total_milliseconds());
+}
+
+access_log::ring::ring()
+	: records(ring_size), head(0), tail(0), dropped(0), dropped_reported(0)
+{
+}
+
+access_log::access_log()
+	: open_(false), file_(0), max_bytes_(0), max_seconds_(0), written_(0), opened_(0), formatted_time_(0),
+	local_ring_(&access_log::keep_ring), stopping_(false)
+{
+}
+
+access_log::~access_log()
+{
+	if (thread_)
+	{
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			stopping_ = true;
+		}
+		wake_.notify_one();
+		thread_->join();
+	}
+	if (file_)
+	{
+		std::fclose(file_);
+	}
+}
+
+void access_log::open(const std::string& path)
+{
+	path_ = path;
+	file_ = std::fopen(path.c_str(), "ab");
+	if (!file_)
+	{
+		throw std::runtime_error("cannot open access log " + path);
+	}
+	std::fseek(file_, 0, SEEK_END);
+	written_ = std::ftell(file_);
+	opened_ = std::time(0);
+	batch_.reserve(batch_size + 1024);
+	open_ = true;
+	thread_.reset(new boost::thread(boost::bind(&access_log::run, this)));
+}
+
+void access_log::set_rotation(boost::uint64_t max_bytes, std::time_t max_seconds)
+{
+	max_bytes_ = max_bytes;
+	max_seconds_ = max_seconds;
+}
+
+bool access_log::is_open() const
+{
+	return open_;
+}
+
+void access_log::log(const access_record& record)
+{
+	if (!open_)
+	{
+		return;
+	}
+	ring& r = local_ring();
+	std::size_t head = r.head;
+	if (head - r.tail == r.records.size())
+	{
+		r.dropped = r.dropped + 1;
+		return;
+	}
+	r.records[head % r.records.size()] = record;
+	HTTP_ACCESS_LOG_BARRIER();
+	r.head = head + 1;
+}
+
+void access_log::keep_ring(ring*)
+{
+	// Rings belong to the log, not to the thread-specific pointer.
+}
+
+access_log::ring& access_log::local_ring()
+{
+	ring* r = local_ring_.get();
+	if (!r)
+	{
+		boost::shared_ptr<ring> created(new ring);
+		boost::mutex::scoped_lock lock(mutex_);
+		rings_.push_back(created);
+		r = created.get();
+		local_ring_.reset(r);
+	}
+	return *r;
+}
+
+void access_log::run()
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	while (!stopping_)
+	{
+		wake_.timed_wait(lock, boost::posix_time::milliseconds(drain_interval));
+		lock.unlock();
+		drain();
+		lock.lock();
+	}
+	lock.unlock();
+	drain();
+}
+
+void access_log::drain()
+{
+	std::vector<boost::shared_ptr<ring> > rings;
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		rings = rings_;
+	}
+
+	for (std::size_t i = 0; i < rings.size(); ++i)
+	{
+		ring& r = *rings[i];
+		std::size_t tail = r.tail;
+		std::size_t head = r.head;
+		HTTP_ACCESS_LOG_BARRIER();
+		while (tail != head)
+		{
+			format(r.records[tail % r.records.size()], batch_);
+			++tail;
+			if (batch_.size() >= batch_size)
+			{
+				HTTP_ACCESS_LOG_BARRIER();
+				r.tail = tail;
+				write(batch_);
+				batch_.clear();
+			}
+		}
+		HTTP_ACCESS_LOG_BARRIER();
+		r.tail = tail;
+
+		std::size_t dropped = r.dropped;
+		if (dropped != r.dropped_reported)
+		{
+			batch_ += "# ";
+			append_number(batch_, dropped - r.dropped_reported);
+			batch_ += " records dropped\n";
+			r.dropped_reported = dropped;
+		}
+	}
+
+	if (!batch_.empty())
+	{
+		write(batch_);
+		batch_.clear();
+	}
+	if (file_)
+	{
+		std::fflush(file_);
+	}
+}
+
+void access_log::write(const std::string& text)
+{
+	if ((max_bytes_ > 0 && written_ > 0 && written_ + text.size() > max_bytes_)
+		|| (max_seconds_ > 0 && std::time(0) - opened_ >= max_seconds_))
+	{
+		rotate();
+	}
+	if (file_)
+	{
+		written_ += std::fwrite(text.data(), 1, text.size(), file_);
+	}
+}
+
+void access_log::rotate()
+{
+	if (file_)
+	{
+		std::fclose(file_);
+	}
+	std::tm now = utc_time(std::time(0));
+	char suffix[32];
+	std::strftime(suffix, sizeof(suffix), ".%Y%m%d-%H%M%S", &now);
+	std::rename(path_.c_str(), (path_ + suffix).c_str());
+
+	// If the new file cannot be opened, the old one is appended to instead.
+	file_ = std::fopen(path_.c_str(), "ab");
+	if (!file_)
+	{
+		file_ = std::fopen((path_ + suffix).c_str(), "ab");
+	}
+	written_ = 0;
+	opened_ = std::time(0);
+}
+
+void access_log::format(const access_record& record, std::string& out)
+{
+	if (record.address_v6)
+	{
+		boost::asio::ip::address_v6::bytes_type b;
+		std::copy(record.address, record.address + b.size(), b.begin());
+		out += boost::asio::ip::address_v6(b).to_string();
+	}
+	else
+	{
+		boost::asio::ip::address_v4::bytes_type b;
+		std::copy(record.address, record.address + b.size(), b.begin());
+		out += boost::asio::ip::address_v4(b).to_string();
+	}
+
+	if (record.time != formatted_time_)
+	{
+		std::tm time = utc_time(record.time);
+		char text[64];
+		std::strftime(text, sizeof(text), " - - [%d/%b/%Y:%H:%M:%S +0000] \"", &time);
+		time_text_ = text;
+		formatted_time_ = record.time;
+	}
+	out += time_text_;
+
+	// A request that could not be parsed is shown as "-".
+	if (record.method[0] == 0)
+	{
+		out += '-';
+	}
+	else
+	{
+		out += record.method;
+		out += ' ';
+		for (const char* p = record.uri; *p; ++p)
+		{
+			if (*p == '"' || *p == '\\')
+			{
+				out += '\\';
+			}
+			out += *p;
+		}
+		out += " HTTP/";
+		append_number(out, record.version_major);
+		out += '.';
+		append_number(out, record.version_minor);
+	}
+	out += "\" ";
+	append_number(out, record.status);
+	out += ' ';
+	append_number(out, record.bytes);
+	out += ' ';
+	append_number(out, record.milliseconds);
+	out += '\n';
+}
+
+} // namespace server
+} // namespace http
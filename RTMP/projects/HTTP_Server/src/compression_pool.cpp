@@ -0,0 +1,72 @@
+#include "compression_pool.hpp"
+#include <boost/bind.hpp>
+#include "gzip_encoder.hpp"
+
+namespace http {
+namespace server {
+
+compression_pool::compression_pool()
+	: stopping_(false)
+{
+}
+
+compression_pool::~compression_pool()
+{
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		stopping_ = true;
+	}
+	ready_.notify_all();
+	if (thread_)
+	{
+		thread_->join();
+	}
+}
+
+void compression_pool::async_compress(boost::asio::io_service& io_service, const boost::shared_ptr<const std::string>& data,
+	int level, const compress_handler& handler)
+{
+	job j;
+	j.io_service = &io_service;
+	j.work.reset(new boost::asio::io_service::work(io_service));
+	j.data = data;
+	j.level = level;
+	j.handler = handler;
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		if (!thread_)
+		{
+			thread_.reset(new boost::thread(boost::bind(&compression_pool::run, this)));
+		}
+		jobs_.push_back(j);
+	}
+	ready_.notify_one();
+}
+
+void compression_pool::run()
+{
+	for (;;)
+	{
+		job j;
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			while (jobs_.empty() && !stopping_)
+			{
+				ready_.wait(lock);
+			}
+			if (stopping_)
+			{
+				return;
+			}
+			j = jobs_.front();
+			jobs_.pop_front();
+		}
+
+		boost::shared_ptr<const std::string> compressed(new std::string(
+			gzip_encoder::compress(j.data->data(), j.data->size(), j.level)));
+		j.io_service->post(boost::bind(j.handler, compressed));
+	}
+}
+
+} // namespace server
+} // namespace http
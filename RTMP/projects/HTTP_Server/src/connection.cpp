@@ -1,14 +1,36 @@
 #include "connection.hpp"
+#include <algorithm>
+#include <cstdio>
 #include <vector>
+#include <boost/algorithm/string/predicate.hpp>
 #include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
 #include "connection_manager.hpp"
 #include "request_handler.hpp"
 
 namespace http {
 namespace server {
 
-connection::connection(boost::asio::io_service& io_service, connection_manager& manager, request_handler& handler)
-	: socket_(io_service), connection_manager_(manager), request_handler_(handler)
+namespace {
+
+/// Replies that may be queued before reading stops, bounding the memory a
+/// client can tie up by pipelining without reading the responses.
+const std::size_t max_pipelined_replies = 32;
+
+/// File bodies are read in pieces that end on multiples of this size.
+const std::size_t body_block_size = 256 * 1024;
+
+} // namespace
+
+connection::body_piece::body_piece()
+	: text(0), length(0), in_use(false), ready(false)
+{
+}
+
+connection::connection(boost::asio::io_service& io_service, connection_manager& manager, request_handler& handler,
+	disk_io_pool& disk_pool, access_log& log, const boost::posix_time::time_duration& idle_timeout)
+	: socket_(io_service), connection_manager_(manager), request_handler_(handler), io_service_(io_service), disk_pool_(disk_pool), log_(log), timer_(io_service), idle_timeout_(idle_timeout),
+	body_remaining_(0), replies_writing_(0), segment_(0), segment_read_(0), segment_started_(false), body_writing_(false), body_streaming_(false), body_sent_(0), reading_(false), closing_(false)
 {
 }
 
@@ -19,52 +41,385 @@ boost::asio::ip::tcp::socket& connection::socket()
 
 void connection::start()
 {
-	socket_.async_read_some(boost::asio::buffer(buffer_), boost::bind(&connection::handle_read, shared_from_this(), boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+	boost::system::error_code ignored_ec;
+	peer_ = socket_.remote_endpoint(ignored_ec).address();
+	read_more();
 }
 
 void connection::stop()
 {
+	// A file body cut short is logged with what was sent of it.
+	if (body_streaming_)
+	{
+		body_streaming_ = false;
+		log_reply(replies_[replies_writing_ - 1], body_sent_);
+	}
 	socket_.close();
+	timer_.cancel();
+}
+
+void connection::read_more()
+{
+	reading_ = true;
+	if (replies_.empty())
+	{
+		timer_.expires_from_now(idle_timeout_);
+		timer_.async_wait(boost::bind(&connection::handle_timeout, shared_from_this(), boost::asio::placeholders::error));
+	}
+	socket_.async_read_some(boost::asio::buffer(buffer_), boost::bind(&connection::handle_read, shared_from_this(), boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
 }
 
 void connection::handle_read(const boost::system::error_code& e, std::size_t bytes_transferred)
 {
+	reading_ = false;
 	if (!e)
 	{
+		timer_.cancel();
+		process(buffer_.data(), buffer_.data() + bytes_transferred);
+
+		if (!replies_.empty() && replies_writing_ == 0)
+		{
+			write_replies();
+		}
+		if (!closing_ && replies_.size() < max_pipelined_replies)
+		{
+			read_more();
+		}
+	}
+	else if (e != boost::asio::error::operation_aborted)
+	{
+		connection_manager_.stop(shared_from_this());
+	}
+}
+
+void connection::process(const char* begin, const char* end)
+{
+	boost::posix_time::ptime now;
+	if (log_.is_open())
+	{
+		now = boost::posix_time::microsec_clock::universal_time();
+	}
+	while (begin != end && !closing_)
+	{
+		// Bodies are not used by any handler, but must not be mistaken for
+		// the next pipelined request.
+		if (body_remaining_ > 0)
+		{
+			std::size_t skipped = std::min(body_remaining_, static_cast<std::size_t>(end - begin));
+			begin += skipped;
+			body_remaining_ -= skipped;
+			continue;
+		}
+
 		boost::tribool result;
-		boost::tie(result, boost::tuples::ignore) = request_parser_.parse(request_, buffer_.data(), buffer_.data() + bytes_transferred);
+		boost::tie(result, begin) = request_parser_.parse(request_, begin, end);
 
 		if (result)
 		{
-			request_handler_.handle_request(request_, reply_);
-			boost::asio::async_write(socket_, reply_.to_buffers(), boost::bind(&connection::handle_write, shared_from_this(), boost::asio::placeholders::error));
+			if (const std::string* length = find_header(request_, "Content-Length"))
+			{
+				try
+				{
+					body_remaining_ = boost::lexical_cast<std::size_t>(*length);
+				}
+				catch (boost::bad_lexical_cast&)
+				{
+					body_remaining_ = 0;
+				}
+			}
+			replies_.push_back(reply());
+			request_handler_.handle_request(request_, replies_.back());
+			if (request_.method == "HEAD")
+			{
+				replies_.back().drop_body();
+			}
+			replies_.back().record.set_request(request_, peer_, now);
+			finish_reply(keep_alive(request_));
+			request_parser_.reset();
+			request_ = request();
 		}
 		else if (!result)
 		{
-			reply_ = reply::stock_reply(reply::bad_request);
-			boost::asio::async_write(socket_, reply_.to_buffers(), boost::bind(&connection::handle_write, shared_from_this(), boost::asio::placeholders::error));
+			replies_.push_back(reply::stock_reply(reply::bad_request));
+			replies_.back().record.set_request(request(), peer_, now);
+			finish_reply(false);
 		}
-		else
+	}
+}
+
+void connection::finish_reply(bool keep_alive)
+{
+	reply& rep = replies_.back();
+	if (!keep_alive)
+	{
+		rep.patch_header("Connection", "close");
+		closing_ = true;
+	}
+	else if (request_.http_version_major == 1 && request_.http_version_minor == 0)
+	{
+		rep.patch_header("Connection", "keep-alive");
+	}
+}
+
+bool connection::keep_alive(const request& req)
+{
+	// HTTP/1.1 connections persist unless the client asks otherwise, and
+	// HTTP/1.0 ones only if it asks for it.
+	const std::string* connection_header = find_header(req, "Connection");
+	if (req.http_version_major > 1 || (req.http_version_major == 1 && req.http_version_minor >= 1))
+	{
+		return !connection_header || !boost::algorithm::iequals(*connection_header, "close");
+	}
+	return connection_header && boost::algorithm::iequals(*connection_header, "keep-alive");
+}
+
+void connection::write_replies()
+{
+	std::vector<boost::asio::const_buffer> buffers;
+	replies_writing_ = 0;
+	while (replies_writing_ < replies_.size())
+	{
+		std::vector<boost::asio::const_buffer> reply_buffers = replies_[replies_writing_].to_buffers();
+		buffers.insert(buffers.end(), reply_buffers.begin(), reply_buffers.end());
+		if (replies_[replies_writing_++].file)
 		{
-			socket_.async_read_some(boost::asio::buffer(buffer_), boost::bind(&connection::handle_read, shared_from_this(), boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+			break;
 		}
 	}
-	else if (e != boost::asio::error::operation_aborted)
+	boost::asio::async_write(socket_, buffers, boost::bind(&connection::handle_write, shared_from_this(), boost::asio::placeholders::error));
+}
+
+void connection::handle_write(const boost::system::error_code& e)
+{
+	if (e)
 	{
-		connection_manager_.stop(shared_from_this());
+		if (e != boost::asio::error::operation_aborted)
+		{
+			connection_manager_.stop(shared_from_this());
+		}
+		return;
 	}
+
+	const reply& last = replies_[replies_writing_ - 1];
+	if (last.file && !last.segments.empty())
+	{
+		start_body();
+		return;
+	}
+	replies_written();
 }
 
-void connection::handle_write(const boost::system::error_code& e)
+void connection::replies_written()
 {
-	if (!e)
+	body_streaming_ = false;
+	for (std::size_t i = 0; i < replies_writing_; ++i)
+	{
+		log_reply(replies_[i], replies_[i].encoder ? body_sent_ : replies_[i].body_size());
+	}
+	replies_.erase(replies_.begin(), replies_.begin() + replies_writing_);
+	replies_writing_ = 0;
+
+	if (!replies_.empty())
+	{
+		write_replies();
+	}
+	else if (closing_)
 	{
 		// Initiate graceful connection closure.
 		boost::system::error_code ignored_ec;
 		socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored_ec);
+		connection_manager_.stop(shared_from_this());
+	}
+	else if (!reading_)
+	{
+		read_more();
+	}
+	else
+	{
+		// Everything has been answered; the pending read now waits idle.
+		timer_.expires_from_now(idle_timeout_);
+		timer_.async_wait(boost::bind(&connection::handle_timeout, shared_from_this(), boost::asio::placeholders::error));
+	}
+}
+
+void connection::log_reply(reply& rep, boost::uint64_t body_bytes)
+{
+	if (log_.is_open())
+	{
+		rep.record.set_reply(rep.status, body_bytes, boost::posix_time::microsec_clock::universal_time());
+		log_.log(rep.record);
+	}
+}
+
+void connection::start_body()
+{
+	body_streaming_ = true;
+	body_sent_ = 0;
+	segment_ = 0;
+	segment_read_ = 0;
+	segment_started_ = false;
+	body_writing_ = false;
+	for (std::size_t i = 0; i < body_piece_count; ++i)
+	{
+		read_body();
+	}
+}
+
+void connection::read_body()
+{
+	const reply& rep = replies_[replies_writing_ - 1];
+	if (segment_ == rep.segments.size() || body_order_.size() == body_piece_count)
+	{
+		return;
+	}
+
+	std::size_t slot = 0;
+	while (body_pieces_[slot].in_use)
+	{
+		++slot;
+	}
+	body_piece& piece = body_pieces_[slot];
+	const reply::file_segment& segment = rep.segments[segment_];
+	piece.in_use = true;
+	piece.ready = false;
+	piece.text = segment_started_ ? 0 : &segment.text;
+	segment_started_ = true;
+
+	// Pieces end on block boundaries so the disk sees aligned reads.
+	boost::uint64_t offset = segment.offset + segment_read_;
+	piece.length = static_cast<std::size_t>(std::min<boost::uint64_t>(body_block_size - offset % body_block_size, segment.length - segment_read_));
+	segment_read_ += piece.length;
+	if (segment_read_ == segment.length)
+	{
+		++segment_;
+		segment_read_ = 0;
+		segment_started_ = false;
+	}
+	body_order_.push_back(slot);
+
+	if (piece.length == 0)
+	{
+		piece.ready = true;
+		return;
+	}
+	piece.data.resize(body_block_size);
+	disk_pool_.async_read(io_service_, rep.file, offset, &piece.data[0], piece.length,
+		boost::bind(&connection::handle_body_read, shared_from_this(), slot, _1));
+}
+
+void connection::handle_body_read(std::size_t slot, std::size_t bytes_read)
+{
+	if (!socket_.is_open())
+	{
+		return;
+	}
+	if (bytes_read != body_pieces_[slot].length)
+	{
+		// The file has shrunk; the promised length can no longer be sent.
+		connection_manager_.stop(shared_from_this());
+		return;
+	}
+	body_pieces_[slot].ready = true;
+	write_body();
+}
+
+void connection::write_body()
+{
+	if (body_writing_ || body_order_.empty() || !body_pieces_[body_order_.front()].ready)
+	{
+		return;
 	}
 
-	if (e != boost::asio::error::operation_aborted)
+	body_piece& piece = body_pieces_[body_order_.front()];
+	const reply& rep = replies_[replies_writing_ - 1];
+	std::vector<boost::asio::const_buffer> buffers;
+	if (rep.encoder)
+	{
+		// Pieces are compressed in body order, the last ending the stream.
+		bool last = segment_ == rep.segments.size() && body_order_.size() == 1;
+		encode_piece(piece, *rep.encoder, last);
+		buffers.push_back(boost::asio::buffer(piece.chunk));
+	}
+	else
+	{
+		if (piece.text)
+		{
+			buffers.push_back(boost::asio::buffer(*piece.text));
+		}
+		if (piece.length > 0)
+		{
+			buffers.push_back(boost::asio::buffer(&piece.data[0], piece.length));
+		}
+	}
+	body_writing_ = true;
+	boost::asio::async_write(socket_, buffers, boost::bind(&connection::handle_body_write, shared_from_this(), boost::asio::placeholders::error));
+}
+
+void connection::handle_body_write(const boost::system::error_code& e)
+{
+	body_writing_ = false;
+	if (e)
+	{
+		if (e != boost::asio::error::operation_aborted)
+		{
+			connection_manager_.stop(shared_from_this());
+		}
+		return;
+	}
+
+	body_piece& piece = body_pieces_[body_order_.front()];
+	body_sent_ += replies_[replies_writing_ - 1].encoder ? piece.chunk.size() : (piece.text ? piece.text->size() : 0) + piece.length;
+	piece.in_use = false;
+	body_order_.pop_front();
+
+	const reply& rep = replies_[replies_writing_ - 1];
+	if (segment_ == rep.segments.size() && body_order_.empty())
+	{
+		replies_written();
+		return;
+	}
+
+	// The freed buffer is refilled while the next piece is written.
+	read_body();
+	write_body();
+}
+
+void connection::encode_piece(body_piece& piece, gzip_encoder& encoder, bool last)
+{
+	std::string compressed;
+	if (piece.text)
+	{
+		encoder.write(piece.text->data(), piece.text->size(), compressed);
+	}
+	if (piece.length > 0)
+	{
+		encoder.write(&piece.data[0], piece.length, compressed);
+	}
+	if (last)
+	{
+		encoder.finish(compressed);
+	}
+
+	piece.chunk.clear();
+	if (!compressed.empty())
+	{
+		char size[20];
+		std::sprintf(size, "%lx\r\n", static_cast<unsigned long>(compressed.size()));
+		piece.chunk = size;
+		piece.chunk += compressed;
+		piece.chunk += "\r\n";
+	}
+	if (last)
+	{
+		piece.chunk += "0\r\n\r\n";
+	}
+}
+
+void connection::handle_timeout(const boost::system::error_code& e)
+{
+	// A timer that was re-armed rather than cancelled also completes with
+	// operation_aborted, so only a genuine expiry closes the connection.
+	if (!e && timer_.expires_at() <= boost::asio::deadline_timer::traits_type::now())
 	{
 		connection_manager_.stop(shared_from_this());
 	}
@@ -0,0 +1,89 @@
+#include "disk_io_pool.hpp"
+#include <boost/bind.hpp>
+
+namespace http {
+namespace server {
+
+disk_io_pool::device_queue::device_queue()
+	: stopping(false)
+{
+}
+
+disk_io_pool::disk_io_pool(std::size_t threads_per_device)
+	: threads_per_device_(threads_per_device)
+{
+}
+
+disk_io_pool::~disk_io_pool()
+{
+	std::map<boost::uint64_t, boost::shared_ptr<device_queue> >::iterator i;
+	for (i = devices_.begin(); i != devices_.end(); ++i)
+	{
+		{
+			boost::mutex::scoped_lock lock(i->second->mutex);
+			i->second->stopping = true;
+		}
+		i->second->ready.notify_all();
+		i->second->threads.join_all();
+	}
+}
+
+void disk_io_pool::async_read(boost::asio::io_service& io_service, const open_file_ptr& file,
+	boost::uint64_t offset, char* data, std::size_t length, const read_handler& handler)
+{
+	boost::shared_ptr<device_queue> queue;
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		boost::shared_ptr<device_queue>& q = devices_[file->device()];
+		if (!q)
+		{
+			q.reset(new device_queue);
+			for (std::size_t i = 0; i < threads_per_device_; ++i)
+			{
+				q->threads.create_thread(boost::bind(&disk_io_pool::run, boost::ref(*q)));
+			}
+		}
+		queue = q;
+	}
+
+	job j;
+	j.io_service = &io_service;
+	j.work.reset(new boost::asio::io_service::work(io_service));
+	j.file = file;
+	j.offset = offset;
+	j.data = data;
+	j.length = length;
+	j.handler = handler;
+	{
+		boost::mutex::scoped_lock lock(queue->mutex);
+		queue->jobs.push_back(j);
+	}
+	queue->ready.notify_one();
+}
+
+void disk_io_pool::run(device_queue& queue)
+{
+	for (;;)
+	{
+		job j;
+		{
+			boost::mutex::scoped_lock lock(queue.mutex);
+			while (queue.jobs.empty() && !queue.stopping)
+			{
+				queue.ready.wait(lock);
+			}
+			if (queue.stopping)
+			{
+				return;
+			}
+			j = queue.jobs.front();
+			queue.jobs.pop_front();
+		}
+
+		std::size_t bytes = j.file->read(j.offset, j.data, j.length);
+		j.io_service->post(boost::bind(j.handler, bytes));
+	}
+}
+
+} // namespace server
+} // namespace http
@@ -0,0 +1,227 @@
+#include "fd_cache.hpp"
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace http {
+namespace server {
+
+open_file::open_file()
+#if defined(_WIN32)
+	: handle_(INVALID_HANDLE_VALUE), volume_(0),
+#else
+	: fd_(-1), device_(0), inode_(0),
+#endif
+	size_(0), mtime_(0)
+{
+}
+
+open_file_ptr open_file::open(const std::string& path)
+{
+	open_file_ptr file(new open_file);
+#if defined(_WIN32)
+	file->handle_ = ::CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if (file->handle_ == INVALID_HANDLE_VALUE)
+	{
+		return open_file_ptr();
+	}
+	BY_HANDLE_FILE_INFORMATION info;
+	if (!::GetFileInformationByHandle(file->handle_, &info) || (info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+	{
+		return open_file_ptr();
+	}
+	file->size_ = (static_cast<boost::uint64_t>(info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+	file->volume_ = info.dwVolumeSerialNumber;
+
+	// FILETIME counts 100ns intervals since 1601.
+	boost::uint64_t ticks = (static_cast<boost::uint64_t>(info.ftLastWriteTime.dwHighDateTime) << 32) | info.ftLastWriteTime.dwLowDateTime;
+	file->mtime_ = static_cast<std::time_t>(ticks / 10000000 - 11644473600ULL);
+#else
+	file->fd_ = ::open(path.c_str(), O_RDONLY);
+	if (file->fd_ < 0)
+	{
+		return open_file_ptr();
+	}
+	struct stat status;
+	if (::fstat(file->fd_, &status) != 0 || !S_ISREG(status.st_mode))
+	{
+		return open_file_ptr();
+	}
+	file->size_ = status.st_size;
+	file->mtime_ = status.st_mtime;
+	file->device_ = status.st_dev;
+	file->inode_ = status.st_ino;
+#endif
+	return file;
+}
+
+open_file::~open_file()
+{
+#if defined(_WIN32)
+	if (handle_ != INVALID_HANDLE_VALUE)
+	{
+		::CloseHandle(handle_);
+	}
+#else
+	if (fd_ >= 0)
+	{
+		::close(fd_);
+	}
+#endif
+}
+
+boost::uint64_t open_file::size() const
+{
+	return size_;
+}
+
+std::time_t open_file::mtime() const
+{
+	return mtime_;
+}
+
+boost::uint64_t open_file::device() const
+{
+#if defined(_WIN32)
+	return volume_;
+#else
+	return static_cast<boost::uint64_t>(device_);
+#endif
+}
+
+bool open_file::current(const std::string& path) const
+{
+	struct stat status;
+	if (::stat(path.c_str(), &status) != 0)
+	{
+		return false;
+	}
+#if !defined(_WIN32)
+	if (status.st_dev != device_ || status.st_ino != inode_)
+	{
+		return false;
+	}
+#endif
+	return status.st_mtime == mtime_ && static_cast<boost::uint64_t>(status.st_size) == size_;
+}
+
+std::size_t open_file::read(boost::uint64_t offset, char* data, std::size_t length) const
+{
+	std::size_t total = 0;
+	while (total < length)
+	{
+#if defined(_WIN32)
+		// An offset in OVERLAPPED makes a synchronous read positional.
+		OVERLAPPED overlapped = OVERLAPPED();
+		overlapped.Offset = static_cast<DWORD>(offset + total);
+		overlapped.OffsetHigh = static_cast<DWORD>((offset + total) >> 32);
+		DWORD bytes = 0;
+		if (!::ReadFile(handle_, data + total, static_cast<DWORD>(length - total), &bytes, &overlapped) || bytes == 0)
+		{
+			break;
+		}
+#else
+		ssize_t bytes = ::pread(fd_, data + total, length - total, static_cast<off_t>(offset + total));
+		if (bytes <= 0)
+		{
+			break;
+		}
+#endif
+		total += bytes;
+	}
+	return total;
+}
+
+fd_cache::fd_cache()
+	: max_files_(4096), revalidate_interval_(2), negative_ttl_(2)
+{
+}
+
+void fd_cache::set_max_files(std::size_t count)
+{
+	max_files_ = count;
+}
+
+void fd_cache::set_revalidate_interval(std::time_t seconds)
+{
+	revalidate_interval_ = seconds;
+}
+
+void fd_cache::set_negative_ttl(std::time_t seconds)
+{
+	negative_ttl_ = seconds;
+}
+
+open_file_ptr fd_cache::acquire(const std::string& path)
+{
+	std::time_t now = std::time(0);
+	open_file_ptr stale;
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		std::map<std::string, entry_list::iterator>::iterator i = index_.find(path);
+		if (i != index_.end())
+		{
+			entry& e = *i->second;
+			entries_.splice(entries_.begin(), entries_, i->second);
+			if (!e.file && now - e.checked < negative_ttl_)
+			{
+				return open_file_ptr();
+			}
+			if (e.file && now - e.checked < revalidate_interval_)
+			{
+				return e.file;
+			}
+			stale = e.file;
+		}
+	}
+
+	// The filesystem is only touched without holding the lock.
+	open_file_ptr file;
+	if (stale && stale->current(path))
+	{
+		file = stale;
+	}
+	else
+	{
+		file = open_file::open(path);
+	}
+
+	boost::mutex::scoped_lock lock(mutex_);
+	insert(path, file, now);
+	return file;
+}
+
+void fd_cache::insert(const std::string& path, const open_file_ptr& file, std::time_t now)
+{
+	std::map<std::string, entry_list::iterator>::iterator i = index_.find(path);
+	if (i != index_.end())
+	{
+		i->second->file = file;
+		i->second->checked = now;
+		entries_.splice(entries_.begin(), entries_, i->second);
+		return;
+	}
+
+	entry e;
+	e.path = path;
+	e.file = file;
+	e.checked = now;
+	entries_.push_front(e);
+	index_[path] = entries_.begin();
+
+	// Responses still using an evicted file keep it open until they finish.
+	while (entries_.size() > max_files_)
+	{
+		index_.erase(entries_.back().path);
+		entries_.pop_back();
+	}
+}
+
+} // namespace server
+} // namespace http
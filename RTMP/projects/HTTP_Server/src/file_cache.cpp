@@ -0,0 +1,237 @@
+#include "file_cache.hpp"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "reply.hpp"
+
+namespace http {
+namespace server {
+
+namespace {
+
+/// Share of a shard's budget that the protected segment may use.
+const std::size_t protected_percent = 80;
+
+} // namespace
+
+file_cache::shard::shard()
+	: probation_bytes(0), protected_bytes(0)
+{
+}
+
+file_cache::file_cache()
+	: budget_(32 * 1024 * 1024), max_file_size_(512 * 1024), revalidate_interval_(2)
+{
+}
+
+void file_cache::set_budget(std::size_t bytes)
+{
+	budget_ = bytes;
+}
+
+void file_cache::set_max_file_size(std::size_t bytes)
+{
+	max_file_size_ = bytes;
+}
+
+void file_cache::set_revalidate_interval(std::time_t seconds)
+{
+	revalidate_interval_ = seconds;
+}
+
+bool file_cache::cacheable(boost::uint64_t size) const
+{
+	return size <= max_file_size_ && size < budget_ / shard_count;
+}
+
+bool file_cache::find(const std::string& path, bool gzip, reply& rep)
+{
+	shard& s = shard_for(path);
+	std::time_t now = std::time(0);
+	std::time_t mtime;
+	boost::uint64_t size;
+	{
+		boost::mutex::scoped_lock lock(s.mutex);
+		std::map<std::string, entry_list::iterator>::iterator i = s.index.find(path);
+		if (i == s.index.end())
+		{
+			return false;
+		}
+		entry& e = *i->second;
+		if (now - e.checked < revalidate_interval_)
+		{
+			touch(s, i->second);
+			fill(e, gzip, rep);
+			return true;
+		}
+		mtime = e.mtime;
+		size = e.size;
+	}
+
+	// The file is checked without holding the lock.
+	struct stat status;
+	bool unchanged = ::stat(path.c_str(), &status) == 0 && status.st_mtime == mtime && static_cast<boost::uint64_t>(status.st_size) == size;
+
+	boost::mutex::scoped_lock lock(s.mutex);
+	std::map<std::string, entry_list::iterator>::iterator i = s.index.find(path);
+	if (i == s.index.end())
+	{
+		return false;
+	}
+	if (!unchanged)
+	{
+		if (i->second->mtime == mtime)
+		{
+			erase(s, i->second);
+		}
+		return false;
+	}
+	entry& e = *i->second;
+	e.checked = now;
+	touch(s, i->second);
+	fill(e, gzip, rep);
+	return true;
+}
+
+void file_cache::insert(const std::string& path, std::time_t mtime, boost::uint64_t size, reply& rep)
+{
+	entry e;
+	share(rep, e.head, e.content);
+	e.path = path;
+	e.mtime = mtime;
+	e.size = size;
+	e.checked = std::time(0);
+	e.cost = path.size() + e.head->size() + e.content->size();
+	e.is_protected = false;
+
+	shard& s = shard_for(path);
+	boost::mutex::scoped_lock lock(s.mutex);
+	std::map<std::string, entry_list::iterator>::iterator i = s.index.find(path);
+	if (i != s.index.end())
+	{
+		erase(s, i->second);
+	}
+	s.probation.push_front(e);
+	s.index[path] = s.probation.begin();
+	s.probation_bytes += e.cost;
+	evict(s);
+}
+
+void file_cache::insert_gzip(const std::string& path, std::time_t mtime, boost::uint64_t size, reply& rep)
+{
+	boost::shared_ptr<const std::string> head;
+	boost::shared_ptr<const std::string> content;
+	share(rep, head, content);
+
+	shard& s = shard_for(path);
+	boost::mutex::scoped_lock lock(s.mutex);
+	std::map<std::string, entry_list::iterator>::iterator i = s.index.find(path);
+	if (i == s.index.end() || i->second->mtime != mtime || i->second->size != size || i->second->gzip_content)
+	{
+		return;
+	}
+	entry& e = *i->second;
+	e.gzip_head = head;
+	e.gzip_content = content;
+	std::size_t cost = head->size() + content->size();
+	e.cost += cost;
+	(e.is_protected ? s.protected_bytes : s.probation_bytes) += cost;
+	evict(s);
+}
+
+void file_cache::fill(const entry& e, bool gzip, reply& rep)
+{
+	rep.status = reply::ok;
+	if (gzip && e.gzip_content)
+	{
+		rep.shared_head = e.gzip_head;
+		rep.shared_content = e.gzip_content;
+	}
+	else
+	{
+		rep.shared_head = e.head;
+		rep.shared_content = e.content;
+	}
+}
+
+void file_cache::share(reply& rep, boost::shared_ptr<const std::string>& head, boost::shared_ptr<const std::string>& content)
+{
+	boost::shared_ptr<std::string> body(new std::string);
+	body->swap(rep.content);
+	rep.shared_head.reset(new std::string(rep.head_to_string()));
+	rep.shared_content = body;
+	rep.head_patch.clear();
+	rep.headers.clear();
+	head = rep.shared_head;
+	content = rep.shared_content;
+}
+
+file_cache::shard& file_cache::shard_for(const std::string& path)
+{
+	// FNV-1a.
+	boost::uint32_t hash = 2166136261u;
+	for (std::size_t i = 0; i < path.size(); ++i)
+	{
+		hash = (hash ^ static_cast<unsigned char>(path[i])) * 16777619u;
+	}
+	return shards_[hash % shard_count];
+}
+
+void file_cache::touch(shard& s, entry_list::iterator i)
+{
+	if (i->is_protected)
+	{
+		s.protected_entries.splice(s.protected_entries.begin(), s.protected_entries, i);
+		return;
+	}
+
+	// A second hit promotes the entry. The protected segment overflows back
+	// into probation, least recently used first.
+	i->is_protected = true;
+	s.probation_bytes -= i->cost;
+	s.protected_bytes += i->cost;
+	s.protected_entries.splice(s.protected_entries.begin(), s.probation, i);
+
+	std::size_t protected_budget = budget_ / shard_count * protected_percent / 100;
+	while (s.protected_bytes > protected_budget && s.protected_entries.size() > 1)
+	{
+		entry_list::iterator demoted = --s.protected_entries.end();
+		demoted->is_protected = false;
+		s.protected_bytes -= demoted->cost;
+		s.probation_bytes += demoted->cost;
+		s.probation.splice(s.probation.begin(), s.protected_entries, demoted);
+	}
+}
+
+void file_cache::erase(shard& s, entry_list::iterator i)
+{
+	s.index.erase(i->path);
+	if (i->is_protected)
+	{
+		s.protected_bytes -= i->cost;
+		s.protected_entries.erase(i);
+	}
+	else
+	{
+		s.probation_bytes -= i->cost;
+		s.probation.erase(i);
+	}
+}
+
+void file_cache::evict(shard& s)
+{
+	std::size_t shard_budget = budget_ / shard_count;
+	while (s.probation_bytes + s.protected_bytes > shard_budget)
+	{
+		if (!s.probation.empty())
+		{
+			erase(s, --s.probation.end());
+		}
+		else
+		{
+			erase(s, --s.protected_entries.end());
+		}
+	}
+}
+
+} // namespace server
+} // namespace http
@@ -0,0 +1,92 @@
+#include "gzip_encoder.hpp"
+#include <cstring>
+
+namespace http {
+namespace server {
+
+namespace {
+
+/// The gzip header: magic, deflate, no flags, no time, no extra flags and an
+/// unknown operating system.
+const unsigned char gzip_header[] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 255 };
+
+void append_le32(std::string& out, uLong value)
+{
+	for (int i = 0; i < 4; ++i)
+	{
+		out += static_cast<char>((value >> (8 * i)) & 0xff);
+	}
+}
+
+} // namespace
+
+gzip_encoder::gzip_encoder(int level)
+	: crc_(crc32(0, Z_NULL, 0)), size_(0), started_(false)
+{
+	std::memset(&stream_, 0, sizeof(stream_));
+
+	// A negative window size asks for raw deflate data, without zlib's own
+	// header and trailer.
+	deflateInit2(&stream_, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+}
+
+gzip_encoder::~gzip_encoder()
+{
+	deflateEnd(&stream_);
+}
+
+void gzip_encoder::write(const char* data, std::size_t size, std::string& out)
+{
+	crc_ = crc32(crc_, reinterpret_cast<const Bytef*>(data), static_cast<uInt>(size));
+	size_ += static_cast<uLong>(size);
+
+	// A sync flush ends each piece on a byte boundary, so it can be sent and
+	// decompressed before the next is read.
+	deflate_to(data, size, Z_SYNC_FLUSH, out);
+}
+
+void gzip_encoder::finish(std::string& out)
+{
+	deflate_to(0, 0, Z_FINISH, out);
+	append_le32(out, crc_);
+	append_le32(out, size_);
+}
+
+std::string gzip_encoder::compress(const char* data, std::size_t size, int level)
+{
+	gzip_encoder encoder(level);
+	std::string out;
+	out.reserve(size / 2 + 64);
+	encoder.crc_ = crc32(encoder.crc_, reinterpret_cast<const Bytef*>(data), static_cast<uInt>(size));
+	encoder.size_ = static_cast<uLong>(size);
+	encoder.deflate_to(data, size, Z_NO_FLUSH, out);
+	encoder.finish(out);
+	return out;
+}
+
+void gzip_encoder::deflate_to(const char* data, std::size_t size, int flush, std::string& out)
+{
+	if (!started_)
+	{
+		out.append(reinterpret_cast<const char*>(gzip_header), sizeof(gzip_header));
+		started_ = true;
+	}
+
+	stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+	stream_.avail_in = static_cast<uInt>(size);
+	char buffer[16384];
+	do
+	{
+		stream_.next_out = reinterpret_cast<Bytef*>(buffer);
+		stream_.avail_out = sizeof(buffer);
+		if (deflate(&stream_, flush) == Z_STREAM_ERROR)
+		{
+			return;
+		}
+		out.append(buffer, sizeof(buffer) - stream_.avail_out);
+	}
+	while (stream_.avail_out == 0);
+}
+
+} // namespace server
+} // namespace http
@@ -0,0 +1,111 @@
+#include "listener.hpp"
+#include <boost/bind.hpp>
+
+namespace http {
+namespace server {
+
+namespace {
+
+#if defined(SO_REUSEPORT)
+/// Lets several sockets listen on one port, the kernel choosing between them.
+typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port_option;
+#endif
+
+/// How long a slot waits before accepting again when the process or system
+/// has run out of descriptors. Retrying at once would spin, as the pending
+/// connection stays in the backlog until a descriptor is freed.
+const long accept_retry_ms = 100;
+
+} // namespace
+
+listener::listener(boost::asio::io_service& io_service, const boost::asio::ip::tcp::endpoint& endpoint,
+	std::size_t accepts, bool reuse_port, request_handler& handler, disk_io_pool& disk_pool,
+	access_log& log, const boost::posix_time::time_duration& idle_timeout)
+	: io_service_(io_service), acceptor_(io_service), new_connections_(accepts), accept_timers_(accepts), request_handler_(handler), disk_pool_(disk_pool), log_(log), idle_timeout_(idle_timeout)
+{
+	// Open the acceptor with the option to reuse the address (i.e. SO_REUSEADDR).
+	acceptor_.open(endpoint.protocol());
+	acceptor_.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+#if defined(SO_REUSEPORT)
+	if (reuse_port)
+	{
+		acceptor_.set_option(reuse_port_option(true));
+	}
+#endif
+	acceptor_.bind(endpoint);
+	acceptor_.listen();
+	for (std::size_t i = 0; i < new_connections_.size(); ++i)
+	{
+		accept_timers_[i].reset(new boost::asio::deadline_timer(io_service_));
+		start_accept(i);
+	}
+}
+
+void listener::run()
+{
+	// The io_service::run() call will block until all asynchronous operations
+	// have finished. While the listener is running, there is always at least
+	// one asynchronous operation outstanding: the accepts waiting for new
+	// incoming connections.
+	io_service_.run();
+}
+
+void listener::stop()
+{
+	io_service_.post(boost::bind(&listener::handle_stop, this));
+}
+
+void listener::start_accept(std::size_t slot)
+{
+	new_connections_[slot].reset(new connection(io_service_, connection_manager_, request_handler_, disk_pool_, log_, idle_timeout_));
+	acceptor_.async_accept(new_connections_[slot]->socket(), boost::bind(&listener::handle_accept, this, slot, boost::asio::placeholders::error));
+}
+
+void listener::handle_accept(std::size_t slot, const boost::system::error_code& e)
+{
+	if (!e)
+	{
+		connection_manager_.start(new_connections_[slot]);
+		start_accept(slot);
+		return;
+	}
+
+	// Any other failure is of this connection alone or passes with time, so
+	// the slot keeps accepting unless the listener has been stopped.
+	if (e == boost::asio::error::operation_aborted || !acceptor_.is_open())
+	{
+		return;
+	}
+	if (e == boost::asio::error::no_descriptors || e == boost::asio::error::no_buffer_space || e == boost::asio::error::no_memory
+		|| e == boost::system::error_code(ENFILE, boost::asio::error::get_system_category()))
+	{
+		accept_timers_[slot]->expires_from_now(boost::posix_time::milliseconds(accept_retry_ms));
+		accept_timers_[slot]->async_wait(boost::bind(&listener::handle_accept_retry, this, slot, boost::asio::placeholders::error));
+		return;
+	}
+	start_accept(slot);
+}
+
+void listener::handle_accept_retry(std::size_t slot, const boost::system::error_code& e)
+{
+	if (!e && acceptor_.is_open())
+	{
+		start_accept(slot);
+	}
+}
+
+void listener::handle_stop()
+{
+	// The listener is stopped by cancelling all outstanding asynchronous
+	// operations. Once all operations have finished the io_service::run() call
+	// will exit.
+	acceptor_.close();
+	for (std::size_t i = 0; i < accept_timers_.size(); ++i)
+	{
+		accept_timers_[i]->cancel();
+	}
+	connection_manager_.stop_all();
+}
+
+} // namespace server
+} // namespace http
@@ -10,11 +10,18 @@ struct mapping
 	const char* mime_type;
 } mappings[] =
 {
+	{ "css", "text/css" },
+	{ "flv", "video/x-flv" },
 	{ "gif", "image/gif" },
 	{ "htm", "text/html" },
 	{ "html", "text/html" },
 	{ "jpg", "image/jpeg" },
+	{ "js", "application/javascript" },
+	{ "json", "application/json" },
 	{ "png", "image/png" },
+	{ "txt", "text/plain" },
+	{ "xml", "text/xml" },
+	{ "xspf", "application/xspf+xml" },
 	{ 0, 0 } // Marks end of list.
 };
 
@@ -31,6 +38,30 @@ std::string extension_to_type(const std::string& extension)
 	return "text/plain";
 }
 
+bool is_compressible(const std::string& mime_type)
+{
+	static const char* const types[] = { "application/javascript", "application/json", "application/xml", 0 };
+	static const char xml_suffix[] = "+xml";
+	const std::size_t suffix_length = sizeof(xml_suffix) - 1;
+
+	if (mime_type.compare(0, 5, "text/") == 0)
+	{
+		return true;
+	}
+	if (mime_type.size() > suffix_length && mime_type.compare(mime_type.size() - suffix_length, suffix_length, xml_suffix) == 0)
+	{
+		return true;
+	}
+	for (const char* const* t = types; *t; ++t)
+	{
+		if (mime_type == *t)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
 } // namespace mime_types
 } // namespace server
 } // namespace http
@@ -1,3 +1,4 @@
+#include <cstdlib>
 #include <iostream>
 #include <string>
 #include <boost/asio.hpp>
@@ -15,9 +16,9 @@ int main(int argc, char* argv[])
 	try
 	{
 		// Check command line arguments.
-		if (argc != 4)
+		if (argc < 4 || argc > 6)
 		{
-			std::cerr << "Usage: http_server <address> <port> <doc_root>\n";
+			std::cerr << "Usage: http_server <address> <port> <doc_root> [<threads> [<access_log>]]\n";
 			std::cerr << "  For IPv4, try:\n";
 			std::cerr << "    receiver 0.0.0.0 80 .\n";
 			std::cerr << "  For IPv6, try:\n";
@@ -25,6 +26,9 @@ int main(int argc, char* argv[])
 			return 1;
 		}
 
+		// One thread per processor unless told otherwise.
+		std::size_t threads = argc >= 5 ? std::atoi(argv[4]) : boost::thread::hardware_concurrency();
+
 		// Block all signals for background thread.
 		sigset_t new_mask;
 		sigfillset(&new_mask);
@@ -32,7 +36,11 @@ int main(int argc, char* argv[])
 		pthread_sigmask(SIG_BLOCK, &new_mask, &old_mask);
 
 		// Run server in background thread.
-		http::server::server s(argv[1], argv[2], argv[3]);
+		http::server::server s(argv[1], argv[2], argv[3], threads);
+		if (argc == 6)
+		{
+			s.log().open(argv[5]);
+		}
 		boost::thread t(boost::bind(&http::server::server::run, &s));
 
 		// Restore previous signals.
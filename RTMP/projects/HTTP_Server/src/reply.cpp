@@ -1,6 +1,8 @@
 #include "reply.hpp"
+#include <map>
 #include <string>
-#include <boost/lexical_cast.hpp>
+#include <utility>
+#include <boost/thread/tss.hpp>
 
 namespace http {
 namespace server {
@@ -8,22 +10,24 @@ namespace server {
 
 namespace status_strings {
 
-const std::string ok					= "HTTP/1.0 200 OK\r\n";
-const std::string created				= "HTTP/1.0 201 Created\r\n";
-const std::string accepted				= "HTTP/1.0 202 Accepted\r\n";
-const std::string no_content			= "HTTP/1.0 204 No Content\r\n";
-const std::string multiple_choices		= "HTTP/1.0 300 Multiple Choices\r\n";
-const std::string moved_permanently		= "HTTP/1.0 301 Moved Permanently\r\n";
-const std::string moved_temporarily		= "HTTP/1.0 302 Moved Temporarily\r\n";
-const std::string not_modified			= "HTTP/1.0 304 Not Modified\r\n";
-const std::string bad_request			= "HTTP/1.0 400 Bad Request\r\n";
-const std::string unauthorized			= "HTTP/1.0 401 Unauthorized\r\n";
-const std::string forbidden				= "HTTP/1.0 403 Forbidden\r\n";
-const std::string not_found				= "HTTP/1.0 404 Not Found\r\n";
-const std::string internal_server_error = "HTTP/1.0 500 Internal Server Error\r\n";
-const std::string not_implemented		= "HTTP/1.0 501 Not Implemented\r\n";
-const std::string bad_gateway			= "HTTP/1.0 502 Bad Gateway\r\n";
-const std::string service_unavailable	= "HTTP/1.0 503 Service Unavailable\r\n";
+const std::string ok					= "HTTP/1.1 200 OK\r\n";
+const std::string created				= "HTTP/1.1 201 Created\r\n";
+const std::string accepted				= "HTTP/1.1 202 Accepted\r\n";
+const std::string no_content			= "HTTP/1.1 204 No Content\r\n";
+const std::string partial_content		= "HTTP/1.1 206 Partial Content\r\n";
+const std::string multiple_choices		= "HTTP/1.1 300 Multiple Choices\r\n";
+const std::string moved_permanently		= "HTTP/1.1 301 Moved Permanently\r\n";
+const std::string moved_temporarily		= "HTTP/1.1 302 Moved Temporarily\r\n";
+const std::string not_modified			= "HTTP/1.1 304 Not Modified\r\n";
+const std::string bad_request			= "HTTP/1.1 400 Bad Request\r\n";
+const std::string unauthorized			= "HTTP/1.1 401 Unauthorized\r\n";
+const std::string forbidden				= "HTTP/1.1 403 Forbidden\r\n";
+const std::string not_found				= "HTTP/1.1 404 Not Found\r\n";
+const std::string requested_range_not_satisfiable = "HTTP/1.1 416 Requested Range Not Satisfiable\r\n";
+const std::string internal_server_error = "HTTP/1.1 500 Internal Server Error\r\n";
+const std::string not_implemented		= "HTTP/1.1 501 Not Implemented\r\n";
+const std::string bad_gateway			= "HTTP/1.1 502 Bad Gateway\r\n";
+const std::string service_unavailable	= "HTTP/1.1 503 Service Unavailable\r\n";
 
 boost::asio::const_buffer to_buffer(reply::status_type status)
 {
@@ -37,6 +41,8 @@ boost::asio::const_buffer to_buffer(reply::status_type status)
 			return boost::asio::buffer(accepted);
 		case reply::no_content:
 			return boost::asio::buffer(no_content);
+		case reply::partial_content:
+			return boost::asio::buffer(partial_content);
 		case reply::multiple_choices:
 			return boost::asio::buffer(multiple_choices);
 		case reply::moved_permanently:
@@ -53,6 +59,8 @@ boost::asio::const_buffer to_buffer(reply::status_type status)
 			return boost::asio::buffer(forbidden);
 		case reply::not_found:
 			return boost::asio::buffer(not_found);
+		case reply::requested_range_not_satisfiable:
+			return boost::asio::buffer(requested_range_not_satisfiable);
 		case reply::internal_server_error:
 			return boost::asio::buffer(internal_server_error);
 		case reply::not_implemented:
@@ -77,25 +85,157 @@ const char crlf[] = { '\r', '\n' };
 
 } // namespace misc_strings
 
-std::vector<boost::asio::const_buffer> reply::to_buffers()
+namespace {
+
+/// Shared heads by status and Accept-Ranges, then content type.
+typedef std::map<std::pair<int, std::string>, boost::shared_ptr<const std::string> > head_block_map;
+
+/// What each thread formats once and reuses for its replies. Every thread
+/// keeps its own, so building a reply takes no lock; a handful of heads and
+/// a Date header per thread cost far less than threads contending for them.
+struct reply_cache
 {
-	std::vector<boost::asio::const_buffer> buffers;
-	buffers.push_back(status_strings::to_buffer(status));
+	reply_cache()
+		: date_time(0)
+	{
+	}
+
+	head_block_map head_blocks;
+
+	/// The second date_header was formatted for.
+	std::time_t date_time;
+
+	/// The Date header line for date_time.
+	std::string date_header;
+};
 
+/// The calling thread's cache, created on first use.
+boost::thread_specific_ptr<reply_cache> thread_cache;
+
+reply_cache& local_cache()
+{
+	reply_cache* cache = thread_cache.get();
+	if (!cache)
+	{
+		cache = new reply_cache;
+		thread_cache.reset(cache);
+	}
+	return *cache;
+}
+
+/// Append the Date header, formatted at most once a second per thread.
+void append_date(std::string& out)
+{
+	std::time_t now = std::time(0);
+	reply_cache& cache = local_cache();
+	if (now != cache.date_time)
+	{
+		cache.date_header = "Date: " + http_date(now) + "\r\n";
+		cache.date_time = now;
+	}
+	out += cache.date_header;
+}
+
+} // namespace
+
+void reply::patch_header(const char* name, const std::string& value)
+{
+	head_patch += name;
+	head_patch.append(misc_strings::name_value_separator, sizeof(misc_strings::name_value_separator));
+	head_patch += value;
+	head_patch.append(misc_strings::crlf, sizeof(misc_strings::crlf));
+}
+
+void reply::patch_content_length(boost::uint64_t length)
+{
+	char digits[20];
+	char* p = digits + sizeof(digits);
+	do
+	{
+		*--p = static_cast<char>('0' + length % 10);
+		length /= 10;
+	}
+	while (length > 0);
+	head_patch += "Content-Length: ";
+	head_patch.append(p, digits + sizeof(digits));
+	head_patch.append(misc_strings::crlf, sizeof(misc_strings::crlf));
+}
+
+std::vector<boost::asio::const_buffer> reply::to_buffers()
+{
+	// Everything after the status line or shared head goes out as one buffer.
 	for (std::size_t i = 0; i < headers.size(); ++i)
 	{
-		header& h = headers[i];
-		buffers.push_back(boost::asio::buffer(h.name));
-		buffers.push_back(boost::asio::buffer(misc_strings::name_value_separator));
-		buffers.push_back(boost::asio::buffer(h.value));
-		buffers.push_back(boost::asio::buffer(misc_strings::crlf));
+		patch_header(headers[i].name.c_str(), headers[i].value);
 	}
+	headers.clear();
+	append_date(head_patch);
+	head_patch.append(misc_strings::crlf, sizeof(misc_strings::crlf));
 
-	buffers.push_back(boost::asio::buffer(misc_strings::crlf));
-	buffers.push_back(boost::asio::buffer(content));
+	std::vector<boost::asio::const_buffer> buffers;
+	buffers.reserve(3);
+	if (shared_head)
+	{
+		buffers.push_back(boost::asio::buffer(*shared_head));
+	}
+	else
+	{
+		buffers.push_back(status_strings::to_buffer(status));
+	}
+	buffers.push_back(boost::asio::buffer(head_patch));
+	if (shared_content)
+	{
+		buffers.push_back(boost::asio::buffer(*shared_content));
+	}
+	else
+	{
+		buffers.push_back(boost::asio::buffer(content));
+	}
 	return buffers;
 }
 
+boost::uint64_t reply::body_size() const
+{
+	boost::uint64_t size = shared_content ? shared_content->size() : content.size();
+	for (std::size_t i = 0; i < segments.size(); ++i)
+	{
+		size += segments[i].text.size() + segments[i].length;
+	}
+	return size;
+}
+
+void reply::drop_body()
+{
+	content.clear();
+	shared_content.reset();
+	file.reset();
+	segments.clear();
+	encoder.reset();
+}
+
+std::string reply::head_to_string() const
+{
+	std::string head;
+	if (shared_head)
+	{
+		head = *shared_head;
+	}
+	else
+	{
+		boost::asio::const_buffer status_line = status_strings::to_buffer(status);
+		head.assign(boost::asio::buffer_cast<const char*>(status_line), boost::asio::buffer_size(status_line));
+	}
+	head += head_patch;
+	for (std::size_t i = 0; i < headers.size(); ++i)
+	{
+		head += headers[i].name;
+		head.append(misc_strings::name_value_separator, sizeof(misc_strings::name_value_separator));
+		head += headers[i].value;
+		head.append(misc_strings::crlf, sizeof(misc_strings::crlf));
+	}
+	return head;
+}
+
 namespace stock_replies {
 
 const char ok[] = "";
@@ -114,6 +254,11 @@ const char no_content[] =
 	"<head><title>No Content</title></head>"
 	"<body><h1>204 Content</h1></body>"
 	"</html>";
+const char partial_content[] =
+	"<html>"
+	"<head><title>Partial Content</title></head>"
+	"<body><h1>206 Partial Content</h1></body>"
+	"</html>";
 const char multiple_choices[] =
 	"<html>"
 	"<head><title>Multiple Choices</title></head>"
@@ -154,6 +299,11 @@ const char not_found[] =
 	"<head><title>Not Found</title></head>"
 	"<body><h1>404 Not Found</h1></body>"
 	"</html>";
+const char requested_range_not_satisfiable[] =
+	"<html>"
+	"<head><title>Requested Range Not Satisfiable</title></head>"
+	"<body><h1>416 Requested Range Not Satisfiable</h1></body>"
+	"</html>";
 const char internal_server_error[] =
 	"<html>"
 	"<head><title>Internal Server Error</title></head>"
@@ -187,6 +337,8 @@ std::string to_string(reply::status_type status)
 			return accepted;
 		case reply::no_content:
 			return no_content;
+		case reply::partial_content:
+			return partial_content;
 		case reply::multiple_choices:
 			return multiple_choices;
 		case reply::moved_permanently:
@@ -203,6 +355,8 @@ std::string to_string(reply::status_type status)
 			return forbidden;
 		case reply::not_found:
 			return not_found;
+		case reply::requested_range_not_satisfiable:
+			return requested_range_not_satisfiable;
 		case reply::internal_server_error:
 			return internal_server_error;
 		case reply::not_implemented:
@@ -222,14 +376,42 @@ reply reply::stock_reply(reply::status_type status)
 {
 	reply rep;
 	rep.status = status;
+	rep.shared_head = head_block(status, "text/html", false);
 	rep.content = stock_replies::to_string(status);
-	rep.headers.resize(2);
-	rep.headers[0].name = "Content-Length";
-	rep.headers[0].value = boost::lexical_cast<std::string>(rep.content.size());
-	rep.headers[1].name = "Content-Type";
-	rep.headers[1].value = "text/html";
+	rep.patch_content_length(rep.content.size());
 	return rep;
 }
 
+boost::shared_ptr<const std::string> reply::head_block(status_type status, const std::string& content_type, bool accept_ranges)
+{
+	std::pair<int, std::string> key(accept_ranges ? -status : status, content_type);
+	boost::shared_ptr<const std::string>& block = local_cache().head_blocks[key];
+	if (!block)
+	{
+		reply rep;
+		rep.status = status;
+		rep.patch_header("Content-Type", content_type);
+		if (accept_ranges)
+		{
+			rep.patch_header("Accept-Ranges", "bytes");
+		}
+		block.reset(new std::string(rep.head_to_string()));
+	}
+	return block;
+}
+
+std::string http_date(std::time_t t)
+{
+	std::tm time;
+#if defined(_WIN32)
+	::gmtime_s(&time, &t);
+#else
+	::gmtime_r(&t, &time);
+#endif
+	char text[64];
+	std::strftime(text, sizeof(text), "%a, %d %b %Y %H:%M:%S GMT", &time);
+	return text;
+}
+
 } // namespace server
 } // namespace http
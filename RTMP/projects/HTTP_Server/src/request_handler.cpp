@@ -1,7 +1,11 @@
 #include "request_handler.hpp"
-#include <fstream>
-#include <sstream>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
 #include <string>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/bind.hpp>
 #include <boost/lexical_cast.hpp>
 #include "mime_types.hpp"
 #include "reply.hpp"
@@ -10,13 +14,106 @@
 namespace http {
 namespace server {
 
-request_handler::request_handler(const std::string& doc_root)
-	: doc_root_(doc_root)
+namespace {
+
+/// Separates the parts of a multipart/byteranges body.
+const char multipart_boundary[] = "3d6b6a416f9b5e0c";
+
+/// More ranges than this in one request are treated as abuse and ignored.
+const std::size_t max_ranges = 32;
+
+/// Files smaller than this gain too little from compression to be worth it.
+const boost::uint64_t min_compressed_size = 1024;
+
+/// Compression level for cached files, compressed once.
+const int cache_gzip_level = 9;
+
+/// Compression level for files compressed as they are sent.
+const int stream_gzip_level = 1;
+
+/// The value of each byte as a hexadecimal digit, or -1.
+struct hex_digit_table
+{
+	hex_digit_table()
+	{
+		for (int c = 0; c < 256; ++c)
+		{
+			value[c] = -1;
+		}
+		for (int c = 0; c < 10; ++c)
+		{
+			value['0' + c] = static_cast<signed char>(c);
+		}
+		for (int c = 0; c < 6; ++c)
+		{
+			value['a' + c] = value['A' + c] = static_cast<signed char>(10 + c);
+		}
+	}
+
+	signed char value[256];
+};
+
+const hex_digit_table hex_digits;
+
+std::string to_hex(boost::uint64_t value)
+{
+	char text[17];
+	std::sprintf(text, "%x%08x", static_cast<unsigned int>(value >> 32), static_cast<unsigned int>(value));
+	std::string result(text);
+	result.erase(0, std::min(result.find_first_not_of('0'), result.size() - 1));
+	return result;
+}
+
+std::string content_range(const std::pair<boost::uint64_t, boost::uint64_t>& range, boost::uint64_t size)
+{
+	return "bytes " + boost::lexical_cast<std::string>(range.first) + "-" + boost::lexical_cast<std::string>(range.second)
+		+ "/" + boost::lexical_cast<std::string>(size);
+}
+
+/// Parse a non-empty string of decimal digits.
+bool parse_offset(const std::string& text, boost::uint64_t& value)
+{
+	if (text.empty() || text.size() > 19 || text.find_first_not_of("0123456789") != std::string::npos)
+	{
+		return false;
+	}
+	value = boost::lexical_cast<boost::uint64_t>(text);
+	return true;
+}
+
+/// The entity tag of the gzip-compressed variant of a file. It is weak since
+/// the compressed bytes depend on the level used.
+std::string gzip_etag(const std::string& etag)
+{
+	return "W/" + etag.substr(0, etag.size() - 1) + "-gzip\"";
+}
+
+void add_segment(reply& rep, const std::string& text, boost::uint64_t offset, boost::uint64_t length)
+{
+	rep.segments.push_back(reply::file_segment());
+	rep.segments.back().text = text;
+	rep.segments.back().offset = offset;
+	rep.segments.back().length = length;
+}
+
+} // namespace
+
+request_handler::request_handler(const std::string& doc_root, boost::asio::io_service& io_service, disk_io_pool& disk_pool)
+	: doc_root_(doc_root), io_service_(io_service), disk_pool_(disk_pool)
 {
 }
 
 void request_handler::handle_request(const request& req, reply& rep)
 {
+	// Only files are served, so only GET and HEAD mean anything. The
+	// connection drops the body of the reply to a HEAD.
+	if (req.method != "GET" && req.method != "HEAD")
+	{
+		rep = reply::stock_reply(reply::not_implemented);
+		rep.patch_header("Allow", "GET, HEAD");
+		return;
+	}
+
 	// Decode url to path.
 	std::string request_path;
 	if (!url_decode(req.uri, request_path))
@@ -47,29 +144,323 @@ void request_handler::handle_request(const request& req, reply& rep)
 		extension = request_path.substr(last_dot_pos + 1);
 	}
 
-	// Open the file to send back.
+	// Small hot files are served from memory without touching the filesystem.
 	std::string full_path = doc_root_ + request_path;
-	std::ifstream is(full_path.c_str(), std::ios::in | std::ios::binary);
-	if (!is)
+	bool gzip = accepts_gzip(req);
+	if (!find_header(req, "Range") && cache_.find(full_path, gzip, rep))
+	{
+		return;
+	}
+
+	// Open the file to send back, usually already open from an earlier request.
+	open_file_ptr file = files_.acquire(full_path);
+	if (!file)
 	{
 		rep = reply::stock_reply(reply::not_found);
 		return;
 	}
+	boost::uint64_t size = file->size();
 
-	// Fill out the reply to be sent to the client.
-	rep.status = reply::ok;
-	char buf[512];
-	
-	while (is.read(buf, sizeof(buf)).gcount() > 0)
+	// Validators let a client resume a download only if the file is unchanged.
+	std::string etag = "\"" + to_hex(size) + "-" + to_hex(file->mtime()) + "\"";
+	std::string last_modified = http_date(file->mtime());
+
+	// A Range is honoured unless If-Range names a different version.
+	std::vector<byte_range> ranges;
+	const std::string* range = find_header(req, "Range");
+	const std::string* if_range = find_header(req, "If-Range");
+	bool partial = range && (!if_range || *if_range == etag || *if_range == last_modified)
+		&& parse_ranges(*range, size, ranges);
+
+	if (partial && ranges.empty())
+	{
+		rep = reply::stock_reply(reply::requested_range_not_satisfiable);
+		rep.patch_header("ETag", etag);
+		rep.patch_header("Last-Modified", last_modified);
+		rep.patch_header("Content-Range", "bytes */" + boost::lexical_cast<std::string>(size));
+		return;
+	}
+
+	// Fill out the reply to be sent to the client. The body is read from the
+	// file as it is written rather than held in memory. The status line and
+	// headers common to many replies come from a shared block.
+	std::string content_type = mime_types::extension_to_type(extension);
+	bool compressible = mime_types::is_compressible(content_type) && size >= min_compressed_size;
+	if (!partial && cache_.cacheable(size))
+	{
+		fill_cache(full_path, file, etag, last_modified, content_type, compressible);
+	}
+
+	rep.file = file;
+	if (compressible)
+	{
+		rep.patch_header("Vary", "Accept-Encoding");
+	}
+
+	// Files too large for the cache are compressed as they are sent, which
+	// needs the chunked transfer coding of HTTP/1.1 as the length is unknown.
+	bool http_1_1 = req.http_version_major > 1 || (req.http_version_major == 1 && req.http_version_minor >= 1);
+	if (!partial && compressible && gzip && http_1_1 && !cache_.cacheable(size))
+	{
+		rep.status = reply::ok;
+		rep.shared_head = reply::head_block(reply::ok, content_type, false);
+		rep.encoder.reset(new gzip_encoder(stream_gzip_level));
+		add_segment(rep, "", 0, size);
+		rep.patch_header("Content-Encoding", "gzip");
+		rep.patch_header("Transfer-Encoding", "chunked");
+		rep.patch_header("ETag", gzip_etag(etag));
+		rep.patch_header("Last-Modified", last_modified);
+		return;
+	}
+
+	if (!partial)
+	{
+		rep.status = reply::ok;
+		rep.shared_head = reply::head_block(reply::ok, content_type, true);
+		add_segment(rep, "", 0, size);
+		rep.patch_content_length(size);
+	}
+	else if (ranges.size() == 1)
+	{
+		rep.status = reply::partial_content;
+		rep.shared_head = reply::head_block(reply::partial_content, content_type, true);
+		add_segment(rep, "", ranges[0].first, ranges[0].second - ranges[0].first + 1);
+		rep.patch_content_length(ranges[0].second - ranges[0].first + 1);
+		rep.patch_header("Content-Range", content_range(ranges[0], size));
+	}
+	else
+	{
+		rep.status = reply::partial_content;
+		rep.shared_head = reply::head_block(reply::partial_content, "multipart/byteranges; boundary=" + std::string(multipart_boundary), true);
+		boost::uint64_t length = 0;
+		for (std::size_t i = 0; i < ranges.size(); ++i)
+		{
+			std::string part_header = "\r\n--" + std::string(multipart_boundary) + "\r\nContent-Type: " + content_type
+				+ "\r\nContent-Range: " + content_range(ranges[i], size) + "\r\n\r\n";
+			add_segment(rep, part_header, ranges[i].first, ranges[i].second - ranges[i].first + 1);
+			length += part_header.size() + ranges[i].second - ranges[i].first + 1;
+		}
+		std::string closing = "\r\n--" + std::string(multipart_boundary) + "--\r\n";
+		add_segment(rep, closing, 0, 0);
+		length += closing.size();
+		rep.patch_content_length(length);
+	}
+	rep.patch_header("ETag", etag);
+	rep.patch_header("Last-Modified", last_modified);
+}
+
+void request_handler::fill_cache(const std::string& path, const open_file_ptr& file, const std::string& etag,
+	const std::string& last_modified, const std::string& content_type, bool compressible)
+{
+	{
+		boost::mutex::scoped_lock lock(filling_mutex_);
+		if (!filling_.insert(path).second)
+		{
+			return;
+		}
+	}
+
+	// The file is read off the io_service thread; until it has been, requests
+	// for it are streamed from the file like any other.
+	boost::shared_ptr<reply> rep(new reply);
+	rep->status = reply::ok;
+	rep->shared_head = reply::head_block(reply::ok, content_type, true);
+	rep->patch_content_length(file->size());
+	rep->patch_header("ETag", etag);
+	rep->patch_header("Last-Modified", last_modified);
+	rep->content.resize(static_cast<std::size_t>(file->size()));
+
+	boost::shared_ptr<reply> gzip_rep;
+	if (compressible)
+	{
+		rep->patch_header("Vary", "Accept-Encoding");
+		gzip_rep.reset(new reply);
+		gzip_rep->status = reply::ok;
+		gzip_rep->shared_head = reply::head_block(reply::ok, content_type, false);
+		gzip_rep->patch_header("Content-Encoding", "gzip");
+		gzip_rep->patch_header("ETag", gzip_etag(etag));
+		gzip_rep->patch_header("Last-Modified", last_modified);
+		gzip_rep->patch_header("Vary", "Accept-Encoding");
+	}
+
+	disk_pool_.async_read(io_service_, file, 0, rep->content.empty() ? 0 : &rep->content[0], rep->content.size(),
+		boost::bind(&request_handler::handle_fill, this, path, file, rep, gzip_rep, _1));
+}
+
+void request_handler::handle_fill(const std::string& path, const open_file_ptr& file, const boost::shared_ptr<reply>& rep,
+	const boost::shared_ptr<reply>& gzip_rep, std::size_t bytes_read)
+{
+	{
+		boost::mutex::scoped_lock lock(filling_mutex_);
+		filling_.erase(path);
+	}
+	if (bytes_read != rep->content.size())
+	{
+		return;
+	}
+	cache_.insert(path, file->mtime(), file->size(), *rep);
+
+	// Until the compressed variant is ready, the file is sent uncompressed.
+	if (gzip_rep)
+	{
+		compressor_.async_compress(io_service_, rep->shared_content, cache_gzip_level,
+			boost::bind(&request_handler::handle_compressed, this, path, file->mtime(), file->size(), gzip_rep, _1));
+	}
+}
+
+void request_handler::handle_compressed(const std::string& path, std::time_t mtime, boost::uint64_t size,
+	const boost::shared_ptr<reply>& gzip_rep, const boost::shared_ptr<const std::string>& compressed)
+{
+	// A file that hardly compresses is not worth a second copy in the cache.
+	if (compressed->size() > size / 10 * 9)
+	{
+		return;
+	}
+	gzip_rep->content = *compressed;
+	gzip_rep->patch_content_length(compressed->size());
+	cache_.insert_gzip(path, mtime, size, *gzip_rep);
+}
+
+file_cache& request_handler::cache()
+{
+	return cache_;
+}
+
+fd_cache& request_handler::files()
+{
+	return files_;
+}
+
+bool request_handler::accepts_gzip(const request& req)
+{
+	const std::string* value = find_header(req, "Accept-Encoding");
+	if (!value)
+	{
+		return false;
+	}
+
+	// Each comma separated element is a coding with an optional quality. gzip
+	// is accepted if it is named, or failing that covered by "*", with a
+	// quality above zero.
+	int gzip = -1;
+	int any = -1;
+	std::size_t pos = 0;
+	while (pos <= value->size())
+	{
+		std::size_t comma = value->find(',', pos);
+		std::string element = value->substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+		pos = (comma == std::string::npos) ? value->size() + 1 : comma + 1;
+
+		std::size_t semicolon = element.find(';');
+		std::string coding = element.substr(0, semicolon);
+		coding.erase(0, coding.find_first_not_of(" \t"));
+		coding.erase(coding.find_last_not_of(" \t") + 1);
+		bool accepted = true;
+		if (semicolon != std::string::npos)
+		{
+			std::size_t q = element.find("q=", semicolon);
+			if (q != std::string::npos)
+			{
+				accepted = std::strtod(element.c_str() + q + 2, 0) > 0;
+			}
+		}
+
+		if (boost::algorithm::iequals(coding, "gzip") || boost::algorithm::iequals(coding, "x-gzip"))
+		{
+			gzip = accepted;
+		}
+		else if (coding == "*")
+		{
+			any = accepted;
+		}
+	}
+	return gzip >= 0 ? gzip == 1 : any == 1;
+}
+
+bool request_handler::parse_ranges(const std::string& value, boost::uint64_t size, std::vector<byte_range>& ranges)
+{
+	ranges.clear();
+	const std::string unit = "bytes=";
+	if (value.compare(0, unit.size(), unit) != 0)
 	{
-		rep.content.append(buf, is.gcount());
+		return false;
 	}
 
-	rep.headers.resize(2);
-	rep.headers[0].name = "Content-Length";
-	rep.headers[0].value = boost::lexical_cast<std::string>(rep.content.size());
-	rep.headers[1].name = "Content-Type";
-	rep.headers[1].value = mime_types::extension_to_type(extension);
+	// Each comma separated spec is "first-last", "first-" or "-suffix_length".
+	std::size_t pos = unit.size();
+	std::size_t specs = 0;
+	while (pos <= value.size())
+	{
+		std::size_t comma = value.find(',', pos);
+		std::string spec = value.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+		pos = (comma == std::string::npos) ? value.size() + 1 : comma + 1;
+
+		spec.erase(0, spec.find_first_not_of(" \t"));
+		spec.erase(spec.find_last_not_of(" \t") + 1);
+		std::size_t dash = spec.find('-');
+		if (dash == std::string::npos || ++specs > max_ranges)
+		{
+			return false;
+		}
+
+		boost::uint64_t first = 0, last = 0;
+		if (dash != 0 && !parse_offset(spec.substr(0, dash), first))
+		{
+			return false;
+		}
+		bool has_last = parse_offset(spec.substr(dash + 1), last);
+		if (dash == 0)
+		{
+			// A suffix: the final last bytes of the file.
+			if (!has_last)
+			{
+				return false;
+			}
+			if (last == 0 || size == 0)
+			{
+				continue;
+			}
+			first = (last >= size) ? 0 : size - last;
+			last = size - 1;
+		}
+		else
+		{
+			if (dash + 1 != spec.size() && !has_last)
+			{
+				return false;
+			}
+			if (has_last && last < first)
+			{
+				return false;
+			}
+			if (first >= size)
+			{
+				continue;
+			}
+			if (!has_last || last >= size)
+			{
+				last = size - 1;
+			}
+		}
+		ranges.push_back(byte_range(first, last));
+	}
+
+	// Overlapping and adjacent ranges are sent once.
+	std::sort(ranges.begin(), ranges.end());
+	std::vector<byte_range> merged;
+	for (std::size_t i = 0; i < ranges.size(); ++i)
+	{
+		if (!merged.empty() && ranges[i].first <= merged.back().second + 1)
+		{
+			merged.back().second = std::max(merged.back().second, ranges[i].second);
+		}
+		else
+		{
+			merged.push_back(ranges[i]);
+		}
+	}
+	ranges.swap(merged);
+	return true;
 }
 
 bool request_handler::url_decode(const std::string& in, std::string& out)
@@ -80,25 +471,18 @@ bool request_handler::url_decode(const std::string& in, std::string& out)
 	{
 		if (in[i] == '%')
 		{
-			if (i + 3 <= in.size())
+			if (i + 3 > in.size())
 			{
-				int value;
-				std::istringstream is(in.substr(i + 1, 2));
-				
-				if (is >> std::hex >> value)
-				{
-					out += static_cast<char>(value);
-					i += 2;
-				}
-				else
-				{
-					return false;
-				}
+				return false;
 			}
-			else
+			int high = hex_digits.value[static_cast<unsigned char>(in[i + 1])];
+			int low = hex_digits.value[static_cast<unsigned char>(in[i + 2])];
+			if (high < 0 || low < 0)
 			{
 				return false;
 			}
+			out += static_cast<char>(high << 4 | low);
+			i += 2;
 		}
 		else if (in[i] == '+')
 		{
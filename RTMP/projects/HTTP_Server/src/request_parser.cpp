@@ -1,285 +1,268 @@
 #include "request_parser.hpp"
 #include "request.hpp"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HTTP_REQUEST_PARSER_SSE2
+#endif
+
 namespace http {
 namespace server {
 
+namespace {
+
+/// Longest request head accepted, bounding what a client can make the
+/// server buffer before the request is complete.
+const std::size_t max_head_size = 64 * 1024;
+
+/// Find the first control character in [begin, end), or end if there is none.
+const char* find_ctl(const char* begin, const char* end)
+{
+#if defined(HTTP_REQUEST_PARSER_SSE2)
+	// Sixteen bytes at a time: bytes 0 to 31 are those left unchanged by an
+	// unsigned minimum with 31; DEL is compared for directly.
+	const __m128i ctl_max = _mm_set1_epi8(31);
+	const __m128i del = _mm_set1_epi8(127);
+	while (end - begin >= 16)
+	{
+		__m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+		__m128i ctl = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(bytes, ctl_max), bytes), _mm_cmpeq_epi8(bytes, del));
+		int mask = _mm_movemask_epi8(ctl);
+		if (mask != 0)
+		{
+			while ((mask & 1) == 0)
+			{
+				mask >>= 1;
+				++begin;
+			}
+			return begin;
+		}
+		begin += 16;
+	}
+#endif
+	while (begin != end && !((*begin >= 0 && *begin <= 31) || *begin == 127))
+	{
+		++begin;
+	}
+	return begin;
+}
+
+} // namespace
+
 request_parser::request_parser()
-	: state_(method_start)
 {
+	reset();
 }
 
 void request_parser::reset()
 {
-	state_ = method_start;
+	pending_.clear();
+	line_start_ = 0;
+	scan_ = 0;
+	request_line_done_ = false;
+	http_version_major_ = 0;
+	http_version_minor_ = 0;
+	headers_.clear();
 }
 
-boost::tribool request_parser::consume(request& req, char input)
+boost::tuple<boost::tribool, const char*> request_parser::parse(request& req, const char* begin, const char* end)
 {
-	switch (state_)
+	// Offsets are from the start of the head, which is the start of the input
+	// unless part of the head arrived earlier.
+	std::size_t earlier = pending_.size();
+	const char* head = begin;
+	std::size_t size = end - begin;
+	if (earlier > 0)
 	{
-		case method_start:
-			if (!is_char(input) || is_ctl(input) || is_tspecial(input))
-			{
-				return false;
-			}
-			else
-			{
-				state_ = method;
-				req.method.push_back(input);
-				return boost::indeterminate;
-			}
-		case method:
-			if (input == ' ')
-			{
-				state_ = uri;
-				return boost::indeterminate;
-			}
-			else if (!is_char(input) || is_ctl(input) || is_tspecial(input))
-			{
-				return false;
-			}
-			else
-			{
-				req.method.push_back(input);
-				return boost::indeterminate;
-			}
-		case uri_start:
-			if (is_ctl(input))
-			{
-				return false;
-			}
-			else
-			{
-				state_ = uri;
-				req.uri.push_back(input);
-				return boost::indeterminate;
-			}
-		case uri:
-			if (input == ' ')
-			{
-				state_ = http_version_h;
-				return boost::indeterminate;
-			}
-			else if (is_ctl(input))
-			{
-				return false;
-			}
-			else
-			{
-				req.uri.push_back(input);
-				return boost::indeterminate;
-			}
-		case http_version_h:
-			if (input == 'H')
-			{
-				state_ = http_version_t_1;
-				return boost::indeterminate;
-			}
-			else
-			{
-				return false;
-			}
-		case http_version_t_1:
-			if (input == 'T')
-			{
-				state_ = http_version_t_2;
-				return boost::indeterminate;
-			}
-			else
-			{
-				return false;
-			}
-		case http_version_t_2:
-			if (input == 'T')
-			{
-				state_ = http_version_p;
-				return boost::indeterminate;
-			}
-			else
-			{
-				return false;
-			}
-		case http_version_p:
-			if (input == 'P')
-			{
-				state_ = http_version_slash;
-				return boost::indeterminate;
-			}
-			else
-			{
-				return false;
-			}
-		case http_version_slash:
-			if (input == '/')
-			{
-				req.http_version_major = 0;
-				req.http_version_minor = 0;
-				state_ = http_version_major_start;
-				return boost::indeterminate;
-			}
-			else
-			{
-				return false;
-			}
-		case http_version_major_start:
-			if (is_digit(input))
-			{
-				req.http_version_major = req.http_version_major * 10 + input - '0';
-				state_ = http_version_major;
-				return boost::indeterminate;
-			}
-			else
-			{
-				return false;
-			}
-		case http_version_major:
-			if (input == '.')
-			{
-				state_ = http_version_minor_start;
-				return boost::indeterminate;
-			}
-			else if (is_digit(input))
-			{
-				req.http_version_major = req.http_version_major * 10 + input - '0';
-				return boost::indeterminate;
-			}
-			else
-			{
-				return false;
-			}
-		case http_version_minor_start:
-			if (is_digit(input))
-			{
-				req.http_version_minor = req.http_version_minor * 10 + input - '0';
-				state_ = http_version_minor;
-				return boost::indeterminate;
-			}
-			else
-			{
-				return false;
-			}
-		case http_version_minor:
-			if (input == '\r')
-			{
-				state_ = expecting_newline_1;
-				return boost::indeterminate;
-			}
-			else if (is_digit(input))
-			{
-				req.http_version_minor = req.http_version_minor * 10 + input - '0';
-				return boost::indeterminate;
-			}
-			else
-			{
-				return false;
-			}
-		case expecting_newline_1:
-			if (input == '\n')
-			{
-				state_ = header_line_start;
-				return boost::indeterminate;
-			}
-			else
-			{
-				return false;
-			}
-		case header_line_start:
-			if (input == '\r')
-			{
-				state_ = expecting_newline_3;
-				return boost::indeterminate;
-			}
-			else if (!req.headers.empty() && (input == ' ' || input == '\t'))
-			{
-				state_ = header_lws;
-				return boost::indeterminate;
-			}
-			else if (!is_char(input) || is_ctl(input) || is_tspecial(input))
-			{
-				return false;
-			}
-			else
-			{
-				req.headers.push_back(header());
-				req.headers.back().name.push_back(input);
-				state_ = header_name;
-				return boost::indeterminate;
-			}
-		case header_lws:
-			if (input == '\r')
-			{
-				state_ = expecting_newline_2;
-				return boost::indeterminate;
-			}
-			else if (input == ' ' || input == '\t')
-			{
-				return boost::indeterminate;
-			}
-			else if (is_ctl(input))
-			{
-				return false;
-			}
-			else
-			{
-				state_ = header_value;
-				req.headers.back().value.push_back(input);
-				return boost::indeterminate;
-			}
-		case header_name:
-			if (input == ':')
-			{
-				state_ = space_before_header_value;
-				return boost::indeterminate;
-			}
-			else if (!is_char(input) || is_ctl(input) || is_tspecial(input))
-			{
-				return false;
-			}
-			else
-			{
-				req.headers.back().name.push_back(input);
-				return boost::indeterminate;
-			}
-		case space_before_header_value:
-			if (input == ' ')
-			{
-				state_ = header_value;
-				return boost::indeterminate;
-			}
-			else
-			{
-				return false;
-			}
-		case header_value:
-			if (input == '\r')
-			{
-				state_ = expecting_newline_2;
-				return boost::indeterminate;
-			}
-			else if (is_ctl(input))
-			{
-				return false;
-			}
-			else
-			{
-				req.headers.back().value.push_back(input);
-				return boost::indeterminate;
-			}
-		case expecting_newline_2:
-			if (input == '\n')
-			{
-				state_ = header_line_start;
-				return boost::indeterminate;
-			}
-			else
-			{
-				return false;
-			}
-		case expecting_newline_3:
-			return (input == '\n');
-		default:
+		pending_.append(begin, end);
+		head = pending_.data();
+		size = pending_.size();
+	}
+
+	while (scan_ < size)
+	{
+		const char* p = find_ctl(head + scan_, head + size);
+		if (p == head + size)
+		{
+			scan_ = size;
+			break;
+		}
+
+		// Header values may contain tabs; nothing else may contain control
+		// characters other than the line's CR LF.
+		if (*p == '\t' && request_line_done_)
+		{
+			scan_ = p + 1 - head;
+			continue;
+		}
+		if (*p != '\r')
+		{
+			return boost::make_tuple(boost::tribool(false), end);
+		}
+		if (p + 1 == head + size)
+		{
+			scan_ = p - head;
+			break;
+		}
+		if (p[1] != '\n')
+		{
+			return boost::make_tuple(boost::tribool(false), end);
+		}
+
+		std::size_t line_end = p - head;
+		std::size_t next = line_end + 2;
+		if (line_end == line_start_ && request_line_done_)
+		{
+			fill(req, head);
+			const char* consumed = begin + (next - earlier);
+			pending_.clear();
+			return boost::make_tuple(boost::tribool(true), consumed);
+		}
+		if (!parse_line(head, line_start_, line_end))
+		{
+			return boost::make_tuple(boost::tribool(false), end);
+		}
+		line_start_ = next;
+		scan_ = next;
+	}
+
+	if (size > max_head_size)
+	{
+		return boost::make_tuple(boost::tribool(false), end);
+	}
+	if (earlier == 0)
+	{
+		pending_.assign(begin, end);
+	}
+	boost::tribool result = boost::indeterminate;
+	return boost::make_tuple(result, end);
+}
+
+bool request_parser::parse_line(const char* head, std::size_t begin, std::size_t end)
+{
+	if (!request_line_done_)
+	{
+		request_line_done_ = true;
+		return parse_request_line(head, begin, end);
+	}
+	return parse_header_line(head, begin, end);
+}
+
+bool request_parser::parse_request_line(const char* head, std::size_t begin, std::size_t end)
+{
+	std::size_t i = begin;
+	while (i != end && head[i] != ' ')
+	{
+		if (!is_token(head[i]))
+		{
+			return false;
+		}
+		++i;
+	}
+	if (i == begin || i == end)
+	{
+		return false;
+	}
+	method_.offset = begin;
+	method_.length = i - begin;
+
+	std::size_t uri_begin = ++i;
+	while (i != end && head[i] != ' ')
+	{
+		++i;
+	}
+	if (i == end)
+	{
+		return false;
+	}
+	uri_.offset = uri_begin;
+	uri_.length = i - uri_begin;
+
+	++i;
+	if (end - i < 5 || head[i] != 'H' || head[i + 1] != 'T' || head[i + 2] != 'T' || head[i + 3] != 'P' || head[i + 4] != '/')
+	{
+		return false;
+	}
+	i += 5;
+
+	std::size_t digits = i;
+	while (i != end && is_digit(head[i]))
+	{
+		http_version_major_ = http_version_major_ * 10 + head[i++] - '0';
+	}
+	if (i == digits || i == end || head[i] != '.')
+	{
+		return false;
+	}
+	digits = ++i;
+	while (i != end && is_digit(head[i]))
+	{
+		http_version_minor_ = http_version_minor_ * 10 + head[i++] - '0';
+	}
+	return i != digits && i == end;
+}
+
+bool request_parser::parse_header_line(const char* head, std::size_t begin, std::size_t end)
+{
+	header_slice h;
+	if (head[begin] == ' ' || head[begin] == '\t')
+	{
+		if (headers_.empty())
+		{
+			return false;
+		}
+		std::size_t i = begin;
+		while (i != end && (head[i] == ' ' || head[i] == '\t'))
+		{
+			++i;
+		}
+		h.name.offset = begin;
+		h.name.length = 0;
+		h.value.offset = i;
+		h.value.length = end - i;
+		headers_.push_back(h);
+		return true;
+	}
+
+	std::size_t i = begin;
+	while (i != end && head[i] != ':')
+	{
+		if (!is_token(head[i]))
+		{
 			return false;
+		}
+		++i;
+	}
+	if (i == begin || end - i < 2 || head[i + 1] != ' ')
+	{
+		return false;
+	}
+	h.name.offset = begin;
+	h.name.length = i - begin;
+	h.value.offset = i + 2;
+	h.value.length = end - (i + 2);
+	headers_.push_back(h);
+	return true;
+}
+
+void request_parser::fill(request& req, const char* head) const
+{
+	req.method.assign(head + method_.offset, method_.length);
+	req.uri.assign(head + uri_.offset, uri_.length);
+	req.http_version_major = http_version_major_;
+	req.http_version_minor = http_version_minor_;
+	req.headers.reserve(headers_.size());
+	for (std::size_t i = 0; i < headers_.size(); ++i)
+	{
+		const header_slice& h = headers_[i];
+		if (h.name.length == 0)
+		{
+			req.headers.back().value.append(head + h.value.offset, h.value.length);
+			continue;
+		}
+		req.headers.push_back(header());
+		req.headers.back().name.assign(head + h.name.offset, h.name.length);
+		req.headers.back().value.assign(head + h.value.offset, h.value.length);
 	}
 }
 
@@ -290,7 +273,7 @@ bool request_parser::is_char(int c)
 
 bool request_parser::is_ctl(int c)
 {
-	return c >= 0 && c <= 31 || c == 127;
+	return (c >= 0 && c <= 31) || c == 127;
 }
 
 bool request_parser::is_tspecial(int c)
@@ -312,5 +295,10 @@ bool request_parser::is_digit(int c)
 	return c >= '0' && c <= '9';
 }
 
+bool request_parser::is_token(int c)
+{
+	return is_char(c) && !is_ctl(c) && !is_tspecial(c);
+}
+
 } // namespace server
 } // namespace http
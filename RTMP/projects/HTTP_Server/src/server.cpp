@@ -1,56 +1,81 @@
 #include "server.hpp"
 #include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
 
 namespace http {
 namespace server {
 
-server::server(const std::string& address, const std::string& port, const std::string& doc_root)
-  : io_service_(), acceptor_(io_service_), connection_manager_(), new_connection_(new connection(io_service_, connection_manager_, request_handler_)), request_handler_(doc_root)
+namespace {
+
+/// Accepts each listener keeps outstanding.
+const std::size_t accepts_per_listener = 4;
+
+} // namespace
+
+server::server(const std::string& address, const std::string& port, const std::string& doc_root, std::size_t thread_count)
+  : io_services_(make_io_services(thread_count)), disk_pool_(), idle_timeout_(boost::posix_time::seconds(15)), request_handler_(doc_root, *io_services_[0], disk_pool_)
 {
-	// Open the acceptor with the option to reuse the address (i.e. SO_REUSEADDR).
-	boost::asio::ip::tcp::resolver resolver(io_service_);
+	boost::asio::ip::tcp::resolver resolver(*io_services_[0]);
 	boost::asio::ip::tcp::resolver::query query(address, port);
 	boost::asio::ip::tcp::endpoint endpoint = *resolver.resolve(query);
-	acceptor_.open(endpoint.protocol());
-	acceptor_.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
-	acceptor_.bind(endpoint);
-	acceptor_.listen();
-	acceptor_.async_accept(new_connection_->socket(), boost::bind(&server::handle_accept, this, boost::asio::placeholders::error));
+	for (std::size_t i = 0; i < io_services_.size(); ++i)
+	{
+		listeners_.push_back(boost::shared_ptr<listener>(new listener(*io_services_[i], endpoint,
+			accepts_per_listener, io_services_.size() > 1, request_handler_, disk_pool_, log_, idle_timeout_)));
+	}
 }
 
-void server::run()
+std::vector<server::io_service_ptr> server::make_io_services(std::size_t thread_count)
 {
-	// The io_service::run() call will block until all asynchronous operations
-	// have finished. While the server is running, there is always at least one
-	// asynchronous operation outstanding: the asynchronous accept call waiting
-	// for new incoming connections.
-	io_service_.run();
+#if !defined(SO_REUSEPORT)
+	thread_count = 1;
+#endif
+	std::vector<io_service_ptr> io_services;
+	for (std::size_t i = 0; i < thread_count || i == 0; ++i)
+	{
+		io_services.push_back(io_service_ptr(new boost::asio::io_service));
+	}
+	return io_services;
 }
 
-void server::stop()
+void server::set_idle_timeout(const boost::posix_time::time_duration& timeout)
+{
+	idle_timeout_ = timeout;
+}
+
+file_cache& server::cache()
+{
+	return request_handler_.cache();
+}
+
+fd_cache& server::files()
 {
-	// Post a call to the stop function so that server::stop() is safe to call
-	// from any thread.
-	io_service_.post(boost::bind(&server::handle_stop, this));
+	return request_handler_.files();
 }
 
-void server::handle_accept(const boost::system::error_code& e)
+access_log& server::log()
 {
-	if (!e)
+	return log_;
+}
+
+void server::run()
+{
+	// The calling thread runs the first listener.
+	boost::thread_group threads;
+	for (std::size_t i = 1; i < listeners_.size(); ++i)
 	{
-		connection_manager_.start(new_connection_);
-		new_connection_.reset(new connection(io_service_, connection_manager_, request_handler_));
-		acceptor_.async_accept(new_connection_->socket(), boost::bind(&server::handle_accept, this, boost::asio::placeholders::error));
+		threads.create_thread(boost::bind(&listener::run, listeners_[i]));
 	}
+	listeners_[0]->run();
+	threads.join_all();
 }
 
-void server::handle_stop()
+void server::stop()
 {
-	// The server is stopped by cancelling all outstanding asynchronous
-	// operations. Once all operations have finished the io_service::run() call
-	// will exit.
-	acceptor_.close();
-	connection_manager_.stop_all();
+	for (std::size_t i = 0; i < listeners_.size(); ++i)
+	{
+		listeners_[i]->stop();
+	}
 }
 
 } // namespace server
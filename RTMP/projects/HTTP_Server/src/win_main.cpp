@@ -1,8 +1,10 @@
+#include <cstdlib>
 #include <iostream>
 #include <string>
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
 #include <boost/function.hpp>
+#include <boost/thread/thread.hpp>
 #include "server.hpp"
 
 #if defined(_WIN32)
@@ -30,9 +32,9 @@ int main(int argc, char* argv[])
 	{
 		//TODO: ver de hacer esto con una clase que maneje los parametros del programa
 		// Check command line arguments.
-		if (argc != 4)
+		if (argc < 4 || argc > 6)
 		{
-			std::cerr << "Usage: http_server <address> <port> <doc_root>\n";
+			std::cerr << "Usage: http_server <address> <port> <doc_root> [<threads> [<access_log>]]\n";
 			std::cerr << "  For IPv4, try:\n";
 			std::cerr << "    http_server 0.0.0.0 80 .\n";
 			std::cerr << "  For IPv6, try:\n";
@@ -40,12 +42,19 @@ int main(int argc, char* argv[])
 			return 1;
 		}
 
+		// One thread per processor unless told otherwise.
+		std::size_t threads = argc >= 5 ? std::atoi(argv[4]) : boost::thread::hardware_concurrency();
+
 		const std::string address = argv[1];
 		const std::string port = argv[2];
 		const std::string docRoot = argv[3];
 
 		// Initialise server.
-		http::server::server s(address, port, docRoot);
+		http::server::server s(address, port, docRoot, threads);
+		if (argc == 6)
+		{
+			s.log().open(argv[5]);
+		}
 
 		// Set console control handler to allow server to be stopped.
 		console_ctrl_function = boost::bind(&http::server::server::stop, &s);
@@ -1,15 +1,22 @@
 #ifndef HTTP_CONNECTION_HPP
 #define HTTP_CONNECTION_HPP
 
+#include <deque>
+#include <string>
+#include <vector>
 #include <boost/asio.hpp>
 #include <boost/array.hpp>
+#include <boost/cstdint.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/enable_shared_from_this.hpp>
+#include "access_log.hpp"
+#include "live_stream.hpp"
 #include "reply.hpp"
 #include "request.hpp"
 #include "request_handler.hpp"
 #include "request_parser.hpp"
+#include "stream_pacer.hpp"
 
 namespace http {
 namespace server {
@@ -23,7 +30,7 @@ class connection : public boost::enable_shared_from_this<connection>, private bo
 public:
 	/// Construct a connection with the given io_service.
 	explicit connection(boost::asio::io_service& io_service,
-	connection_manager& manager, request_handler& handler);
+	connection_manager& manager, request_handler& handler, access_log& log);
 
 	/// Get the socket associated with the connection.
 	boost::asio::ip::tcp::socket& socket();
@@ -42,6 +49,32 @@ private:
 	/// Handle completion of a write operation.
 	void handle_write(const boost::system::error_code& e);
 
+	/// Send the next piece of the reply's file, or wait until pacing allows.
+	void write_body();
+
+	/// Handle completion of writing a piece of the file.
+	void handle_body_write(const boost::system::error_code& e, std::size_t bytes_transferred);
+
+	/// Handle expiry of the wait for pacing.
+	void handle_pace_timer(const boost::system::error_code& e);
+
+	/// Take a tag of the reply's live stream, or its end.
+	void handle_live_tag(const live_tag_ptr& tag);
+
+	/// Drop the live tags queued for a client too far behind, but for the
+	/// file header and the latest config tag of each type, which the stream
+	/// does not send again.
+	void drop_live_backlog();
+
+	/// Send the live tags queued, unless a write is already in progress.
+	void write_live();
+
+	/// Handle completion of writing live tags.
+	void handle_live_write(const boost::system::error_code& e, std::size_t bytes_transferred);
+
+	/// Close the connection after the reply has been sent.
+	void finish(const boost::system::error_code& e);
+
 	/// Socket for the connection.
 	boost::asio::ip::tcp::socket socket_;
 
@@ -51,6 +84,12 @@ private:
 	/// The handler used to process the incoming request.
 	request_handler& request_handler_;
 
+	/// Where the request is logged.
+	access_log& log_;
+
+	/// The address of the client.
+	boost::asio::ip::address peer_;
+
 	/// Buffer for incoming data.
 	boost::array<char, 8192> buffer_;
 
@@ -62,6 +101,64 @@ private:
 
 	/// The reply to be sent back to the client.
 	reply reply_;
+
+	/// Bytes of the reply's file sent so far.
+	boost::uint64_t body_sent_;
+
+	/// Bytes of body sent so far, including content before the file.
+	boost::uint64_t bytes_sent_;
+
+	/// Whether a reply has been started and not yet logged.
+	bool replying_;
+
+	/// A piece of the reply's file being written.
+	std::vector<char> body_;
+
+	/// Paces the reply's file.
+	token_bucket pace_;
+
+	/// Wakes writing up when pacing allows more.
+	boost::asio::deadline_timer pace_timer_;
+
+	/// A live tag to be sent, with the timestamp it is sent with.
+	struct live_piece
+	{
+		live_tag_ptr tag;
+		boost::uint32_t timestamp;
+	};
+
+	/// Live tags waiting to be sent, and their size.
+	std::deque<live_piece> live_queue_;
+	std::size_t live_queued_bytes_;
+
+	/// Live tags being written, and the tag headers they are sent with.
+	std::vector<live_piece> live_writing_;
+	std::string live_headers_;
+
+	/// This connection's id with the live stream.
+	std::size_t live_id_;
+
+	/// Whether subscribed to the live stream.
+	bool live_subscribed_;
+
+	/// Whether the live stream's file header has been queued.
+	bool live_started_;
+
+	/// Whether the live stream has ended.
+	bool live_ended_;
+
+	/// Whether only a keyframe, or the tags a decoder needs before one, may be
+	/// sent next.
+	bool live_waiting_keyframe_;
+
+	/// Whether the stream's timestamps have been mapped onto those sent.
+	bool live_based_;
+
+	/// What is added to a stream timestamp to give the one sent.
+	boost::uint32_t live_offset_;
+
+	/// The last timestamp sent.
+	boost::uint32_t live_last_;
 };
 
 typedef boost::shared_ptr<connection> connection_ptr;
@@ -0,0 +1,132 @@
+#ifndef HTTP_FD_CACHE_HPP
+#define HTTP_FD_CACHE_HPP
+
+#include <ctime>
+#include <list>
+#include <map>
+#include <string>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+#if !defined(_WIN32)
+#include <sys/types.h>
+#endif
+
+namespace http {
+namespace server {
+
+/// A regular file opened for reading, with the size and mtime it had when
+/// opened. Reads are positional, so one open file can be shared by any
+/// number of responses and threads.
+class open_file
+  : private boost::noncopyable
+{
+public:
+  /// Open the regular file at path. Returns an empty pointer if it does not
+  /// exist or is not a regular file.
+  static boost::shared_ptr<open_file> open(const std::string& path);
+
+  /// Close the file.
+  ~open_file();
+
+  /// Size in bytes.
+  boost::uint64_t size() const;
+
+  /// Time of last modification.
+  std::time_t mtime() const;
+
+  /// Whether path still names this file, unmodified.
+  bool current(const std::string& path) const;
+
+  /// Read up to length bytes at offset. Returns the number of bytes read,
+  /// which is less than length only at the end of the file or on error.
+  std::size_t read(boost::uint64_t offset, char* data, std::size_t length) const;
+
+private:
+  open_file();
+
+#if defined(_WIN32)
+  /// A HANDLE; windows.h is kept out of this header for boost::asio's sake.
+  void* handle_;
+#else
+  int fd_;
+  dev_t device_;
+  ino_t inode_;
+#endif
+
+  boost::uint64_t size_;
+  std::time_t mtime_;
+};
+
+typedef boost::shared_ptr<open_file> open_file_ptr;
+
+/// Cache of open files, so that serving a file does not cost an open and
+/// fstat per request.
+///
+/// Open files are reference counted: one leaving the cache is only closed
+/// once every response reading it has finished. Paths that do not exist are
+/// remembered too, for a short time, so repeated 404s do not reach the
+/// filesystem. The number of entries is bounded and the least recently used
+/// is closed first. An entry is checked against its path at most once per
+/// revalidation interval, and reopened if the file was replaced.
+class fd_cache
+  : private boost::noncopyable
+{
+public:
+  /// Construct with room for 4096 files, revalidation every 2 seconds and
+  /// missing files remembered for 2 seconds.
+  fd_cache();
+
+  /// Set the most files kept open. Must be called before use.
+  void set_max_files(std::size_t count);
+
+  /// Set how often an entry is checked against its path. Must be called
+  /// before use.
+  void set_revalidate_interval(std::time_t seconds);
+
+  /// Set how long a missing file is remembered. Must be called before use.
+  void set_negative_ttl(std::time_t seconds);
+
+  /// Get the open file for path, or an empty pointer if there is none.
+  open_file_ptr acquire(const std::string& path);
+
+private:
+  /// A cached lookup, successful or not.
+  struct entry
+  {
+    std::string path;
+    open_file_ptr file;
+    std::time_t checked;
+  };
+
+  typedef std::list<entry> entry_list;
+
+  /// Cache the result of a lookup, closing the least recently used entries
+  /// beyond the limit. Called with the lock held.
+  void insert(const std::string& path, const open_file_ptr& file, std::time_t now);
+
+  /// Protects the entries.
+  boost::mutex mutex_;
+
+  /// Entries from most to least recently used.
+  entry_list entries_;
+
+  /// Entries by path.
+  std::map<std::string, entry_list::iterator> index_;
+
+  /// Most entries kept.
+  std::size_t max_files_;
+
+  /// Seconds between checks of an open file against its path.
+  std::time_t revalidate_interval_;
+
+  /// Seconds a missing file is remembered.
+  std::time_t negative_ttl_;
+};
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_FD_CACHE_HPP
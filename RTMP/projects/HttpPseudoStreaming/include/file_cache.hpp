@@ -0,0 +1,115 @@
+#ifndef HTTP_FILE_CACHE_HPP
+#define HTTP_FILE_CACHE_HPP
+
+#include <ctime>
+#include <list>
+#include <map>
+#include <string>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace http {
+namespace server {
+
+struct reply;
+
+/// Cache of small, frequently requested files, held as ready to send header
+/// and body buffers shared by every reply that uses them.
+///
+/// Entries are spread over independently locked shards by path. Each shard
+/// is a segmented LRU: new entries start on probation and are only promoted
+/// to the protected segment when requested again, so a scan through many
+/// files used once evicts other probationary entries rather than the hot
+/// set. Entries are revalidated against the file's mtime and size at most
+/// once per revalidation interval.
+class file_cache
+  : private boost::noncopyable
+{
+public:
+  /// Construct with the default budget of 32MB, files up to 512KB and
+  /// revalidation every 2 seconds.
+  file_cache();
+
+  /// Set the memory budget in bytes. Must be called before use.
+  void set_budget(std::size_t bytes);
+
+  /// Set the largest file that is cached. Must be called before use.
+  void set_max_file_size(std::size_t bytes);
+
+  /// Set how often an entry is checked against its file. Must be called
+  /// before use.
+  void set_revalidate_interval(std::time_t seconds);
+
+  /// Whether a file of the given size may be cached.
+  bool cacheable(boost::uint64_t size) const;
+
+  /// Look up the file at path, filling the reply from the cache on a hit.
+  bool find(const std::string& path, reply& rep);
+
+  /// Cache rep, a complete 200 reply for the file at path with the given
+  /// mtime and size, and turn it into a reply sharing the cached buffers.
+  void insert(const std::string& path, std::time_t mtime, boost::uint64_t size, reply& rep);
+
+private:
+  /// A cached file.
+  struct entry
+  {
+    std::string path;
+    boost::shared_ptr<const std::string> head;
+    boost::shared_ptr<const std::string> content;
+    std::time_t mtime;
+    boost::uint64_t size;
+    std::time_t checked;
+    std::size_t cost;
+    bool is_protected;
+  };
+
+  typedef std::list<entry> entry_list;
+
+  /// An independently locked part of the cache. Lists are ordered from
+  /// most to least recently used.
+  struct shard
+  {
+    shard();
+
+    boost::mutex mutex;
+    entry_list probation;
+    entry_list protected_entries;
+    std::map<std::string, entry_list::iterator> index;
+    std::size_t probation_bytes;
+    std::size_t protected_bytes;
+  };
+
+  enum { shard_count = 8 };
+
+  /// The shard holding path.
+  shard& shard_for(const std::string& path);
+
+  /// Record a hit, promoting a probationary entry. Called with the lock held.
+  void touch(shard& s, entry_list::iterator i);
+
+  /// Remove an entry. Called with the lock held.
+  void erase(shard& s, entry_list::iterator i);
+
+  /// Evict until the shard is within its budget. Called with the lock held.
+  void evict(shard& s);
+
+  /// The shards.
+  shard shards_[shard_count];
+
+  /// Memory budget for all shards.
+  std::size_t budget_;
+
+  /// Largest file that is cached.
+  std::size_t max_file_size_;
+
+  /// Seconds between checks of an entry against its file.
+  std::time_t revalidate_interval_;
+};
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_FILE_CACHE_HPP
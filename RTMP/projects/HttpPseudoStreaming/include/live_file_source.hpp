@@ -0,0 +1,88 @@
+#ifndef HTTP_LIVE_FILE_SOURCE_HPP
+#define HTTP_LIVE_FILE_SOURCE_HPP
+
+#include <string>
+#include <boost/asio.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include "fd_cache.hpp"
+#include "live_stream.hpp"
+
+namespace http {
+namespace server {
+
+/// Feeds a live stream from an FLV file that another process is still
+/// writing, e.g. an encoder recording to disk.
+///
+/// On starting, the file is skimmed for its onMetaData tag and sequence
+/// headers, which are written to the stream, and followed from its last
+/// keyframe. The file is then polled for new data. If it is found shorter
+/// than what was read, it is taken to have been started over and is
+/// followed again from its header. The source stops once the stream has had
+/// no viewers for a while, and is started again by the next.
+class live_file_source
+  : public boost::enable_shared_from_this<live_file_source>,
+    private boost::noncopyable
+{
+public:
+  /// Construct a source writing the file at path to stream, polling on
+  /// io_service.
+  live_file_source(boost::asio::io_service& io_service, const std::string& path, const live_stream_ptr& stream);
+
+  /// Start following the file, unless already running. Returns false if it
+  /// cannot be opened or is not an FLV file.
+  bool start();
+
+  /// Stop following the file.
+  void stop();
+
+  /// Whether the file is being followed.
+  bool running() const;
+
+private:
+  /// Open the file and write its header, metadata and sequence headers to
+  /// the stream, leaving offset_ at the tag to follow from.
+  bool open();
+
+  /// Read whatever has been added to the file and poll again.
+  void poll();
+
+  /// Handle expiry of the poll timer.
+  void handle_timer(const boost::system::error_code& e);
+
+  /// Copy the tag at offset in the file to the stream.
+  bool write_tag(boost::uint64_t offset);
+
+  /// The file to follow.
+  std::string path_;
+
+  /// Where the file's tags go.
+  live_stream_ptr stream_;
+
+  /// The file, while running.
+  open_file_ptr file_;
+
+  /// Offset of the next byte to read.
+  boost::uint64_t offset_;
+
+  /// Polls since the stream last had a viewer.
+  unsigned int unwatched_polls_;
+
+  /// Whether the file is being followed.
+  bool running_;
+
+  /// Wakes polling up.
+  boost::asio::deadline_timer timer_;
+
+  /// Buffer for data read.
+  std::string buffer_;
+};
+
+typedef boost::shared_ptr<live_file_source> live_file_source_ptr;
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_LIVE_FILE_SOURCE_HPP
@@ -0,0 +1,162 @@
+#ifndef HTTP_LIVE_STREAM_HPP
+#define HTTP_LIVE_STREAM_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace http {
+namespace server {
+
+/// A tag of a live FLV stream, shared by every viewer it is sent to.
+struct live_tag
+{
+  /// Tag type for the FLV file header, which is sent as it is.
+  enum { file_header = 0 };
+
+  /// The tag type: 8 for audio, 9 for video, 18 for script data, or
+  /// file_header.
+  unsigned char type;
+
+  /// Timestamp in milliseconds, including the extended byte.
+  boost::uint32_t timestamp;
+
+  /// Whether a viewer may start watching at this tag.
+  bool keyframe;
+
+  /// Whether this is onMetaData or an audio or video sequence header, which
+  /// a viewer needs before the tags that follow.
+  bool config;
+
+  /// The tag as it appears in the file: the 11 byte tag header, the data and
+  /// the PreviousTagSize that follows.
+  std::string bytes;
+};
+
+typedef boost::shared_ptr<const live_tag> live_tag_ptr;
+
+/// A live FLV stream, written by a source in this process and sent to any
+/// number of viewers as its tags arrive.
+///
+/// A viewer joining is first sent the FLV header, the onMetaData tag and the
+/// audio and video sequence headers seen last, then the tags since the last
+/// keyframe, so that playback can start at once. Each tag is held once, in a
+/// buffer shared by all the viewers it is queued for.
+///
+/// Data may be written from any thread; it is parsed into tags there and
+/// the tags are handed to viewers on the io_service thread, where viewers
+/// subscribe and unsubscribe.
+class live_stream
+  : public boost::enable_shared_from_this<live_stream>,
+    private boost::noncopyable
+{
+public:
+  /// Called with each tag for a viewer, or with an empty pointer once the
+  /// stream has ended.
+  typedef boost::function<void (const live_tag_ptr&)> tag_handler;
+
+  /// Most bytes of tags kept since the last keyframe. A longer group of
+  /// pictures is not kept, and a viewer joining waits for the next keyframe.
+  /// Viewers must be able to queue this much besides the config tags.
+  enum { max_gop_bytes = 1536 * 1024 };
+
+  /// Construct a stream handing tags to viewers on io_service.
+  explicit live_stream(boost::asio::io_service& io_service);
+
+  /// Append FLV data, starting with the file header. Safe to call from any
+  /// thread.
+  void write(const char* data, std::size_t size);
+
+  /// Drop any partly written tag and expect a new file header, e.g. when the
+  /// source starts over. Viewers carry on with the tags that follow. Safe to
+  /// call from any thread.
+  void restart();
+
+  /// End the stream. Safe to call from any thread.
+  void close();
+
+  /// Start sending tags to handler. Returns an id for unsubscribe.
+  std::size_t subscribe(const tag_handler& handler);
+
+  /// Stop sending tags to a viewer.
+  void unsubscribe(std::size_t id);
+
+  /// Number of viewers.
+  std::size_t viewers() const;
+
+private:
+  /// A subscribed viewer.
+  struct viewer
+  {
+    tag_handler handler;
+
+    /// Whether the file header has been sent.
+    bool started;
+  };
+
+  /// Take in a tag parsed from the data written.
+  void handle_tag(const live_tag_ptr& tag);
+
+  /// Send the stream's state to a viewer that has not yet been sent the
+  /// file header.
+  void start_viewer(viewer& v);
+
+  /// End the stream for all viewers.
+  void handle_close();
+
+  /// Parse complete tags from pending_ and hand them to the io_service.
+  /// Called with the lock held.
+  void parse();
+
+  /// Where tags are handed to viewers.
+  boost::asio::io_service& io_service_;
+
+  /// Protects pending_, have_header_, has_video_ and corrupt_.
+  boost::mutex mutex_;
+
+  /// Data written but not yet parsed.
+  std::string pending_;
+
+  /// Whether the file header has been parsed.
+  bool have_header_;
+
+  /// Whether the file header announces video, whose keyframes viewers
+  /// start at.
+  bool has_video_;
+
+  /// Whether the data written could not be parsed, so everything up to the
+  /// next restart is dropped.
+  bool corrupt_;
+
+  /// The state a new viewer is sent.
+  live_tag_ptr header_;
+  live_tag_ptr metadata_;
+  live_tag_ptr video_config_;
+  live_tag_ptr audio_config_;
+
+  /// Tags since the last keyframe, if that is within bounds.
+  std::vector<live_tag_ptr> gop_;
+  std::size_t gop_bytes_;
+  bool gop_valid_;
+
+  /// Viewers by id.
+  std::map<std::size_t, viewer> viewers_;
+  std::size_t next_id_;
+
+  /// Whether the stream has ended.
+  bool closed_;
+};
+
+typedef boost::shared_ptr<live_stream> live_stream_ptr;
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_LIVE_STREAM_HPP
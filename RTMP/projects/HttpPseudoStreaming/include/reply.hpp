@@ -4,7 +4,12 @@
 #include <string>
 #include <vector>
 #include <boost/asio.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include "access_log.hpp"
+#include "fd_cache.hpp"
 #include "header.hpp"
+#include "live_stream.hpp"
 
 namespace http {
 namespace server {
@@ -12,6 +17,9 @@ namespace server {
 /// A reply to be sent to a client.
 struct reply
 {
+  /// Construct an empty reply, sent as fast as the client reads it.
+  reply();
+
   /// The status of the reply.
   enum status_type
   {
@@ -39,11 +47,40 @@ struct reply
   /// The content to be sent in the reply.
   std::string content;
 
+  /// Status line and headers built in advance and shared between replies,
+  /// e.g. by the file cache. When set, status is not written again and
+  /// headers holds only headers added afterwards.
+  boost::shared_ptr<const std::string> shared_head;
+
+  /// Content shared between replies, sent instead of content when set.
+  boost::shared_ptr<const std::string> shared_content;
+
+  /// A file sent whole after the content, when set.
+  open_file_ptr file;
+
+  /// Bytes per second to send the file at once pace_burst bytes have been
+  /// sent, or 0 to send it as fast as the client reads.
+  double pace_rate;
+
+  /// Bytes of the file sent before pacing starts.
+  boost::uint64_t pace_burst;
+
+  /// A live stream sent after the content until it ends or the client goes
+  /// away, when set.
+  live_stream_ptr live;
+
+  /// What is logged once the reply has been sent.
+  access_record record;
+
   /// Convert the reply into a vector of buffers. The buffers do not own the
   /// underlying memory blocks, therefore the reply object must remain valid and
   /// not be changed until the write operation has completed.
   std::vector<boost::asio::const_buffer> to_buffers();
 
+  /// Format the status line and headers, without the blank line that ends
+  /// them.
+  std::string head_to_string() const;
+
   /// Get a stock reply.
   static reply stock_reply(status_type status);
 };
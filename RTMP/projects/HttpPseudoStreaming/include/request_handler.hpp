@@ -1,8 +1,16 @@
 #ifndef HTTP_REQUEST_HANDLER_HPP
 #define HTTP_REQUEST_HANDLER_HPP
 
+#include <map>
 #include <string>
+#include <boost/asio.hpp>
 #include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include "fd_cache.hpp"
+#include "file_cache.hpp"
+#include "live_file_source.hpp"
+#include "live_stream.hpp"
+#include "stream_pacer.hpp"
 
 namespace http {
 namespace server {
@@ -15,16 +23,62 @@ class request_handler
   : private boost::noncopyable
 {
 public:
-  /// Construct with a directory containing files to be served.
-  explicit request_handler(const std::string& doc_root);
+  /// Construct with a directory containing files to be served, and the
+  /// io_service live streams are sent on.
+  request_handler(const std::string& doc_root, boost::asio::io_service& io_service);
 
   /// Handle a request and produce a reply.
   void handle_request(const request& req, reply& rep);
 
+  /// The cache of small hot files.
+  file_cache& cache();
+
+  /// The cache of open files.
+  fd_cache& files();
+
+  /// How fast files are sent.
+  stream_pacer& pacer();
+
+  /// The live stream served as /live/<name>.flv, created if need be, for a
+  /// publisher in this process to write to.
+  live_stream_ptr live(const std::string& name);
+
+  /// Stop following the files of live streams.
+  void stop_live();
+
 private:
+  /// A live stream and, if it comes from a file, the file's source.
+  struct live_entry
+  {
+    live_stream_ptr stream;
+    live_file_source_ptr source;
+  };
+
+  /// Find the live stream called name, starting to follow path for it if
+  /// that is an FLV file. Returns an empty pointer if there is neither.
+  live_stream_ptr find_live(const std::string& name, const std::string& path);
+
+  /// Where live streams are sent.
+  boost::asio::io_service& io_service_;
+
   /// The directory containing the files to be served.
   std::string doc_root_;
 
+  /// Small files served from memory.
+  file_cache cache_;
+
+  /// Files kept open between requests.
+  fd_cache files_;
+
+  /// Paces FLV files and caps the total rate.
+  stream_pacer pacer_;
+
+  /// Protects live_.
+  boost::mutex live_mutex_;
+
+  /// Live streams by name.
+  std::map<std::string, live_entry> live_;
+
   /// Perform URL-decoding on a string. Returns false if the encoding was
   /// invalid.
   static bool url_decode(const std::string& in, std::string& out);
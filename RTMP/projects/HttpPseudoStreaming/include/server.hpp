@@ -4,6 +4,7 @@
 #include <boost/asio.hpp>
 #include <string>
 #include <boost/noncopyable.hpp>
+#include "access_log.hpp"
 #include "connection.hpp"
 #include "connection_manager.hpp"
 #include "request_handler.hpp"
@@ -20,6 +21,22 @@ public:
 	explicit server(const std::string& address, const std::string& port,
 	const std::string& doc_root);
 
+	/// The cache of small hot files, e.g. to change its budget.
+	file_cache& cache();
+
+	/// The cache of open files, e.g. to change how many are kept.
+	fd_cache& files();
+
+	/// How fast files are sent, e.g. to enable pacing of FLV files.
+	stream_pacer& pacer();
+
+	/// The access log, e.g. to open it before the server is run.
+	access_log& log();
+
+	/// The live stream served as /live/<name>.flv, for a publisher in this
+	/// process to write to.
+	live_stream_ptr live(const std::string& name);
+
 	/// Run the server's io_service loop.
 	void run();
 
@@ -36,6 +53,9 @@ private:
 	/// The io_service used to perform asynchronous operations.
 	boost::asio::io_service io_service_;
 
+	/// The access log, which outlives the connections.
+	access_log log_;
+
 	/// Acceptor used to listen for incoming connections.
 	boost::asio::ip::tcp::acceptor acceptor_;
 
@@ -0,0 +1,118 @@
+#ifndef HTTP_STREAM_PACER_HPP
+#define HTTP_STREAM_PACER_HPP
+
+#include <ctime>
+#include <map>
+#include <string>
+#include <boost/cstdint.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include "fd_cache.hpp"
+
+namespace http {
+namespace server {
+
+struct reply;
+
+/// Limits a flow of bytes to a rate, allowing bursts up to a depth.
+class token_bucket
+{
+public:
+  /// Construct a bucket that does not limit.
+  token_bucket();
+
+  /// Limit to rate bytes per second, starting with initial bytes available.
+  /// Unused allowance accumulates up to depth bytes.
+  void reset(double rate, double initial, double depth);
+
+  /// Whether the bucket limits at all.
+  bool limited() const;
+
+  /// Bytes that may be sent now.
+  std::size_t available(const boost::posix_time::ptime& now);
+
+  /// Record that bytes were sent.
+  void consume(std::size_t bytes);
+
+  /// Time until bytes may be sent, as of the last call to available().
+  boost::posix_time::time_duration wait_for(std::size_t bytes) const;
+
+private:
+  double rate_;
+  double depth_;
+  double tokens_;
+  boost::posix_time::ptime updated_;
+};
+
+/// Decides how fast files are sent.
+///
+/// Pseudo-streamed FLV files are sent at a multiple of their bitrate once a
+/// burst of some seconds of video has gone out, so that a viewer who stops
+/// watching early has not been sent the whole file. The bitrate comes from
+/// the file's onMetaData, or failing that from its size and the timestamp of
+/// its last tag, and is remembered per file. Independently, the total rate of
+/// all file bodies sent by the server may be capped.
+class stream_pacer
+  : private boost::noncopyable
+{
+public:
+  /// Construct with pacing disabled, a 10 second burst, a rate multiplier of
+  /// 1.25 and no total cap.
+  stream_pacer();
+
+  /// Enable or disable pacing of FLV files. Must be called before use.
+  void set_enabled(bool enabled);
+
+  /// Set the seconds of video sent before pacing starts. Must be called before
+  /// use.
+  void set_burst(double seconds);
+
+  /// Set the multiple of a file's bitrate it is paced at. Must be called before
+  /// use.
+  void set_rate_multiplier(double multiplier);
+
+  /// Cap the bytes per second sent for all file bodies together, or 0 for no
+  /// cap. Must be called before use.
+  void set_total_cap(double bytes_per_second);
+
+  /// Set the pace of a reply sending file, which path names.
+  void pace(const std::string& path, const open_file& file, reply& rep);
+
+  /// Take up to wanted bytes from the total cap, or none if fewer than minimum
+  /// are available.
+  std::size_t take_total(std::size_t wanted, std::size_t minimum);
+
+  /// Time until bytes are available under the total cap.
+  boost::posix_time::time_duration total_wait(std::size_t bytes);
+
+private:
+  /// A remembered bitrate.
+  struct rate_entry
+  {
+    std::time_t mtime;
+    boost::uint64_t size;
+    double bitrate;
+  };
+
+  /// The bitrate of file in bytes per second, or 0 if it cannot be told.
+  double bitrate(const std::string& path, const open_file& file);
+
+  bool enabled_;
+  double burst_;
+  double multiplier_;
+
+  /// Protects rates_ and total_.
+  boost::mutex mutex_;
+
+  /// Bitrates by path.
+  std::map<std::string, rate_entry> rates_;
+
+  /// The cap on all file bodies.
+  token_bucket total_;
+};
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_STREAM_PACER_HPP
@@ -1,4 +1,5 @@
 #include "connection.hpp"
+#include <algorithm>
 #include <vector>
 #include <boost/bind.hpp>
 #include "connection_manager.hpp"
@@ -7,8 +8,34 @@
 namespace http {
 namespace server {
 
-connection::connection(boost::asio::io_service& io_service, connection_manager& manager, request_handler& handler)
-	: socket_(io_service), connection_manager_(manager), request_handler_(handler)
+namespace {
+
+/// Files are sent in pieces of at most this size.
+const std::size_t body_block_size = 64 * 1024;
+
+/// Paced pieces are not sent smaller than this, unless it is the last.
+const std::size_t min_paced_write = 16 * 1024;
+
+/// Most bytes of live tags queued for a client: room for a whole group of
+/// pictures as the stream keeps it, and the header and config tags sent
+/// before it. A client further behind loses the tags and carries on from the
+/// next keyframe.
+const std::size_t max_live_backlog = live_stream::max_gop_bytes + 512 * 1024;
+
+/// Largest step forward in a live stream's timestamps taken as it is. A
+/// larger step, or one back, comes from the source starting over, and the
+/// timestamps are mapped to carry on from the last sent.
+const boost::uint32_t max_live_step = 60 * 1000;
+
+/// Size of the header in front of each tag's data.
+const std::size_t tag_header_size = 11;
+
+} // namespace
+
+connection::connection(boost::asio::io_service& io_service, connection_manager& manager, request_handler& handler, access_log& log)
+	: socket_(io_service), connection_manager_(manager), request_handler_(handler), log_(log), body_sent_(0), bytes_sent_(0), replying_(false), pace_timer_(io_service),
+	live_queued_bytes_(0), live_id_(0), live_subscribed_(false), live_started_(false), live_ended_(false), live_waiting_keyframe_(true), live_based_(false),
+	live_offset_(0), live_last_(0)
 {
 }
 
@@ -19,12 +46,30 @@ boost::asio::ip::tcp::socket& connection::socket()
 
 void connection::start()
 {
+	boost::system::error_code ignored_ec;
+	peer_ = socket_.remote_endpoint(ignored_ec).address();
 	socket_.async_read_some(boost::asio::buffer(buffer_), boost::bind(&connection::handle_read, shared_from_this(), boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
 }
 
 void connection::stop()
 {
+	// Every reply ends here, whether sent whole or cut short.
+	if (replying_)
+	{
+		replying_ = false;
+		if (log_.is_open())
+		{
+			reply_.record.set_reply(reply_.status, bytes_sent_, boost::posix_time::microsec_clock::universal_time());
+			log_.log(reply_.record);
+		}
+	}
+	if (live_subscribed_)
+	{
+		live_subscribed_ = false;
+		reply_.live->unsubscribe(live_id_);
+	}
 	socket_.close();
+	pace_timer_.cancel();
 }
 
 void connection::handle_read(const boost::system::error_code& e, std::size_t bytes_transferred)
@@ -34,14 +79,23 @@ void connection::handle_read(const boost::system::error_code& e, std::size_t byt
 		boost::tribool result;
 		boost::tie(result, boost::tuples::ignore) = request_parser_.parse(request_, buffer_.data(), buffer_.data() + bytes_transferred);
 
+		boost::posix_time::ptime now;
+		if (log_.is_open())
+		{
+			now = boost::posix_time::microsec_clock::universal_time();
+		}
 		if (result)
 		{
 			request_handler_.handle_request(request_, reply_);
+			reply_.record.set_request(request_, peer_, now);
+			replying_ = true;
 			boost::asio::async_write(socket_, reply_.to_buffers(), boost::bind(&connection::handle_write, shared_from_this(), boost::asio::placeholders::error));
 		}
 		else if (!result)
 		{
 			reply_ = reply::stock_reply(reply::bad_request);
+			reply_.record.set_request(request(), peer_, now);
+			replying_ = true;
 			boost::asio::async_write(socket_, reply_.to_buffers(), boost::bind(&connection::handle_write, shared_from_this(), boost::asio::placeholders::error));
 		}
 		else
@@ -56,6 +110,247 @@ void connection::handle_read(const boost::system::error_code& e, std::size_t byt
 }
 
 void connection::handle_write(const boost::system::error_code& e)
+{
+	if (!e)
+	{
+		bytes_sent_ = reply_.shared_content ? reply_.shared_content->size() : reply_.content.size();
+	}
+	if (!e && reply_.file)
+	{
+		if (reply_.pace_rate > 0)
+		{
+			pace_.reset(reply_.pace_rate, static_cast<double>(reply_.pace_burst), std::max(reply_.pace_rate, static_cast<double>(body_block_size)));
+		}
+		write_body();
+		return;
+	}
+	if (!e && reply_.live)
+	{
+		// Tags of a stream already running are handed over at once.
+		live_id_ = reply_.live->subscribe(boost::bind(&connection::handle_live_tag, shared_from_this(), _1));
+		live_subscribed_ = !live_ended_;
+		return;
+	}
+	finish(e);
+}
+
+void connection::write_body()
+{
+	boost::uint64_t remaining = reply_.file->size() - body_sent_;
+	if (remaining == 0)
+	{
+		finish(boost::system::error_code());
+		return;
+	}
+
+	// Take what both this reply's pace and the server's total cap allow.
+	stream_pacer& pacer = request_handler_.pacer();
+	std::size_t wanted = static_cast<std::size_t>(std::min<boost::uint64_t>(remaining, body_block_size));
+	std::size_t minimum = std::min(wanted, min_paced_write);
+	std::size_t bytes = std::min(wanted, pace_.available(boost::posix_time::microsec_clock::universal_time()));
+	bytes = bytes < minimum ? 0 : pacer.take_total(bytes, minimum);
+	if (bytes == 0)
+	{
+		pace_timer_.expires_from_now(std::max(pace_.wait_for(minimum), pacer.total_wait(minimum)));
+		pace_timer_.async_wait(boost::bind(&connection::handle_pace_timer, shared_from_this(), boost::asio::placeholders::error));
+		return;
+	}
+	pace_.consume(bytes);
+
+	body_.resize(body_block_size);
+	if (reply_.file->read(body_sent_, &body_[0], bytes) != bytes)
+	{
+		connection_manager_.stop(shared_from_this());
+		return;
+	}
+	boost::asio::async_write(socket_, boost::asio::buffer(&body_[0], bytes), boost::bind(&connection::handle_body_write, shared_from_this(), boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+}
+
+void connection::handle_body_write(const boost::system::error_code& e, std::size_t bytes_transferred)
+{
+	if (!e)
+	{
+		body_sent_ += bytes_transferred;
+		bytes_sent_ += bytes_transferred;
+		write_body();
+	}
+	else if (e != boost::asio::error::operation_aborted)
+	{
+		connection_manager_.stop(shared_from_this());
+	}
+}
+
+void connection::handle_pace_timer(const boost::system::error_code& e)
+{
+	if (!e && socket_.is_open())
+	{
+		write_body();
+	}
+}
+
+void connection::handle_live_tag(const live_tag_ptr& tag)
+{
+	if (!tag)
+	{
+		live_ended_ = true;
+		live_subscribed_ = false;
+		if (live_writing_.empty())
+		{
+			finish(boost::system::error_code());
+		}
+		return;
+	}
+
+	live_piece piece;
+	piece.tag = tag;
+	piece.timestamp = 0;
+	if (tag->type == live_tag::file_header)
+	{
+		// Only the first header is sent; a later one starts a new session of
+		// the source, whose timestamps are mapped onto those already sent.
+		if (live_started_)
+		{
+			live_based_ = false;
+			live_waiting_keyframe_ = true;
+			return;
+		}
+		live_started_ = true;
+	}
+	else
+	{
+		if (live_waiting_keyframe_ && !tag->keyframe && !tag->config)
+		{
+			return;
+		}
+		if (tag->keyframe)
+		{
+			live_waiting_keyframe_ = false;
+			if (!live_based_)
+			{
+				live_offset_ = live_last_ - tag->timestamp;
+				live_based_ = true;
+			}
+		}
+
+		// Tags before the first keyframe go out at the last timestamp sent.
+		piece.timestamp = live_last_;
+		if (live_based_)
+		{
+			boost::uint32_t timestamp = tag->timestamp + live_offset_;
+			if (timestamp - live_last_ > max_live_step)
+			{
+				live_offset_ = live_last_ - tag->timestamp;
+				timestamp = live_last_;
+			}
+			piece.timestamp = timestamp;
+		}
+		live_last_ = piece.timestamp;
+	}
+
+	if (live_queued_bytes_ + tag->bytes.size() > max_live_backlog)
+	{
+		drop_live_backlog();
+		live_waiting_keyframe_ = !tag->keyframe;
+		if (live_waiting_keyframe_ && !tag->config)
+		{
+			return;
+		}
+	}
+	live_queue_.push_back(piece);
+	live_queued_bytes_ += tag->bytes.size();
+	write_live();
+}
+
+void connection::drop_live_backlog()
+{
+	std::deque<live_piece> kept;
+	std::size_t kept_bytes = 0;
+	bool have_metadata = false, have_video = false, have_audio = false;
+	for (std::deque<live_piece>::reverse_iterator i = live_queue_.rbegin(); i != live_queue_.rend(); ++i)
+	{
+		const live_tag& tag = *i->tag;
+		bool* have = tag.type == 18 ? &have_metadata : tag.type == 9 ? &have_video : &have_audio;
+		if (tag.type == live_tag::file_header || (tag.config && !*have))
+		{
+			if (tag.config)
+			{
+				*have = true;
+			}
+			kept.push_front(*i);
+			kept_bytes += tag.bytes.size();
+		}
+	}
+	live_queue_.swap(kept);
+	live_queued_bytes_ = kept_bytes;
+	live_waiting_keyframe_ = true;
+}
+
+void connection::write_live()
+{
+	if (!live_writing_.empty() || live_queue_.empty() || !socket_.is_open())
+	{
+		return;
+	}
+
+	// The tag headers are written again with this client's timestamps; the
+	// rest of each tag is sent from the buffer shared by all its viewers.
+	live_writing_.assign(live_queue_.begin(), live_queue_.end());
+	live_queue_.clear();
+	live_queued_bytes_ = 0;
+	live_headers_.clear();
+	for (std::size_t i = 0; i < live_writing_.size(); ++i)
+	{
+		const live_piece& piece = live_writing_[i];
+		if (piece.tag->type != live_tag::file_header)
+		{
+			live_headers_.append(piece.tag->bytes, 0, 4);
+			live_headers_ += static_cast<char>((piece.timestamp >> 16) & 0xff);
+			live_headers_ += static_cast<char>((piece.timestamp >> 8) & 0xff);
+			live_headers_ += static_cast<char>(piece.timestamp & 0xff);
+			live_headers_ += static_cast<char>((piece.timestamp >> 24) & 0xff);
+			live_headers_.append(piece.tag->bytes, 8, 3);
+		}
+	}
+
+	std::vector<boost::asio::const_buffer> buffers;
+	std::size_t header = 0;
+	for (std::size_t i = 0; i < live_writing_.size(); ++i)
+	{
+		const std::string& bytes = live_writing_[i].tag->bytes;
+		if (live_writing_[i].tag->type == live_tag::file_header)
+		{
+			buffers.push_back(boost::asio::buffer(bytes));
+		}
+		else
+		{
+			buffers.push_back(boost::asio::buffer(live_headers_.data() + header, tag_header_size));
+			buffers.push_back(boost::asio::buffer(bytes.data() + tag_header_size, bytes.size() - tag_header_size));
+			header += tag_header_size;
+		}
+	}
+	boost::asio::async_write(socket_, buffers, boost::bind(&connection::handle_live_write, shared_from_this(), boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+}
+
+void connection::handle_live_write(const boost::system::error_code& e, std::size_t bytes_transferred)
+{
+	live_writing_.clear();
+	if (!e)
+	{
+		bytes_sent_ += bytes_transferred;
+		if (live_ended_ && live_queue_.empty())
+		{
+			finish(e);
+			return;
+		}
+		write_live();
+	}
+	else if (e != boost::asio::error::operation_aborted)
+	{
+		connection_manager_.stop(shared_from_this());
+	}
+}
+
+void connection::finish(const boost::system::error_code& e)
 {
 	if (!e)
 	{
@@ -0,0 +1,347 @@
+#include "live_file_source.hpp"
+#include <algorithm>
+#include <cstring>
+#include <boost/bind.hpp>
+
+namespace http {
+namespace server {
+
+namespace {
+
+/// How often the file is checked for new data, in milliseconds.
+const long poll_interval = 200;
+
+/// Polls without viewers after which the source stops.
+const unsigned int unwatched_limit = 150;
+
+/// Most bytes read from the file at a time.
+const std::size_t read_size = 64 * 1024;
+
+/// Bytes after the file header skimmed for onMetaData and the sequence
+/// headers, which an encoder writes first.
+const std::size_t head_window = 1024 * 1024;
+
+/// Bytes at the end of the file skimmed for the last keyframe. One further
+/// back starts a group of pictures longer than the stream keeps.
+const std::size_t tail_window = live_stream::max_gop_bytes;
+
+/// Size of the header in front of each tag's data.
+const std::size_t tag_header_size = 11;
+
+/// Size of the PreviousTagSize after each tag.
+const std::size_t tag_trailer_size = 4;
+
+/// Marks a tag not found.
+const boost::uint64_t none = static_cast<boost::uint64_t>(-1);
+
+boost::uint32_t get_ui24(const char* p)
+{
+	const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+	return (u[0] << 16) | (u[1] << 8) | u[2];
+}
+
+boost::uint32_t get_ui32(const char* p)
+{
+	const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+	return (static_cast<boost::uint32_t>(u[0]) << 24) | (u[1] << 16) | (u[2] << 8) | u[3];
+}
+
+/// Offsets of the tags a viewer needs first and of the last place to start
+/// from, as found by skimming a file.
+struct skim_result
+{
+	skim_result()
+		: metadata(none), video_config(none), audio_config(none), keyframe(none)
+	{
+	}
+
+	boost::uint64_t metadata;
+	boost::uint64_t video_config;
+	boost::uint64_t audio_config;
+	boost::uint64_t keyframe;
+};
+
+/// Whether data holds a whole tag at position whose PreviousTagSize agrees
+/// with its size, following one whose PreviousTagSize does too. Used to find
+/// a tag boundary in data read from the middle of a file.
+bool tag_at(const std::string& data, std::size_t position)
+{
+	const char* p = data.data();
+	if (position < tag_trailer_size || position + tag_header_size > data.size())
+	{
+		return false;
+	}
+	boost::uint32_t size = tag_header_size + get_ui24(p + position + 1);
+	boost::uint32_t previous = get_ui32(p + position - tag_trailer_size);
+	if (position + size + tag_trailer_size > data.size() || get_ui32(p + position + size) != size
+		|| previous < tag_header_size || previous > position - tag_trailer_size)
+	{
+		return false;
+	}
+	const char* before = p + position - tag_trailer_size - previous;
+	unsigned char type = static_cast<unsigned char>(p[position]) & 0x1f;
+	unsigned char type_before = static_cast<unsigned char>(before[0]) & 0x1f;
+	return (type == 8 || type == 9 || type == 18) && (type_before == 8 || type_before == 9 || type_before == 18)
+		&& get_ui24(p + position + 8) == 0 && tag_header_size + get_ui24(before + 1) == previous;
+}
+
+/// Skim the tags in data, read from the file at base, from position on.
+/// Records the first config tag of each kind and the last keyframe, and
+/// returns the file offset of the first tag not wholly in data.
+boost::uint64_t skim(const std::string& data, std::size_t position, boost::uint64_t base, bool has_video, skim_result& result)
+{
+	const char* p = data.data();
+	while (data.size() - position >= tag_header_size + 2)
+	{
+		const char* tag = p + position;
+		std::size_t size = tag_header_size + get_ui24(tag + 1) + tag_trailer_size;
+		if (size > data.size() - position)
+		{
+			break;
+		}
+		boost::uint64_t offset = base + position;
+		unsigned char type = static_cast<unsigned char>(tag[0]) & 0x1f;
+		unsigned char first = static_cast<unsigned char>(tag[11]);
+		unsigned char second = static_cast<unsigned char>(tag[12]);
+		if (type == 18)
+		{
+			static const char name[] = "\x02\x00\x0aonMetaData";
+			if (result.metadata == none && size >= tag_header_size + sizeof(name) - 1 + tag_trailer_size
+				&& std::memcmp(tag + tag_header_size, name, sizeof(name) - 1) == 0)
+			{
+				result.metadata = offset;
+			}
+		}
+		else if (type == 9)
+		{
+			if ((first & 0x0f) == 7 && second == 0)
+			{
+				if (result.video_config == none)
+				{
+					result.video_config = offset;
+				}
+			}
+			else if ((first >> 4) == 1)
+			{
+				result.keyframe = offset;
+			}
+		}
+		else if (type == 8)
+		{
+			if ((first >> 4) == 10 && second == 0)
+			{
+				if (result.audio_config == none)
+				{
+					result.audio_config = offset;
+				}
+			}
+			else if (!has_video)
+			{
+				result.keyframe = offset;
+			}
+		}
+		else
+		{
+			break;
+		}
+		position += size;
+	}
+	return base + position;
+}
+
+} // namespace
+
+live_file_source::live_file_source(boost::asio::io_service& io_service, const std::string& path, const live_stream_ptr& stream)
+	: path_(path), stream_(stream), offset_(0), unwatched_polls_(0), running_(false), timer_(io_service)
+{
+}
+
+bool live_file_source::start()
+{
+	if (running_)
+	{
+		return true;
+	}
+	if (!open())
+	{
+		return false;
+	}
+	running_ = true;
+	unwatched_polls_ = 0;
+	poll();
+	return true;
+}
+
+void live_file_source::stop()
+{
+	running_ = false;
+	file_.reset();
+	timer_.cancel();
+}
+
+bool live_file_source::running() const
+{
+	return running_;
+}
+
+bool live_file_source::open()
+{
+	file_ = open_file::open(path_);
+	if (!file_)
+	{
+		return false;
+	}
+
+	// The header gives its own size, after which come a PreviousTagSize and
+	// the first tag.
+	char header[13];
+	if (file_->read(0, header, sizeof(header)) != sizeof(header) || std::memcmp(header, "FLV", 3) != 0)
+	{
+		file_.reset();
+		return false;
+	}
+	boost::uint64_t header_size = get_ui32(header + 5) + 4;
+	if (header_size > 1024)
+	{
+		file_.reset();
+		return false;
+	}
+
+	// Skim the start of the file for the tags a viewer needs first, and its
+	// end for the last place to start from, each with a single read. A tag
+	// still being written ends a skim.
+	skim_result found;
+	bool has_video = (header[4] & 1) != 0;
+	boost::uint64_t size = file_->size();
+	buffer_.resize(static_cast<std::size_t>(size > header_size ? std::min<boost::uint64_t>(size - header_size, head_window) : 0));
+	if (!buffer_.empty() && file_->read(header_size, &buffer_[0], buffer_.size()) != buffer_.size())
+	{
+		file_.reset();
+		return false;
+	}
+	boost::uint64_t offset = skim(buffer_, 0, header_size, has_video, found);
+	if (header_size + buffer_.size() < size)
+	{
+		// The tail carries on from the head skim if it is near. Otherwise it
+		// starts at a tag boundary found in the window, and a keyframe before
+		// the window is too far back to start from.
+		boost::uint64_t tail = std::max<boost::uint64_t>(offset, size - tail_window);
+		buffer_.resize(static_cast<std::size_t>(size - tail));
+		if (file_->read(tail, &buffer_[0], buffer_.size()) != buffer_.size())
+		{
+			file_.reset();
+			return false;
+		}
+		std::size_t position = 0;
+		if (tail != offset)
+		{
+			while (position < buffer_.size() && !tag_at(buffer_, position))
+			{
+				++position;
+			}
+		}
+		if (position < buffer_.size())
+		{
+			skim_result tail_found;
+			boost::uint64_t end = skim(buffer_, position, tail, has_video, tail_found);
+			if (tail_found.keyframe != none || tail != offset)
+			{
+				found.keyframe = tail_found.keyframe;
+			}
+			offset = end;
+		}
+	}
+
+	// Follow from the last keyframe, or from the end if there is none yet.
+	offset_ = found.keyframe != none ? found.keyframe : offset;
+
+	buffer_.resize(static_cast<std::size_t>(header_size));
+	if (file_->read(0, &buffer_[0], buffer_.size()) != buffer_.size())
+	{
+		file_.reset();
+		return false;
+	}
+	stream_->restart();
+	stream_->write(buffer_.data(), buffer_.size());
+	boost::uint64_t configs[] = { found.metadata, found.video_config, found.audio_config };
+	for (std::size_t i = 0; i < sizeof(configs) / sizeof(configs[0]); ++i)
+	{
+		if (configs[i] < offset_ && !write_tag(configs[i]))
+		{
+			file_.reset();
+			return false;
+		}
+	}
+	return true;
+}
+
+bool live_file_source::write_tag(boost::uint64_t offset)
+{
+	char header[11];
+	if (file_->read(offset, header, sizeof(header)) != sizeof(header))
+	{
+		return false;
+	}
+	buffer_.resize(tag_header_size + get_ui24(header + 1) + tag_trailer_size);
+	if (file_->read(offset, &buffer_[0], buffer_.size()) != buffer_.size())
+	{
+		return false;
+	}
+	stream_->write(buffer_.data(), buffer_.size());
+	return true;
+}
+
+void live_file_source::poll()
+{
+	if (!running_)
+	{
+		return;
+	}
+
+	unwatched_polls_ = stream_->viewers() > 0 ? 0 : unwatched_polls_ + 1;
+	if (unwatched_polls_ > unwatched_limit)
+	{
+		stop();
+		return;
+	}
+
+	buffer_.resize(read_size);
+	std::size_t got = file_->read(offset_, &buffer_[0], buffer_.size());
+	if (got > 0)
+	{
+		stream_->write(buffer_.data(), got);
+		offset_ += got;
+	}
+	else
+	{
+		// A file found shorter than what was read has been started over.
+		open_file_ptr current = open_file::open(path_);
+		if (current && current->size() < offset_ && !open())
+		{
+			stop();
+			return;
+		}
+	}
+
+	// Keep reading at once while there is a backlog.
+	if (got == buffer_.size())
+	{
+		timer_.expires_from_now(boost::posix_time::milliseconds(0));
+	}
+	else
+	{
+		timer_.expires_from_now(boost::posix_time::milliseconds(poll_interval));
+	}
+	timer_.async_wait(boost::bind(&live_file_source::handle_timer, shared_from_this(), boost::asio::placeholders::error));
+}
+
+void live_file_source::handle_timer(const boost::system::error_code& e)
+{
+	if (!e)
+	{
+		poll();
+	}
+}
+
+} // namespace server
+} // namespace http
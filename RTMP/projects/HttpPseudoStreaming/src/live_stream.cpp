@@ -0,0 +1,291 @@
+#include "live_stream.hpp"
+#include <boost/bind.hpp>
+
+namespace http {
+namespace server {
+
+namespace {
+
+/// Size of the header in front of each tag's data.
+const std::size_t tag_header_size = 11;
+
+/// Size of the PreviousTagSize after each tag.
+const std::size_t tag_trailer_size = 4;
+
+/// Largest tag accepted; anything bigger is taken for corrupt data.
+const std::size_t max_tag_size = 16 * 1024 * 1024;
+
+boost::uint32_t get_ui24(const char* p)
+{
+	const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+	return (u[0] << 16) | (u[1] << 8) | u[2];
+}
+
+boost::uint32_t get_ui32(const char* p)
+{
+	const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+	return (static_cast<boost::uint32_t>(u[0]) << 24) | (u[1] << 16) | (u[2] << 8) | u[3];
+}
+
+/// The byte at index in a tag's data, or 0 if the data is shorter.
+unsigned char first_data_byte(const live_tag& tag, std::size_t index)
+{
+	std::size_t position = tag_header_size + index;
+	return position + tag_trailer_size < tag.bytes.size() ? static_cast<unsigned char>(tag.bytes[position]) : 0;
+}
+
+/// Whether a tag is onMetaData or an AVC or AAC sequence header.
+bool is_config(const live_tag& tag)
+{
+	switch (tag.type)
+	{
+	case 18:
+		{
+			static const char name[] = "\x02\x00\x0aonMetaData";
+			return tag.bytes.compare(tag_header_size, sizeof(name) - 1, name, sizeof(name) - 1) == 0;
+		}
+	case 9:
+		return (first_data_byte(tag, 0) & 0x0f) == 7 && first_data_byte(tag, 1) == 0;
+	case 8:
+		return (first_data_byte(tag, 0) >> 4) == 10 && first_data_byte(tag, 1) == 0;
+	default:
+		return false;
+	}
+}
+
+} // namespace
+
+live_stream::live_stream(boost::asio::io_service& io_service)
+	: io_service_(io_service), have_header_(false), has_video_(true), corrupt_(false), gop_bytes_(0), gop_valid_(false),
+	next_id_(0), closed_(false)
+{
+}
+
+void live_stream::write(const char* data, std::size_t size)
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	if (!corrupt_)
+	{
+		pending_.append(data, size);
+		parse();
+	}
+}
+
+void live_stream::restart()
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	pending_.clear();
+	have_header_ = false;
+	corrupt_ = false;
+}
+
+void live_stream::close()
+{
+	io_service_.post(boost::bind(&live_stream::handle_close, shared_from_this()));
+}
+
+std::size_t live_stream::subscribe(const tag_handler& handler)
+{
+	if (closed_)
+	{
+		handler(live_tag_ptr());
+		return next_id_++;
+	}
+	viewer& v = viewers_[next_id_];
+	v.handler = handler;
+	v.started = false;
+	if (header_)
+	{
+		start_viewer(v);
+	}
+	return next_id_++;
+}
+
+void live_stream::unsubscribe(std::size_t id)
+{
+	viewers_.erase(id);
+}
+
+std::size_t live_stream::viewers() const
+{
+	return viewers_.size();
+}
+
+void live_stream::parse()
+{
+	if (!have_header_)
+	{
+		// The file header gives its own size, followed by a PreviousTagSize.
+		if (pending_.size() < 9)
+		{
+			return;
+		}
+		std::size_t size = get_ui32(&pending_[5]) + tag_trailer_size;
+		if (pending_.compare(0, 3, "FLV") != 0 || size > 1024)
+		{
+			corrupt_ = true;
+			pending_.clear();
+			return;
+		}
+		if (pending_.size() < size)
+		{
+			return;
+		}
+		boost::shared_ptr<live_tag> tag(new live_tag);
+		tag->type = live_tag::file_header;
+		tag->timestamp = 0;
+		tag->keyframe = false;
+		tag->config = false;
+		tag->bytes.assign(pending_, 0, size);
+		has_video_ = (pending_[4] & 1) != 0;
+		pending_.erase(0, size);
+		have_header_ = true;
+		io_service_.post(boost::bind(&live_stream::handle_tag, shared_from_this(), live_tag_ptr(tag)));
+	}
+
+	std::size_t used = 0;
+	while (pending_.size() - used >= tag_header_size)
+	{
+		const char* p = pending_.data() + used;
+		unsigned char type = static_cast<unsigned char>(p[0]) & 0x1f;
+		std::size_t size = tag_header_size + get_ui24(p + 1) + tag_trailer_size;
+		if ((type != 8 && type != 9 && type != 18) || size > max_tag_size)
+		{
+			corrupt_ = true;
+			pending_.clear();
+			return;
+		}
+		if (pending_.size() - used < size)
+		{
+			break;
+		}
+
+		boost::shared_ptr<live_tag> tag(new live_tag);
+		tag->type = type;
+		tag->timestamp = get_ui24(p + 4) | (static_cast<boost::uint32_t>(static_cast<unsigned char>(p[7])) << 24);
+		tag->bytes.assign(p, size);
+		// Without video, any audio tag is a place to start.
+		tag->config = is_config(*tag);
+		tag->keyframe = !tag->config && (type == 9 ? (first_data_byte(*tag, 0) >> 4) == 1 : type == 8 && !has_video_);
+		used += size;
+		io_service_.post(boost::bind(&live_stream::handle_tag, shared_from_this(), live_tag_ptr(tag)));
+	}
+	pending_.erase(0, used);
+}
+
+void live_stream::handle_tag(const live_tag_ptr& tag)
+{
+	if (closed_)
+	{
+		return;
+	}
+
+	if (tag->type == live_tag::file_header)
+	{
+		// A new header starts a new session of the source. Viewers already
+		// watching carry on without it.
+		header_ = tag;
+		gop_.clear();
+		gop_bytes_ = 0;
+		gop_valid_ = false;
+		std::map<std::size_t, viewer>::iterator i = viewers_.begin();
+		while (i != viewers_.end())
+		{
+			viewer& v = (i++)->second;
+			if (!v.started)
+			{
+				start_viewer(v);
+			}
+		}
+		return;
+	}
+
+	// onMetaData and the AVC and AAC sequence headers are kept for viewers
+	// joining later.
+	if (tag->config)
+	{
+		switch (tag->type)
+		{
+		case 18:
+			metadata_ = tag;
+			break;
+		case 9:
+			video_config_ = tag;
+			break;
+		default:
+			audio_config_ = tag;
+			break;
+		}
+	}
+	else
+	{
+		if (tag->keyframe)
+		{
+			gop_.clear();
+			gop_bytes_ = 0;
+			gop_valid_ = true;
+		}
+		if (gop_valid_)
+		{
+			gop_.push_back(tag);
+			gop_bytes_ += tag->bytes.size();
+			if (gop_bytes_ > max_gop_bytes)
+			{
+				gop_.clear();
+				gop_bytes_ = 0;
+				gop_valid_ = false;
+			}
+		}
+	}
+
+	// A handler may unsubscribe its own viewer, which destroys the stored
+	// handler, so the iterator is moved on and the handler copied before
+	// each call.
+	std::map<std::size_t, viewer>::iterator i = viewers_.begin();
+	while (i != viewers_.end())
+	{
+		viewer& v = (i++)->second;
+		if (v.started)
+		{
+			tag_handler handler = v.handler;
+			handler(tag);
+		}
+	}
+}
+
+void live_stream::start_viewer(viewer& v)
+{
+	v.started = true;
+	tag_handler handler = v.handler;
+	handler(header_);
+	if (metadata_)
+	{
+		handler(metadata_);
+	}
+	if (video_config_)
+	{
+		handler(video_config_);
+	}
+	if (audio_config_)
+	{
+		handler(audio_config_);
+	}
+	for (std::size_t i = 0; i < gop_.size(); ++i)
+	{
+		handler(gop_[i]);
+	}
+}
+
+void live_stream::handle_close()
+{
+	closed_ = true;
+	std::map<std::size_t, viewer> viewers;
+	viewers.swap(viewers_);
+	for (std::map<std::size_t, viewer>::iterator i = viewers.begin(); i != viewers.end(); ++i)
+	{
+		i->second.handler(live_tag_ptr());
+	}
+}
+
+} // namespace server
+} // namespace http
@@ -77,10 +77,22 @@ const char crlf[] = { '\r', '\n' };
 
 } // namespace misc_strings
 
+reply::reply()
+	: status(ok), pace_rate(0), pace_burst(0)
+{
+}
+
 std::vector<boost::asio::const_buffer> reply::to_buffers()
 {
 	std::vector<boost::asio::const_buffer> buffers;
-	buffers.push_back(status_strings::to_buffer(status));
+	if (shared_head)
+	{
+		buffers.push_back(boost::asio::buffer(*shared_head));
+	}
+	else
+	{
+		buffers.push_back(status_strings::to_buffer(status));
+	}
 
 	for (std::size_t i = 0; i < headers.size(); ++i)
 	{
@@ -92,10 +104,31 @@ std::vector<boost::asio::const_buffer> reply::to_buffers()
 	}
 
 	buffers.push_back(boost::asio::buffer(misc_strings::crlf));
-	buffers.push_back(boost::asio::buffer(content));
+	if (shared_content)
+	{
+		buffers.push_back(boost::asio::buffer(*shared_content));
+	}
+	else
+	{
+		buffers.push_back(boost::asio::buffer(content));
+	}
 	return buffers;
 }
 
+std::string reply::head_to_string() const
+{
+	boost::asio::const_buffer status_line = status_strings::to_buffer(status);
+	std::string head(boost::asio::buffer_cast<const char*>(status_line), boost::asio::buffer_size(status_line));
+	for (std::size_t i = 0; i < headers.size(); ++i)
+	{
+		head += headers[i].name;
+		head.append(misc_strings::name_value_separator, sizeof(misc_strings::name_value_separator));
+		head += headers[i].value;
+		head.append(misc_strings::crlf, sizeof(misc_strings::crlf));
+	}
+	return head;
+}
+
 namespace stock_replies {
 
 const char ok[] = "";
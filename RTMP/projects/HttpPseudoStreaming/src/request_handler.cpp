@@ -1,5 +1,4 @@
 #include "request_handler.hpp"
-#include <fstream>
 #include <sstream>
 #include <string>
 #include <boost/lexical_cast.hpp>
@@ -10,8 +9,15 @@
 namespace http {
 namespace server {
 
-request_handler::request_handler(const std::string& doc_root)
-	: doc_root_(doc_root)
+namespace {
+
+/// Prefix of the paths of live streams.
+const char live_prefix[] = "/live/";
+
+} // namespace
+
+request_handler::request_handler(const std::string& doc_root, boost::asio::io_service& io_service)
+	: io_service_(io_service), doc_root_(doc_root)
 {
 }
 
@@ -47,29 +53,132 @@ void request_handler::handle_request(const request& req, reply& rep)
 		extension = request_path.substr(last_dot_pos + 1);
 	}
 
-	// Open the file to send back.
+	// Live streams are sent as their tags arrive, with no length, so the end
+	// of the stream is the end of the connection.
 	std::string full_path = doc_root_ + request_path;
-	std::ifstream is(full_path.c_str(), std::ios::in | std::ios::binary);
-	if (!is)
+	const std::size_t live_prefix_size = sizeof(live_prefix) - 1;
+	if (extension == "flv" && request_path.compare(0, live_prefix_size, live_prefix) == 0 && last_slash_pos == live_prefix_size - 1)
 	{
-		rep = reply::stock_reply(reply::not_found);
+		live_stream_ptr stream = find_live(request_path.substr(live_prefix_size, last_dot_pos - live_prefix_size), full_path);
+		if (!stream)
+		{
+			rep = reply::stock_reply(reply::not_found);
+			return;
+		}
+		rep.status = reply::ok;
+		rep.headers.resize(2);
+		rep.headers[0].name = "Content-Type";
+		rep.headers[0].value = mime_types::extension_to_type(extension);
+		rep.headers[1].name = "Cache-Control";
+		rep.headers[1].value = "no-cache";
+		rep.live = stream;
 		return;
 	}
 
-	// Fill out the reply to be sent to the client.
-	rep.status = reply::ok;
-	char buf[512];
-	
-	while (is.read(buf, sizeof(buf)).gcount() > 0)
+	// Small hot files are served from memory without touching the filesystem.
+	if (cache_.find(full_path, rep))
 	{
-		rep.content.append(buf, is.gcount());
+		return;
+	}
+
+	// Open the file to send back, usually already open from an earlier request.
+	open_file_ptr file = files_.acquire(full_path);
+	if (!file)
+	{
+		rep = reply::stock_reply(reply::not_found);
+		return;
 	}
 
+	// Fill out the reply to be sent to the client.
+	rep.status = reply::ok;
 	rep.headers.resize(2);
 	rep.headers[0].name = "Content-Length";
-	rep.headers[0].value = boost::lexical_cast<std::string>(rep.content.size());
+	rep.headers[0].value = boost::lexical_cast<std::string>(file->size());
 	rep.headers[1].name = "Content-Type";
 	rep.headers[1].value = mime_types::extension_to_type(extension);
+
+	// Small files are read now and cached; others are sent from the file as
+	// the client takes them.
+	if (cache_.cacheable(file->size()))
+	{
+		rep.content.resize(static_cast<std::size_t>(file->size()));
+		if (file->size() > 0 && file->read(0, &rep.content[0], rep.content.size()) != file->size())
+		{
+			rep = reply::stock_reply(reply::internal_server_error);
+			return;
+		}
+		cache_.insert(full_path, file->mtime(), file->size(), rep);
+		return;
+	}
+	rep.file = file;
+	if (extension == "flv")
+	{
+		pacer_.pace(full_path, *file, rep);
+	}
+}
+
+file_cache& request_handler::cache()
+{
+	return cache_;
+}
+
+fd_cache& request_handler::files()
+{
+	return files_;
+}
+
+stream_pacer& request_handler::pacer()
+{
+	return pacer_;
+}
+
+live_stream_ptr request_handler::live(const std::string& name)
+{
+	boost::mutex::scoped_lock lock(live_mutex_);
+	live_entry& entry = live_[name];
+	if (!entry.stream)
+	{
+		entry.stream.reset(new live_stream(io_service_));
+	}
+	return entry.stream;
+}
+
+void request_handler::stop_live()
+{
+	boost::mutex::scoped_lock lock(live_mutex_);
+	for (std::map<std::string, live_entry>::iterator i = live_.begin(); i != live_.end(); ++i)
+	{
+		if (i->second.source)
+		{
+			i->second.source->stop();
+		}
+	}
+}
+
+live_stream_ptr request_handler::find_live(const std::string& name, const std::string& path)
+{
+	boost::mutex::scoped_lock lock(live_mutex_);
+	std::map<std::string, live_entry>::iterator i = live_.find(name);
+	if (i != live_.end())
+	{
+		// A file's source stops while nobody watches, and starts again here.
+		if (i->second.source && !i->second.source->start())
+		{
+			live_.erase(i);
+			return live_stream_ptr();
+		}
+		return i->second.stream;
+	}
+
+	live_entry entry;
+	entry.stream.reset(new live_stream(io_service_));
+	entry.source.reset(new live_file_source(io_service_, path, entry.stream));
+	if (!entry.source->start())
+	{
+		return live_stream_ptr();
+	}
+	live_[name] = entry;
+	return entry.stream;
 }
 
 bool request_handler::url_decode(const std::string& in, std::string& out)
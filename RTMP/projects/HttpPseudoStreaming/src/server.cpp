@@ -7,7 +7,7 @@ namespace server {
 
 
 server::server(const std::string& address, const std::string& port, const std::string& doc_root)
-  : io_service_(), acceptor_(io_service_), connection_manager_(), new_connection_(new connection(io_service_, connection_manager_, request_handler_)), request_handler_(doc_root)
+  : io_service_(), log_(), acceptor_(io_service_), connection_manager_(), new_connection_(new connection(io_service_, connection_manager_, request_handler_, log_)), request_handler_(doc_root, io_service_)
 {
 	// Open the acceptor with the option to reuse the address (i.e. SO_REUSEADDR).
 	 boost::asio::ip::tcp::resolver resolver(io_service_);
@@ -21,6 +21,31 @@ server::server(const std::string& address, const std::string& port, const std::s
 }
 
 
+file_cache& server::cache()
+{
+	return request_handler_.cache();
+}
+
+fd_cache& server::files()
+{
+	return request_handler_.files();
+}
+
+stream_pacer& server::pacer()
+{
+	return request_handler_.pacer();
+}
+
+access_log& server::log()
+{
+	return log_;
+}
+
+live_stream_ptr server::live(const std::string& name)
+{
+	return request_handler_.live(name);
+}
+
 void server::run()
 {
 	// The io_service::run() call will block until all asynchronous operations
@@ -42,7 +67,7 @@ void server::handle_accept(const boost::system::error_code& e)
 	if (!e)
 	{
 		connection_manager_.start(new_connection_);
-		new_connection_.reset(new connection(io_service_, connection_manager_, request_handler_));
+		new_connection_.reset(new connection(io_service_, connection_manager_, request_handler_, log_));
 		acceptor_.async_accept(new_connection_->socket(), boost::bind(&server::handle_accept, this, boost::asio::placeholders::error));
 	}
 }
@@ -53,6 +78,7 @@ void server::handle_stop()
 	// operations. Once all operations have finished the io_service::run() call
 	// will exit.
 	acceptor_.close();
+	request_handler_.stop_live();
 	connection_manager_.stop_all();
 }
 
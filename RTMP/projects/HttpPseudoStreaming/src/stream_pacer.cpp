@@ -0,0 +1,417 @@
+#include "stream_pacer.hpp"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <vector>
+#include "reply.hpp"
+
+namespace http {
+namespace server {
+
+namespace {
+
+/// Most of an onMetaData tag that is read. The values wanted come before the
+/// keyframe index some encoders append.
+const std::size_t max_metadata_size = 64 * 1024;
+
+/// Bitrates remembered before all are forgotten.
+const std::size_t max_rates = 4096;
+
+/// Deepest nesting of AMF values followed.
+const int max_amf_depth = 16;
+
+/// The least depth of a token bucket, so that whole writes fit.
+const double min_bucket_depth = 64 * 1024;
+
+/// The values of onMetaData used to tell the bitrate.
+struct flv_metadata
+{
+	flv_metadata()
+		: duration(0), videodatarate(0), audiodatarate(0)
+	{
+	}
+
+	double duration;
+	double videodatarate;
+	double audiodatarate;
+};
+
+boost::uint32_t get_ui16(const unsigned char* p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+boost::uint32_t get_ui24(const unsigned char* p)
+{
+	return (p[0] << 16) | (p[1] << 8) | p[2];
+}
+
+boost::uint32_t get_ui32(const unsigned char* p)
+{
+	return (static_cast<boost::uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+double get_double(const unsigned char* p)
+{
+	boost::uint64_t bits = (static_cast<boost::uint64_t>(get_ui32(p)) << 32) | get_ui32(p + 4);
+	double value;
+	std::memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+bool skip_amf_value(const unsigned char*& p, const unsigned char* end, int depth);
+
+/// Read the properties of an AMF object or ECMA array up to its end marker.
+/// At the top level, the numbers wanted are stored in metadata.
+bool read_amf_properties(const unsigned char*& p, const unsigned char* end, int depth, flv_metadata* metadata)
+{
+	for (;;)
+	{
+		if (end - p < 2)
+		{
+			return false;
+		}
+		std::size_t length = get_ui16(p);
+		p += 2;
+		if (length == 0 && p != end && *p == 9)
+		{
+			++p;
+			return true;
+		}
+		if (static_cast<std::size_t>(end - p) < length)
+		{
+			return false;
+		}
+		std::string name(reinterpret_cast<const char*>(p), length);
+		p += length;
+
+		if (metadata && end - p >= 9 && *p == 0)
+		{
+			double value = get_double(p + 1);
+			if (name == "duration")
+			{
+				metadata->duration = value;
+			}
+			else if (name == "videodatarate")
+			{
+				metadata->videodatarate = value;
+			}
+			else if (name == "audiodatarate")
+			{
+				metadata->audiodatarate = value;
+			}
+		}
+		if (!skip_amf_value(p, end, depth + 1))
+		{
+			return false;
+		}
+	}
+}
+
+/// Move past one AMF0 value.
+bool skip_amf_value(const unsigned char*& p, const unsigned char* end, int depth)
+{
+	if (p == end || depth > max_amf_depth)
+	{
+		return false;
+	}
+	std::size_t size;
+	switch (*p++)
+	{
+		case 0: // Number.
+			size = 8;
+			break;
+		case 1: // Boolean.
+			size = 1;
+			break;
+		case 2: // String.
+			if (end - p < 2)
+			{
+				return false;
+			}
+			size = 2 + get_ui16(p);
+			break;
+		case 3: // Object.
+			return read_amf_properties(p, end, depth, 0);
+		case 5: // Null.
+		case 6: // Undefined.
+			size = 0;
+			break;
+		case 7: // Reference.
+			size = 2;
+			break;
+		case 8: // ECMA array.
+			if (end - p < 4)
+			{
+				return false;
+			}
+			p += 4;
+			return read_amf_properties(p, end, depth, 0);
+		case 10: // Strict array.
+		{
+			if (end - p < 4)
+			{
+				return false;
+			}
+			boost::uint32_t count = get_ui32(p);
+			p += 4;
+			for (boost::uint32_t i = 0; i < count; ++i)
+			{
+				if (!skip_amf_value(p, end, depth + 1))
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+		case 11: // Date.
+			size = 10;
+			break;
+		case 12: // Long string.
+			if (end - p < 4)
+			{
+				return false;
+			}
+			size = 4 + get_ui32(p);
+			break;
+		default:
+			return false;
+	}
+	if (static_cast<std::size_t>(end - p) < size)
+	{
+		return false;
+	}
+	p += size;
+	return true;
+}
+
+/// Read what is wanted from an onMetaData script tag body.
+void read_metadata(const unsigned char* p, const unsigned char* end, flv_metadata& metadata)
+{
+	static const char name[] = "onMetaData";
+	const std::size_t name_length = sizeof(name) - 1;
+	if (static_cast<std::size_t>(end - p) < 3 + name_length || p[0] != 2 || get_ui16(p + 1) != name_length
+		|| std::memcmp(p + 3, name, name_length) != 0)
+	{
+		return;
+	}
+	p += 3 + name_length;
+	if (p == end)
+	{
+		return;
+	}
+	if (*p == 8 && end - p >= 5)
+	{
+		p += 5;
+	}
+	else if (*p == 3)
+	{
+		++p;
+	}
+	else
+	{
+		return;
+	}
+
+	// A truncated tag still yields the values that came before the cut.
+	read_amf_properties(p, end, 0, &metadata);
+}
+
+/// The bitrate of an FLV file in bytes per second, or 0 if it cannot be told.
+double flv_bitrate(const open_file& file)
+{
+	unsigned char header[9];
+	if (file.read(0, reinterpret_cast<char*>(header), sizeof(header)) != sizeof(header)
+		|| header[0] != 'F' || header[1] != 'L' || header[2] != 'V')
+	{
+		return 0;
+	}
+	boost::uint64_t size = file.size();
+
+	// The first tag follows the header and a zero PreviousTagSize.
+	boost::uint64_t first_tag = get_ui32(header + 5) + 4;
+	unsigned char tag[11];
+	if (file.read(first_tag, reinterpret_cast<char*>(tag), sizeof(tag)) == sizeof(tag) && tag[0] == 18)
+	{
+		std::vector<unsigned char> data(std::min<std::size_t>(get_ui24(tag + 1), max_metadata_size));
+		if (!data.empty())
+		{
+			std::size_t length = file.read(first_tag + sizeof(tag), reinterpret_cast<char*>(&data[0]), data.size());
+			flv_metadata metadata;
+			read_metadata(&data[0], &data[0] + length, metadata);
+			if (metadata.videodatarate + metadata.audiodatarate > 0)
+			{
+				// Data rates are given in kilobits per second.
+				return (metadata.videodatarate + metadata.audiodatarate) * 1000 / 8;
+			}
+			if (metadata.duration > 0)
+			{
+				return size / metadata.duration;
+			}
+		}
+	}
+
+	// Otherwise the file ends with the size of its last tag, whose timestamp
+	// is the duration.
+	unsigned char trailer[4];
+	if (size < first_tag + sizeof(tag) + sizeof(trailer)
+		|| file.read(size - sizeof(trailer), reinterpret_cast<char*>(trailer), sizeof(trailer)) != sizeof(trailer))
+	{
+		return 0;
+	}
+	boost::uint32_t last_size = get_ui32(trailer);
+	if (last_size < sizeof(tag) || last_size > size - sizeof(trailer) - first_tag)
+	{
+		return 0;
+	}
+	if (file.read(size - sizeof(trailer) - last_size, reinterpret_cast<char*>(tag), sizeof(tag)) != sizeof(tag)
+		|| get_ui24(tag + 1) + sizeof(tag) != last_size)
+	{
+		return 0;
+	}
+	boost::uint32_t timestamp = get_ui24(tag + 4) | (tag[7] << 24);
+	if (timestamp == 0)
+	{
+		return 0;
+	}
+	return size * 1000.0 / timestamp;
+}
+
+} // namespace
+
+token_bucket::token_bucket()
+	: rate_(0), depth_(0), tokens_(0)
+{
+}
+
+void token_bucket::reset(double rate, double initial, double depth)
+{
+	rate_ = rate;
+	tokens_ = initial;
+	depth_ = depth;
+	updated_ = boost::posix_time::ptime();
+}
+
+bool token_bucket::limited() const
+{
+	return rate_ > 0;
+}
+
+std::size_t token_bucket::available(const boost::posix_time::ptime& now)
+{
+	if (!limited())
+	{
+		return (std::numeric_limits<std::size_t>::max)();
+	}
+	if (!updated_.is_not_a_date_time())
+	{
+		// An initial burst beyond the depth is used up before refilling.
+		double elapsed = (now - updated_).total_microseconds() / 1000000.0;
+		tokens_ = std::min(tokens_ + elapsed * rate_, std::max(tokens_, depth_));
+	}
+	updated_ = now;
+	return tokens_ > 0 ? static_cast<std::size_t>(tokens_) : 0;
+}
+
+void token_bucket::consume(std::size_t bytes)
+{
+	if (limited())
+	{
+		tokens_ -= bytes;
+	}
+}
+
+boost::posix_time::time_duration token_bucket::wait_for(std::size_t bytes) const
+{
+	if (!limited() || tokens_ >= bytes)
+	{
+		return boost::posix_time::time_duration();
+	}
+	return boost::posix_time::microseconds(static_cast<long>((bytes - tokens_) / rate_ * 1000000) + 1);
+}
+
+stream_pacer::stream_pacer()
+	: enabled_(false), burst_(10), multiplier_(1.25)
+{
+}
+
+void stream_pacer::set_enabled(bool enabled)
+{
+	enabled_ = enabled;
+}
+
+void stream_pacer::set_burst(double seconds)
+{
+	burst_ = seconds;
+}
+
+void stream_pacer::set_rate_multiplier(double multiplier)
+{
+	multiplier_ = multiplier;
+}
+
+void stream_pacer::set_total_cap(double bytes_per_second)
+{
+	total_.reset(bytes_per_second, bytes_per_second, std::max(bytes_per_second, min_bucket_depth));
+}
+
+void stream_pacer::pace(const std::string& path, const open_file& file, reply& rep)
+{
+	if (!enabled_)
+	{
+		return;
+	}
+	double rate = bitrate(path, file);
+	if (rate > 0)
+	{
+		rep.pace_rate = rate * multiplier_;
+		rep.pace_burst = static_cast<boost::uint64_t>(rate * burst_);
+	}
+}
+
+std::size_t stream_pacer::take_total(std::size_t wanted, std::size_t minimum)
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	std::size_t bytes = std::min(wanted, total_.available(boost::posix_time::microsec_clock::universal_time()));
+	if (bytes < minimum)
+	{
+		return 0;
+	}
+	total_.consume(bytes);
+	return bytes;
+}
+
+boost::posix_time::time_duration stream_pacer::total_wait(std::size_t bytes)
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	return total_.wait_for(bytes);
+}
+
+double stream_pacer::bitrate(const std::string& path, const open_file& file)
+{
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		std::map<std::string, rate_entry>::iterator i = rates_.find(path);
+		if (i != rates_.end() && i->second.mtime == file.mtime() && i->second.size == file.size())
+		{
+			return i->second.bitrate;
+		}
+	}
+
+	// The file is read without holding the lock.
+	rate_entry e;
+	e.mtime = file.mtime();
+	e.size = file.size();
+	e.bitrate = flv_bitrate(file);
+
+	boost::mutex::scoped_lock lock(mutex_);
+	if (rates_.size() >= max_rates)
+	{
+		rates_.clear();
+	}
+	rates_[path] = e;
+	return e.bitrate;
+}
+
+} // namespace server
+} // namespace http
@@ -1,4 +1,5 @@
 #include <iostream>
+#include <cstdlib>
 #include <string>
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
@@ -24,15 +25,80 @@ BOOL WINAPI console_ctrl_handler(DWORD ctrl_type)
 	}
 }
 
+namespace {
+
+/// Parse text as a number, failing unless all of it is used.
+bool parse_number(const char* text, double& value)
+{
+	char* end = 0;
+	value = std::strtod(text, &end);
+	return end != text && *end == 0;
+}
+
+/// Apply the pacing options given on the command line.
+void configure_pacer(http::server::stream_pacer& pacer, bool pace, double burst, double multiplier, double total_cap)
+{
+	pacer.set_enabled(pace);
+	if (burst >= 0)
+	{
+		pacer.set_burst(burst);
+	}
+	if (multiplier > 0)
+	{
+		pacer.set_rate_multiplier(multiplier);
+	}
+	pacer.set_total_cap(total_cap);
+}
+
+} // namespace
+
 int main(int argc, char* argv[])
 {
 	try
 	{
-		//TODO: ver de hacer esto con una clase que maneje los parametros del programa
 		// Check command line arguments.
-		if (argc != 4)
+		std::string access_log;
+		bool pace = false;
+		double burst = -1;
+		double multiplier = 0;
+		double total_cap = 0;
+		bool usage = argc < 4;
+		for (int i = 4; i < argc && !usage; ++i)
 		{
-			std::cerr << "Usage: http_server <address> <port> <doc_root>\n";
+			std::string arg = argv[i];
+			if (arg == "--pace")
+			{
+				pace = true;
+			}
+			else if (arg == "--burst" && i + 1 < argc)
+			{
+				usage = !parse_number(argv[++i], burst) || burst < 0;
+			}
+			else if (arg == "--rate" && i + 1 < argc)
+			{
+				usage = !parse_number(argv[++i], multiplier) || multiplier <= 0;
+			}
+			else if (arg == "--total-cap" && i + 1 < argc)
+			{
+				usage = !parse_number(argv[++i], total_cap) || total_cap < 0;
+			}
+			else if (i == 4 && arg.compare(0, 2, "--") != 0)
+			{
+				access_log = arg;
+			}
+			else
+			{
+				usage = true;
+			}
+		}
+		if (usage)
+		{
+			std::cerr << "Usage: http_server <address> <port> <doc_root> [<access_log>] [--pace]\n";
+			std::cerr << "         [--burst <seconds>] [--rate <multiplier>] [--total-cap <bytes/s>]\n";
+			std::cerr << "  --pace       send FLV files at a multiple of their bitrate\n";
+			std::cerr << "  --burst      seconds of video sent before pacing starts\n";
+			std::cerr << "  --rate       the multiple of a file's bitrate it is paced at\n";
+			std::cerr << "  --total-cap  bytes per second for all file bodies together\n";
 			std::cerr << "  For IPv4, try:\n";
 			std::cerr << "    http_server 0.0.0.0 80 .\n";
 			std::cerr << "  For IPv6, try:\n";
@@ -46,6 +112,11 @@ int main(int argc, char* argv[])
 
 		// Initialise server.
 		http::server::server s(address, port, docRoot);
+		if (!access_log.empty())
+		{
+			s.log().open(access_log);
+		}
+		configure_pacer(s.pacer(), pace, burst, multiplier, total_cap);
 
 		// Set console control handler to allow server to be stopped.
 		console_ctrl_function = boost::bind(&http::server::server::stop, &s);
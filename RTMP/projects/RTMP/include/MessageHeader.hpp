@@ -0,0 +1,47 @@
+#ifndef MESSAGE_HEADER_HPP
+#define MESSAGE_HEADER_HPP
+
+#include <string>
+#include <boost/cstdint.hpp>
+
+namespace http {
+namespace server {
+
+/// The header shared by every RTMP message, independent of how it was chunked.
+struct message_header
+{
+	/// Absolute timestamp in milliseconds.
+	unsigned int timestamp;
+
+	/// Length of the payload in bytes.
+	unsigned int length;
+
+	/// Message type id (constants::TYPE_*).
+	unsigned char type_id;
+
+	/// Message stream id.
+	unsigned int stream_id;
+};
+
+/// A complete RTMP message, reassembled from one or more chunks.
+struct message
+{
+	message_header header;
+
+	/// The chunk stream the message arrived on.
+	unsigned int chunk_stream_id;
+
+	/// The message payload.
+	std::string payload;
+
+	/// When the first chunk of the message arrived (monotonic microseconds).
+	boost::uint64_t received;
+
+	/// When the last chunk of the message arrived (monotonic microseconds).
+	boost::uint64_t completed;
+};
+
+} // namespace server
+} // namespace http
+
+#endif // MESSAGE_HEADER_HPP
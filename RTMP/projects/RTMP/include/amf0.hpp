@@ -0,0 +1,90 @@
+#ifndef AMF0_HPP
+#define AMF0_HPP
+
+#include <string>
+
+namespace http {
+namespace server {
+namespace amf0 {
+
+/// Big endian 16 bit integer at p.
+inline unsigned int get_ui16(const char* p)
+{
+	const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+	return (u[0] << 8) | u[1];
+}
+
+/// Big endian 32 bit integer at p.
+inline unsigned int get_ui32(const char* p)
+{
+	const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+	return (u[0] << 24) | (u[1] << 16) | (u[2] << 8) | u[3];
+}
+
+/// Append a big endian 16 bit integer.
+inline void put_ui16(std::string& out, unsigned int value)
+{
+	out += static_cast<char>(value >> 8);
+	out += static_cast<char>(value);
+}
+
+/// Append a big endian 32 bit integer.
+inline void put_ui32(std::string& out, unsigned int value)
+{
+	out += static_cast<char>(value >> 24);
+	out += static_cast<char>(value >> 16);
+	out += static_cast<char>(value >> 8);
+	out += static_cast<char>(value);
+}
+
+/// Append a UTF-8 string with a 16 bit length prefix (no type marker).
+inline void put_utf(std::string& out, const std::string& value)
+{
+	put_ui16(out, static_cast<unsigned int>(value.size()));
+	out += value;
+}
+
+/// Append a string value (type marker 0x02).
+inline void put_string(std::string& out, const std::string& value)
+{
+	out += static_cast<char>(0x02);
+	put_utf(out, value);
+}
+
+/// Append a number value (type marker 0x00).
+void put_number(std::string& out, double value);
+
+/// Append the end of an object's properties. An object is written as the
+/// 0x03 marker, then put_utf names each followed by a value, then this.
+inline void put_object_end(std::string& out)
+{
+	put_ui16(out, 0);
+	out += static_cast<char>(0x09);
+}
+
+/// Read a UTF-8 string with a 16 bit length prefix (no type marker). Returns
+/// false if it does not fit in the remaining input.
+bool read_utf(const char*& p, const char* end, std::string& value);
+
+/// Read a string value (type marker 0x02).
+bool read_string(const char*& p, const char* end, std::string& value);
+
+/// Read a number value (type marker 0x00).
+bool read_number(const char*& p, const char* end, double& value);
+
+/// Advance p past one encoded value of any type.
+bool skip_value(const char*& p, const char* end);
+
+/// Read an object value (type marker 0x03) and look for a string property
+/// called name. Returns false if the object is malformed or has no such string
+/// property; p is left after the object either way if it was well formed.
+bool find_string_property(const char*& p, const char* end, const std::string& name, std::string& value);
+
+/// As find_string_property, for a number property.
+bool find_number_property(const char*& p, const char* end, const std::string& name, double& value);
+
+} // namespace amf0
+} // namespace server
+} // namespace http
+
+#endif // AMF0_HPP
@@ -6,11 +6,19 @@
 #include <boost/noncopyable.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/enable_shared_from_this.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <deque>
+#include <vector>
 #include "reply.hpp"
 #include "request.hpp"
 #include "request_handler.hpp"
-//#include "request_parser.hpp"
-#include "handshake_manager.hpp"
+#include "request_parser.hpp"
+#include "delivery_policy.hpp"
+#include "latency_stats.hpp"
+#include "rtmp_session.hpp"
+#include "rtmpt.hpp"
+#include "session_trace.hpp"
+#include "shared_object.hpp"
 
 namespace http {
 namespace server {
@@ -19,12 +27,13 @@ class connection_manager;
 
 /// Represents a single connection from a client.
 
-class connection : public boost::enable_shared_from_this<connection>, private boost::noncopyable
+class connection : public boost::enable_shared_from_this<connection>, public rtmp_session::transport, private boost::noncopyable
 {
 public:
 	/// Construct a connection with the given io_service.
 	explicit connection(boost::asio::io_service& io_service,
-	connection_manager& manager, request_handler& handler);
+	connection_manager& manager, request_handler& handler, shared_object_store& shared_objects, latency_stats& stats,
+	const delivery_policy_map& policies, rtmpt_manager& rtmpt);
 
 	/// Get the socket associated with the connection.
 	boost::asio::ip::tcp::socket& socket();
@@ -35,14 +44,55 @@ public:
 	/// Stop all asynchronous operations associated with the connection.
 	void stop();
 
+	/// Record every inbound byte to a trace file at path. Must be called
+	/// before start().
+	void record_to(const std::string& path);
+
+	/// Queue already chunked data for sending. Queued buffers are written in
+	/// order, gathered into as few writes as possible. A peer that lets too
+	/// much pile up is disconnected.
+	void send(const boost::shared_ptr<const std::string>& data);
+
+	/// Queue data produced from input that arrived at time received. The delay
+	/// until it has been handed to the kernel is recorded in stats.
+	virtual void send(const boost::shared_ptr<const std::string>& data, boost::uint64_t received, latency_stats::stream_stats* stats);
+
+	/// Apply a delivery policy to the socket.
+	virtual void apply_policy(const delivery_policy& policy);
+
+	/// The peer's address and port.
+	virtual std::string peer_name();
+
 private:
 	/// Handle completion of a read operation.
 	void handle_read(const boost::system::error_code& e,
 	std::size_t bytes_transferred);
 
-	/// Handle completion of a write operation.
+	/// Handle completion of writing an HTTP reply.
 	void handle_write(const boost::system::error_code& e);
 
+	/// Handle completion of writing queued data.
+	void handle_send(const boost::system::error_code& e);
+
+	/// Start writing everything in the outbound queue.
+	void write_queued();
+
+	/// Feed received bytes to the HTTP request parser.
+	void process_http(const char* begin, const char* end);
+
+	/// Parse buffered HTTP input and answer the request once it is complete,
+	/// body included.
+	void handle_http_input();
+
+	/// Resize the send buffer to follow the observed outbound bitrate.
+	void update_send_buffer(std::size_t bytes_written);
+
+	/// Continue reading from the socket.
+	void read_more();
+
+	/// The io_service the connection runs on.
+	boost::asio::io_service& io_service_;
+
 	/// Socket for the connection.
 	boost::asio::ip::tcp::socket socket_;
 
@@ -52,6 +102,32 @@ private:
 	/// The handler used to process the incoming request.
 	request_handler& request_handler_;
 
+	/// Where latencies and queue depths are recorded.
+	latency_stats& stats_;
+
+	/// The RTMPT sessions, served to HTTP clients.
+	rtmpt_manager& rtmpt_;
+
+	/// The policy in force, chosen when the client connects.
+	delivery_policy policy_;
+
+	/// Start of the current bitrate measurement window.
+	boost::uint64_t window_start_;
+
+	/// Bytes written during the current measurement window.
+	std::size_t window_bytes_;
+
+	/// The send buffer size last applied, 0 if never changed.
+	std::size_t send_buffer_size_;
+
+	/// The protocol spoken by the peer, decided by its first byte.
+	enum protocol
+	{
+		unknown_protocol,
+		rtmp_protocol,
+		http_protocol
+	} protocol_;
+
 	/// Buffer for incoming data.
 	boost::array<char, 8192> buffer_;
 
@@ -60,8 +136,45 @@ private:
 
 	
 	/// The parser for the incoming request.
-	//request_parser request_parser_;
-	handshakeManager  handshakeManager_;
+	request_parser request_parser_;
+
+	/// HTTP input received but not yet consumed, e.g. a pipelined request.
+	std::string http_input_;
+
+	/// Whether the headers of request_ have been parsed.
+	bool headers_complete_;
+
+	/// Length of the body of request_.
+	std::size_t content_length_;
+
+	/// Whether the connection stays open after the current reply.
+	bool keep_alive_;
+
+	/// The RTMP engine for this connection.
+	rtmp_session session_;
+
+	/// Queued data, with what is needed to account for it once written.
+	struct outbound_item
+	{
+		boost::shared_ptr<const std::string> data;
+		boost::uint64_t received;
+		latency_stats::stream_stats* stats;
+	};
+
+	/// Data waiting to be written.
+	std::deque<outbound_item> outbound_;
+
+	/// Data being written by the outstanding write, kept alive until it completes.
+	std::vector<outbound_item> sending_;
+
+	/// Bytes in outbound_ and sending_.
+	std::size_t queued_bytes_;
+
+	/// Whether the queue outgrew its bound and the connection is closing.
+	bool overflowed_;
+
+	/// Optional recorder of inbound bytes.
+	boost::scoped_ptr<trace_writer> trace_;
 
 
 	/// The reply to be sent back to the client.
@@ -1,5 +1,10 @@
 //package org.red5.server.net.rtmp.message;
 
+#ifndef CONSTANTS_HPP
+#define CONSTANTS_HPP
+
+typedef unsigned char byte;
+
 /**
  * Class for AMF and RTMP marker values constants
  */
@@ -171,31 +176,36 @@ struct constants
      * Shared Object attribute deletion flag
      */
     static const byte SO_DELETE_ATTRIBUTE = 0x0A;
+};
 
-	static const String ACTION_CONNECT = "connect";
+/**
+ * Invoke action names. These live outside 'constants' because only integral
+ * static members can be initialised in-class.
+ */
+const char* const ACTION_CONNECT = "connect";
 
-	static const String ACTION_DISCONNECT = "disconnect";
+const char* const ACTION_DISCONNECT = "disconnect";
 
-	static const String ACTION_CREATE_STREAM = "createStream";
+const char* const ACTION_CREATE_STREAM = "createStream";
 
-	static const String ACTION_DELETE_STREAM = "deleteStream";
+const char* const ACTION_DELETE_STREAM = "deleteStream";
 
-	static const String ACTION_CLOSE_STREAM = "closeStream";
+const char* const ACTION_CLOSE_STREAM = "closeStream";
 
-	static const String ACTION_RELEASE_STREAM = "releaseStream";
+const char* const ACTION_RELEASE_STREAM = "releaseStream";
 
-	static const String ACTION_PUBLISH = "publish";
+const char* const ACTION_PUBLISH = "publish";
 
-	static const String ACTION_PAUSE = "pause";
+const char* const ACTION_PAUSE = "pause";
 
-	static const String ACTION_SEEK = "seek";
+const char* const ACTION_SEEK = "seek";
 
-	static const String ACTION_PLAY = "play";
+const char* const ACTION_PLAY = "play";
 
-	static const String ACTION_STOP = "disconnect";
+const char* const ACTION_STOP = "disconnect";
 
-	static const String ACTION_RECEIVE_VIDEO = "receiveVideo";
+const char* const ACTION_RECEIVE_VIDEO = "receiveVideo";
 
-	static const String ACTION_RECEIVE_AUDIO = "receiveAudio";
+const char* const ACTION_RECEIVE_AUDIO = "receiveAudio";
 
-}
+#endif // CONSTANTS_HPP
@@ -0,0 +1,92 @@
+#ifndef DELIVERY_POLICY_HPP
+#define DELIVERY_POLICY_HPP
+
+#include <cstdlib>
+#include <map>
+#include <string>
+
+namespace http {
+namespace server {
+
+/// How a connection trades throughput for latency. The policy is chosen by
+/// the application named in the client's connect command.
+struct delivery_policy
+{
+	/// The default favours throughput and leaves the socket alone.
+	delivery_policy()
+		: low_latency(false), notsent_lowat(0), send_buffer_seconds(0)
+	{
+	}
+
+	/// Set TCP_NODELAY and write each queued message on its own rather than
+	/// gathering everything queued into one write.
+	bool low_latency;
+
+	/// Limit on unsent bytes held in the kernel (TCP_NOTSENT_LOWAT), so stale
+	/// data stays in our queue where it can still be dropped. 0 leaves the
+	/// system default. Ignored where the option does not exist.
+	std::size_t notsent_lowat;
+
+	/// Size SO_SNDBUF to this many seconds of the connection's observed
+	/// outbound bitrate. 0 leaves the system default.
+	double send_buffer_seconds;
+};
+
+/// Delivery policies by application name.
+typedef std::map<std::string, delivery_policy> delivery_policy_map;
+
+/// Parse a policy given on the command line as
+/// "<application>:<option>[,<option>...]", where an option is one of
+/// "low_latency", "notsent_lowat=<bytes>" and "send_buffer_seconds=<seconds>".
+/// Returns false if spec is malformed.
+inline bool parse_delivery_policy(const std::string& spec, std::string& application, delivery_policy& policy)
+{
+	std::string::size_type colon = spec.find(':');
+	if (colon == std::string::npos || colon == 0)
+	{
+		return false;
+	}
+	application = spec.substr(0, colon);
+	policy = delivery_policy();
+
+	std::string::size_type begin = colon + 1;
+	while (begin <= spec.size())
+	{
+		std::string::size_type end = spec.find(',', begin);
+		if (end == std::string::npos)
+		{
+			end = spec.size();
+		}
+		std::string option = spec.substr(begin, end - begin);
+		std::string::size_type equals = option.find('=');
+		std::string value = equals == std::string::npos ? "" : option.substr(equals + 1);
+		char* rest = 0;
+		if (option == "low_latency")
+		{
+			policy.low_latency = true;
+		}
+		else if (option.compare(0, equals, "notsent_lowat") == 0 && !value.empty())
+		{
+			policy.notsent_lowat = std::strtoul(value.c_str(), &rest, 10);
+		}
+		else if (option.compare(0, equals, "send_buffer_seconds") == 0 && !value.empty())
+		{
+			policy.send_buffer_seconds = std::strtod(value.c_str(), &rest);
+		}
+		else
+		{
+			return false;
+		}
+		if (rest && *rest != '\0')
+		{
+			return false;
+		}
+		begin = end + 1;
+	}
+	return true;
+}
+
+} // namespace server
+} // namespace http
+
+#endif // DELIVERY_POLICY_HPP
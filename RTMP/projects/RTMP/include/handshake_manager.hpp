@@ -1,83 +1,78 @@
 #ifndef HANDSHAKE_MANAGER_HPP
 #define HANDSHAKE_MANAGER_HPP
 
+#include <boost/array.hpp>
 #include <boost/logic/tribool.hpp>
 #include <boost/tuple/tuple.hpp>
+#include "constants.hpp"
 
 namespace http {
 namespace server {
 
 
-//TODO: comment /// 
+/// Parser for the client side of the RTMP handshake (C0, C1 and C2). Once C0
+/// and C1 have arrived the server reply (S0, S1 and S2) is available.
 class handshakeManager
 {
 public:
-	/// Construct ready to parse the request method.
+	/// Construct ready to parse the protocol version.
 	handshakeManager();
 
 	/// Reset to initial parser state.
 	void reset();
 
-	/// Parse some data. The tribool return value is true when a complete request
-	/// has been parsed, false if the data is invalid, indeterminate when more
-	/// data is required. The InputIterator return value indicates how much of the
-	/// input has been consumed.
-	//template <typename InputIterator>
-	//boost::tuple<boost::tribool, InputIterator> parse(request& req, InputIterator begin, InputIterator end)
-	//{
-	//	while (begin != end)
-	//	{
-	//		boost::tribool result = consume(req, *begin++);
-	//		if (result || !result)
-	//		{
-	//			return boost::make_tuple(result, begin);
-	//		}
-	//	}
-	//	boost::tribool result = boost::indeterminate;
-	//	return boost::make_tuple(result, begin);
-	//}
+	/// Parse some data. The tribool return value is true when the handshake has
+	/// completed, false if the data is invalid, indeterminate when more data is
+	/// required. The InputIterator return value indicates how much of the input
+	/// has been consumed.
+	template <typename InputIterator>
+	boost::tuple<boost::tribool, InputIterator> parse(InputIterator begin, InputIterator end)
+	{
+		while (begin != end)
+		{
+			boost::tribool result = consume(*begin++);
+			if (result || !result)
+			{
+				return boost::make_tuple(result, begin);
+			}
+		}
+		boost::tribool result = boost::indeterminate;
+		return boost::make_tuple(result, begin);
+	}
 
-private:
-	/// Handle the next character of input.
-	//boost::tribool consume(request& req, char input);
+	/// True once C0 and C1 have been received and reply() may be sent.
+	bool reply_ready() const;
+
+	/// True once C2 has been received.
+	bool complete() const;
 
-	/// Check if a byte is an HTTP character.
-	static bool is_char(int c);
+	/// The server reply (S0 + S1 + S2). Only valid once reply_ready() is true.
+	const boost::array<char, 1 + 2 * constants::HANDSHAKE_SIZE>& reply() const;
 
-	/// Check if a byte is an HTTP control character.
-	static bool is_ctl(int c);
+private:
+	/// Handle the next byte of input.
+	boost::tribool consume(char input);
 
-	/// Check if a byte is defined as an HTTP tspecial character.
-	static bool is_tspecial(int c);
+	/// Build S0, S1 and S2 from the received C1.
+	void build_reply();
 
-	/// Check if a byte is a digit.
-	static bool is_digit(int c);
+	/// The RTMP protocol version we speak.
+	static const char protocol_version = 0x03;
 
 	/// The current state of the parser.
 	enum state
 	{
-		method_start,
-		method,
-		uri_start,
-		uri,
-		http_version_h,
-		http_version_t_1,
-		http_version_t_2,
-		http_version_p,
-		http_version_slash,
-		http_version_major_start,
-		http_version_major,
-		http_version_minor_start,
-		http_version_minor,
-		expecting_newline_1,
-		header_line_start,
-		header_lws,
-		header_name,
-		space_before_header_value,
-		header_value,
-		expecting_newline_2,
-		expecting_newline_3
+		version,
+		client_signature,
+		client_echo,
+		established
 	} state_;
+
+	/// Bytes of the current handshake block received so far.
+	std::size_t position_;
+
+	/// The server reply, S2 being an echo of C1.
+	boost::array<char, 1 + 2 * constants::HANDSHAKE_SIZE> reply_;
 };
 
 } // namespace server
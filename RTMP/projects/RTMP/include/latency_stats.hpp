@@ -0,0 +1,131 @@
+#ifndef LATENCY_STATS_HPP
+#define LATENCY_STATS_HPP
+
+#include <map>
+#include <string>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace http {
+namespace server {
+
+/// A histogram with logarithmic buckets, each power of two being split into
+/// 16 linear sub-buckets, so every recorded value is kept to within about 6%
+/// over the full 64 bit range in fixed memory.
+class latency_histogram
+{
+public:
+	latency_histogram();
+
+	/// Add one value (microseconds).
+	void record(boost::uint64_t value);
+
+	/// Number of values recorded.
+	boost::uint64_t count() const;
+
+	/// Smallest value recorded, 0 if empty.
+	boost::uint64_t min() const;
+
+	/// Largest value recorded, 0 if empty.
+	boost::uint64_t max() const;
+
+	/// Arithmetic mean, 0 if empty.
+	boost::uint64_t mean() const;
+
+	/// The value below which the given percentage (0-100) of values fall.
+	boost::uint64_t percentile(double percent) const;
+
+private:
+	/// Number of buckets needed to cover 64 bit values.
+	enum { bucket_count = 32 + 59 * 16 };
+
+	/// Map a value to its bucket.
+	static std::size_t bucket_index(boost::uint64_t value);
+
+	/// The largest value that maps to a bucket.
+	static boost::uint64_t bucket_value(std::size_t index);
+
+	boost::uint64_t counts_[bucket_count];
+	boost::uint64_t count_;
+	boost::uint64_t min_;
+	boost::uint64_t max_;
+	boost::uint64_t sum_;
+};
+
+/// Per stream latency histograms and queue depth gauges.
+///
+/// Recording happens on the io_service thread; snapshot() and report() may be
+/// called from any thread.
+///
+/// Names come from clients, so the number of streams is limited. Once the
+/// limit is reached, any new name shares the single entry overflow_name.
+class latency_stats
+  : private boost::noncopyable
+{
+public:
+	/// Most streams kept by name.
+	enum { max_streams = 256 };
+
+	/// Name of the entry that streams past the limit are counted under.
+	static const char* const overflow_name;
+
+	/// Everything measured for one stream.
+	struct stream_stats
+	{
+		stream_stats();
+
+		/// Time from the first chunk of a message arriving to the message being
+		/// complete in the chunk parser.
+		latency_histogram reassembly;
+
+		/// Time from a message arriving to the last byte of it (or of what it
+		/// produced) being handed to the kernel for one subscriber.
+		latency_histogram delivery;
+
+		/// Messages and bytes currently queued for subscribers.
+		boost::uint64_t queued_messages;
+		boost::uint64_t queued_bytes;
+
+		/// High-water marks of the queue gauges.
+		boost::uint64_t max_queued_messages;
+		boost::uint64_t max_queued_bytes;
+	};
+
+	typedef std::map<std::string, stream_stats> stream_map;
+
+	/// Find or create the statistics for a stream, or the overflow entry if
+	/// the limit has been reached. The reference stays valid for the lifetime
+	/// of this object.
+	stream_stats& stream(const std::string& name);
+
+	/// Record the reassembly time of a message.
+	void record_reassembly(stream_stats& stats, boost::uint64_t microseconds);
+
+	/// Record the delivery time of a message to one subscriber.
+	void record_delivery(stream_stats& stats, boost::uint64_t microseconds);
+
+	/// A message of the given size was queued for a subscriber.
+	void enqueued(stream_stats& stats, std::size_t bytes);
+
+	/// A queued message of the given size was handed to the kernel.
+	void dequeued(stream_stats& stats, std::size_t bytes);
+
+	/// A copy of all statistics.
+	stream_map snapshot() const;
+
+	/// A plain text report of all statistics, one line per stream and metric.
+	std::string report() const;
+
+private:
+	/// Protects streams_.
+	mutable boost::mutex mutex_;
+
+	/// Statistics by stream name.
+	stream_map streams_;
+};
+
+} // namespace server
+} // namespace http
+
+#endif // LATENCY_STATS_HPP
@@ -0,0 +1,36 @@
+#ifndef MONOTONIC_CLOCK_HPP
+#define MONOTONIC_CLOCK_HPP
+
+#include <boost/cstdint.hpp>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+namespace http {
+namespace server {
+
+/// Microseconds elapsed on a clock that never jumps backwards. Only the
+/// difference between two readings is meaningful.
+inline boost::uint64_t monotonic_microseconds()
+{
+#if defined(_WIN32)
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return static_cast<boost::uint64_t>(counter.QuadPart / frequency.QuadPart) * 1000000
+		+ static_cast<boost::uint64_t>(counter.QuadPart % frequency.QuadPart) * 1000000 / frequency.QuadPart;
+#else
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<boost::uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+} // namespace server
+} // namespace http
+
+#endif // MONOTONIC_CLOCK_HPP
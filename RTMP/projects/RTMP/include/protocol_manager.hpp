@@ -1,86 +1,76 @@
-//#ifndef PROTOCOL_MANAGER_HPP
-//#define PROTOCOL_MANAGER_HPP
-//
-//#include <boost/logic/tribool.hpp>
-//#include <boost/tuple/tuple.hpp>
-//
-//namespace http {
-//namespace server {
-//
-//
-////TODO: comment ... ///
-//class protocolManager
-//{
-//public:
-//	/// Construct ready to parse the request method.
-//	protocolManager();
-//
-//	/// Reset to initial parser state.
-//	void reset();
-//
-//	/// Parse some data. The tribool return value is true when a complete request
-//	/// has been parsed, false if the data is invalid, indeterminate when more
-//	/// data is required. The InputIterator return value indicates how much of the
-//	/// input has been consumed.
-//	template <typename InputIterator>
-//	boost::tuple<boost::tribool, InputIterator> parse(request& req, InputIterator begin, InputIterator end)
-//	{
-//		while (begin != end)
-//		{
-//			boost::tribool result = consume(req, *begin++);
-//			if (result || !result)
-//			{
-//				return boost::make_tuple(result, begin);
-//			}
-//		}
-//		boost::tribool result = boost::indeterminate;
-//		return boost::make_tuple(result, begin);
-//	}
-//
-//private:
-//	/// Handle the next character of input.
-//	boost::tribool consume(request& req, char input);
-//
-//	/// Check if a byte is an HTTP character.
-//	static bool is_char(int c);
-//
-//	/// Check if a byte is an HTTP control character.
-//	static bool is_ctl(int c);
-//
-//	/// Check if a byte is defined as an HTTP tspecial character.
-//	static bool is_tspecial(int c);
-//
-//	/// Check if a byte is a digit.
-//	static bool is_digit(int c);
-//
-//	/// The current state of the parser.
-//	enum state
-//	{
-//		method_start,
-//		method,
-//		uri_start,
-//		uri,
-//		http_version_h,
-//		http_version_t_1,
-//		http_version_t_2,
-//		http_version_p,
-//		http_version_slash,
-//		http_version_major_start,
-//		http_version_major,
-//		http_version_minor_start,
-//		http_version_minor,
-//		expecting_newline_1,
-//		header_line_start,
-//		header_lws,
-//		header_name,
-//		space_before_header_value,
-//		header_value,
-//		expecting_newline_2,
-//		expecting_newline_3
-//	} state_;
-//};
-//
-//} // namespace server
-//} // namespace http
-//
-//#endif // PROTOCOL_MANAGER_HPP
+#ifndef PROTOCOL_MANAGER_HPP
+#define PROTOCOL_MANAGER_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/logic/tribool.hpp>
+#include "MessageHeader.hpp"
+
+namespace http {
+namespace server {
+
+
+/// Parser for the RTMP chunk stream. Chunks are reassembled into complete
+/// messages; protocol control messages that affect chunking (Set Chunk Size)
+/// are applied here as well as being handed to the caller.
+class protocolManager
+{
+public:
+	/// Construct ready to parse the first chunk.
+	protocolManager();
+
+	/// Reset to initial parser state.
+	void reset();
+
+	/// Parse some data. Completed messages are appended to messages. The tribool
+	/// return value is true when at least one message was completed, false if the
+	/// data is invalid, indeterminate when more data is required. Incomplete
+	/// chunks are buffered until the next call.
+	boost::tribool parse(const char* begin, const char* end, std::vector<message>& messages);
+
+	/// The chunk size currently used by the peer.
+	std::size_t chunk_size() const;
+
+	/// Append message to out split into chunks of chunk_size bytes, using a
+	/// full header on the first chunk and continuation headers on the rest.
+	static void write_message(const message& m, std::size_t chunk_size, std::string& out);
+
+	/// The default chunk size before any Set Chunk Size message.
+	static const std::size_t default_chunk_size = 128;
+
+private:
+	/// Per chunk stream state needed to decode compressed chunk headers.
+	struct chunk_stream
+	{
+		chunk_stream();
+
+		message_header header;
+		unsigned int timestamp_delta;
+		bool extended_timestamp;
+		std::string payload;
+		boost::uint64_t received;
+	};
+
+	/// Try to decode one chunk, received at time now, from the front of data.
+	/// Returns the number of bytes consumed, zero if more data is needed, or -1
+	/// if the data is invalid.
+	int decode_chunk(const char* data, std::size_t length, boost::uint64_t now, std::vector<message>& messages);
+
+	/// The largest payload we are willing to reassemble.
+	static const std::size_t max_message_length = 16 * 1024 * 1024;
+
+	/// Bytes of an incomplete chunk carried over from the previous parse.
+	std::vector<char> pending_;
+
+	/// Current inbound chunk size.
+	std::size_t chunk_size_;
+
+	/// The chunk streams seen so far, keyed by chunk stream id.
+	std::map<unsigned int, chunk_stream> streams_;
+};
+
+} // namespace server
+} // namespace http
+
+#endif // PROTOCOL_MANAGER_HPP
@@ -3,6 +3,7 @@
 
 #include <string>
 #include <vector>
+#include <boost/algorithm/string/predicate.hpp>
 #include "header.hpp"
 
 namespace http {
@@ -16,8 +17,25 @@ struct request
 	int http_version_major;
 	int http_version_minor;
 	std::vector<header> headers;
+
+	/// The request body, as announced by Content-Length.
+	std::string content;
 };
 
+/// Find the value of the named header, compared case-insensitively. Returns 0
+/// if the request does not have it.
+inline const std::string* find_header(const request& req, const char* name)
+{
+	for (std::size_t i = 0; i < req.headers.size(); ++i)
+	{
+		if (boost::algorithm::iequals(req.headers[i].name, name))
+		{
+			return &req.headers[i].value;
+		}
+	}
+	return 0;
+}
+
 } // namespace server
 } // namespace http
 
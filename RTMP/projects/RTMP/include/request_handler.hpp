@@ -9,14 +9,16 @@ namespace server {
 
 struct reply;
 struct request;
+class latency_stats;
 
 /// The common handler for all incoming requests.
 class request_handler
   : private boost::noncopyable
 {
 public:
-  /// Construct with a directory containing files to be served.
-  explicit request_handler(const std::string& doc_root);
+  /// Construct with a directory containing files to be served. The path
+  /// "/stats" is answered with a plain text report of stats.
+  request_handler(const std::string& doc_root, const latency_stats& stats);
 
   /// Handle a request and produce a reply.
   void handle_request(const request& req, reply& rep);
@@ -25,6 +27,9 @@ private:
   /// The directory containing the files to be served.
   std::string doc_root_;
 
+  /// The statistics served at "/stats".
+  const latency_stats& stats_;
+
   /// Perform URL-decoding on a string. Returns false if the encoding was
   /// invalid.
   static bool url_decode(const std::string& in, std::string& out);
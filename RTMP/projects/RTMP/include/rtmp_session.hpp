@@ -0,0 +1,113 @@
+#ifndef RTMP_SESSION_HPP
+#define RTMP_SESSION_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include "delivery_policy.hpp"
+#include "handshake_manager.hpp"
+#include "latency_stats.hpp"
+#include "protocol_manager.hpp"
+#include "shared_object.hpp"
+
+namespace http {
+namespace server {
+
+/// The RTMP protocol engine for one client: handshake, chunk stream parsing
+/// and message dispatch. It knows nothing of how bytes reach the client, so
+/// the same engine serves plain TCP connections and RTMPT sessions.
+class rtmp_session : public shared_object_subscriber, private boost::noncopyable
+{
+public:
+	/// Where a session's output goes.
+	class transport
+	{
+	public:
+		virtual ~transport() {}
+
+		/// Queue already chunked data for the client. received and stats are
+		/// as for shared_object_subscriber::send.
+		virtual void send(const boost::shared_ptr<const std::string>& data, boost::uint64_t received, latency_stats::stream_stats* stats) = 0;
+
+		/// Apply the delivery policy of the application the client connected to.
+		virtual void apply_policy(const delivery_policy& policy) = 0;
+
+		/// Name of the peer used to label its statistics, e.g. "1.2.3.4:5678".
+		virtual std::string peer_name() = 0;
+	};
+
+	/// Construct a session writing to the given transport.
+	rtmp_session(transport& output, shared_object_store& shared_objects, latency_stats& stats, const delivery_policy_map& policies);
+
+	/// Feed received bytes through the handshake and chunk parsers. Returns
+	/// false if the peer sent invalid data.
+	bool process(const char* begin, const char* end);
+
+	/// Release everything the session holds in shared services. Must be
+	/// called before the session is destroyed.
+	void close();
+
+	/// Pass data to the transport.
+	virtual void send(const boost::shared_ptr<const std::string>& data, boost::uint64_t received, latency_stats::stream_stats* stats);
+
+private:
+	/// Dispatch a complete message from the peer.
+	void handle_message(const message& m);
+
+	/// Handle a command message, e.g. connect.
+	void handle_invoke(const message& m);
+
+	/// Accept a connect command: the window and bandwidth the client may use,
+	/// then the _result that completes its NetConnection.
+	void accept_connect(double transaction_id, double object_encoding);
+
+	/// Encode a message on message stream 0 and send it.
+	void send_message(unsigned int chunk_stream, unsigned char type, const std::string& payload);
+
+	/// Look up the delivery policy of the named application and apply it.
+	void apply_policy(const std::string& application);
+
+	/// Statistics for a message stream of this session, kept by application
+	/// and published stream name so that they are shared across sessions.
+	latency_stats::stream_stats& stream_stats(unsigned int stream_id);
+
+	/// Destination of the session's output.
+	transport& transport_;
+
+	/// The shared object service.
+	shared_object_store& shared_objects_;
+
+	/// Where latencies and queue depths are recorded.
+	latency_stats& stats_;
+
+	/// Delivery policies by application name.
+	const delivery_policy_map& policies_;
+
+	/// The parser for the RTMP handshake.
+	handshakeManager handshakeManager_;
+
+	/// Whether S0/S1/S2 have been queued for sending.
+	bool handshake_replied_;
+
+	/// The chunk stream parser, used once the handshake has completed.
+	protocolManager protocolManager_;
+
+	/// Messages completed by the last parse.
+	std::vector<message> messages_;
+
+	/// Application named in the connect command.
+	std::string application_;
+
+	/// Names given to the message streams by publish.
+	std::map<unsigned int, std::string> stream_names_;
+
+	/// Statistics of the message streams published in this session.
+	std::map<unsigned int, latency_stats::stream_stats*> streams_;
+};
+
+} // namespace server
+} // namespace http
+
+#endif // RTMP_SESSION_HPP
@@ -0,0 +1,166 @@
+#ifndef RTMPT_HPP
+#define RTMPT_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include "delivery_policy.hpp"
+#include "latency_stats.hpp"
+#include "rtmp_session.hpp"
+#include "shared_object.hpp"
+
+namespace http {
+namespace server {
+
+struct reply;
+struct request;
+
+/// One client tunnelling RTMP through HTTP requests (RTMPT). Output produced
+/// between polls is held here and returned, all of it, in the next response.
+/// A client that lets more than max_pending_bytes pile up is cut off: the
+/// output is dropped and the session is marked overflowed for the manager to
+/// close.
+class rtmpt_session : public rtmp_session::transport, private boost::noncopyable
+{
+public:
+	/// Most bytes of output held for a client between polls.
+	enum { max_pending_bytes = 4 * 1024 * 1024 };
+
+	/// Construct a session for the client at peer.
+	rtmpt_session(const std::string& peer, shared_object_store& shared_objects, latency_stats& stats, const delivery_policy_map& policies);
+
+	/// Destroy the session, releasing its shared objects.
+	~rtmpt_session();
+
+	/// Feed bytes from a send request to the RTMP engine. Returns false if
+	/// they were invalid.
+	bool process(const char* begin, const char* end);
+
+	/// Append the poll delay byte and all pending output to out.
+	void poll(std::string& out);
+
+	/// When the client last sent a request (monotonic microseconds).
+	boost::uint64_t last_request() const;
+
+	/// Whether output outgrew max_pending_bytes, so the session must close.
+	bool overflowed() const;
+
+	/// Queue output until the next poll.
+	virtual void send(const boost::shared_ptr<const std::string>& data, boost::uint64_t received, latency_stats::stream_stats* stats);
+
+	/// Remember the policy; low latency keeps the poll delay at its minimum.
+	virtual void apply_policy(const delivery_policy& policy);
+
+	/// The client's address.
+	virtual std::string peer_name();
+
+private:
+	/// Output waiting for a poll, with what is needed to account for it.
+	struct pending_item
+	{
+		boost::shared_ptr<const std::string> data;
+		boost::uint64_t received;
+		latency_stats::stream_stats* stats;
+	};
+
+	/// The client's address.
+	std::string peer_;
+
+	/// Where latencies and queue depths are recorded.
+	latency_stats& stats_;
+
+	/// The policy in force, chosen when the client connects.
+	delivery_policy policy_;
+
+	/// Release the output waiting for the next poll.
+	void drop_pending();
+
+	/// Output waiting for the next poll, and its size.
+	std::vector<pending_item> pending_;
+	std::size_t pending_bytes_;
+
+	/// Whether output outgrew max_pending_bytes.
+	bool overflowed_;
+
+	/// The poll delay last sent to the client.
+	unsigned char delay_;
+
+	/// When the client last sent a request.
+	boost::uint64_t last_request_;
+
+	/// The RTMP engine. Declared last as it refers back to this transport.
+	rtmp_session session_;
+};
+
+/// Serves the RTMPT commands /open/1, /send/<id>/<seq>, /idle/<id>/<seq> and
+/// /close/<id>/<seq>. Sessions that stop polling are closed after a timeout,
+/// as are those whose output overflowed. At most max_sessions are open, and
+/// at most max_sessions_per_address for one client address; /open is
+/// answered with 503 beyond that.
+///
+/// All member functions must be called from the io_service thread.
+class rtmpt_manager : private boost::noncopyable
+{
+public:
+	/// Most sessions open at once.
+	enum { max_sessions = 1024 };
+
+	/// Most sessions open at once from one address.
+	enum { max_sessions_per_address = 16 };
+
+	/// Construct a manager whose sessions use the given shared services.
+	rtmpt_manager(boost::asio::io_service& io_service, shared_object_store& shared_objects, latency_stats& stats, const delivery_policy_map& policies);
+
+	/// Handle a request from the client at peer. Returns false, leaving rep
+	/// untouched, if the request is not an RTMPT command.
+	bool handle_request(const request& req, const std::string& peer, reply& rep);
+
+	/// Close every session.
+	void stop();
+
+private:
+	typedef boost::shared_ptr<rtmpt_session> session_ptr;
+
+	/// Create a session and answer with its id.
+	void open(const std::string& peer, reply& rep);
+
+	/// The address part of a peer name, without the port.
+	static std::string peer_address(const std::string& peer);
+
+	/// Close sessions which have not been heard from within the timeout, or
+	/// whose output overflowed.
+	void handle_timer(const boost::system::error_code& e);
+
+	/// Make a session id of 128 bits from the system's secure random number
+	/// generator. Returns an empty string if it cannot be read.
+	static std::string make_id();
+
+	/// Fill rep as an RTMPT response carrying content.
+	static void fill_reply(reply& rep, const std::string& content);
+
+	/// The shared object service.
+	shared_object_store& shared_objects_;
+
+	/// Where latencies and queue depths are recorded.
+	latency_stats& stats_;
+
+	/// Delivery policies by application name.
+	const delivery_policy_map& policies_;
+
+	/// Live sessions by id.
+	std::map<std::string, session_ptr> sessions_;
+
+	/// Timer for expiring idle sessions, running while any session exists.
+	boost::asio::deadline_timer timer_;
+
+	/// Whether timer_ is waiting.
+	bool timer_running_;
+};
+
+} // namespace server
+} // namespace http
+
+#endif // RTMPT_HPP
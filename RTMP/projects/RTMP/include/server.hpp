@@ -6,7 +6,11 @@
 #include <boost/noncopyable.hpp>
 #include "connection.hpp"
 #include "connection_manager.hpp"
+#include "delivery_policy.hpp"
 #include "request_handler.hpp"
+#include "latency_stats.hpp"
+#include "rtmpt.hpp"
+#include "shared_object.hpp"
 
 namespace http {
 namespace server {
@@ -16,9 +20,23 @@ class server : private boost::noncopyable
 {
 public:
 	/// Construct the server to listen on the specified TCP address and port, and
-	/// serve up files from the given directory.
+	/// serve up files from the given directory. RTMP is accepted directly and
+	/// tunnelled over HTTP (RTMPT) on the same port. If trace_dir is not empty every
+	/// session's inbound bytes are recorded to a trace file in that directory.
+	/// Persistent shared objects are saved in so_dir, which must lie outside
+	/// doc_root; if it is empty they are not saved.
 	explicit server(const std::string& address, const std::string& port,
-	const std::string& doc_root);
+	const std::string& doc_root, const std::string& trace_dir = "", const std::string& so_dir = "");
+
+	/// The shared object service, e.g. to change its flush interval.
+	shared_object_store& shared_objects();
+
+	/// Set the delivery policy for clients connecting to the named application.
+	/// Must be called before run().
+	void set_delivery_policy(const std::string& application, const delivery_policy& policy);
+
+	/// Latency histograms and queue gauges, also served at "/stats".
+	const latency_stats& stats() const;
 
 	/// Run the server's io_service loop.
 	void run();
@@ -39,6 +57,12 @@ private:
 	/// Acceptor used to listen for incoming connections.
 	boost::asio::ip::tcp::acceptor acceptor_;
 
+	/// Latency statistics for all streams.
+	latency_stats stats_;
+
+	/// The shared object service used by all connections.
+	shared_object_store shared_objects_;
+
 	/// The connection manager which owns all live connections.
 	connection_manager connection_manager_;
 
@@ -47,6 +71,18 @@ private:
 
 	/// The handler for all incoming requests.
 	request_handler request_handler_;
+
+	/// Delivery policies by application name.
+	delivery_policy_map policies_;
+
+	/// Sessions of clients tunnelling RTMP over HTTP.
+	rtmpt_manager rtmpt_;
+
+	/// Directory that session traces are written to, empty if not recording.
+	std::string trace_dir_;
+
+	/// Number of sessions recorded so far, used to name trace files.
+	unsigned int trace_count_;
 };
 
 } // namespace server
@@ -0,0 +1,82 @@
+#ifndef SESSION_TRACE_HPP
+#define SESSION_TRACE_HPP
+
+#include <fstream>
+#include <string>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+
+namespace http {
+namespace server {
+
+/// One read from a recorded session.
+struct trace_record
+{
+	/// Microseconds since the previous record (or since the trace started).
+	boost::uint64_t delay;
+
+	/// The bytes delivered by the read.
+	std::string data;
+};
+
+/// Records every inbound byte of a connection with its arrival time.
+///
+/// The trace is a magic string followed by one record per read, each record
+/// being a varint delay in microseconds, a varint length and the raw bytes.
+class trace_writer
+  : private boost::noncopyable
+{
+public:
+	/// Create (or truncate) the trace file at path.
+	explicit trace_writer(const std::string& path);
+
+	/// True if the trace file could be opened.
+	bool is_open() const;
+
+	/// Append a record for data that has just been received.
+	void record(const char* data, std::size_t length);
+
+private:
+	/// Write a variable length unsigned integer (7 bits per byte).
+	void write_varint(boost::uint64_t value);
+
+	/// The trace file.
+	std::ofstream file_;
+
+	/// Arrival time of the previous record.
+	boost::uint64_t last_;
+};
+
+/// Reads back a trace produced by trace_writer.
+class trace_reader
+  : private boost::noncopyable
+{
+public:
+	/// Open the trace file at path and check its magic.
+	explicit trace_reader(const std::string& path);
+
+	/// True if the trace file was opened and is a valid trace.
+	bool is_open() const;
+
+	/// Read the next record. Returns false at the end of the trace or if the
+	/// trace is truncated.
+	bool next(trace_record& record);
+
+	/// Start again from the first record.
+	void rewind();
+
+private:
+	/// Read a variable length unsigned integer.
+	bool read_varint(boost::uint64_t& value);
+
+	/// The trace file.
+	std::ifstream file_;
+
+	/// Whether the magic matched.
+	bool valid_;
+};
+
+} // namespace server
+} // namespace http
+
+#endif // SESSION_TRACE_HPP
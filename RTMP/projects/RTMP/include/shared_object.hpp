@@ -0,0 +1,168 @@
+#ifndef SHARED_OBJECT_HPP
+#define SHARED_OBJECT_HPP
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include "latency_stats.hpp"
+
+namespace http {
+namespace server {
+
+/// A client of the shared object service. Encoded messages are shared between
+/// every subscriber they are sent to and must not be modified.
+class shared_object_subscriber
+{
+public:
+	virtual ~shared_object_subscriber() {}
+
+	/// Queue an already chunked RTMP message for sending. received is when the
+	/// oldest input that produced it arrived; once the data has been handed to
+	/// the kernel the delay is recorded in stats.
+	virtual void send(const boost::shared_ptr<const std::string>& data, boost::uint64_t received, latency_stats::stream_stats* stats) = 0;
+};
+
+/// Remote shared objects (the SO_* message family).
+///
+/// Changes made by clients are not broadcast one by one. Every change within
+/// the flush interval is coalesced per object, and on flush each dirty object
+/// gets a new version and a single delta message which is encoded once and
+/// handed to all of its subscribers. Persistent objects are snapshotted to disk
+/// after each flush and reloaded when first used.
+///
+/// An object is dropped once nobody is connected to it and its changes have
+/// gone out, unless it is persistent and there is no directory to reload it
+/// from. Messages naming a new object are ignored while max_objects are held,
+/// as are messages whose object name is longer than max_name_length.
+///
+/// All member functions must be called from the io_service thread.
+class shared_object_store
+  : private boost::noncopyable
+{
+public:
+	/// Construct a store whose persistent objects live in persistence_dir. The
+	/// directory must not be served to clients. If it is empty, persistent
+	/// objects are kept in memory only.
+	/// Delivery latencies are recorded in stats under "so:<name>".
+	shared_object_store(boost::asio::io_service& io_service, const std::string& persistence_dir, latency_stats& stats);
+
+	/// Most objects held at once.
+	enum { max_objects = 1024 };
+
+	/// Longest object name accepted. Escaped for a snapshot file name it may
+	/// take three times as many bytes, which must stay within the 255 most
+	/// file systems allow.
+	enum { max_name_length = 64 };
+
+	/// Set how long changes are collected before being broadcast.
+	void set_flush_interval(const boost::posix_time::time_duration& interval);
+
+	/// Handle a shared object message body received from client at the given
+	/// time (monotonic microseconds).
+	void handle_message(shared_object_subscriber* client, const std::string& body, boost::uint64_t received);
+
+	/// Remove client from every object it is connected to.
+	void unsubscribe_all(shared_object_subscriber* client);
+
+	/// Broadcast all pending changes now.
+	void flush();
+
+private:
+	/// An event queued for the next delta, e.g. a send message.
+	struct event
+	{
+		unsigned char type;
+		std::string data;
+	};
+
+	/// A single shared object.
+	struct object
+	{
+		object();
+
+		std::string name;
+		bool persistent;
+		unsigned int version;
+		std::map<std::string, std::string> attributes;
+
+		/// Attributes changed or deleted since the last flush.
+		std::set<std::string> changed;
+
+		/// Events to append after the attribute changes.
+		std::vector<event> events;
+
+		/// When the oldest unflushed change arrived.
+		boost::uint64_t oldest_change;
+
+		/// Latency statistics for this object.
+		latency_stats::stream_stats* stats;
+
+		/// Clients whose own changes need an acknowledgement, by attribute.
+		std::map<shared_object_subscriber*, std::set<std::string> > acks;
+
+		std::set<shared_object_subscriber*> subscribers;
+	};
+
+	typedef std::map<std::string, object> object_map;
+
+	/// Find or create (and load) the named object. Returns 0 if it would be
+	/// new and the store is full.
+	object* get_object(const std::string& name, bool persistent);
+
+	/// Drop the object at i if nothing needs it in memory any more.
+	void release(object_map::iterator i);
+
+	/// Send the full state of obj to client.
+	void send_initial_data(object& obj, shared_object_subscriber* client, boost::uint64_t received);
+
+	/// Mark obj as changed at time received and make sure a flush is scheduled.
+	void touch(object& obj, boost::uint64_t received);
+
+	/// Encode and broadcast obj's pending changes.
+	void flush_object(object& obj);
+
+	/// Handle expiry of the flush timer.
+	void handle_flush(const boost::system::error_code& e);
+
+	/// Encode a shared object message body into a chunked RTMP message.
+	static boost::shared_ptr<const std::string> encode(const object& obj, const std::string& events);
+
+	/// Path of the snapshot file for the named object.
+	std::string snapshot_path(const std::string& name) const;
+
+	/// Write obj's attributes to its snapshot file.
+	void save(const object& obj) const;
+
+	/// Read obj's attributes from its snapshot file, if there is one.
+	void load(object& obj) const;
+
+	/// Where delivery latencies are recorded.
+	latency_stats& stats_;
+
+	/// Directory holding persistent object snapshots, empty for none.
+	std::string persistence_dir_;
+
+	/// How long changes are collected before being broadcast.
+	boost::posix_time::time_duration flush_interval_;
+
+	/// Timer driving the flush.
+	boost::asio::deadline_timer flush_timer_;
+
+	/// Whether the flush timer is running.
+	bool flush_pending_;
+
+	/// All objects, by name.
+	object_map objects_;
+
+	/// Names of objects with unflushed changes.
+	std::set<std::string> dirty_;
+};
+
+} // namespace server
+} // namespace http
+
+#endif // SHARED_OBJECT_HPP
@@ -0,0 +1,219 @@
+#include "amf0.hpp"
+#include <cstring>
+#include <boost/cstdint.hpp>
+
+namespace http {
+namespace server {
+namespace amf0 {
+
+namespace {
+
+/// Values nested deeper than this are rejected rather than recursed into.
+const int max_depth = 32;
+
+bool skip_nested(const char*& p, const char* end, int depth);
+
+/// Skip "name: value" pairs up to the object end marker.
+bool skip_properties(const char*& p, const char* end, int depth)
+{
+	std::string name;
+	for (;;)
+	{
+		if (!read_utf(p, end, name))
+		{
+			return false;
+		}
+		if (name.empty() && p < end && *p == 0x09)
+		{
+			++p;
+			return true;
+		}
+		if (!skip_nested(p, end, depth))
+		{
+			return false;
+		}
+	}
+}
+
+/// Advance p past one value nested depth levels deep.
+bool skip_nested(const char*& p, const char* end, int depth)
+{
+	if (p >= end || depth > max_depth)
+	{
+		return false;
+	}
+
+	std::string ignored;
+	std::size_t need = 0;
+	switch (static_cast<unsigned char>(*p++))
+	{
+		case 0x00: // number
+			need = 8;
+			break;
+		case 0x01: // boolean
+			need = 1;
+			break;
+		case 0x02: // string
+		case 0x04: // movie clip
+			return read_utf(p, end, ignored);
+		case 0x03: // object
+			return skip_properties(p, end, depth + 1);
+		case 0x05: // null
+		case 0x06: // undefined
+		case 0x0d: // unsupported
+			return true;
+		case 0x07: // reference
+			need = 2;
+			break;
+		case 0x08: // ECMA array
+			if (end - p < 4)
+			{
+				return false;
+			}
+			p += 4;
+			return skip_properties(p, end, depth + 1);
+		case 0x0a: // strict array
+		{
+			if (end - p < 4)
+			{
+				return false;
+			}
+			unsigned int count = get_ui32(p);
+			p += 4;
+			for (unsigned int i = 0; i < count; ++i)
+			{
+				if (!skip_nested(p, end, depth + 1))
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+		case 0x0b: // date
+			need = 10;
+			break;
+		case 0x0c: // long string
+		case 0x0f: // XML document
+			if (end - p < 4)
+			{
+				return false;
+			}
+			need = 4 + get_ui32(p);
+			break;
+		case 0x10: // typed object
+			return read_utf(p, end, ignored) && skip_properties(p, end, depth + 1);
+		default:
+			return false;
+	}
+
+	if (static_cast<std::size_t>(end - p) < need)
+	{
+		return false;
+	}
+	p += need;
+	return true;
+}
+
+/// Read an object value and look for a property called name, reading its
+/// value with read.
+template <typename Value>
+bool find_property(const char*& p, const char* end, const std::string& name, Value& value,
+	bool (*read)(const char*&, const char*, Value&))
+{
+	if (p >= end || *p != 0x03)
+	{
+		return false;
+	}
+	++p;
+
+	bool found = false;
+	std::string key;
+	for (;;)
+	{
+		if (!read_utf(p, end, key))
+		{
+			return false;
+		}
+		if (key.empty() && p < end && *p == 0x09)
+		{
+			++p;
+			return found;
+		}
+		if (!found && key == name && read(p, end, value))
+		{
+			found = true;
+		}
+		else if (!skip_nested(p, end, 1))
+		{
+			return false;
+		}
+	}
+}
+
+} // namespace
+
+void put_number(std::string& out, double value)
+{
+	boost::uint64_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	out += static_cast<char>(0x00);
+	put_ui32(out, static_cast<unsigned int>(bits >> 32));
+	put_ui32(out, static_cast<unsigned int>(bits));
+}
+
+bool read_utf(const char*& p, const char* end, std::string& value)
+{
+	if (end - p < 2)
+	{
+		return false;
+	}
+	std::size_t length = get_ui16(p);
+	if (static_cast<std::size_t>(end - p - 2) < length)
+	{
+		return false;
+	}
+	value.assign(p + 2, length);
+	p += 2 + length;
+	return true;
+}
+
+bool read_string(const char*& p, const char* end, std::string& value)
+{
+	if (p >= end || *p != 0x02)
+	{
+		return false;
+	}
+	++p;
+	return read_utf(p, end, value);
+}
+
+bool read_number(const char*& p, const char* end, double& value)
+{
+	if (end - p < 9 || *p != 0x00)
+	{
+		return false;
+	}
+	boost::uint64_t bits = (static_cast<boost::uint64_t>(get_ui32(p + 1)) << 32) | get_ui32(p + 5);
+	std::memcpy(&value, &bits, sizeof(value));
+	p += 9;
+	return true;
+}
+
+bool skip_value(const char*& p, const char* end)
+{
+	return skip_nested(p, end, 0);
+}
+
+bool find_string_property(const char*& p, const char* end, const std::string& name, std::string& value)
+{
+	return find_property(p, end, name, value, &read_string);
+}
+
+bool find_number_property(const char*& p, const char* end, const std::string& name, double& value)
+{
+	return find_property(p, end, name, value, &read_number);
+}
+
+} // namespace amf0
+} // namespace server
+} // namespace http
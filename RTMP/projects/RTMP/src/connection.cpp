@@ -1,14 +1,44 @@
 #include "connection.hpp"
+#include <algorithm>
 #include <vector>
+#include <boost/algorithm/string/predicate.hpp>
 #include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
 #include "connection_manager.hpp"
 #include "request_handler.hpp"
+#include "monotonic_clock.hpp"
+
+#if !defined(_WIN32)
+#include <netinet/tcp.h>
+#endif
 
 namespace http {
 namespace server {
 
-connection::connection(boost::asio::io_service& io_service, connection_manager& manager, request_handler& handler)
-	: socket_(io_service), connection_manager_(manager), request_handler_(handler)
+namespace {
+
+/// Bounds for a bitrate derived send buffer.
+const std::size_t min_send_buffer = 16 * 1024;
+const std::size_t max_send_buffer = 16 * 1024 * 1024;
+
+/// How long outbound bytes are counted before the bitrate is re-estimated.
+const boost::uint64_t bitrate_window = 1000000;
+
+/// Most bytes queued for a peer. A peer this far behind is not reading, and
+/// holding more for it would let it take any amount of memory.
+const std::size_t max_queued_bytes = 8 * 1024 * 1024;
+
+/// Largest request body accepted. RTMPT clients post a few kilobytes at a
+/// time, so anything near this is not a real client.
+const std::size_t max_request_content = 256 * 1024;
+
+} // namespace
+
+connection::connection(boost::asio::io_service& io_service, connection_manager& manager, request_handler& handler, shared_object_store& shared_objects, latency_stats& stats,
+	const delivery_policy_map& policies, rtmpt_manager& rtmpt)
+	: io_service_(io_service), socket_(io_service), connection_manager_(manager), request_handler_(handler), stats_(stats), rtmpt_(rtmpt),
+	window_start_(0), window_bytes_(0), send_buffer_size_(0), protocol_(unknown_protocol), headers_complete_(false), content_length_(0), keep_alive_(false),
+	session_(*this, shared_objects, stats, policies), queued_bytes_(0), overflowed_(false)
 {
 }
 
@@ -19,35 +49,276 @@ boost::asio::ip::tcp::socket& connection::socket()
 
 void connection::start()
 {
-	socket_.async_read_some(boost::asio::buffer(buffer_), boost::bind(&connection::handle_read, shared_from_this(), boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+	read_more();
 }
 
 void connection::stop()
 {
+	session_.close();
 	socket_.close();
+
+	// Data that will now never be written no longer counts as queued.
+	for (std::size_t i = 0; i < outbound_.size(); ++i)
+	{
+		if (outbound_[i].stats)
+		{
+			stats_.dequeued(*outbound_[i].stats, outbound_[i].data->size());
+		}
+	}
+	outbound_.clear();
 }
 
-void connection::handle_read(const boost::system::error_code& e, std::size_t bytes_transferred)
+void connection::record_to(const std::string& path)
 {
-	if (!e)
+	trace_.reset(new trace_writer(path));
+	if (!trace_->is_open())
 	{
-		boost::tribool result;
-		//boost::tie(result, boost::tuples::ignore) = request_parser_.parse(request_, buffer_.data(), buffer_.data() + bytes_transferred);
-		//this->handshakeManager_ = NULL;
+		trace_.reset();
+	}
+}
 
-		if (result)
+void connection::read_more()
+{
+	socket_.async_read_some(boost::asio::buffer(buffer_), boost::bind(&connection::handle_read, shared_from_this(), boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+}
+
+void connection::process_http(const char* begin, const char* end)
+{
+	http_input_.append(begin, end);
+	handle_http_input();
+}
+
+void connection::handle_http_input()
+{
+	const char* begin = http_input_.data();
+	const char* end = begin + http_input_.size();
+
+	if (!headers_complete_)
+	{
+		boost::tribool result;
+		boost::tie(result, begin) = request_parser_.parse(request_, begin, end);
+		if (!result)
 		{
-			request_handler_.handle_request(request_, reply_);
+			keep_alive_ = false;
+			reply_ = reply::stock_reply(reply::bad_request);
+			reply_.headers.push_back(header());
+			reply_.headers.back().name = "Connection";
+			reply_.headers.back().value = "close";
 			boost::asio::async_write(socket_, reply_.to_buffers(), boost::bind(&connection::handle_write, shared_from_this(), boost::asio::placeholders::error));
+			return;
 		}
-		else if (!result)
+		if (boost::indeterminate(result))
 		{
-			reply_ = reply::stock_reply(reply::bad_request);
+			// The parser has consumed everything.
+			http_input_.clear();
+			read_more();
+			return;
+		}
+
+		headers_complete_ = true;
+		content_length_ = 0;
+		if (const std::string* length = find_header(request_, "Content-Length"))
+		{
+			try
+			{
+				content_length_ = boost::lexical_cast<std::size_t>(*length);
+			}
+			catch (boost::bad_lexical_cast&)
+			{
+				content_length_ = 0;
+			}
+		}
+		if (content_length_ > max_request_content)
+		{
+			keep_alive_ = false;
+			reply_ = reply::stock_reply(reply::request_entity_too_large);
+			reply_.headers.push_back(header());
+			reply_.headers.back().name = "Connection";
+			reply_.headers.back().value = "close";
 			boost::asio::async_write(socket_, reply_.to_buffers(), boost::bind(&connection::handle_write, shared_from_this(), boost::asio::placeholders::error));
+			return;
+		}
+	}
+
+	std::size_t wanted = std::min(content_length_ - request_.content.size(), static_cast<std::size_t>(end - begin));
+	request_.content.append(begin, wanted);
+	begin += wanted;
+	http_input_.erase(0, begin - http_input_.data());
+	if (request_.content.size() < content_length_)
+	{
+		read_more();
+		return;
+	}
+
+	// HTTP/1.1 connections persist unless the client asks otherwise, and
+	// HTTP/1.0 ones only if it asks for it. RTMPT clients rely on this.
+	const std::string* connection_header = find_header(request_, "Connection");
+	if (request_.http_version_major == 1 && request_.http_version_minor >= 1)
+	{
+		keep_alive_ = !connection_header || !boost::algorithm::iequals(*connection_header, "close");
+	}
+	else
+	{
+		keep_alive_ = connection_header && boost::algorithm::iequals(*connection_header, "keep-alive");
+	}
+
+	if (!rtmpt_.handle_request(request_, peer_name(), reply_))
+	{
+		request_handler_.handle_request(request_, reply_);
+	}
+	if (!keep_alive_)
+	{
+		reply_.headers.push_back(header());
+		reply_.headers.back().name = "Connection";
+		reply_.headers.back().value = "close";
+	}
+	boost::asio::async_write(socket_, reply_.to_buffers(), boost::bind(&connection::handle_write, shared_from_this(), boost::asio::placeholders::error));
+}
+
+void connection::apply_policy(const delivery_policy& policy)
+{
+	policy_ = policy;
+
+	boost::system::error_code ignored_ec;
+	if (policy_.low_latency)
+	{
+		socket_.set_option(boost::asio::ip::tcp::no_delay(true), ignored_ec);
+	}
+
+#if defined(TCP_NOTSENT_LOWAT)
+	if (policy_.notsent_lowat)
+	{
+		typedef boost::asio::detail::socket_option::integer<IPPROTO_TCP, TCP_NOTSENT_LOWAT> notsent_lowat;
+		socket_.set_option(notsent_lowat(static_cast<int>(policy_.notsent_lowat)), ignored_ec);
+	}
+#endif
+
+	window_start_ = monotonic_microseconds();
+	window_bytes_ = 0;
+}
+
+std::string connection::peer_name()
+{
+	boost::system::error_code ec;
+	boost::asio::ip::tcp::endpoint peer = socket_.remote_endpoint(ec);
+	return peer.address().to_string(ec) + ":" + boost::lexical_cast<std::string>(peer.port());
+}
+
+void connection::update_send_buffer(std::size_t bytes_written)
+{
+	if (policy_.send_buffer_seconds <= 0)
+	{
+		return;
+	}
+
+	window_bytes_ += bytes_written;
+	boost::uint64_t now = monotonic_microseconds();
+	boost::uint64_t elapsed = now - window_start_;
+	if (elapsed < bitrate_window)
+	{
+		return;
+	}
+
+	double bytes_per_second = window_bytes_ * 1000000.0 / elapsed;
+	std::size_t size = static_cast<std::size_t>(bytes_per_second * policy_.send_buffer_seconds);
+	size = std::min(std::max(size, min_send_buffer), max_send_buffer);
+
+	// Only touch the socket when the rate has moved by more than a quarter.
+	if (size * 4 < send_buffer_size_ * 3 || size * 4 > send_buffer_size_ * 5)
+	{
+		boost::system::error_code ignored_ec;
+		socket_.set_option(boost::asio::socket_base::send_buffer_size(static_cast<int>(size)), ignored_ec);
+		send_buffer_size_ = size;
+	}
+
+	window_start_ = now;
+	window_bytes_ = 0;
+}
+
+void connection::send(const boost::shared_ptr<const std::string>& data)
+{
+	send(data, 0, 0);
+}
+
+void connection::send(const boost::shared_ptr<const std::string>& data, boost::uint64_t received, latency_stats::stream_stats* stats)
+{
+	// The connection is stopped from the io_service rather than here, as the
+	// caller may be walking the subscribers that stopping it would change.
+	if (overflowed_)
+	{
+		return;
+	}
+	if (queued_bytes_ + data->size() > max_queued_bytes)
+	{
+		overflowed_ = true;
+		io_service_.post(boost::bind(&connection_manager::stop, &connection_manager_, shared_from_this()));
+		return;
+	}
+
+	outbound_item item;
+	item.data = data;
+	item.received = received;
+	item.stats = stats;
+	outbound_.push_back(item);
+	queued_bytes_ += data->size();
+
+	if (stats)
+	{
+		stats_.enqueued(*stats, data->size());
+	}
+
+	if (sending_.empty())
+	{
+		write_queued();
+	}
+}
+
+void connection::write_queued()
+{
+	// In low latency mode every message is flushed on its own, so nothing
+	// waits behind a large write that has already gone stale.
+	std::vector<boost::asio::const_buffer> buffers;
+	buffers.reserve(outbound_.size());
+	while (!outbound_.empty())
+	{
+		sending_.push_back(outbound_.front());
+		buffers.push_back(boost::asio::buffer(*outbound_.front().data));
+		outbound_.pop_front();
+		if (policy_.low_latency)
+		{
+			break;
+		}
+	}
+	boost::asio::async_write(socket_, buffers, boost::bind(&connection::handle_send, shared_from_this(), boost::asio::placeholders::error));
+}
+
+void connection::handle_read(const boost::system::error_code& e, std::size_t bytes_transferred)
+{
+	if (!e)
+	{
+		if (trace_)
+		{
+			trace_->record(buffer_.data(), bytes_transferred);
+		}
+
+		// An RTMP client opens with the protocol version; anything else is
+		// treated as HTTP, e.g. a request for the statistics page.
+		if (protocol_ == unknown_protocol && bytes_transferred > 0)
+		{
+			protocol_ = (buffer_[0] == 0x03) ? rtmp_protocol : http_protocol;
+		}
+
+		if (protocol_ == http_protocol)
+		{
+			process_http(buffer_.data(), buffer_.data() + bytes_transferred);
+		}
+		else if (session_.process(buffer_.data(), buffer_.data() + bytes_transferred))
+		{
+			read_more();
 		}
 		else
 		{
-			socket_.async_read_some(boost::asio::buffer(buffer_), boost::bind(&connection::handle_read, shared_from_this(), boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+			connection_manager_.stop(shared_from_this());
 		}
 	}
 	else if (e != boost::asio::error::operation_aborted)
@@ -58,6 +329,25 @@ void connection::handle_read(const boost::system::error_code& e, std::size_t byt
 
 void connection::handle_write(const boost::system::error_code& e)
 {
+	if (!e && keep_alive_)
+	{
+		// Start on the next request, which may already have been received.
+		request_parser_.reset();
+		request_ = request();
+		reply_ = reply();
+		headers_complete_ = false;
+		content_length_ = 0;
+		if (http_input_.empty())
+		{
+			read_more();
+		}
+		else
+		{
+			handle_http_input();
+		}
+		return;
+	}
+
 	if (!e)
 	{
 		// Initiate graceful connection closure.
@@ -71,5 +361,39 @@ void connection::handle_write(const boost::system::error_code& e)
 	}
 }
 
+void connection::handle_send(const boost::system::error_code& e)
+{
+	// Everything in this write has now been handed to the kernel.
+	boost::uint64_t now = monotonic_microseconds();
+	std::size_t bytes_written = 0;
+	for (std::size_t i = 0; i < sending_.size(); ++i)
+	{
+		const outbound_item& item = sending_[i];
+		bytes_written += item.data->size();
+		if (item.stats)
+		{
+			stats_.dequeued(*item.stats, item.data->size());
+			if (!e && item.received)
+			{
+				stats_.record_delivery(*item.stats, now - item.received);
+			}
+		}
+	}
+	sending_.clear();
+	queued_bytes_ -= bytes_written;
+	if (!e)
+	{
+		update_send_buffer(bytes_written);
+		if (!outbound_.empty())
+		{
+			write_queued();
+		}
+	}
+	else if (e != boost::asio::error::operation_aborted)
+	{
+		connection_manager_.stop(shared_from_this());
+	}
+}
+
 } // namespace server
 } // namespace http
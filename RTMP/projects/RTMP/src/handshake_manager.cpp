@@ -1,314 +1,91 @@
 #include "handshake_manager.hpp"
+#include <cstdlib>
+#include <ctime>
 
 namespace http {
 namespace server {
 
 handshakeManager::handshakeManager()
-	: state_(method_start)
+	: state_(version), position_(0)
 {
 }
 
 void handshakeManager::reset()
 {
-	state_ = method_start;
+	state_ = version;
+	position_ = 0;
 }
 
-//boost::tribool handshakeManager::consume(request& req, char input)
-//{
-//	switch (state_)
-//	{
-//		case method_start:
-//			if (!is_char(input) || is_ctl(input) || is_tspecial(input))
-//			{
-//				return false;
-//			}
-//			else
-//			{
-//				state_ = method;
-//				req.method.push_back(input);
-//				return boost::indeterminate;
-//			}
-//		case method:
-//			if (input == ' ')
-//			{
-//				state_ = uri;
-//				return boost::indeterminate;
-//			}
-//			else if (!is_char(input) || is_ctl(input) || is_tspecial(input))
-//			{
-//				return false;
-//			}
-//			else
-//			{
-//				req.method.push_back(input);
-//				return boost::indeterminate;
-//			}
-//		case uri_start:
-//			if (is_ctl(input))
-//			{
-//				return false;
-//			}
-//			else
-//			{
-//				state_ = uri;
-//				req.uri.push_back(input);
-//				return boost::indeterminate;
-//			}
-//		case uri:
-//			if (input == ' ')
-//			{
-//				state_ = http_version_h;
-//				return boost::indeterminate;
-//			}
-//			else if (is_ctl(input))
-//			{
-//				return false;
-//			}
-//			else
-//			{
-//				req.uri.push_back(input);
-//				return boost::indeterminate;
-//			}
-//		case http_version_h:
-//			if (input == 'H')
-//			{
-//				state_ = http_version_t_1;
-//				return boost::indeterminate;
-//			}
-//			else
-//			{
-//				return false;
-//			}
-//		case http_version_t_1:
-//			if (input == 'T')
-//			{
-//				state_ = http_version_t_2;
-//				return boost::indeterminate;
-//			}
-//			else
-//			{
-//				return false;
-//			}
-//		case http_version_t_2:
-//			if (input == 'T')
-//			{
-//				state_ = http_version_p;
-//				return boost::indeterminate;
-//			}
-//			else
-//			{
-//				return false;
-//			}
-//		case http_version_p:
-//			if (input == 'P')
-//			{
-//				state_ = http_version_slash;
-//				return boost::indeterminate;
-//			}
-//			else
-//			{
-//				return false;
-//			}
-//		case http_version_slash:
-//			if (input == '/')
-//			{
-//				req.http_version_major = 0;
-//				req.http_version_minor = 0;
-//				state_ = http_version_major_start;
-//				return boost::indeterminate;
-//			}
-//			else
-//			{
-//				return false;
-//			}
-//		case http_version_major_start:
-//			if (is_digit(input))
-//			{
-//				req.http_version_major = req.http_version_major * 10 + input - '0';
-//				state_ = http_version_major;
-//				return boost::indeterminate;
-//			}
-//			else
-//			{
-//				return false;
-//			}
-//		case http_version_major:
-//			if (input == '.')
-//			{
-//				state_ = http_version_minor_start;
-//				return boost::indeterminate;
-//			}
-//			else if (is_digit(input))
-//			{
-//				req.http_version_major = req.http_version_major * 10 + input - '0';
-//				return boost::indeterminate;
-//			}
-//			else
-//			{
-//				return false;
-//			}
-//		case http_version_minor_start:
-//			if (is_digit(input))
-//			{
-//				req.http_version_minor = req.http_version_minor * 10 + input - '0';
-//				state_ = http_version_minor;
-//				return boost::indeterminate;
-//			}
-//			else
-//			{
-//				return false;
-//			}
-//		case http_version_minor:
-//			if (input == '\r')
-//			{
-//				state_ = expecting_newline_1;
-//				return boost::indeterminate;
-//			}
-//			else if (is_digit(input))
-//			{
-//				req.http_version_minor = req.http_version_minor * 10 + input - '0';
-//				return boost::indeterminate;
-//			}
-//			else
-//			{
-//				return false;
-//			}
-//		case expecting_newline_1:
-//			if (input == '\n')
-//			{
-//				state_ = header_line_start;
-//				return boost::indeterminate;
-//			}
-//			else
-//			{
-//				return false;
-//			}
-//		case header_line_start:
-//			if (input == '\r')
-//			{
-//				state_ = expecting_newline_3;
-//				return boost::indeterminate;
-//			}
-//			else if (!req.headers.empty() && (input == ' ' || input == '\t'))
-//			{
-//				state_ = header_lws;
-//				return boost::indeterminate;
-//			}
-//			else if (!is_char(input) || is_ctl(input) || is_tspecial(input))
-//			{
-//				return false;
-//			}
-//			else
-//			{
-//				req.headers.push_back(header());
-//				req.headers.back().name.push_back(input);
-//				state_ = header_name;
-//				return boost::indeterminate;
-//			}
-//		case header_lws:
-//			if (input == '\r')
-//			{
-//				state_ = expecting_newline_2;
-//				return boost::indeterminate;
-//			}
-//			else if (input == ' ' || input == '\t')
-//			{
-//				return boost::indeterminate;
-//			}
-//			else if (is_ctl(input))
-//			{
-//				return false;
-//			}
-//			else
-//			{
-//				state_ = header_value;
-//				req.headers.back().value.push_back(input);
-//				return boost::indeterminate;
-//			}
-//		case header_name:
-//			if (input == ':')
-//			{
-//				state_ = space_before_header_value;
-//				return boost::indeterminate;
-//			}
-//			else if (!is_char(input) || is_ctl(input) || is_tspecial(input))
-//			{
-//				return false;
-//			}
-//			else
-//			{
-//				req.headers.back().name.push_back(input);
-//				return boost::indeterminate;
-//			}
-//		case space_before_header_value:
-//			if (input == ' ')
-//			{
-//				state_ = header_value;
-//				return boost::indeterminate;
-//			}
-//			else
-//			{
-//				return false;
-//			}
-//		case header_value:
-//			if (input == '\r')
-//			{
-//				state_ = expecting_newline_2;
-//				return boost::indeterminate;
-//			}
-//			else if (is_ctl(input))
-//			{
-//				return false;
-//			}
-//			else
-//			{
-//				req.headers.back().value.push_back(input);
-//				return boost::indeterminate;
-//			}
-//		case expecting_newline_2:
-//			if (input == '\n')
-//			{
-//				state_ = header_line_start;
-//				return boost::indeterminate;
-//			}
-//			else
-//			{
-//				return false;
-//			}
-//		case expecting_newline_3:
-//			return (input == '\n');
-//		default:
-//			return false;
-//	}
-//}
+bool handshakeManager::reply_ready() const
+{
+	return state_ == client_echo || state_ == established;
+}
 
-bool handshakeManager::is_char(int c)
+bool handshakeManager::complete() const
 {
-	return c >= 0 && c <= 127;
+	return state_ == established;
 }
 
-bool handshakeManager::is_ctl(int c)
+const boost::array<char, 1 + 2 * constants::HANDSHAKE_SIZE>& handshakeManager::reply() const
 {
-	return c >= 0 && c <= 31 || c == 127;
+	return reply_;
 }
 
-bool handshakeManager::is_tspecial(int c)
+boost::tribool handshakeManager::consume(char input)
 {
-	switch (c)
+	switch (state_)
 	{
-		case '(': case ')': case '<': case '>': case '@':
-		case ',': case ';': case ':': case '\\': case '"':
-		case '/': case '[': case ']': case '?': case '=':
-		case '{': case '}': case ' ': case '\t':
-			return true;
+		case version:
+			if (input != protocol_version)
+			{
+				return false;
+			}
+			else
+			{
+				reply_[0] = protocol_version;
+				state_ = client_signature;
+				position_ = 0;
+				return boost::indeterminate;
+			}
+		case client_signature:
+			// C1 is echoed back verbatim as S2.
+			reply_[1 + constants::HANDSHAKE_SIZE + position_] = input;
+			if (++position_ == constants::HANDSHAKE_SIZE)
+			{
+				build_reply();
+				state_ = client_echo;
+				position_ = 0;
+			}
+			return boost::indeterminate;
+		case client_echo:
+			// C2 echoes S1; the simple handshake does not validate it.
+			if (++position_ == constants::HANDSHAKE_SIZE)
+			{
+				state_ = established;
+				return true;
+			}
+			return boost::indeterminate;
 		default:
 			return false;
 	}
 }
 
-bool handshakeManager::is_digit(int c)
+void handshakeManager::build_reply()
 {
-	return c >= '0' && c <= '9';
+	char* s1 = reply_.data() + 1;
+
+	// S1: 4 bytes of time, 4 zero bytes, then random filler.
+	unsigned int now = static_cast<unsigned int>(std::time(0));
+	s1[0] = static_cast<char>(now >> 24);
+	s1[1] = static_cast<char>(now >> 16);
+	s1[2] = static_cast<char>(now >> 8);
+	s1[3] = static_cast<char>(now);
+	s1[4] = s1[5] = s1[6] = s1[7] = 0;
+
+	for (std::size_t i = 8; i < constants::HANDSHAKE_SIZE; ++i)
+	{
+		s1[i] = static_cast<char>(std::rand());
+	}
 }
 
 } // namespace server
@@ -0,0 +1,199 @@
+#include "latency_stats.hpp"
+#include <algorithm>
+#include <sstream>
+
+namespace http {
+namespace server {
+
+latency_histogram::latency_histogram()
+	: count_(0), min_(0), max_(0), sum_(0)
+{
+	std::fill(counts_, counts_ + bucket_count, 0);
+}
+
+std::size_t latency_histogram::bucket_index(boost::uint64_t value)
+{
+	if (value < 32)
+	{
+		return static_cast<std::size_t>(value);
+	}
+
+	// Keep the 5 most significant bits: the top one selects the power of two,
+	// the other four the sub-bucket.
+	std::size_t msb = 5;
+	while (value >> (msb + 1))
+	{
+		++msb;
+	}
+	std::size_t shift = msb - 4;
+	return 32 + (shift - 1) * 16 + static_cast<std::size_t>((value >> shift) - 16);
+}
+
+boost::uint64_t latency_histogram::bucket_value(std::size_t index)
+{
+	if (index < 32)
+	{
+		return index;
+	}
+	std::size_t shift = (index - 32) / 16 + 1;
+	boost::uint64_t sub = (index - 32) % 16 + 16;
+	return ((sub + 1) << shift) - 1;
+}
+
+void latency_histogram::record(boost::uint64_t value)
+{
+	++counts_[bucket_index(value)];
+	if (count_ == 0 || value < min_)
+	{
+		min_ = value;
+	}
+	if (value > max_)
+	{
+		max_ = value;
+	}
+	++count_;
+	sum_ += value;
+}
+
+boost::uint64_t latency_histogram::count() const
+{
+	return count_;
+}
+
+boost::uint64_t latency_histogram::min() const
+{
+	return min_;
+}
+
+boost::uint64_t latency_histogram::max() const
+{
+	return max_;
+}
+
+boost::uint64_t latency_histogram::mean() const
+{
+	return count_ ? sum_ / count_ : 0;
+}
+
+boost::uint64_t latency_histogram::percentile(double percent) const
+{
+	if (count_ == 0)
+	{
+		return 0;
+	}
+
+	boost::uint64_t rank = static_cast<boost::uint64_t>(count_ * percent / 100.0 + 0.5);
+	if (rank == 0)
+	{
+		rank = 1;
+	}
+
+	boost::uint64_t seen = 0;
+	for (std::size_t i = 0; i < bucket_count; ++i)
+	{
+		seen += counts_[i];
+		if (seen >= rank)
+		{
+			return std::min(bucket_value(i), max_);
+		}
+	}
+	return max_;
+}
+
+latency_stats::stream_stats::stream_stats()
+	: queued_messages(0), queued_bytes(0), max_queued_messages(0), max_queued_bytes(0)
+{
+}
+
+const char* const latency_stats::overflow_name = "(other)";
+
+latency_stats::stream_stats& latency_stats::stream(const std::string& name)
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	stream_map::iterator i = streams_.find(name);
+	if (i != streams_.end())
+	{
+		return i->second;
+	}
+	if (streams_.size() >= max_streams)
+	{
+		return streams_[overflow_name];
+	}
+	return streams_[name];
+}
+
+void latency_stats::record_reassembly(stream_stats& stats, boost::uint64_t microseconds)
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	stats.reassembly.record(microseconds);
+}
+
+void latency_stats::record_delivery(stream_stats& stats, boost::uint64_t microseconds)
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	stats.delivery.record(microseconds);
+}
+
+void latency_stats::enqueued(stream_stats& stats, std::size_t bytes)
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	++stats.queued_messages;
+	stats.queued_bytes += bytes;
+	stats.max_queued_messages = std::max(stats.max_queued_messages, stats.queued_messages);
+	stats.max_queued_bytes = std::max(stats.max_queued_bytes, stats.queued_bytes);
+}
+
+void latency_stats::dequeued(stream_stats& stats, std::size_t bytes)
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	--stats.queued_messages;
+	stats.queued_bytes -= bytes;
+}
+
+latency_stats::stream_map latency_stats::snapshot() const
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	return streams_;
+}
+
+namespace {
+
+void report_histogram(std::ostream& os, const std::string& stream, const char* name, const latency_histogram& h)
+{
+	os << stream << ' ' << name
+		<< " count=" << h.count()
+		<< " min=" << h.min()
+		<< " mean=" << h.mean()
+		<< " p50=" << h.percentile(50)
+		<< " p90=" << h.percentile(90)
+		<< " p99=" << h.percentile(99)
+		<< " p999=" << h.percentile(99.9)
+		<< " max=" << h.max() << "\n";
+}
+
+} // namespace
+
+std::string latency_stats::report() const
+{
+	std::ostringstream os;
+
+	// Formatted under the lock rather than from a snapshot, which would copy
+	// every histogram.
+	boost::mutex::scoped_lock lock(mutex_);
+	os << "# latencies in microseconds\n";
+	for (stream_map::const_iterator i = streams_.begin(); i != streams_.end(); ++i)
+	{
+		const stream_stats& s = i->second;
+		report_histogram(os, i->first, "reassembly", s.reassembly);
+		report_histogram(os, i->first, "delivery", s.delivery);
+		os << i->first << " queue"
+			<< " messages=" << s.queued_messages
+			<< " bytes=" << s.queued_bytes
+			<< " max_messages=" << s.max_queued_messages
+			<< " max_bytes=" << s.max_queued_bytes << "\n";
+	}
+	return os.str();
+}
+
+} // namespace server
+} // namespace http
@@ -15,9 +15,42 @@ int main(int argc, char* argv[])
 	try
 	{
 		// Check command line arguments.
-		if (argc != 4)
+		std::string trace_dir;
+		std::string so_dir;
+		http::server::delivery_policy_map policies;
+		bool usage = argc < 4;
+		for (int i = 4; i < argc && !usage; ++i)
 		{
-			std::cerr << "Usage: http_server <address> <port> <doc_root>\n";
+			std::string arg = argv[i];
+			if (arg == "--so-dir" && i + 1 < argc)
+			{
+				so_dir = argv[++i];
+			}
+			else if (arg == "--policy" && i + 1 < argc)
+			{
+				std::string application;
+				http::server::delivery_policy policy;
+				usage = !http::server::parse_delivery_policy(argv[++i], application, policy);
+				policies[application] = policy;
+			}
+			else if (i == 4 && arg.compare(0, 2, "--") != 0)
+			{
+				trace_dir = arg;
+			}
+			else
+			{
+				usage = true;
+			}
+		}
+		if (usage)
+		{
+			std::cerr << "Usage: http_server <address> <port> <doc_root> [trace_dir] [--so-dir <dir>]\n";
+			std::cerr << "         [--policy <app>:<option>[,<option>...]]...\n";
+			std::cerr << "  --so-dir  where persistent shared objects are saved; keep it\n";
+			std::cerr << "            outside doc_root, which is served to anyone\n";
+			std::cerr << "  --policy  delivery policy of an application; options are\n";
+			std::cerr << "            low_latency, notsent_lowat=<bytes> and\n";
+			std::cerr << "            send_buffer_seconds=<seconds>\n";
 			std::cerr << "  For IPv4, try:\n";
 			std::cerr << "    receiver 0.0.0.0 80 .\n";
 			std::cerr << "  For IPv6, try:\n";
@@ -32,7 +65,11 @@ int main(int argc, char* argv[])
 		pthread_sigmask(SIG_BLOCK, &new_mask, &old_mask);
 
 		// Run server in background thread.
-		http::server::server s(argv[1], argv[2], argv[3]);
+		http::server::server s(argv[1], argv[2], argv[3], trace_dir, so_dir);
+		for (http::server::delivery_policy_map::const_iterator i = policies.begin(); i != policies.end(); ++i)
+		{
+			s.set_delivery_policy(i->first, i->second);
+		}
 		boost::thread t(boost::bind(&http::server::server::run, &s));
 
 		// Restore previous signals.
@@ -1,316 +1,318 @@
-//#include "protocol_manager.hpp"
-//
-//namespace http {
-//namespace server {
-//
-//protocolManager::protocolManager()
-//	: state_(method_start)
-//{
-//}
-//
-//void protocolManager::reset()
-//{
-//	state_ = method_start;
-//}
-//
-//
-//boost::tribool protocolManager::consume(request& req, char input)
-//{
-//	switch (state_)
-//	{
-//		case method_start:
-//			if (!is_char(input) || is_ctl(input) || is_tspecial(input))
-//			{
-//				return false;
-//			}
-//			else
-//			{
-//				state_ = method;
-//				req.method.push_back(input);
-//				return boost::indeterminate;
-//			}
-//		case method:
-//			if (input == ' ')
-//			{
-//				state_ = uri;
-//				return boost::indeterminate;
-//			}
-//			else if (!is_char(input) || is_ctl(input) || is_tspecial(input))
-//			{
-//				return false;
-//			}
-//			else
-//			{
-//				req.method.push_back(input);
-//				return boost::indeterminate;
-//			}
-//		case uri_start:
-//			if (is_ctl(input))
-//			{
-//				return false;
-//			}
-//			else
-//			{
-//				state_ = uri;
-//				req.uri.push_back(input);
-//				return boost::indeterminate;
-//			}
-//		case uri:
-//			if (input == ' ')
-//			{
-//				state_ = http_version_h;
-//				return boost::indeterminate;
-//			}
-//			else if (is_ctl(input))
-//			{
-//				return false;
-//			}
-//			else
-//			{
-//				req.uri.push_back(input);
-//				return boost::indeterminate;
-//			}
-//		case http_version_h:
-//			if (input == 'H')
-//			{
-//				state_ = http_version_t_1;
-//				return boost::indeterminate;
-//			}
-//			else
-//			{
-//				return false;
-//			}
-//		case http_version_t_1:
-//			if (input == 'T')
-//			{
-//				state_ = http_version_t_2;
-//				return boost::indeterminate;
-//			}
-//			else
-//			{
-//				return false;
-//			}
-//		case http_version_t_2:
-//			if (input == 'T')
-//			{
-//				state_ = http_version_p;
-//				return boost::indeterminate;
-//			}
-//			else
-//			{
-//				return false;
-//			}
-//		case http_version_p:
-//			if (input == 'P')
-//			{
-//				state_ = http_version_slash;
-//				return boost::indeterminate;
-//			}
-//			else
-//			{
-//				return false;
-//			}
-//		case http_version_slash:
-//			if (input == '/')
-//			{
-//				req.http_version_major = 0;
-//				req.http_version_minor = 0;
-//				state_ = http_version_major_start;
-//				return boost::indeterminate;
-//			}
-//			else
-//			{
-//				return false;
-//			}
-//		case http_version_major_start:
-//			if (is_digit(input))
-//			{
-//				req.http_version_major = req.http_version_major * 10 + input - '0';
-//				state_ = http_version_major;
-//				return boost::indeterminate;
-//			}
-//			else
-//			{
-//				return false;
-//			}
-//		case http_version_major:
-//			if (input == '.')
-//			{
-//				state_ = http_version_minor_start;
-//				return boost::indeterminate;
-//			}
-//			else if (is_digit(input))
-//			{
-//				req.http_version_major = req.http_version_major * 10 + input - '0';
-//				return boost::indeterminate;
-//			}
-//			else
-//			{
-//				return false;
-//			}
-//		case http_version_minor_start:
-//			if (is_digit(input))
-//			{
-//				req.http_version_minor = req.http_version_minor * 10 + input - '0';
-//				state_ = http_version_minor;
-//				return boost::indeterminate;
-//			}
-//			else
-//			{
-//				return false;
-//			}
-//		case http_version_minor:
-//			if (input == '\r')
-//			{
-//				state_ = expecting_newline_1;
-//				return boost::indeterminate;
-//			}
-//			else if (is_digit(input))
-//			{
-//				req.http_version_minor = req.http_version_minor * 10 + input - '0';
-//				return boost::indeterminate;
-//			}
-//			else
-//			{
-//				return false;
-//			}
-//		case expecting_newline_1:
-//			if (input == '\n')
-//			{
-//				state_ = header_line_start;
-//				return boost::indeterminate;
-//			}
-//			else
-//			{
-//				return false;
-//			}
-//		case header_line_start:
-//			if (input == '\r')
-//			{
-//				state_ = expecting_newline_3;
-//				return boost::indeterminate;
-//			}
-//			else if (!req.headers.empty() && (input == ' ' || input == '\t'))
-//			{
-//				state_ = header_lws;
-//				return boost::indeterminate;
-//			}
-//			else if (!is_char(input) || is_ctl(input) || is_tspecial(input))
-//			{
-//				return false;
-//			}
-//			else
-//			{
-//				req.headers.push_back(header());
-//				req.headers.back().name.push_back(input);
-//				state_ = header_name;
-//				return boost::indeterminate;
-//			}
-//		case header_lws:
-//			if (input == '\r')
-//			{
-//				state_ = expecting_newline_2;
-//				return boost::indeterminate;
-//			}
-//			else if (input == ' ' || input == '\t')
-//			{
-//				return boost::indeterminate;
-//			}
-//			else if (is_ctl(input))
-//			{
-//				return false;
-//			}
-//			else
-//			{
-//				state_ = header_value;
-//				req.headers.back().value.push_back(input);
-//				return boost::indeterminate;
-//			}
-//		case header_name:
-//			if (input == ':')
-//			{
-//				state_ = space_before_header_value;
-//				return boost::indeterminate;
-//			}
-//			else if (!is_char(input) || is_ctl(input) || is_tspecial(input))
-//			{
-//				return false;
-//			}
-//			else
-//			{
-//				req.headers.back().name.push_back(input);
-//				return boost::indeterminate;
-//			}
-//		case space_before_header_value:
-//			if (input == ' ')
-//			{
-//				state_ = header_value;
-//				return boost::indeterminate;
-//			}
-//			else
-//			{
-//				return false;
-//			}
-//		case header_value:
-//			if (input == '\r')
-//			{
-//				state_ = expecting_newline_2;
-//				return boost::indeterminate;
-//			}
-//			else if (is_ctl(input))
-//			{
-//				return false;
-//			}
-//			else
-//			{
-//				req.headers.back().value.push_back(input);
-//				return boost::indeterminate;
-//			}
-//		case expecting_newline_2:
-//			if (input == '\n')
-//			{
-//				state_ = header_line_start;
-//				return boost::indeterminate;
-//			}
-//			else
-//			{
-//				return false;
-//			}
-//		case expecting_newline_3:
-//			return (input == '\n');
-//		default:
-//			return false;
-//	}
-//}
-//
-//bool protocolManager::is_char(int c)
-//{
-//	return c >= 0 && c <= 127;
-//}
-//
-//bool protocolManager::is_ctl(int c)
-//{
-//	return c >= 0 && c <= 31 || c == 127;
-//}
-//
-//bool protocolManager::is_tspecial(int c)
-//{
-//	switch (c)
-//	{
-//		case '(': case ')': case '<': case '>': case '@':
-//		case ',': case ';': case ':': case '\\': case '"':
-//		case '/': case '[': case ']': case '?': case '=':
-//		case '{': case '}': case ' ': case '\t':
-//			return true;
-//		default:
-//			return false;
-//	}
-//}
-//
-//bool protocolManager::is_digit(int c)
-//{
-//	return c >= '0' && c <= '9';
-//}
-//
-//} // namespace server
-//} // namespace http
+#include "protocol_manager.hpp"
+#include <algorithm>
+#include "constants.hpp"
+#include "monotonic_clock.hpp"
+
+namespace http {
+namespace server {
+
+namespace {
+
+inline unsigned int get_ui24(const unsigned char* p)
+{
+	return (p[0] << 16) | (p[1] << 8) | p[2];
+}
+
+inline unsigned int get_ui32(const unsigned char* p)
+{
+	return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+inline unsigned int get_ui32_le(const unsigned char* p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24);
+}
+
+inline void put_basic_header(std::string& out, unsigned int format, unsigned int csid)
+{
+	if (csid < 64)
+	{
+		out += static_cast<char>((format << 6) | csid);
+	}
+	else if (csid < 64 + 256)
+	{
+		out += static_cast<char>(format << 6);
+		out += static_cast<char>(csid - 64);
+	}
+	else
+	{
+		out += static_cast<char>((format << 6) | 1);
+		out += static_cast<char>((csid - 64) & 0xff);
+		out += static_cast<char>((csid - 64) >> 8);
+	}
+}
+
+inline void put_ui24(std::string& out, unsigned int value)
+{
+	out += static_cast<char>(value >> 16);
+	out += static_cast<char>(value >> 8);
+	out += static_cast<char>(value);
+}
+
+inline void put_ui32(std::string& out, unsigned int value)
+{
+	out += static_cast<char>(value >> 24);
+	put_ui24(out, value);
+}
+
+inline void put_ui32_le(std::string& out, unsigned int value)
+{
+	out += static_cast<char>(value);
+	out += static_cast<char>(value >> 8);
+	out += static_cast<char>(value >> 16);
+	out += static_cast<char>(value >> 24);
+}
+
+/// Size of the message header for each chunk format.
+const std::size_t message_header_size[4] = { 11, 7, 3, 0 };
+
+} // namespace
+
+protocolManager::chunk_stream::chunk_stream()
+	: timestamp_delta(0), extended_timestamp(false), received(0)
+{
+	header.timestamp = 0;
+	header.length = 0;
+	header.type_id = 0;
+	header.stream_id = 0;
+}
+
+protocolManager::protocolManager()
+	: chunk_size_(default_chunk_size)
+{
+}
+
+void protocolManager::reset()
+{
+	pending_.clear();
+	chunk_size_ = default_chunk_size;
+	streams_.clear();
+}
+
+std::size_t protocolManager::chunk_size() const
+{
+	return chunk_size_;
+}
+
+void protocolManager::write_message(const message& m, std::size_t chunk_size, std::string& out)
+{
+	bool extended = m.header.timestamp >= 0xffffff;
+	std::size_t length = m.payload.size();
+	std::size_t chunks = length == 0 ? 1 : (length + chunk_size - 1) / chunk_size;
+	out.reserve(out.size() + length + 18 + (chunks - 1) * (3 + (extended ? 4 : 0)));
+
+	put_basic_header(out, constants::HEADER_NEW, m.chunk_stream_id);
+	put_ui24(out, extended ? 0xffffff : m.header.timestamp);
+	put_ui24(out, static_cast<unsigned int>(length));
+	out += static_cast<char>(m.header.type_id);
+	put_ui32_le(out, m.header.stream_id);
+
+	for (std::size_t offset = 0; ; )
+	{
+		if (extended)
+		{
+			put_ui32(out, m.header.timestamp);
+		}
+
+		std::size_t size = std::min(chunk_size, length - offset);
+		out.append(m.payload, offset, size);
+		offset += size;
+		if (offset >= length)
+		{
+			break;
+		}
+		put_basic_header(out, constants::HEADER_CONTINUE, m.chunk_stream_id);
+	}
+}
+
+boost::tribool protocolManager::parse(const char* begin, const char* end, std::vector<message>& messages)
+{
+	std::size_t completed = messages.size();
+	boost::uint64_t now = monotonic_microseconds();
+
+	// Only copy when a chunk straddles two reads; the common case decodes
+	// straight out of the caller's buffer.
+	const char* data = begin;
+	std::size_t length = end - begin;
+	if (!pending_.empty())
+	{
+		pending_.insert(pending_.end(), begin, end);
+		data = &pending_[0];
+		length = pending_.size();
+	}
+
+	std::size_t offset = 0;
+	while (offset < length)
+	{
+		int used = decode_chunk(data + offset, length - offset, now, messages);
+		if (used < 0)
+		{
+			return false;
+		}
+		if (used == 0)
+		{
+			break;
+		}
+		offset += used;
+	}
+
+	if (pending_.empty())
+	{
+		pending_.assign(data + offset, data + length);
+	}
+	else
+	{
+		pending_.erase(pending_.begin(), pending_.begin() + offset);
+	}
+
+	if (messages.size() > completed)
+	{
+		return true;
+	}
+	return boost::indeterminate;
+}
+
+int protocolManager::decode_chunk(const char* data, std::size_t length, boost::uint64_t now, std::vector<message>& messages)
+{
+	const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+	std::size_t used = 1;
+
+	// Basic header: 2 bits of format, then a 1, 2 or 3 byte chunk stream id.
+	unsigned int format = p[0] >> 6;
+	unsigned int csid = p[0] & 0x3f;
+	if (csid == 0)
+	{
+		if (length < 2)
+		{
+			return 0;
+		}
+		csid = 64 + p[1];
+		used = 2;
+	}
+	else if (csid == 1)
+	{
+		if (length < 3)
+		{
+			return 0;
+		}
+		csid = 64 + p[1] + (p[2] << 8);
+		used = 3;
+	}
+
+	if (length < used + message_header_size[format])
+	{
+		return 0;
+	}
+
+	chunk_stream& stream = streams_[csid];
+	const unsigned char* h = p + used;
+	used += message_header_size[format];
+
+	// A new message may only start on a chunk with a non-continuation header,
+	// except when the previous message on this chunk stream is complete.
+	bool starts_message = stream.payload.empty();
+	if (format != constants::HEADER_CONTINUE && !starts_message)
+	{
+		return -1;
+	}
+
+	unsigned int timestamp_field = 0;
+	switch (format)
+	{
+		case constants::HEADER_NEW:
+			timestamp_field = get_ui24(h);
+			stream.header.length = get_ui24(h + 3);
+			stream.header.type_id = h[6];
+			stream.header.stream_id = get_ui32_le(h + 7);
+			break;
+		case constants::HEADER_SAME_SOURCE:
+			timestamp_field = get_ui24(h);
+			stream.header.length = get_ui24(h + 3);
+			stream.header.type_id = h[6];
+			break;
+		case constants::HEADER_TIMER_CHANGE:
+			timestamp_field = get_ui24(h);
+			break;
+		default:
+			break;
+	}
+
+	if (format != constants::HEADER_CONTINUE)
+	{
+		stream.extended_timestamp = (timestamp_field == 0xffffff);
+	}
+
+	if (stream.extended_timestamp)
+	{
+		if (length < used + 4)
+		{
+			return 0;
+		}
+		if (format != constants::HEADER_CONTINUE)
+		{
+			timestamp_field = get_ui32(p + used);
+		}
+		used += 4;
+	}
+
+	if (stream.header.length > max_message_length)
+	{
+		return -1;
+	}
+
+	std::size_t remaining = stream.header.length - stream.payload.size();
+	std::size_t chunk_length = std::min(remaining, chunk_size_);
+	if (length < used + chunk_length)
+	{
+		return 0;
+	}
+
+	// Only now that the whole chunk is present do we commit header state.
+	if (starts_message)
+	{
+		if (format == constants::HEADER_NEW)
+		{
+			stream.header.timestamp = timestamp_field;
+			stream.timestamp_delta = 0;
+		}
+		else
+		{
+			if (format != constants::HEADER_CONTINUE)
+			{
+				stream.timestamp_delta = timestamp_field;
+			}
+			stream.header.timestamp += stream.timestamp_delta;
+		}
+		stream.payload.reserve(stream.header.length);
+		stream.received = now;
+	}
+
+	stream.payload.append(data + used, chunk_length);
+	used += chunk_length;
+
+	if (stream.payload.size() == stream.header.length)
+	{
+		messages.push_back(message());
+		message& m = messages.back();
+		m.header = stream.header;
+		m.chunk_stream_id = csid;
+		m.payload.swap(stream.payload);
+		m.received = stream.received;
+		m.completed = now;
+
+		if (m.header.type_id == constants::TYPE_CHUNK_SIZE && m.payload.size() >= 4)
+		{
+			std::size_t size = get_ui32(reinterpret_cast<const unsigned char*>(m.payload.data())) & 0x7fffffff;
+			if (size == 0)
+			{
+				return -1;
+			}
+			chunk_size_ = size;
+		}
+	}
+
+	return static_cast<int>(used);
+}
+
+} // namespace server
+} // namespace http
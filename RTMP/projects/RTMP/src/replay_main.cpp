@@ -0,0 +1,174 @@
+// Replays a session recorded with "http_server ... <trace_dir>".
+//
+// In-process mode feeds the trace straight into the handshake and chunk
+// parsers as fast as possible and reports throughput, giving a repeatable CPU
+// benchmark of the protocol stack. Loopback mode sends the trace to a running
+// server over TCP, honouring the recorded inter-arrival times.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+#include "handshake_manager.hpp"
+#include "monotonic_clock.hpp"
+#include "protocol_manager.hpp"
+#include "session_trace.hpp"
+
+using namespace http::server;
+
+namespace {
+
+/// Totals for one in-process pass over a trace.
+struct replay_result
+{
+	std::size_t bytes;
+	std::size_t messages;
+	bool valid;
+};
+
+replay_result replay_in_process(const std::vector<trace_record>& records)
+{
+	replay_result result = { 0, 0, true };
+	handshakeManager handshake;
+	protocolManager protocol;
+	std::vector<message> messages;
+
+	for (std::size_t i = 0; result.valid && i < records.size(); ++i)
+	{
+		const trace_record& record = records[i];
+		const char* begin = record.data.data();
+		const char* end = begin + record.data.size();
+		result.bytes += record.data.size();
+
+		if (!handshake.complete())
+		{
+			boost::tribool parsed;
+			boost::tie(parsed, begin) = handshake.parse(begin, end);
+			if (!parsed)
+			{
+				result.valid = false;
+			}
+		}
+
+		if (handshake.complete() && begin != end)
+		{
+			messages.clear();
+			if (!protocol.parse(begin, end, messages))
+			{
+				result.valid = false;
+			}
+			result.messages += messages.size();
+		}
+	}
+	return result;
+}
+
+int run_in_process(trace_reader& reader, unsigned int iterations)
+{
+	// The whole trace is read before timing starts, so that only the
+	// protocol stack is measured and not the disk or the allocator.
+	std::vector<trace_record> records;
+	trace_record record;
+	while (reader.next(record))
+	{
+		records.push_back(record);
+	}
+
+	replay_result result = { 0, 0, true };
+	boost::uint64_t start = monotonic_microseconds();
+
+	for (unsigned int i = 0; i < iterations && result.valid; ++i)
+	{
+		result = replay_in_process(records);
+	}
+
+	boost::uint64_t elapsed = monotonic_microseconds() - start;
+	if (!result.valid)
+	{
+		std::cerr << "trace contains invalid protocol data\n";
+		return 1;
+	}
+
+	double seconds = elapsed / 1000000.0;
+	std::cout << iterations << " iterations, " << result.bytes << " bytes and "
+		<< result.messages << " messages per iteration\n";
+	std::cout << seconds << " s total, " << (result.bytes * static_cast<double>(iterations)) / (1024 * 1024) / seconds
+		<< " MB/s, " << (result.messages * static_cast<double>(iterations)) / seconds << " messages/s\n";
+	return 0;
+}
+
+int run_loopback(trace_reader& reader, const std::string& host, const std::string& port)
+{
+	boost::asio::io_service io_service;
+	boost::asio::ip::tcp::resolver resolver(io_service);
+	boost::asio::ip::tcp::resolver::query query(host, port);
+	boost::asio::ip::tcp::socket socket(io_service);
+	socket.connect(*resolver.resolve(query));
+
+	boost::array<char, 8192> discard;
+	trace_record record;
+	boost::uint64_t sent = 0;
+	boost::uint64_t due = monotonic_microseconds();
+
+	while (reader.next(record))
+	{
+		// Sleep until the record's original arrival time, measured from the
+		// previous record's due time so that write latency does not accumulate.
+		due += record.delay;
+		boost::uint64_t now = monotonic_microseconds();
+		if (due > now)
+		{
+			boost::this_thread::sleep(boost::posix_time::microseconds(static_cast<long>(due - now)));
+		}
+
+		boost::asio::write(socket, boost::asio::buffer(record.data));
+		sent += record.data.size();
+
+		// Drain whatever the server sent back so it never blocks on us.
+		while (socket.available())
+		{
+			socket.read_some(boost::asio::buffer(discard));
+		}
+	}
+
+	std::cout << sent << " bytes replayed\n";
+	return 0;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+	try
+	{
+		if (argc < 2 || argc > 4)
+		{
+			std::cerr << "Usage: replay <trace> [iterations]\n";
+			std::cerr << "       replay <trace> <host> <port>\n";
+			return 1;
+		}
+
+		trace_reader reader(argv[1]);
+		if (!reader.is_open())
+		{
+			std::cerr << "not a session trace: " << argv[1] << "\n";
+			return 1;
+		}
+
+		if (argc == 4)
+		{
+			return run_loopback(reader, argv[2], argv[3]);
+		}
+
+		unsigned int iterations = argc == 3 ? boost::lexical_cast<unsigned int>(argv[2]) : 1;
+		return run_in_process(reader, iterations);
+	}
+	catch (std::exception& e)
+	{
+		std::cerr << "exception: " << e.what() << "\n";
+	}
+
+	return 1;
+}
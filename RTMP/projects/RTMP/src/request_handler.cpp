@@ -3,6 +3,7 @@
 #include <sstream>
 #include <string>
 #include <boost/lexical_cast.hpp>
+#include "latency_stats.hpp"
 #include "mime_types.hpp"
 #include "reply.hpp"
 #include "request.hpp"
@@ -10,8 +11,8 @@
 namespace http {
 namespace server {
 
-request_handler::request_handler(const std::string& doc_root)
-	: doc_root_(doc_root)
+request_handler::request_handler(const std::string& doc_root, const latency_stats& stats)
+	: doc_root_(doc_root), stats_(stats)
 {
 }
 
@@ -32,6 +33,19 @@ void request_handler::handle_request(const request& req, reply& rep)
 		return;
 	}
 
+	// Latency statistics are generated rather than read from a file.
+	if (request_path == "/stats")
+	{
+		rep.status = reply::ok;
+		rep.content = stats_.report();
+		rep.headers.resize(2);
+		rep.headers[0].name = "Content-Length";
+		rep.headers[0].value = boost::lexical_cast<std::string>(rep.content.size());
+		rep.headers[1].name = "Content-Type";
+		rep.headers[1].value = "text/plain";
+		return;
+	}
+
 	// If path ends in slash (i.e. is a directory) then add "index.html".
 	if (request_path[request_path.size() - 1] == '/')
 	{
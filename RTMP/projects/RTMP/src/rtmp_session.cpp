@@ -0,0 +1,226 @@
+#include "rtmp_session.hpp"
+#include <boost/lexical_cast.hpp>
+#include "amf0.hpp"
+
+namespace http {
+namespace server {
+
+namespace {
+
+/// Chunk stream of protocol control messages.
+const unsigned int control_chunk_stream = 2;
+
+/// Chunk stream of command replies.
+const unsigned int command_chunk_stream = 3;
+
+/// Bytes the client may receive before acknowledging, and may send us.
+const unsigned int window_size = 2500000;
+
+/// Set Peer Bandwidth limit type letting the client pick hard or soft.
+const unsigned char limit_dynamic = 2;
+
+} // namespace
+
+rtmp_session::rtmp_session(transport& output, shared_object_store& shared_objects, latency_stats& stats, const delivery_policy_map& policies)
+	: transport_(output), shared_objects_(shared_objects), stats_(stats), policies_(policies), handshake_replied_(false)
+{
+}
+
+bool rtmp_session::process(const char* begin, const char* end)
+{
+	if (!handshakeManager_.complete())
+	{
+		boost::tribool result;
+		boost::tie(result, begin) = handshakeManager_.parse(begin, end);
+		if (!result)
+		{
+			return false;
+		}
+
+		if (handshakeManager_.reply_ready() && !handshake_replied_)
+		{
+			handshake_replied_ = true;
+			const boost::array<char, 1 + 2 * constants::HANDSHAKE_SIZE>& reply = handshakeManager_.reply();
+			send(boost::shared_ptr<const std::string>(new std::string(reply.begin(), reply.end())), 0, 0);
+		}
+	}
+
+	if (handshakeManager_.complete() && begin != end)
+	{
+		messages_.clear();
+		boost::tribool result = protocolManager_.parse(begin, end, messages_);
+		if (!result)
+		{
+			return false;
+		}
+
+		for (std::size_t i = 0; i < messages_.size(); ++i)
+		{
+			handle_message(messages_[i]);
+		}
+	}
+
+	return true;
+}
+
+void rtmp_session::close()
+{
+	shared_objects_.unsubscribe_all(this);
+}
+
+void rtmp_session::send(const boost::shared_ptr<const std::string>& data, boost::uint64_t received, latency_stats::stream_stats* stats)
+{
+	transport_.send(data, received, stats);
+}
+
+latency_stats::stream_stats& rtmp_session::stream_stats(unsigned int stream_id)
+{
+	std::map<unsigned int, latency_stats::stream_stats*>::iterator i = streams_.find(stream_id);
+	if (i != streams_.end())
+	{
+		return *i->second;
+	}
+
+	// A stream not yet published is counted by its id.
+	std::map<unsigned int, std::string>::const_iterator n = stream_names_.find(stream_id);
+	std::string name = "stream:" + application_ + "/"
+		+ (n != stream_names_.end() ? n->second : "#" + boost::lexical_cast<std::string>(stream_id));
+	latency_stats::stream_stats& stats = stats_.stream(name);
+	streams_[stream_id] = &stats;
+	return stats;
+}
+
+void rtmp_session::handle_message(const message& m)
+{
+	switch (m.header.type_id)
+	{
+		case constants::TYPE_AUDIO_DATA:
+		case constants::TYPE_VIDEO_DATA:
+			stats_.record_reassembly(stream_stats(m.header.stream_id), m.completed - m.received);
+			break;
+		case constants::TYPE_INVOKE:
+			handle_invoke(m);
+			break;
+		case constants::TYPE_SHARED_OBJECT:
+			shared_objects_.handle_message(this, m.payload, m.received);
+			break;
+		case constants::TYPE_FLEX_SHARED_OBJECT:
+			// AMF3 shared object messages carry one leading encoding byte.
+			if (!m.payload.empty())
+			{
+				shared_objects_.handle_message(this, m.payload.substr(1), m.received);
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+void rtmp_session::handle_invoke(const message& m)
+{
+	// Command name, transaction id, then the command object.
+	const char* p = m.payload.data();
+	const char* end = p + m.payload.size();
+	std::string command;
+	double transaction_id = 0;
+	if (!amf0::read_string(p, end, command) || !amf0::read_number(p, end, transaction_id))
+	{
+		return;
+	}
+
+	if (command == ACTION_CONNECT)
+	{
+		const char* object = p;
+		std::string application;
+		if (amf0::find_string_property(object, end, "app", application))
+		{
+			application_ = application;
+			apply_policy(application);
+		}
+		object = p;
+		double object_encoding = 0;
+		amf0::find_number_property(object, end, "objectEncoding", object_encoding);
+		accept_connect(transaction_id, object_encoding);
+		return;
+	}
+
+	// publish: a null command object, then the stream name.
+	std::string name;
+	if (command == ACTION_PUBLISH && amf0::skip_value(p, end) && amf0::read_string(p, end, name))
+	{
+		stream_names_[m.header.stream_id] = name;
+		streams_.erase(m.header.stream_id);
+	}
+}
+
+void rtmp_session::accept_connect(double transaction_id, double object_encoding)
+{
+	std::string window;
+	amf0::put_ui32(window, window_size);
+	send_message(control_chunk_stream, constants::TYPE_SERVER_BANDWIDTH, window);
+
+	std::string bandwidth;
+	amf0::put_ui32(bandwidth, window_size);
+	bandwidth += static_cast<char>(limit_dynamic);
+	send_message(control_chunk_stream, constants::TYPE_CLIENT_BANDWIDTH, bandwidth);
+
+	// Stream Begin for stream 0.
+	std::string begin;
+	amf0::put_ui16(begin, 0);
+	amf0::put_ui32(begin, 0);
+	send_message(control_chunk_stream, constants::TYPE_PING, begin);
+
+	std::string result;
+	amf0::put_string(result, "_result");
+	amf0::put_number(result, transaction_id);
+	result += static_cast<char>(0x03);
+	amf0::put_utf(result, "fmsVer");
+	amf0::put_string(result, "FMS/3,0,1,123");
+	amf0::put_utf(result, "capabilities");
+	amf0::put_number(result, 31);
+	amf0::put_object_end(result);
+	result += static_cast<char>(0x03);
+	amf0::put_utf(result, "level");
+	amf0::put_string(result, "status");
+	amf0::put_utf(result, "code");
+	amf0::put_string(result, "NetConnection.Connect.Success");
+	amf0::put_utf(result, "description");
+	amf0::put_string(result, "Connection succeeded.");
+	amf0::put_utf(result, "objectEncoding");
+	amf0::put_number(result, object_encoding);
+	amf0::put_object_end(result);
+	send_message(command_chunk_stream, constants::TYPE_INVOKE, result);
+}
+
+void rtmp_session::send_message(unsigned int chunk_stream, unsigned char type, const std::string& payload)
+{
+	message m;
+	m.received = m.completed = 0;
+	m.header.timestamp = 0;
+	m.header.type_id = type;
+	m.header.stream_id = 0;
+	m.header.length = static_cast<unsigned int>(payload.size());
+	m.chunk_stream_id = chunk_stream;
+	m.payload = payload;
+
+	boost::shared_ptr<std::string> data(new std::string);
+	protocolManager::write_message(m, protocolManager::default_chunk_size, *data);
+	send(data, 0, 0);
+}
+
+void rtmp_session::apply_policy(const std::string& application)
+{
+	// "app/instance" falls back to the policy for "app".
+	delivery_policy_map::const_iterator i = policies_.find(application);
+	if (i == policies_.end())
+	{
+		i = policies_.find(application.substr(0, application.find('/')));
+	}
+	if (i != policies_.end())
+	{
+		transport_.apply_policy(i->second);
+	}
+}
+
+} // namespace server
+} // namespace http
@@ -0,0 +1,356 @@
+#include "rtmpt.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include "monotonic_clock.hpp"
+#include "reply.hpp"
+#include "request.hpp"
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <wincrypt.h>
+#pragma comment(lib, "advapi32.lib")
+#endif
+
+namespace http {
+namespace server {
+
+namespace {
+
+/// Bounds of the poll delay byte that starts every response. The client
+/// waits longer between idle polls the larger it is.
+const unsigned char min_poll_delay = 0x01;
+const unsigned char max_poll_delay = 0x21;
+
+/// Sessions not heard from for this long are closed.
+const boost::uint64_t session_timeout = 60 * 1000000;
+
+/// How often idle sessions are looked for.
+const long sweep_seconds = 5;
+
+/// Bytes of randomness in a session id.
+const std::size_t id_bytes = 16;
+
+/// Fill data with size bytes from the system's secure random number
+/// generator. Returns false if it is not available.
+bool secure_random(unsigned char* data, std::size_t size)
+{
+#if defined(_WIN32)
+	HCRYPTPROV provider;
+	if (!CryptAcquireContext(&provider, 0, 0, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT | CRYPT_SILENT))
+	{
+		return false;
+	}
+	bool ok = CryptGenRandom(provider, static_cast<DWORD>(size), data) != FALSE;
+	CryptReleaseContext(provider, 0);
+	return ok;
+#else
+	std::FILE* file = std::fopen("/dev/urandom", "rb");
+	if (!file)
+	{
+		return false;
+	}
+	bool ok = std::fread(data, 1, size, file) == size;
+	std::fclose(file);
+	return ok;
+#endif
+}
+
+} // namespace
+
+rtmpt_session::rtmpt_session(const std::string& peer, shared_object_store& shared_objects, latency_stats& stats, const delivery_policy_map& policies)
+	: peer_(peer), stats_(stats), pending_bytes_(0), overflowed_(false), delay_(min_poll_delay), last_request_(monotonic_microseconds()), session_(*this, shared_objects, stats, policies)
+{
+}
+
+rtmpt_session::~rtmpt_session()
+{
+	session_.close();
+	drop_pending();
+}
+
+void rtmpt_session::drop_pending()
+{
+	// Output that will now never be polled no longer counts as queued.
+	for (std::size_t i = 0; i < pending_.size(); ++i)
+	{
+		if (pending_[i].stats)
+		{
+			stats_.dequeued(*pending_[i].stats, pending_[i].data->size());
+		}
+	}
+	pending_.clear();
+	pending_bytes_ = 0;
+}
+
+bool rtmpt_session::process(const char* begin, const char* end)
+{
+	last_request_ = monotonic_microseconds();
+	return session_.process(begin, end);
+}
+
+void rtmpt_session::poll(std::string& out)
+{
+	last_request_ = monotonic_microseconds();
+
+	// Poll quickly while data flows and back off, doubling, while it does not.
+	if (!pending_.empty() || policy_.low_latency)
+	{
+		delay_ = min_poll_delay;
+	}
+	else if (delay_ < max_poll_delay)
+	{
+		delay_ = static_cast<unsigned char>(std::min(delay_ * 2, static_cast<int>(max_poll_delay)));
+	}
+	out += static_cast<char>(delay_);
+
+	std::size_t size = out.size();
+	for (std::size_t i = 0; i < pending_.size(); ++i)
+	{
+		size += pending_[i].data->size();
+	}
+	out.reserve(size);
+
+	// The delivery delay is measured up to the response being built, as the
+	// connection it is written on is not known here.
+	for (std::size_t i = 0; i < pending_.size(); ++i)
+	{
+		const pending_item& item = pending_[i];
+		out += *item.data;
+		if (item.stats)
+		{
+			stats_.dequeued(*item.stats, item.data->size());
+			if (item.received)
+			{
+				stats_.record_delivery(*item.stats, last_request_ - item.received);
+			}
+		}
+	}
+	pending_.clear();
+	pending_bytes_ = 0;
+}
+
+boost::uint64_t rtmpt_session::last_request() const
+{
+	return last_request_;
+}
+
+bool rtmpt_session::overflowed() const
+{
+	return overflowed_;
+}
+
+void rtmpt_session::send(const boost::shared_ptr<const std::string>& data, boost::uint64_t received, latency_stats::stream_stats* stats)
+{
+	// A client this far behind is not polling; holding more for it would let
+	// it take any amount of memory.
+	if (overflowed_ || pending_bytes_ + data->size() > max_pending_bytes)
+	{
+		overflowed_ = true;
+		drop_pending();
+		return;
+	}
+
+	pending_item item;
+	item.data = data;
+	item.received = received;
+	item.stats = stats;
+	pending_.push_back(item);
+	pending_bytes_ += data->size();
+
+	if (stats)
+	{
+		stats_.enqueued(*stats, data->size());
+	}
+}
+
+void rtmpt_session::apply_policy(const delivery_policy& policy)
+{
+	policy_ = policy;
+}
+
+std::string rtmpt_session::peer_name()
+{
+	return peer_;
+}
+
+rtmpt_manager::rtmpt_manager(boost::asio::io_service& io_service, shared_object_store& shared_objects, latency_stats& stats, const delivery_policy_map& policies)
+	: shared_objects_(shared_objects), stats_(stats), policies_(policies), timer_(io_service), timer_running_(false)
+{
+}
+
+bool rtmpt_manager::handle_request(const request& req, const std::string& peer, reply& rep)
+{
+	// Commands are "/<command>/<id>/<sequence>"; the sequence number is not
+	// needed since a client's requests arrive in order.
+	const std::string& uri = req.uri;
+	std::string::size_type command_end = uri.find('/', 1);
+	if (uri.empty() || uri[0] != '/' || command_end == std::string::npos)
+	{
+		return false;
+	}
+	std::string command = uri.substr(1, command_end - 1);
+	if (command != "open" && command != "send" && command != "idle" && command != "close")
+	{
+		return false;
+	}
+
+	if (command == "open")
+	{
+		open(peer, rep);
+		return true;
+	}
+
+	std::string::size_type id_end = uri.find('/', command_end + 1);
+	std::string id = uri.substr(command_end + 1, id_end == std::string::npos ? std::string::npos : id_end - command_end - 1);
+	std::map<std::string, session_ptr>::iterator i = sessions_.find(id);
+	if (i == sessions_.end())
+	{
+		rep = reply::stock_reply(reply::not_found);
+		return true;
+	}
+	session_ptr session = i->second;
+	if (session->overflowed())
+	{
+		sessions_.erase(i);
+		rep = reply::stock_reply(reply::not_found);
+		return true;
+	}
+
+	if (command == "close")
+	{
+		sessions_.erase(i);
+		fill_reply(rep, std::string(1, '\0'));
+		return true;
+	}
+
+	if (command == "send" && !req.content.empty() && !session->process(req.content.data(), req.content.data() + req.content.size()))
+	{
+		sessions_.erase(i);
+		rep = reply::stock_reply(reply::bad_request);
+		return true;
+	}
+
+	// Both send and idle are answered with everything queued so far.
+	std::string content;
+	session->poll(content);
+	fill_reply(rep, content);
+	return true;
+}
+
+void rtmpt_manager::stop()
+{
+	sessions_.clear();
+	if (timer_running_)
+	{
+		timer_.cancel();
+	}
+}
+
+void rtmpt_manager::open(const std::string& peer, reply& rep)
+{
+	// Each session holds an RTMP engine and its output for a minute after the
+	// client goes quiet, so their number is bounded overall and per address.
+	std::string address = peer_address(peer);
+	std::size_t from_address = 0;
+	for (std::map<std::string, session_ptr>::iterator i = sessions_.begin(); i != sessions_.end(); ++i)
+	{
+		if (peer_address(i->second->peer_name()) == address)
+		{
+			++from_address;
+		}
+	}
+	if (sessions_.size() >= max_sessions || from_address >= max_sessions_per_address)
+	{
+		rep = reply::stock_reply(reply::service_unavailable);
+		return;
+	}
+
+	// An id that could be guessed would let anyone send into or read from
+	// the session, so none is handed out without secure randomness.
+	std::string id = make_id();
+	if (id.empty() || sessions_.count(id))
+	{
+		rep = reply::stock_reply(reply::service_unavailable);
+		return;
+	}
+	sessions_[id] = session_ptr(new rtmpt_session(peer, shared_objects_, stats_, policies_));
+	fill_reply(rep, id + "\n");
+
+	if (!timer_running_)
+	{
+		timer_running_ = true;
+		timer_.expires_from_now(boost::posix_time::seconds(sweep_seconds));
+		timer_.async_wait(boost::bind(&rtmpt_manager::handle_timer, this, boost::asio::placeholders::error));
+	}
+}
+
+void rtmpt_manager::handle_timer(const boost::system::error_code& e)
+{
+	timer_running_ = false;
+	if (e)
+	{
+		return;
+	}
+
+	boost::uint64_t now = monotonic_microseconds();
+	std::map<std::string, session_ptr>::iterator i = sessions_.begin();
+	while (i != sessions_.end())
+	{
+		if (now - i->second->last_request() > session_timeout || i->second->overflowed())
+		{
+			sessions_.erase(i++);
+		}
+		else
+		{
+			++i;
+		}
+	}
+
+	if (!sessions_.empty())
+	{
+		timer_running_ = true;
+		timer_.expires_from_now(boost::posix_time::seconds(sweep_seconds));
+		timer_.async_wait(boost::bind(&rtmpt_manager::handle_timer, this, boost::asio::placeholders::error));
+	}
+}
+
+std::string rtmpt_manager::peer_address(const std::string& peer)
+{
+	return peer.substr(0, peer.rfind(':'));
+}
+
+std::string rtmpt_manager::make_id()
+{
+	unsigned char random[id_bytes];
+	if (!secure_random(random, sizeof(random)))
+	{
+		return std::string();
+	}
+
+	static const char hex[] = "0123456789ABCDEF";
+	std::string id;
+	for (std::size_t i = 0; i < sizeof(random); ++i)
+	{
+		id += hex[random[i] >> 4];
+		id += hex[random[i] & 0x0f];
+	}
+	return id;
+}
+
+void rtmpt_manager::fill_reply(reply& rep, const std::string& content)
+{
+	rep.status = reply::ok;
+	rep.content = content;
+	rep.headers.resize(3);
+	rep.headers[0].name = "Content-Length";
+	rep.headers[0].value = boost::lexical_cast<std::string>(rep.content.size());
+	rep.headers[1].name = "Content-Type";
+	rep.headers[1].value = "application/x-fcs";
+	rep.headers[2].name = "Cache-Control";
+	rep.headers[2].value = "no-cache";
+}
+
+} // namespace server
+} // namespace http
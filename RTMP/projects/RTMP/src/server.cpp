@@ -1,11 +1,12 @@
 #include "server.hpp"
 #include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
 
 namespace http {
 namespace server {
 
-server::server(const std::string& address, const std::string& port, const std::string& doc_root)
-  : io_service_(), acceptor_(io_service_), connection_manager_(), new_connection_(new connection(io_service_, connection_manager_, request_handler_)), request_handler_(doc_root)
+server::server(const std::string& address, const std::string& port, const std::string& doc_root, const std::string& trace_dir, const std::string& so_dir)
+  : io_service_(), acceptor_(io_service_), stats_(), shared_objects_(io_service_, so_dir, stats_), connection_manager_(), new_connection_(new connection(io_service_, connection_manager_, request_handler_, shared_objects_, stats_, policies_, rtmpt_)), request_handler_(doc_root, stats_), rtmpt_(io_service_, shared_objects_, stats_, policies_), trace_dir_(trace_dir), trace_count_(0)
 {
 	// Open the acceptor with the option to reuse the address (i.e. SO_REUSEADDR).
 	boost::asio::ip::tcp::resolver resolver(io_service_);
@@ -18,6 +19,21 @@ server::server(const std::string& address, const std::string& port, const std::s
 	acceptor_.async_accept(new_connection_->socket(), boost::bind(&server::handle_accept, this, boost::asio::placeholders::error));
 }
 
+shared_object_store& server::shared_objects()
+{
+	return shared_objects_;
+}
+
+void server::set_delivery_policy(const std::string& application, const delivery_policy& policy)
+{
+	policies_[application] = policy;
+}
+
+const latency_stats& server::stats() const
+{
+	return stats_;
+}
+
 void server::run()
 {
 	// The io_service::run() call will block until all asynchronous operations
@@ -38,8 +54,12 @@ void server::handle_accept(const boost::system::error_code& e)
 {
 	if (!e)
 	{
+		if (!trace_dir_.empty())
+		{
+			new_connection_->record_to(trace_dir_ + "/session-" + boost::lexical_cast<std::string>(trace_count_++) + ".rtmptrace");
+		}
 		connection_manager_.start(new_connection_);
-		new_connection_.reset(new connection(io_service_, connection_manager_, request_handler_));
+		new_connection_.reset(new connection(io_service_, connection_manager_, request_handler_, shared_objects_, stats_, policies_, rtmpt_));
 		acceptor_.async_accept(new_connection_->socket(), boost::bind(&server::handle_accept, this, boost::asio::placeholders::error));
 	}
 }
@@ -51,6 +71,7 @@ void server::handle_stop()
 	// will exit.
 	acceptor_.close();
 	connection_manager_.stop_all();
+	rtmpt_.stop();
 }
 
 } // namespace server
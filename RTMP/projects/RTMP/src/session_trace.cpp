@@ -0,0 +1,111 @@
+#include "session_trace.hpp"
+#include <cstring>
+#include "monotonic_clock.hpp"
+
+namespace http {
+namespace server {
+
+namespace {
+
+const char trace_magic[] = { 'R', 'T', 'M', 'P', 'T', 'R', 'C', '1' };
+
+} // namespace
+
+trace_writer::trace_writer(const std::string& path)
+	: file_(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc), last_(monotonic_microseconds())
+{
+	if (file_)
+	{
+		file_.write(trace_magic, sizeof(trace_magic));
+	}
+}
+
+bool trace_writer::is_open() const
+{
+	return file_.is_open() && file_.good();
+}
+
+void trace_writer::record(const char* data, std::size_t length)
+{
+	boost::uint64_t now = monotonic_microseconds();
+	write_varint(now - last_);
+	write_varint(length);
+	file_.write(data, length);
+	last_ = now;
+}
+
+void trace_writer::write_varint(boost::uint64_t value)
+{
+	char buf[10];
+	std::size_t size = 0;
+	do
+	{
+		char c = static_cast<char>(value & 0x7f);
+		value >>= 7;
+		if (value)
+		{
+			c |= 0x80;
+		}
+		buf[size++] = c;
+	} while (value);
+	file_.write(buf, size);
+}
+
+trace_reader::trace_reader(const std::string& path)
+	: file_(path.c_str(), std::ios::in | std::ios::binary), valid_(false)
+{
+	char magic[sizeof(trace_magic)];
+	if (file_.read(magic, sizeof(magic)) && std::memcmp(magic, trace_magic, sizeof(magic)) == 0)
+	{
+		valid_ = true;
+	}
+}
+
+bool trace_reader::is_open() const
+{
+	return valid_;
+}
+
+bool trace_reader::next(trace_record& record)
+{
+	boost::uint64_t length;
+	if (!valid_ || !read_varint(record.delay) || !read_varint(length))
+	{
+		return false;
+	}
+
+	record.data.resize(static_cast<std::size_t>(length));
+	if (length > 0 && !file_.read(&record.data[0], static_cast<std::streamsize>(length)))
+	{
+		return false;
+	}
+	return true;
+}
+
+void trace_reader::rewind()
+{
+	file_.clear();
+	file_.seekg(sizeof(trace_magic), std::ios::beg);
+}
+
+bool trace_reader::read_varint(boost::uint64_t& value)
+{
+	value = 0;
+	for (unsigned int shift = 0; shift < 64; shift += 7)
+	{
+		char c;
+		if (!file_.get(c))
+		{
+			return false;
+		}
+		value |= static_cast<boost::uint64_t>(c & 0x7f) << shift;
+		if (!(c & 0x80))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+} // namespace server
+} // namespace http
@@ -0,0 +1,442 @@
+#include "shared_object.hpp"
+#include <cstdio>
+#include <fstream>
+#include <boost/bind.hpp>
+#if defined(_WIN32)
+#include <windows.h>
+#endif
+#include "amf0.hpp"
+#include "constants.hpp"
+#include "protocol_manager.hpp"
+
+namespace http {
+namespace server {
+
+using namespace amf0;
+
+namespace {
+
+/// Chunk stream used for shared object messages we send.
+const unsigned int shared_object_chunk_stream = 3;
+
+inline void put_event(std::string& out, unsigned char type, const std::string& data)
+{
+	out += static_cast<char>(type);
+	put_ui32(out, static_cast<unsigned int>(data.size()));
+	out += data;
+}
+
+} // namespace
+
+shared_object_store::object::object()
+	: persistent(false), version(0), oldest_change(0), stats(0)
+{
+}
+
+shared_object_store::shared_object_store(boost::asio::io_service& io_service, const std::string& persistence_dir, latency_stats& stats)
+	: stats_(stats), persistence_dir_(persistence_dir), flush_interval_(boost::posix_time::milliseconds(100)), flush_timer_(io_service), flush_pending_(false)
+{
+}
+
+void shared_object_store::set_flush_interval(const boost::posix_time::time_duration& interval)
+{
+	flush_interval_ = interval;
+}
+
+void shared_object_store::handle_message(shared_object_subscriber* client, const std::string& body, boost::uint64_t received)
+{
+	const char* p = body.data();
+	const char* end = p + body.size();
+
+	// Header: name, version, persistence flag and a reserved field.
+	std::string name;
+	if (!read_utf(p, end, name) || name.size() > max_name_length || end - p < 12)
+	{
+		return;
+	}
+	bool persistent = get_ui32(p + 4) != 0;
+	p += 12;
+
+	object* found = get_object(name, persistent);
+	if (!found)
+	{
+		return;
+	}
+	object& obj = *found;
+
+	while (end - p >= 5)
+	{
+		unsigned char type = static_cast<unsigned char>(*p);
+		std::size_t length = get_ui32(p + 1);
+		p += 5;
+		if (static_cast<std::size_t>(end - p) < length)
+		{
+			break;
+		}
+		const char* data = p;
+		const char* data_end = p + length;
+		p = data_end;
+
+		switch (type)
+		{
+			case constants::SO_CONNECT:
+				obj.subscribers.insert(client);
+				send_initial_data(obj, client, received);
+				break;
+			case constants::SO_DISCONNECT:
+				obj.subscribers.erase(client);
+				obj.acks.erase(client);
+				break;
+			case constants::SO_SET_ATTRIBUTE:
+				while (data < data_end)
+				{
+					std::string key;
+					if (!read_utf(data, data_end, key))
+					{
+						break;
+					}
+					const char* value = data;
+					if (!skip_value(data, data_end))
+					{
+						break;
+					}
+					obj.attributes[key].assign(value, data);
+					obj.changed.insert(key);
+					obj.acks[client].insert(key);
+				}
+				touch(obj, received);
+				break;
+			case constants::SO_DELETE_ATTRIBUTE:
+				while (data < data_end)
+				{
+					std::string key;
+					if (!read_utf(data, data_end, key))
+					{
+						break;
+					}
+					if (obj.attributes.erase(key))
+					{
+						obj.changed.insert(key);
+					}
+				}
+				touch(obj, received);
+				break;
+			case constants::SO_SEND_MESSAGE:
+			{
+				event e;
+				e.type = constants::SO_CLIENT_SEND_MESSAGE;
+				e.data.assign(data, data_end);
+				obj.events.push_back(e);
+				touch(obj, received);
+				break;
+			}
+			default:
+				break;
+		}
+	}
+
+	release(objects_.find(name));
+}
+
+void shared_object_store::unsubscribe_all(shared_object_subscriber* client)
+{
+	object_map::iterator i = objects_.begin();
+	while (i != objects_.end())
+	{
+		i->second.subscribers.erase(client);
+		i->second.acks.erase(client);
+		release(i++);
+	}
+}
+
+void shared_object_store::flush()
+{
+	std::set<std::string> dirty;
+	dirty.swap(dirty_);
+	for (std::set<std::string>::iterator i = dirty.begin(); i != dirty.end(); ++i)
+	{
+		object_map::iterator obj = objects_.find(*i);
+		if (obj != objects_.end())
+		{
+			flush_object(obj->second);
+			release(obj);
+		}
+	}
+}
+
+shared_object_store::object* shared_object_store::get_object(const std::string& name, bool persistent)
+{
+	object_map::iterator i = objects_.find(name);
+	if (i != objects_.end())
+	{
+		return &i->second;
+	}
+	if (objects_.size() >= max_objects)
+	{
+		return 0;
+	}
+
+	object& obj = objects_[name];
+	obj.name = name;
+	obj.persistent = persistent;
+	obj.stats = &stats_.stream("so:" + name);
+	if (persistent && !persistence_dir_.empty())
+	{
+		load(obj);
+	}
+	return &obj;
+}
+
+void shared_object_store::release(object_map::iterator i)
+{
+	// A persistent object is reloaded from its snapshot when next used, so
+	// it only has to stay if there is nowhere to reload it from.
+	const object& obj = i->second;
+	if (obj.subscribers.empty() && obj.changed.empty() && obj.events.empty()
+		&& (!obj.persistent || !persistence_dir_.empty()))
+	{
+		objects_.erase(i);
+	}
+}
+
+void shared_object_store::send_initial_data(object& obj, shared_object_subscriber* client, boost::uint64_t received)
+{
+	std::string events;
+	put_event(events, constants::SO_CLIENT_INITIAL_DATA, std::string());
+	put_event(events, constants::SO_CLIENT_CLEAR_DATA, std::string());
+
+	if (!obj.attributes.empty())
+	{
+		std::string data;
+		for (std::map<std::string, std::string>::const_iterator i = obj.attributes.begin(); i != obj.attributes.end(); ++i)
+		{
+			put_utf(data, i->first);
+			data += i->second;
+		}
+		put_event(events, constants::SO_CLIENT_UPDATE_DATA, data);
+	}
+
+	client->send(encode(obj, events), received, obj.stats);
+}
+
+void shared_object_store::touch(object& obj, boost::uint64_t received)
+{
+	if (obj.oldest_change == 0 || received < obj.oldest_change)
+	{
+		obj.oldest_change = received;
+	}
+	dirty_.insert(obj.name);
+	if (!flush_pending_)
+	{
+		flush_pending_ = true;
+		flush_timer_.expires_from_now(flush_interval_);
+		flush_timer_.async_wait(boost::bind(&shared_object_store::handle_flush, this, boost::asio::placeholders::error));
+	}
+}
+
+void shared_object_store::flush_object(object& obj)
+{
+	if (obj.changed.empty() && obj.events.empty())
+	{
+		return;
+	}
+
+	++obj.version;
+
+	// One delta for every subscriber: all attribute updates in a single
+	// UPDATE_DATA event, deletions, then queued messages in arrival order.
+	std::string events;
+	std::string updates;
+	for (std::set<std::string>::const_iterator i = obj.changed.begin(); i != obj.changed.end(); ++i)
+	{
+		std::map<std::string, std::string>::const_iterator value = obj.attributes.find(*i);
+		if (value != obj.attributes.end())
+		{
+			put_utf(updates, *i);
+			updates += value->second;
+		}
+		else
+		{
+			std::string key;
+			put_utf(key, *i);
+			put_event(events, constants::SO_CLIENT_DELETE_DATA, key);
+		}
+	}
+	if (!updates.empty())
+	{
+		put_event(events, constants::SO_CLIENT_UPDATE_DATA, updates);
+	}
+	for (std::size_t i = 0; i < obj.events.size(); ++i)
+	{
+		put_event(events, obj.events[i].type, obj.events[i].data);
+	}
+
+	boost::shared_ptr<const std::string> delta = encode(obj, events);
+	for (std::set<shared_object_subscriber*>::iterator i = obj.subscribers.begin(); i != obj.subscribers.end(); ++i)
+	{
+		(*i)->send(delta, obj.oldest_change, obj.stats);
+	}
+
+	// Clients that changed attributes also get their acknowledgements.
+	for (std::map<shared_object_subscriber*, std::set<std::string> >::iterator i = obj.acks.begin(); i != obj.acks.end(); ++i)
+	{
+		if (obj.subscribers.find(i->first) == obj.subscribers.end())
+		{
+			continue;
+		}
+		std::string acks;
+		for (std::set<std::string>::const_iterator key = i->second.begin(); key != i->second.end(); ++key)
+		{
+			std::string data;
+			put_utf(data, *key);
+			put_event(acks, constants::SO_CLIENT_UPDATE_ATTRIBUTE, data);
+		}
+		i->first->send(encode(obj, acks), obj.oldest_change, obj.stats);
+	}
+
+	obj.changed.clear();
+	obj.events.clear();
+	obj.acks.clear();
+	obj.oldest_change = 0;
+
+	if (obj.persistent && !persistence_dir_.empty())
+	{
+		save(obj);
+	}
+}
+
+void shared_object_store::handle_flush(const boost::system::error_code& e)
+{
+	flush_pending_ = false;
+	if (e != boost::asio::error::operation_aborted)
+	{
+		flush();
+	}
+}
+
+boost::shared_ptr<const std::string> shared_object_store::encode(const object& obj, const std::string& events)
+{
+	message m;
+	m.received = m.completed = 0;
+	m.header.timestamp = 0;
+	m.header.type_id = constants::TYPE_SHARED_OBJECT;
+	m.header.stream_id = 0;
+	m.chunk_stream_id = shared_object_chunk_stream;
+
+	put_utf(m.payload, obj.name);
+	put_ui32(m.payload, obj.version);
+	put_ui32(m.payload, obj.persistent ? 2 : 0);
+	put_ui32(m.payload, 0);
+	m.payload += events;
+	m.header.length = static_cast<unsigned int>(m.payload.size());
+
+	boost::shared_ptr<std::string> data(new std::string);
+	protocolManager::write_message(m, protocolManager::default_chunk_size, *data);
+	return data;
+}
+
+std::string shared_object_store::snapshot_path(const std::string& name) const
+{
+	// Every byte but letters, digits and '-' is escaped as %XX, so that each
+	// name has a file of its own and none can step outside the directory.
+	static const char hex[] = "0123456789ABCDEF";
+	std::string file;
+	for (std::size_t i = 0; i < name.size(); ++i)
+	{
+		unsigned char c = static_cast<unsigned char>(name[i]);
+		if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-')
+		{
+			file += static_cast<char>(c);
+		}
+		else
+		{
+			file += '%';
+			file += hex[c >> 4];
+			file += hex[c & 0x0f];
+		}
+	}
+	return persistence_dir_ + "/" + file + ".rso";
+}
+
+void shared_object_store::save(const object& obj) const
+{
+	// Write to a temporary file first so a crash never leaves a torn snapshot.
+	std::string path = snapshot_path(obj.name);
+	std::string temp = path + ".tmp";
+	{
+		std::ofstream file(temp.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!file)
+		{
+			return;
+		}
+
+		std::string data;
+		put_ui32(data, obj.version);
+		put_ui32(data, static_cast<unsigned int>(obj.attributes.size()));
+		for (std::map<std::string, std::string>::const_iterator i = obj.attributes.begin(); i != obj.attributes.end(); ++i)
+		{
+			put_utf(data, i->first);
+			put_ui32(data, static_cast<unsigned int>(i->second.size()));
+			data += i->second;
+		}
+		if (!file.write(data.data(), data.size()))
+		{
+			return;
+		}
+	}
+
+	// rename replaces the old snapshot atomically on POSIX. On Windows it
+	// fails if the target exists, and MoveFileEx is the atomic replacement.
+#if defined(_WIN32)
+	MoveFileExA(temp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING);
+#else
+	std::rename(temp.c_str(), path.c_str());
+#endif
+}
+
+void shared_object_store::load(object& obj) const
+{
+	std::string path = snapshot_path(obj.name);
+	std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+	if (!file)
+	{
+		return;
+	}
+
+	std::string data;
+	char buf[4096];
+	while (file.read(buf, sizeof(buf)).gcount() > 0)
+	{
+		data.append(buf, file.gcount());
+	}
+
+	const char* p = data.data();
+	const char* end = p + data.size();
+	if (end - p < 8)
+	{
+		return;
+	}
+	obj.version = get_ui32(p);
+	unsigned int count = get_ui32(p + 4);
+	p += 8;
+
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		std::string key;
+		if (!read_utf(p, end, key) || end - p < 4)
+		{
+			return;
+		}
+		std::size_t length = get_ui32(p);
+		p += 4;
+		if (static_cast<std::size_t>(end - p) < length)
+		{
+			return;
+		}
+		obj.attributes[key].assign(p, length);
+		p += length;
+	}
+}
+
+} // namespace server
+} // namespace http
@@ -23,6 +23,7 @@
 
 #define FLVTAGTYPE_AUDIO 8
 #define FLVTAGTYPE_VIDEO 9
+#define FLVTAGTYPE_SCRIPT 18
 
 #define FLVFRAME_KEY 0x10
 #define FLVFRAME_INTER 0x20
@@ -30,6 +31,7 @@
 
 #define FLVCODEC_SORENSEN 0x02
 #define FLVCODEC_SCREEN 0x03
+#define FLVCODEC_SCREEN2 0x06
 
 
 
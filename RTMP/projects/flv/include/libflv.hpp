@@ -31,15 +31,67 @@ typedef struct FLVStream_s FLVStream;
 
 
 /*
- * creates a new flvstream
+ * receives output of a FLVStream as it is flushed
+ * @ctx context given to newFLVStreamCallback
+ * @data bytes to write
+ * @size number of bytes
+ * @return < 0 on error
+ */
+typedef int (*FLVWriteFunc)(void *ctx, const unsigned char *data, int size);
+
+/*
+ * creates a new flvstream, kept in a temporary file until written
+ * with FLVStream_write
  * @version FLV Version ( FLVVERSION_1 )
  * @flags FLVFLAG_*; add multiple flags with bitwise OR
  * @return FLVSTream
  */
 FLVStream *newFLVStream(unsigned char version, unsigned char flags);
 
+/*
+ * creates a new flvstream written to a file as it is recorded.
+ * Only a fixed size buffer is held in memory; the header flags and
+ * the onMetaData duration and filesize are filled in by FLVStream_close.
+ * @version FLV Version ( FLVVERSION_1 )
+ * @flags FLVFLAG_*; add multiple flags with bitwise OR
+ * @name filename
+ * @return FLVSTream, NULL if the file can not be created
+ */
+FLVStream *newFLVStreamFile(unsigned char version, unsigned char flags, const char *name);
+
+/*
+ * like newFLVStreamFile, for a file descriptor open for writing
+ * and seeking. The descriptor is not closed with the stream.
+ * @fd file descriptor
+ */
+FLVStream *newFLVStreamFd(unsigned char version, unsigned char flags, int fd);
+
+/*
+ * creates a new flvstream handing its output to a callback as the
+ * buffer fills. Nothing is written back, so the header flags are
+ * the ones given and there is no onMetaData tag.
+ * @func callback
+ * @ctx passed to func
+ */
+FLVStream *newFLVStreamCallback(unsigned char version, unsigned char flags, FLVWriteFunc func, void *ctx);
+
+/*
+ * passes buffered output on to the file or callback
+ * @flv FLVStream
+ * @return 0, or -1 if writing failed
+ */
+int FLVStream_flush(FLVStream *flv);
+
+/*
+ * flushes the stream, fills in what is only known at the end
+ * and frees the stream
+ * @flv FLVStream
+ * @return 0, or -1 if writing failed at any point
+ */
+int FLVStream_close(FLVStream *flv);
+
 /* 
- * dump stream to file
+ * dump stream to file; only for streams from newFLVStream
  * @flv FLVStream
  * @name filename
  */
@@ -52,6 +104,86 @@ int FLVStream_write(FLVStream *flv, const char *name);
 void dumpFLVFile(const char *name);
 
 
+/*** Reading ***/
+
+struct FLVFile_s;
+typedef struct FLVFile_s FLVFile;
+
+/*
+ * a tag of a FLVFile. data points into the mapped file and stays
+ * valid until the file is closed
+ */
+struct FLVTagView {
+	unsigned char tagType;
+	
+	/* timestamp in msec, including the extended byte */
+	unsigned int timeStamp;
+	
+	/* offset of the tag header in the file */
+	unsigned long long offset;
+	
+	unsigned int dataSize;
+	const unsigned char *data;
+};
+
+/*
+ * maps a FLV file for reading and checks its header
+ * @name filename
+ * @return FLVFile, NULL if it can not be mapped or is no FLV file
+ */
+FLVFile *FLVFile_open(const char *name);
+
+/*
+ * unmaps a FLV file
+ * @file FLVFile
+ */
+void FLVFile_close(FLVFile *file);
+
+/*
+ * @return the header flags; FLVFLAG_*
+ */
+unsigned char FLVFile_flags(FLVFile *file);
+
+/*
+ * gets the next tag, starting with the first
+ * @file FLVFile
+ * @tag filled in
+ * @return 1, or 0 at the end of the file or a truncated tag
+ */
+int FLVFile_nextTag(FLVFile *file, struct FLVTagView *tag);
+
+/*
+ * makes FLVFile_nextTag start over with the first tag
+ * @file FLVFile
+ */
+void FLVFile_rewind(FLVFile *file);
+
+/*
+ * number of complete tags. Scans the file once to build
+ * the offset table used for random access
+ * @file FLVFile
+ */
+int FLVFile_tagCount(FLVFile *file);
+
+/*
+ * gets a tag by its index
+ * @file FLVFile
+ * @index 0 .. FLVFile_tagCount - 1
+ * @tag filled in
+ * @return 1, or 0 if there is no such tag
+ */
+int FLVFile_getTag(FLVFile *file, int index, struct FLVTagView *tag);
+
+/*
+ * finds the last tag at or before a time, for files
+ * with ascending timestamps
+ * @file FLVFile
+ * @timeStamp msec
+ * @return index of the tag, the first if all are later, -1 if there are none
+ */
+int FLVFile_findTag(FLVFile *file, unsigned int timeStamp);
+
+
 /*** Screen Video Codec ***/
 
 enum {
@@ -82,6 +214,14 @@ struct PixelData{
 	unsigned char *data;
 };
 
+/* a rectangle of the screen, in pixels; row 0 is the top row */
+struct ScreenRect{
+	int x;
+	int y;
+	int width;
+	int height;
+};
+
 struct ScreenVideo_s;
 typedef struct ScreenVideo_s ScreenVideo;
 
@@ -95,6 +235,52 @@ typedef struct ScreenVideo_s ScreenVideo;
  */
 ScreenVideo *newScreenVideo(int width, int height, int blockSize);
 
+/*
+ * frees a ScreenVideo and stops its threads
+ * @video ScreenVideo
+ */
+void deleteScreenVideo(ScreenVideo *video);
+
+/*
+ * Sets how many threads compress the changed blocks of a frame,
+ * the calling thread included. The default is 0, one per processor.
+ * @video ScreenVideo
+ * @threads number of threads, 1 to compress on the calling thread only
+ * @return int
+ */
+int ScreenVideo_setThreads(ScreenVideo *video, int threads);
+
+/*
+ * Chooses between Screen Video (1) and Screen Video v2 (2), before
+ * the first frame. v2 compresses each block of a frame after the
+ * first with the same block of the first as zlib dictionary, so
+ * blocks that changed only in part take little room.
+ * @video ScreenVideo
+ * @version 1, the default, or 2
+ * @return int
+ */
+int ScreenVideo_setVersion(ScreenVideo *video, int version);
+
+/*
+ * Lets v2 write blocks in its hybrid palette form: colours of the
+ * standard palette in a byte, others cut to 15 bits in two. This
+ * is lossy, but desktop content usually shrinks by half or more.
+ * @video ScreenVideo set to version 2
+ * @hybrid 1 for the hybrid form, 0 for 24 bit colours
+ * @return int
+ */
+int ScreenVideo_setHybridPalette(ScreenVideo *video, int hybrid);
+
+/*
+ * Sets the memory kept for blocks already compressed. A block whose
+ * pixels were compressed before, at the same level, is taken from it
+ * rather than compressed again. The default is 4 MB.
+ * @video ScreenVideo
+ * @bytes size of the cache, 0 to compress every block
+ * @return int
+ */
+int ScreenVideo_setBlockCache(ScreenVideo *video, int bytes);
+
 
 /* 
  * Sets zlib compression. 
@@ -106,6 +292,17 @@ ScreenVideo *newScreenVideo(int width, int height, int blockSize);
  */
 int ScreenVideo_setCompression(ScreenVideo *video, int level);
 
+/*
+ * Lets the compression level adapt to a time budget per frame.
+ * After a frame that took longer, the next is compressed at half
+ * the level; after one that took less than half, the level goes up
+ * by one, to at most the one set with ScreenVideo_setCompression.
+ * @video ScreenVideo
+ * @msec time budget of a frame, 0 to always use the level set
+ * @return int
+ */
+int ScreenVideo_setFrameBudget(ScreenVideo *video, int msec);
+
 /*
  * adds a new videoFrame to a FLVStream
  * @video ScreenVideo
@@ -115,5 +312,20 @@ int ScreenVideo_setCompression(ScreenVideo *video, int level);
  */
 int ScreenVideo_addFrame (ScreenVideo *video, FLVStream *flv, struct PixelData *pixelData, unsigned int timeStamp );
 
+/*
+ * adds a new videoFrame to a FLVStream, given the rectangles that
+ * changed since the last frame, e.g. as reported by the window system.
+ * Only pixels inside them are compared; the rest of the screen is
+ * taken to be as before. The first frame is always read whole.
+ * @video ScreenVideo
+ * @flv FLVStream
+ * @pixelData struct PixelData * of the whole screen
+ * @timestamp timestamp in msec
+ * @rects changed rectangles, clipped to the screen; may overlap
+ * @count number of rectangles, 0 if nothing changed
+ */
+int ScreenVideo_addFrameRegions (ScreenVideo *video, FLVStream *flv, struct PixelData *pixelData, unsigned int timeStamp, 
+		const struct ScreenRect *rects, int count);
+
 
 #endif
@@ -22,55 +22,134 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
-//#include <unistd.h>
+#if defined(_WIN32)
+#include <io.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
 #include <fcntl.h>
-//#include <sys/mman.h>
 #include <flv.hpp>
 #include <errno.h>
 
 
 //#include <stdint.h>
 #include <vector>
-#include <iostream>
-#include <fstream>
 
 
 
 int errno;
 
+#if defined(_WIN32)
+#define FLVOPEN_FLAGS (O_WRONLY | O_CREAT | O_TRUNC | O_BINARY)
+#define FLVOPEN_MODE (_S_IREAD | _S_IWRITE)
+#else
+#define FLVOPEN_FLAGS (O_WRONLY | O_CREAT | O_TRUNC)
+#define FLVOPEN_MODE 0644
+#endif
+
+/* size of the output buffer, flushed whenever it fills */
+#define FLVBUFSIZE 65536
+
+/* AMF0 markers used by the onMetaData tag */
+#define AMF_NUMBER 0x00
+#define AMF_STRING 0x02
+#define AMF_ECMA_ARRAY 0x08
+#define AMF_OBJECT_END 0x09
+
 struct FLVStream_s 
 {
 	int version;
-	int length;
-	int pos;
-	unsigned char *data;
-	//std::vector<unsigned char> data;
+	int length;			/* size of data */
+	int pos;			/* bytes used in data */
+	unsigned char *data;		/* output not yet flushed */
+	
+	unsigned char flags;		/* header flags given on creation */
+	unsigned char tagFlags;		/* header flags for the tags written */
+	unsigned int lastTimeStamp;	/* highest tag timestamp, for the duration */
+	unsigned long long flushed;	/* bytes passed to the sink */
+	
+	int fd;				/* sink file, or -1 */
+	int ownsFd;			/* close fd with the stream */
+	int spool;			/* fd is a temporary file for FLVStream_write */
+	FLVWriteFunc writeFunc;		/* sink callback, if no fd */
+	void *writeCtx;
+	
+	int metaPos;			/* offset of the duration in onMetaData, or -1 */
+	int error;
 };
 
-#define FLVGROWBY 4096
-inline void grow(FLVStream *flv) 
+
+static inline void __putChar(unsigned char *data, unsigned int val)  //u_int32_t
 {
-	flv->length += FLVGROWBY;
-	//flv->data = realloc(flv->data, flv->length);
+	*data = (val & 0x000000ff);
 }
 
 
+static int sinkWrite(FLVStream *flv, const unsigned char *data, int size)
+{
+	int ret;
+	
+	if(flv->error)
+		return -1;
+	
+	if(flv->fd < 0)
+	{
+		if(flv->writeFunc(flv->writeCtx, data, size) < 0)
+			flv->error = 1;
+	}
+	else
+	{
+		while(size > 0)
+		{
+			ret = write(flv->fd, data, size);
+			if(ret <= 0)
+			{
+				perror("FLV write failed");
+				flv->error = 1;
+				break;
+			}
+			data += ret;
+			size -= ret;
+		}
+	}
+	
+	return flv->error ? -1 : 0;
+}
 
 
-static inline void __putChar(unsigned char *data, unsigned int val)  //u_int32_t
+int FLVStream_flush(FLVStream *flv)
 {
-	*data = (val & 0x000000ff);
+	if(!flv)
+		return -1;
+	
+	if(flv->pos > 0)
+	{
+		sinkWrite(flv, flv->data, flv->pos);
+		flv->flushed += flv->pos;
+		flv->pos = 0;
+	}
+	
+	return flv->error ? -1 : 0;
 }
 
 
 void writeData(FLVStream *flv, unsigned char *data, int size) 
 {
-	while(flv->pos + size >= flv->length)
+	if(flv->pos + size > flv->length)
 	{
-		grow(flv);
+		FLVStream_flush(flv);
+	}
+	
+	/* what does not fit the buffer goes straight to the sink */
+	if(size > flv->length)
+	{
+		sinkWrite(flv, data, size);
+		flv->flushed += size;
+		return;
 	}
 	
-	//flv->data.insert(flv->data.end(), data, data+size);
 	memcpy(flv->data + flv->pos, data, size);
 	flv->pos += size;
 }
@@ -78,9 +157,9 @@ void writeData(FLVStream *flv, unsigned char *data, int size)
 
 static inline void putChar(FLVStream *flv, unsigned int val) //u_int32_t
 {
-	if( flv->pos + 1 >= flv->length ) 
+	if( flv->pos + 1 > flv->length ) 
 	{
-		grow(flv);
+		FLVStream_flush(flv);
 	}
 	
 	
@@ -108,6 +187,29 @@ static inline void putUI32(FLVStream *flv, unsigned int  val) //u_int32_t
 }
 
 
+static inline void putDouble(unsigned char *data, double val)
+{
+	unsigned char bytes[8];
+	unsigned int one = 1;
+	int littleEndian = *(unsigned char *)&one;
+	int i;
+	
+	/* AMF numbers are big endian IEEE doubles */
+	memcpy(bytes, &val, 8);
+	for(i = 0; i < 8; i++)
+	{
+		data[i] = littleEndian ? bytes[7 - i] : bytes[i];
+	}
+}
+
+
+static inline void putAMFName(FLVStream *flv, const char *name)
+{
+	putUI16(flv, strlen(name));
+	writeData(flv, (unsigned char *)name, strlen(name));
+}
+
+
 
 void writeTagData(FLVStream *flv, struct FLVDataTag *tagData) 
 {
@@ -125,11 +227,19 @@ void FLV_writeTag(FLVStream *flv, struct FLVTag *tag) {
 	putChar(flv, tag->tagType);
 	putUI24(flv, tag->dataSize);
 	putUI24(flv, tag->timeStamp);
-	putUI32(flv, 0);
+	putChar(flv, tag->timeStamp >> 24);	/* TimestampExtended */
+	putUI24(flv, 0);			/* StreamID */
 	
 	writeTagData(flv, &(tag->tagData));
 	putUI32(flv, tag->dataSize + 11);
 
+	if(tag->tagType == FLVTAGTYPE_VIDEO)
+		flv->tagFlags |= FLVFLAG_VIDEO;
+	else if(tag->tagType == FLVTAGTYPE_AUDIO)
+		flv->tagFlags |= FLVFLAG_AUDIO;
+
+	if(tag->timeStamp > flv->lastTimeStamp)
+		flv->lastTimeStamp = tag->timeStamp;
 }
 
 
@@ -146,142 +256,509 @@ void writeHeader(FLVStream *flv, unsigned char version, unsigned char flags) {
 	putUI32(flv, 0);
 }
 
-FLVStream *newFLVStream(unsigned char version, unsigned char flags) {
+/*
+ * writes an onMetaData tag whose duration and filesize are filled in
+ * once the stream is complete
+ */
+static void writeMetaData(FLVStream *flv)
+{
+	/* string marker + name, array marker + count, 2 numbers, end marker */
+	unsigned int size = 13 + 5 + 2 * (2 + 8 + 9) + 3;
+	unsigned char zero[8];
+	
+	memset(zero, 0, sizeof(zero));
+	
+	putChar(flv, FLVTAGTYPE_SCRIPT);
+	putUI24(flv, size);
+	putUI32(flv, 0);
+	putUI24(flv, 0);
+	
+	putChar(flv, AMF_STRING);
+	putAMFName(flv, "onMetaData");
+	putChar(flv, AMF_ECMA_ARRAY);
+	putUI32(flv, 2);
+	
+	putAMFName(flv, "duration");
+	putChar(flv, AMF_NUMBER);
+	flv->metaPos = (int)(flv->flushed + flv->pos);
+	writeData(flv, zero, 8);
+	
+	putAMFName(flv, "filesize");
+	putChar(flv, AMF_NUMBER);
+	writeData(flv, zero, 8);
+	
+	putUI16(flv, 0);
+	putChar(flv, AMF_OBJECT_END);
+	putUI32(flv, size + 11);
+}
+
+static FLVStream *allocFLVStream(unsigned char version, unsigned char flags) {
 	FLVStream *flv;
 
 	flv = (FLVStream *)malloc(sizeof(struct FLVStream_s));
 	flv->version = version;
 
-	flv->length = FLVGROWBY;
+	flv->length = FLVBUFSIZE;
 	flv->data = (unsigned char *)malloc(flv->length);
 	flv->pos = 0;
+	
+	flv->flags = flags;
+	flv->tagFlags = 0;
+	flv->lastTimeStamp = 0;
+	flv->flushed = 0;
+	
+	flv->fd = -1;
+	flv->ownsFd = 0;
+	flv->spool = 0;
+	flv->writeFunc = NULL;
+	flv->writeCtx = NULL;
+	
+	flv->metaPos = -1;
+	flv->error = 0;
+
+	return flv;
+}
+
+static void freeFLVStream(FLVStream *flv) {
+	if(flv->ownsFd)
+		close(flv->fd);
+	free(flv->data);
+	free(flv);
+}
+
+FLVStream *newFLVStreamFd(unsigned char version, unsigned char flags, int fd) {
+	FLVStream *flv;
+
+	if(fd < 0)
+		return NULL;
+
+	flv = allocFLVStream(version, flags);
+	flv->fd = fd;
 
 	writeHeader(flv, version, flags);
+	writeMetaData(flv);
+
+	return flv;
+}
+
+FLVStream *newFLVStreamFile(unsigned char version, unsigned char flags, const char *name) {
+	FLVStream *flv;
+	int fd;
+
+	fd = open(name, FLVOPEN_FLAGS, FLVOPEN_MODE);
+	if(fd < 0) 
+	{
+		perror("Can not open flv-file");
+		return NULL;
+	}
+
+	flv = newFLVStreamFd(version, flags, fd);
+	flv->ownsFd = 1;
+
+	return flv;
+}
+
+FLVStream *newFLVStreamCallback(unsigned char version, unsigned char flags, FLVWriteFunc func, void *ctx) {
+	FLVStream *flv;
+
+	if(!func)
+		return NULL;
+
+	flv = allocFLVStream(version, flags);
+	flv->writeFunc = func;
+	flv->writeCtx = ctx;
+
+	writeHeader(flv, version, flags);
+
+	return flv;
+}
+
+FLVStream *newFLVStream(unsigned char version, unsigned char flags) {
+	FLVStream *flv;
+	FILE *spool;
+
+	/* 
+	 * the stream is spooled to a temporary file, so that memory use
+	 * does not grow with the recording until FLVStream_write
+	 */
+	spool = tmpfile();
+	if(!spool) 
+	{
+		perror("Can not create spool file");
+		return NULL;
+	}
+
+	flv = newFLVStreamFd(version, flags, dup(fileno(spool)));
+	fclose(spool);
+	if(!flv)
+		return NULL;
+	flv->ownsFd = 1;
+	flv->spool = 1;
 
 	return flv;
 }
 
 
+/*
+ * fills in the header flags and the onMetaData values, which are only
+ * known at the end, if the sink is a file
+ */
+static int patchHeader(FLVStream *flv)
+{
+	unsigned char c;
+	unsigned char number[8];
+	
+	if(flv->fd < 0 || flv->error)
+		return flv->error ? -1 : 0;
+	
+	c = flv->flags | flv->tagFlags;
+	if(lseek(flv->fd, 4, SEEK_SET) < 0 || write(flv->fd, &c, 1) != 1)
+		return -1;
+	
+	if(flv->metaPos >= 0)
+	{
+		putDouble(number, flv->lastTimeStamp / 1000.0);
+		if(lseek(flv->fd, flv->metaPos, SEEK_SET) < 0 || write(flv->fd, number, 8) != 8)
+			return -1;
+		
+		/* filesize follows the duration, its name and its marker */
+		putDouble(number, (double)flv->flushed);
+		if(lseek(flv->fd, flv->metaPos + 8 + 2 + 8 + 1, SEEK_SET) < 0 || write(flv->fd, number, 8) != 8)
+			return -1;
+	}
+	
+	return lseek(flv->fd, 0, SEEK_END) < 0 ? -1 : 0;
+}
+
+
+int FLVStream_close(FLVStream *flv)
+{
+	int ret;
+	
+	if(!flv)
+		return -1;
+	
+	FLVStream_flush(flv);
+	ret = patchHeader(flv);
+	if(flv->error)
+		ret = -1;
+	
+	freeFLVStream(flv);
+	return ret;
+}
+
+
 int FLVStream_write(FLVStream *flv, const char *name) 
 {
-	/*
-	int fd;
+	unsigned long long remaining;
+	int fd, ret;
+	
+	if(!flv || !flv->spool)
+		return -1;
 	
-	fd = open(name, O_WRONLY | O_CREAT | O_TRUNC); //, S_IRWXU
+	FLVStream_flush(flv);
+	if(patchHeader(flv) < 0 || flv->error)
+		return -1;
 	
+	fd = open(name, FLVOPEN_FLAGS, FLVOPEN_MODE);
 	if(fd < 0) 
 	{
 		perror("Write failed");
 		return -1;
 	}
+	
+	/* copy the spool through the (now empty) output buffer */
+	lseek(flv->fd, 0, SEEK_SET);
+	remaining = flv->flushed;
+	while(remaining > 0)
+	{
+		ret = read(flv->fd, flv->data, remaining < (unsigned long long)flv->length ? (int)remaining : flv->length);
+		if(ret <= 0 || write(fd, flv->data, ret) != ret)
+		{
+			perror("Write failed");
+			break;
+		}
+		remaining -= ret;
+	}
+	
+	close(fd);
+	lseek(flv->fd, 0, SEEK_END);
+	return remaining == 0 ? 0 : -1;
+}
+
+
 
-	return (int)write(fd, flv->data, flv->pos);
-	*/
+/*** Reading ***/
 
-	std::ofstream file (name, std::ios::out | std::ios::binary); //std::ios::app | 
-
-	if (file.is_open()) 
-	{ 
-		file.write((char*)flv->data, flv->pos);
-	}
-
-	file.close();
-	return 0;
+struct FLVFile_s
+{
+	const unsigned char *data;	/* the mapped file */
+	unsigned long long size;
+	unsigned char version;
+	unsigned char flags;
+	unsigned long long first;	/* offset of the first tag */
+	unsigned long long pos;		/* offset of the next tag for FLVFile_nextTag */
+	
+	unsigned long long *offsets;	/* offsets of all tags, once indexed */
+	int count;
+	
+#if defined(_WIN32)
+	HANDLE file;
+	HANDLE mapping;
+#endif
+};
 
 
+static inline unsigned int getUI24(const unsigned char *p) {
+	return (p[0] << 16) | (p[1] << 8) | p[2];
 }
 
 
+static inline unsigned int getUI32(const unsigned char *p) {
+	return ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
 
-inline unsigned char getChar(FLVStream *flv) {
-	unsigned char c = 0;
-	if(flv->pos < flv->length) {
-		c = *(flv->data + flv->pos);
-		flv->pos++;
+/*
+ * reads the tag at offset, if it lies wholly in the file
+ * @return 1 on success, 0 if there is no complete tag
+ */
+static int readTag(FLVFile *file, unsigned long long offset, struct FLVTagView *tag)
+{
+	const unsigned char *p;
+	unsigned int dataSize;
+	
+	if(offset > file->size || file->size - offset < 11 + 4)
+		return 0;
+	
+	p = file->data + offset;
+	dataSize = getUI24(p + 1);
+	if(file->size - offset - 11 - 4 < dataSize)
+		return 0;
+	
+	tag->tagType = p[0] & 0x1f;
+	tag->timeStamp = getUI24(p + 4) | ((unsigned int)p[7] << 24);
+	tag->offset = offset;
+	tag->dataSize = dataSize;
+	tag->data = p + 11;
+	return 1;
+}
+
+
+FLVFile *FLVFile_open(const char *name)
+{
+	FLVFile *file;
+	unsigned int headerSize;
+	
+	file = (FLVFile *)malloc(sizeof(struct FLVFile_s));
+	file->data = NULL;
+	file->offsets = NULL;
+	file->count = -1;
+	
+#if defined(_WIN32)
+	LARGE_INTEGER size;
+	
+	file->mapping = NULL;
+	file->file = CreateFileA(name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if(file->file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file->file, &size))
+	{
+		printf("Can not open flv-file\n");
+		FLVFile_close(file);
+		return NULL;
+	}
+	file->size = size.QuadPart;
+	if(file->size > 0)
+	{
+		file->mapping = CreateFileMapping(file->file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if(file->mapping)
+			file->data = (const unsigned char *)MapViewOfFile(file->mapping, FILE_MAP_READ, 0, 0, 0);
+	}
+#else
+	struct stat buf;
+	int fd;
+	void *data;
+	
+	fd = open(name, O_RDONLY);
+	if(fd < 0 || fstat(fd, &buf) < 0) 
+	{
+		perror("Can not open flv-file");
+		if(fd >= 0)
+			close(fd);
+		FLVFile_close(file);
+		return NULL;
 	}
-	return c;
+	file->size = buf.st_size;
+	if(file->size > 0 && file->size == (size_t)file->size)
+	{
+		data = mmap(NULL, file->size, PROT_READ, MAP_SHARED, fd, 0);
+		if(data != MAP_FAILED)
+		{
+			file->data = (const unsigned char *)data;
+			madvise(data, file->size, MADV_SEQUENTIAL);
+		}
+	}
+	close(fd);
+#endif
+	
+	if(!file->data) 
+	{
+		printf("Can not map flv-file\n");
+		FLVFile_close(file);
+		return NULL;
+	}
+	
+	if(file->size < 9 + 4 || file->data[0] != 'F' || file->data[1] != 'L' || file->data[2] != 'V') 
+	{
+		printf("Not a flv-file\n");
+		FLVFile_close(file);
+		return NULL;
+	}
+	
+	headerSize = getUI32(file->data + 5);
+	if(headerSize < 9 || headerSize > file->size - 4)
+	{
+		printf("Bad flv-header\n");
+		FLVFile_close(file);
+		return NULL;
+	}
+	
+	file->version = file->data[3];
+	file->flags = file->data[4];
+	file->first = headerSize + 4;	/* PreviousTagSize0 */
+	file->pos = file->first;
+	
+	return file;
 }
 
 
-inline unsigned int getUI24(FLVStream *flv) {
-	unsigned int ui24;
-	unsigned int c;
+void FLVFile_close(FLVFile *file)
+{
+	if(!file)
+		return;
+	
+#if defined(_WIN32)
+	if(file->data)
+		UnmapViewOfFile(file->data);
+	if(file->mapping)
+		CloseHandle(file->mapping);
+	if(file->file != INVALID_HANDLE_VALUE)
+		CloseHandle(file->file);
+#else
+	if(file->data)
+		munmap((void *)file->data, file->size);
+#endif
+	
+	free(file->offsets);
+	free(file);
+}
 
-	c = getChar(flv);
-	ui24 = (c<<16);
-	c = getChar(flv);
-	ui24 |= (c<<8);
-	c = getChar(flv);
-	ui24 |= c;
+
+unsigned char FLVFile_flags(FLVFile *file)
+{
+	return file->flags;
+}
+
+
+int FLVFile_nextTag(FLVFile *file, struct FLVTagView *tag)
+{
+	if(!readTag(file, file->pos, tag))
+		return 0;
 	
-	return ui24;
+	file->pos += 11 + tag->dataSize + 4;
+	return 1;
 }
 
 
-inline unsigned int getUI32(FLVStream *flv) {
-	unsigned int ui32;
-	unsigned int c;
+void FLVFile_rewind(FLVFile *file)
+{
+	file->pos = file->first;
+}
 
-	c = getChar(flv);
-	ui32 = (c<<24);
-	c = getChar(flv);
-	ui32 = (c<<16);
-	c = getChar(flv);
-	ui32 |= (c<<8);
-	c = getChar(flv);
-	ui32 |= c;
+
+int FLVFile_tagCount(FLVFile *file)
+{
+	struct FLVTagView tag;
+	unsigned long long offset;
+	int capacity = 0;
+	
+	if(file->count >= 0)
+		return file->count;
+	
+	file->count = 0;
+	offset = file->first;
+	while(readTag(file, offset, &tag))
+	{
+		if(file->count == capacity)
+		{
+			capacity = capacity ? capacity * 2 : 1024;
+			file->offsets = (unsigned long long *)realloc(file->offsets, capacity * sizeof(unsigned long long));
+		}
+		file->offsets[file->count++] = offset;
+		offset += 11 + tag.dataSize + 4;
+	}
 	
-	return ui32;
+	return file->count;
 }
 
-static void dumpHeader(FLVStream *flv) {
-	unsigned char c1,c2,c3;
 
-	c1 = getChar(flv);
-	c2 = getChar(flv);
-	c3 = getChar(flv);
-	if (c1 != 'F' && c2 != 'L' && c3 != 'V') {
-		printf("Not a flv-file\n");
-		return ;
+int FLVFile_getTag(FLVFile *file, int index, struct FLVTagView *tag)
+{
+	if(index < 0 || index >= FLVFile_tagCount(file))
+		return 0;
+	
+	return readTag(file, file->offsets[index], tag);
+}
+
+
+int FLVFile_findTag(FLVFile *file, unsigned int timeStamp)
+{
+	struct FLVTagView tag;
+	int low, high, mid;
+	
+	/* the last tag at or before timeStamp, by binary search */
+	low = 0;
+	high = FLVFile_tagCount(file) - 1;
+	if(high < 0)
+		return -1;
+	
+	while(low < high)
+	{
+		mid = low + (high - low + 1) / 2;
+		if(readTag(file, file->offsets[mid], &tag) && tag.timeStamp <= timeStamp)
+			low = mid;
+		else
+			high = mid - 1;
 	}
 	
-	printf("version: %i\n", getChar(flv));
-	printf("flags %x \n", getChar(flv));
-	printf("offset %i \n", getUI32(flv));
-	printf("%i\n", getUI32(flv));
-} 
+	return low;
+}
+
+
 
-void dumpHex(FLVStream *flv, int size, int width) {
-	unsigned int c;
+static void dumpHex(const unsigned char *data, int size, int width) {
+	int i;
 	
-	while(size > 0) {
-		c = getChar(flv);
-		printf("%.2x ", c);
-		if(size % width == 0)
+	for(i = 1; i <= size; i++) {
+		printf("%.2x ", data[i - 1]);
+		if(i % width == 0)
 			printf("\n");
-		size--;
 	}
 
 	printf("\n\n");
 }		
 		
 
-void dumpVideoData(FLVStream *flv, int size) {
-	unsigned char c;
-
-	c = getChar(flv);
+static void dumpVideoData(struct FLVTagView *tag) {
+	if(tag->dataSize == 0)
+		return;
 
-	printf("VideoDataHeader %x\n", c);
+	printf("VideoDataHeader %x\n", tag->data[0]);
 
-	dumpHex(flv, size -1, 8);
+	dumpHex(tag->data + 1, tag->dataSize - 1, 8);
 }
 
-int dumpFLVTag(FLVStream *flv) {
-	unsigned int nul, len;
-	struct FLVTag tag;
-
-	tag.tagType = getChar(flv);
-	switch (tag.tagType)
+static int dumpFLVTag(struct FLVTagView *tag) {
+	switch (tag->tagType)
 	{
 		case FLVTAGTYPE_AUDIO:
 			printf("AudioTag:\n");
@@ -289,72 +766,53 @@ int dumpFLVTag(FLVStream *flv) {
 		case FLVTAGTYPE_VIDEO:
 			printf("VideoTag:\n");
 			break;
+		case FLVTAGTYPE_SCRIPT:
+			printf("ScriptTag:\n");
+			break;
 		default:
-			printf("Unknown TagType %x\n ", tag.tagType);
+			printf("Unknown TagType %x\n ", tag->tagType);
 			return 0;
 	}
 	
-	tag.dataSize = getUI24(flv);
-	printf("dataSize %i\n", tag.dataSize);
-	tag.timeStamp = getUI24(flv);
-	printf("timeStamp %i\n", tag.timeStamp);
+	printf("dataSize %i\n", tag->dataSize);
+	printf("timeStamp %u\n", tag->timeStamp);
 	
-	nul = getUI32(flv);
-	if(nul)
-		return 0;
-
-	switch (tag.tagType)
+	switch (tag->tagType)
 	{
-		case FLVTAGTYPE_AUDIO:
-			printf("AudioData not implemented\n");
-			flv->pos += tag.dataSize;
-			break;
 		case FLVTAGTYPE_VIDEO:
-			dumpVideoData(flv, tag.dataSize);
+			dumpVideoData(tag);
 			break;
 		default:
-			return 0;
+			printf("Data not shown\n");
+			break;
 	}
 
-	len = getUI32(flv);
-	printf("tag-len %i\n\n\n", len);
+	printf("tag-len %i\n\n\n", getUI32(tag->data + tag->dataSize));
 	
 	return 1;
 }
 
 
-/*
 void dumpFLVFile(const char *name) 
 {
-	struct stat buf;
-	FLVStream *flv;
-	int fd, tagCount = 0;
-	
-	if(stat(name, &buf) < 0) 
-	{
-		perror("Can not open flv-file");
-		return;
-	}
-
-	flv = (FLVStream*)malloc(sizeof(struct FLVStream_s));
-	flv->length = buf.st_size;
-	flv->pos = 0;
+	FLVFile *file;
+	struct FLVTagView tag;
+	int tagCount = 0;
 	
-	fd = open(name, O_RDONLY, 0);
-	flv->data = mmap(flv->data, flv->length, PROT_READ, MAP_PRIVATE, fd, 0);
-	
-	if((int)flv->data < 0) 
-	{
-		perror("Can not open file");
+	file = FLVFile_open(name);
+	if(!file)
 		return;
-	}
 
-	dumpHeader(flv);
+	printf("version: %i\n", file->version);
+	printf("flags %x \n", file->flags);
+	printf("offset %i \n", (int)(file->first - 4));
 
-	do 
+	while(FLVFile_nextTag(file, &tag)) 
 	{
 		printf("TAG: %i \n", tagCount++);
-	} while (dumpFLVTag(flv));
-}		
-*/
-
+		if(!dumpFLVTag(&tag))
+			break;
+	}
+	
+	FLVFile_close(file);
+}
@@ -278,7 +278,7 @@ int capture(unsigned char chr)
 void stop_recording()
 {
 	is_recording = 0;
-	FLVStream_write(flv, "test.flv");
+	FLVStream_close(flv);
 }
 
 //void start_recording(GtkWidget *widget, gpointer data)
@@ -317,7 +317,7 @@ void stop_recording()
 void start_recording()
 {
 	/* creating flv und screenVideo instances */
-	flv = newFLVStream(FLVVERSION_1, FLVFLAG_VIDEO);
+	flv = newFLVStreamFile(FLVVERSION_1, FLVFLAG_VIDEO, "test.flv");
 	video = newScreenVideo(320, 240, 64);
 	printf("video width: %i, height: %i\n", 320, 240);
 
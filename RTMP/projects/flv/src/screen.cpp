@@ -27,9 +27,76 @@
 #include <flv.hpp>
 #include <assert.h>
 #include <screen.hpp>
+#include <list>
+#include <map>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SCREEN_SSE2 1
+#endif
 
 #define BLOCK_DIRTY 1
 
+/* most channels per pixel kept in image */
+#define MAX_CHANNELS 4
+
+/* bytes of compressed blocks kept for reuse by default */
+#define BLOCK_CACHE_SIZE (4 * 1024 * 1024)
+
+/* IMAGEFORMAT of a Screen Video v2 block */
+#define FORMAT_HYBRID 0x10			/* ColorDepth 2, palette and 15 bit colours */
+#define FORMAT_PRIME_PREVIOUS 0x01		/* ZlibPrimeCompressPrevious */
+
+/* zlib header and dictionary id, which a primed block is sent without */
+#define PRIMED_HEADER_SIZE 6
+
+/* the default palette of Screen Video v2, as 0xRRGGBB */
+static const unsigned int screen2Palette[128] = {
+	0x000000, 0x333333, 0x666666, 0x999999, 0xcccccc, 0xffffff,
+	0x330000, 0x660000, 0x990000, 0xcc0000, 0xff0000, 0x003300,
+	0x006600, 0x009900, 0x00cc00, 0x00ff00, 0x000033, 0x000066,
+	0x000099, 0x0000cc, 0x0000ff, 0x333300, 0x666600, 0x999900,
+	0xcccc00, 0xffff00, 0x003333, 0x006666, 0x009999, 0x00cccc,
+	0x00ffff, 0x330033, 0x660066, 0x990099, 0xcc00cc, 0xff00ff,
+	0xffff33, 0xffff66, 0xffff99, 0xffffcc, 0xff33ff, 0xff66ff,
+	0xff99ff, 0xffccff, 0x33ffff, 0x66ffff, 0x99ffff, 0xccffff,
+	0xcccc33, 0xcccc66, 0xcccc99, 0xccccff, 0xcc33cc, 0xcc66cc,
+	0xcc99cc, 0xccffcc, 0x33cccc, 0x66cccc, 0x99cccc, 0xffcccc,
+	0x999933, 0x999966, 0x9999cc, 0x9999ff, 0x993399, 0x996699,
+	0x99cc99, 0x99ff99, 0x339999, 0x669999, 0xcc9999, 0xff9999,
+	0x666633, 0x666699, 0x6666cc, 0x6666ff, 0x663366, 0x669966,
+	0x66cc66, 0x66ff66, 0x336666, 0x996666, 0xcc6666, 0xff6666,
+	0x333366, 0x333399, 0x3333cc, 0x3333ff, 0x336633, 0x339933,
+	0x33cc33, 0x33ff33, 0x663333, 0x993333, 0xcc3333, 0xff3333,
+	0x003366, 0x336600, 0x660033, 0x006633, 0x330066, 0x663300,
+	0x336699, 0x669933, 0x993366, 0x339966, 0x663399, 0x996633,
+	0x6699cc, 0x99cc66, 0xcc6699, 0x66cc99, 0x9966cc, 0xcc9966,
+	0x99ccff, 0xccff99, 0xff99cc, 0x99ffcc, 0xcc99ff, 0xffcc99,
+	0x111111, 0x222222, 0x444444, 0x555555, 0xaaaaaa, 0xbbbbbb,
+	0xdddddd, 0xeeeeee
+};
+
+/* the 15 bit form of a colour, red in the high bits */
+#define COLOR15(r, g, b) ((((r) >> 3) << 10) | (((g) >> 3) << 5) | ((b) >> 3))
+
+/* scratch space of a thread compressing blocks */
+struct BlockWorker {
+	struct BGR *block;
+	unsigned char *hybrid;			/* block in v2 hybrid form */
+	z_stream stream;			/* reset for each block */
+	int level;				/* of stream, -1 before it is made */
+};
+
+class BlockPool;
+class BlockCache;
+
 struct ScreenVideo_s {
 	int blockSize;			
 	int imageWidth;
@@ -39,44 +106,318 @@ struct ScreenVideo_s {
 	int frame;				/* frame number */
 	int frameSize;				/* bytes used in framebuf */
 	unsigned int timeOffset;
+	int channels;				/* channels per pixel in image */
 	
 	char *blockMap;
-	struct BGR *image;
+	unsigned char *image;			/* last frame, as given, bottom row first */
 	unsigned char *framebuf;
+	
+	int *dirty;				/* the dirty blocks of this frame */
+	int dirtyCount;
+	unsigned char *slots;			/* each block compressed, slotSize apart */
+	int slotSize;
+	int *slotLength;			/* bytes in each slot, -1 on failure */
+	
+	int threads;				/* threads compressing, 0 for one per cpu */
+	struct BlockWorker worker;		/* the calling thread's scratch */
+	BlockPool *pool;
+	
+	BlockCache *cache;			/* NULL when blocks are not cached */
+	boost::uint64_t *blockHash;		/* hash of each dirty block's pixels */
+	
+	int version;				/* 1 or 2, fixed by the first frame */
+	int hybrid;				/* v2 blocks in palette and 15 bit colours */
+	unsigned char *paletteIndex;		/* palette entry of each 15 bit colour, 0xff for none */
+	int rawSize;				/* bytes of a block before compression, at most */
+	unsigned char *keyBlocks;		/* v2: bytes deflated for each block of the key frame */
+	int *keyLength;				/* 0 for a block not primed from */
+	unsigned long *keyAdler;
+	
+	int level;				/* zlib level set */
+	int frameLevel;				/* level used for this frame */
+	int frameBudget;			/* msec per frame, 0 for no adapting */
+	struct FLVTag tag;			/* the frame being written */
 };
 
+static void initWorker(ScreenVideo *video, struct BlockWorker *worker) {
+	worker->block = (struct BGR *)malloc(sizeof(struct BGR) * video->blockSize * video->blockSize);
+	worker->hybrid = (unsigned char *)malloc(2 * video->blockSize * video->blockSize);
+	worker->level = -1;
+}
 
-static inline void RGB2GBR(struct RGB *src, struct BGR *dest) {
-	dest->r = src->r;
-	dest->g = src->g;
-	dest->b = src->b;
+static void freeWorker(struct BlockWorker *worker) {
+	if(worker->level >= 0)
+		deflateEnd(&worker->stream);
+	free(worker->hybrid);
+	free(worker->block);
 }
 
-static inline int compareRGB_BGR(struct RGB *p1, struct BGR *p2) {
-	if(
-			p1->r != p2->r ||
-			p1->g != p2->g ||
-			p1->b != p2->b
-	){
-		return 1;
+
+static void compressBlock(ScreenVideo *video, int pos, struct BlockWorker *worker);
+
+/*
+ * compresses the dirty blocks of a frame on worker threads,
+ * with the calling thread taking its share
+ */
+class BlockPool {
+public:
+	BlockPool(ScreenVideo *video, int workers);
+	~BlockPool();
+	
+	/* compresses video->dirty and returns once all are done */
+	void compress();
+
+private:
+	/* a worker thread */
+	void run();
+	
+	/* compresses blocks until none are left */
+	void take(struct BlockWorker *worker);
+	
+	ScreenVideo *video_;
+	boost::mutex mutex_;
+	boost::condition_variable start_;
+	boost::condition_variable done_;
+	int frame_;		/* counts calls of compress */
+	int next_;		/* next of video->dirty to take */
+	int busy_;		/* threads not done with this frame */
+	bool stopping_;
+	boost::thread_group threads_;
+};
+
+BlockPool::BlockPool(ScreenVideo *video, int workers)
+	: video_(video), frame_(0), next_(0), busy_(0), stopping_(false)
+{
+	for(int i = 0; i < workers; i++)
+		threads_.create_thread(boost::bind(&BlockPool::run, this));
+}
+
+BlockPool::~BlockPool()
+{
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		stopping_ = true;
 	}
-	else
-		return 0;
+	start_.notify_all();
+	threads_.join_all();
 }
 
-static inline void __putChar(unsigned char *data, unsigned int val)  //u_int32_t
+void BlockPool::compress()
 {
-	*data = (val & 0x000000ff);
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		frame_++;
+		next_ = 0;
+		busy_ = (int)threads_.size() + 1;
+	}
+	start_.notify_all();
+	
+	take(&video_->worker);
+	
+	boost::mutex::scoped_lock lock(mutex_);
+	busy_--;
+	while(busy_ > 0)
+		done_.wait(lock);
+}
+
+void BlockPool::run()
+{
+	struct BlockWorker worker;
+	int frame = 0;
+	
+	initWorker(video_, &worker);
+	for(;;)
+	{
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			while(frame == frame_ && !stopping_)
+				start_.wait(lock);
+			if(stopping_)
+				break;
+			frame = frame_;
+		}
+		
+		take(&worker);
+		
+		boost::mutex::scoped_lock lock(mutex_);
+		if(--busy_ == 0)
+			done_.notify_one();
+	}
+	freeWorker(&worker);
 }
 
-static inline void markBlock(ScreenVideo *video, int x, int y) {
-	int row, col;
+void BlockPool::take(struct BlockWorker *worker)
+{
+	int i;
 	
-	col = x / video->blockSize;
-	row = y / video->blockSize;
+	for(;;)
+	{
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			if(next_ >= video_->dirtyCount)
+				return;
+			i = next_++;
+		}
+		compressBlock(video_, video_->dirty[i], worker);
+	}
+}
 
-	video->blockMap[row * video->cols + col] = BLOCK_DIRTY;
-}	
+
+/*
+ * keeps compressed blocks by the hash of their pixels, so a block that
+ * comes back, like a window raised again or a cursor blinking, is not
+ * compressed again. The pixels are kept too and compared on a hit, so
+ * a collision costs a compression rather than a wrong block. The
+ * least recently used blocks go once the cache is over its size.
+ */
+class BlockCache {
+public:
+	BlockCache(size_t capacity);
+	
+	/*
+	 * copies the block compressed for pixels to out, returning its length, or -1.
+	 * context tells apart the ways the same pixels are compressed
+	 */
+	int find(boost::uint64_t hash, boost::uint64_t context, const struct BGR *pixels, int size, unsigned char *out);
+	
+	/* keeps length bytes of data as the block compressed for pixels */
+	void insert(boost::uint64_t hash, boost::uint64_t context, const struct BGR *pixels, int size, 
+			const unsigned char *data, int length);
+
+private:
+	struct Entry {
+		boost::uint64_t hash;
+		boost::uint64_t context;
+		std::vector<struct BGR> pixels;
+		std::vector<unsigned char> data;
+	};
+	typedef std::list<Entry> EntryList;
+	
+	/* bytes held for an entry */
+	static size_t cost(const Entry &entry);
+	
+	EntryList entries_;	/* most recently used first */
+	std::map<boost::uint64_t, EntryList::iterator> index_;
+	size_t bytes_;
+	size_t capacity_;
+};
+
+BlockCache::BlockCache(size_t capacity)
+	: bytes_(0), capacity_(capacity)
+{
+}
+
+size_t BlockCache::cost(const Entry &entry)
+{
+	return sizeof(Entry) + entry.pixels.size() * sizeof(struct BGR) + entry.data.size();
+}
+
+int BlockCache::find(boost::uint64_t hash, boost::uint64_t context, const struct BGR *pixels, int size, unsigned char *out)
+{
+	std::map<boost::uint64_t, EntryList::iterator>::iterator i = index_.find(hash);
+	
+	if(i == index_.end())
+		return -1;
+	
+	const Entry &entry = *i->second;
+	if(entry.context != context || (int)entry.pixels.size() != size || memcmp(&entry.pixels[0], pixels, size * sizeof(struct BGR)) != 0)
+		return -1;
+	
+	entries_.splice(entries_.begin(), entries_, i->second);
+	memcpy(out, &entry.data[0], entry.data.size());
+	return (int)entry.data.size();
+}
+
+void BlockCache::insert(boost::uint64_t hash, boost::uint64_t context, const struct BGR *pixels, int size, 
+		const unsigned char *data, int length)
+{
+	std::map<boost::uint64_t, EntryList::iterator>::iterator i = index_.find(hash);
+	
+	/* a collision replaces the block held */
+	if(i != index_.end())
+	{
+		bytes_ -= cost(*i->second);
+		entries_.erase(i->second);
+		index_.erase(i);
+	}
+	
+	entries_.push_front(Entry());
+	Entry &entry = entries_.front();
+	entry.hash = hash;
+	entry.context = context;
+	entry.pixels.assign(pixels, pixels + size);
+	entry.data.assign(data, data + length);
+	index_[hash] = entries_.begin();
+	bytes_ += cost(entry);
+	
+	while(bytes_ > capacity_ && !entries_.empty())
+	{
+		bytes_ -= cost(entries_.back());
+		index_.erase(entries_.back().hash);
+		entries_.pop_back();
+	}
+}
+
+/*
+ * hashes size pixels, 8 bytes at a time, starting from seed.
+ * Not for security; a match is checked against the pixels
+ */
+static boost::uint64_t hashPixels(const struct BGR *pixels, int size, boost::uint64_t seed) {
+	const unsigned char *p = (const unsigned char *)pixels;
+	size_t n = size * sizeof(struct BGR);
+	boost::uint64_t h = seed ^ (n * 0x9e3779b97f4a7c15ULL);
+	boost::uint64_t w;
+	
+	for(; n >= 8; n -= 8, p += 8) {
+		memcpy(&w, p, 8);
+		h = (h ^ w) * 0xff51afd7ed558ccdULL;
+		h ^= h >> 32;
+	}
+	for(; n > 0; n--, p++) {
+		h = (h ^ *p) * 0x100000001b3ULL;
+	}
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+/*
+ * compares size bytes of pixels, ignoring alpha. The SSE2 path ORs
+ * the differences of 16 bytes at a time and tests once at the end
+ */
+static inline int differs(const unsigned char *a, const unsigned char *b, int size, int channels) {
+	int i = 0;
+	
+#ifdef SCREEN_SSE2
+	__m128i acc = _mm_setzero_si128();
+	__m128i mask = channels == 4 ? _mm_set1_epi32(0x00ffffff) : _mm_set1_epi32(-1);
+	
+	/* 16 bytes hold whole pixels when there are 4 channels */
+	for(; i + 16 <= size; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+		__m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+		acc = _mm_or_si128(acc, _mm_xor_si128(x, y));
+	}
+	acc = _mm_and_si128(acc, mask);
+	if(_mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) != 0xffff)
+		return 1;
+#endif
+	
+	if(channels == 3)
+		return memcmp(a + i, b + i, size - i) != 0;
+	
+	for(; i < size; i += channels) {
+		if(a[i] != b[i] || a[i + 1] != b[i + 1] || a[i + 2] != b[i + 2])
+			return 1;
+	}
+	return 0;
+}
+
+static inline void __putChar(unsigned char *data, unsigned int val)  //u_int32_t
+{
+	*data = (val & 0x000000ff);
+}
 
 static inline void resetBlockMap(ScreenVideo *video) {
 	memset(video->blockMap, 0, video->cols * video->rows);
@@ -113,9 +454,11 @@ ScreenVideo *newScreenVideo(int width, int height, int blockSize) {
 	video->blockMap = (char *)malloc(video->cols * video->rows);
 	resetBlockMap(video);
 	
+	video->channels = 0;
+	video->image = (unsigned char *)malloc(MAX_CHANNELS * width * height);
+	memset(video->image, 0, MAX_CHANNELS * width * height);
+
 	imageSize = sizeof(struct BGR) * width * height;
-	video->image = (struct BGR *)malloc(imageSize);
-	memset(video->image, 0, imageSize);
 
 	/* 
 	 * framebuf used to hold frame payload 
@@ -126,17 +469,145 @@ ScreenVideo *newScreenVideo(int width, int height, int blockSize) {
 	 * impossible to grow bigger then imageSize
 	 */
 	video->framebuf = (unsigned char *)malloc(imageSize * 1.5);
-	memset(video->image, 0, imageSize * 1.5); 
+	memset(video->framebuf, 0, imageSize * 1.5); 
 
 	video->frameSize = 0;
 	
+	/* room for a block's worst case, see compress2, a v2 format byte and
+	 * the dictionary id in a primed block's zlib header */
+	video->slotSize = sizeof(struct BGR) * blockSize * blockSize;
+	video->slotSize += video->slotSize / 1000 + 13 + 1 + PRIMED_HEADER_SIZE - 2;
+	video->dirty = (int *)malloc(sizeof(int) * video->cols * video->rows);
+	video->dirtyCount = 0;
+	video->slots = (unsigned char *)malloc(video->slotSize * video->cols * video->rows);
+	video->slotLength = (int *)malloc(sizeof(int) * video->cols * video->rows);
+	
+	video->threads = 0;
+	initWorker(video, &video->worker);
+	video->pool = NULL;
+	
+	video->cache = new BlockCache(BLOCK_CACHE_SIZE);
+	video->blockHash = (boost::uint64_t *)malloc(sizeof(boost::uint64_t) * video->cols * video->rows);
+	
+	video->version = 1;
+	video->hybrid = 0;
+	video->paletteIndex = NULL;
+	video->rawSize = sizeof(struct BGR) * blockSize * blockSize;
+	video->keyBlocks = NULL;
+	video->keyLength = NULL;
+	video->keyAdler = NULL;
+	
+	video->level = 9;
+	video->frameLevel = 9;
+	video->frameBudget = 0;
+	
 	return video;
 }
 
+void deleteScreenVideo(ScreenVideo *video) {
+	if(!video)
+		return;
+	
+	delete video->pool;
+	delete video->cache;
+	free(video->blockHash);
+	free(video->paletteIndex);
+	free(video->keyBlocks);
+	free(video->keyLength);
+	free(video->keyAdler);
+	freeWorker(&video->worker);
+	free(video->slotLength);
+	free(video->slots);
+	free(video->dirty);
+	free(video->framebuf);
+	free(video->image);
+	free(video->blockMap);
+	free(video);
+}
+
+int ScreenVideo_setCompression(ScreenVideo *video, int level) {
+	if(!video || level < 0 || level > 9)
+		return -1;
+	
+	video->level = level;
+	video->frameLevel = level;
+	return 0;
+}
+
+int ScreenVideo_setFrameBudget(ScreenVideo *video, int msec) {
+	if(!video || msec < 0)
+		return -1;
+	
+	video->frameBudget = msec;
+	video->frameLevel = video->level;
+	return 0;
+}
+
+int ScreenVideo_setVersion(ScreenVideo *video, int version) {
+	int blocks;
+	
+	if(!video || video->frame > 0 || version < 1 || version > 2)
+		return -1;
+	
+	video->version = version;
+	if(version == 2 && !video->keyBlocks)
+	{
+		blocks = video->cols * video->rows;
+		video->keyBlocks = (unsigned char *)malloc(video->rawSize * blocks);
+		video->keyLength = (int *)malloc(sizeof(int) * blocks);
+		video->keyAdler = (unsigned long *)malloc(sizeof(unsigned long) * blocks);
+		memset(video->keyLength, 0, sizeof(int) * blocks);
+	}
+	return 0;
+}
+
+int ScreenVideo_setHybridPalette(ScreenVideo *video, int hybrid) {
+	int i;
+	unsigned int c;
+	
+	if(!video || video->version != 2)
+		return -1;
+	
+	/* no two palette colours share a 15 bit form */
+	if(hybrid && !video->paletteIndex)
+	{
+		video->paletteIndex = (unsigned char *)malloc(1 << 15);
+		memset(video->paletteIndex, 0xff, 1 << 15);
+		for(i = 0; i < 128; i++)
+		{
+			c = screen2Palette[i];
+			video->paletteIndex[COLOR15(c >> 16, (c >> 8) & 0xff, c & 0xff)] = i;
+		}
+	}
+	video->hybrid = hybrid != 0;
+	return 0;
+}
+
+int ScreenVideo_setBlockCache(ScreenVideo *video, int bytes) {
+	if(!video || bytes < 0)
+		return -1;
+	
+	delete video->cache;
+	video->cache = bytes > 0 ? new BlockCache(bytes) : NULL;
+	return 0;
+}
+
+int ScreenVideo_setThreads(ScreenVideo *video, int threads) {
+	if(!video || threads < 0)
+		return -1;
+	
+	/* the pool is made again with the new size when next needed */
+	delete video->pool;
+	video->pool = NULL;
+	video->threads = threads;
+	return 0;
+}
+
 static int getImageBlock(ScreenVideo *video, int row, int col, struct BGR *block) {
 	int blockSize = video->blockSize;
 	int x_l, x_h, y_l, y_h;
-	int x, y, line, pos;
+	int x, y;
+	const unsigned char *pixel;
 	int size = 0;
 
 	x_l = col * blockSize;
@@ -154,10 +625,13 @@ static int getImageBlock(ScreenVideo *video, int row, int col, struct BGR *block
 
 
 	for(y = y_l; y < y_h; y++) {
-		line = y * video->imageWidth;
+		pixel = video->image + (y * video->imageWidth + x_l) * video->channels;
 		for(x = x_l; x < x_h; x++) {
-			pos = line + x;
-			block[size++] = video->image[pos];
+			block[size].r = pixel[0];
+			block[size].g = pixel[1];
+			block[size].b = pixel[2];
+			size++;
+			pixel += video->channels;
 		}
 	}
 	
@@ -180,30 +654,263 @@ static inline int writeEmptyImageBlock(ScreenVideo *video) {
 }
 	
 
-static int writeImageBlock(ScreenVideo *video, int row, int col) 
+/*
+ * writes size pixels in the hybrid form of v2: the index of a palette
+ * colour in one byte, any other colour in 15 bits over two, the first
+ * with its high bit set
+ */
+static int encodeHybrid(ScreenVideo *video, const struct BGR *block, int size, unsigned char *out) 
 {
-	//struct BGR src[video->blockSize * video->blockSize];
-	struct BGR *src = new struct BGR[video->blockSize * video->blockSize];
+	unsigned char *start = out;
+	unsigned int c, index;
+	int i;
+	
+	for(i = 0; i < size; i++)
+	{
+		c = COLOR15(block[i].r, block[i].g, block[i].b);
+		index = video->paletteIndex[c];
+		if(index != 0xff && screen2Palette[index] == ((unsigned int)block[i].r << 16 | block[i].g << 8 | block[i].b))
+		{
+			*out++ = index;
+		}
+		else
+		{
+			*out++ = 0x80 | (c >> 8);
+			*out++ = c & 0xff;
+		}
+	}
+	return out - start;
+}
 
-	//unsigned char dest[video->blockSize * video->blockSize * 4];
-	unsigned char *dest = new unsigned char[video->blockSize * video->blockSize * 4];
+/* 
+ * fills worker with the bytes of a block to deflate, returning their
+ * number
+ */
+static int encodeBlock(ScreenVideo *video, int pos, struct BlockWorker *worker, const unsigned char **data) 
+{
+	int size;
+	
+	size = getImageBlock(video, pos / video->cols, pos % video->cols, worker->block);
+	if(video->version == 2 && video->hybrid)
+	{
+		*data = worker->hybrid;
+		return encodeHybrid(video, worker->block, size, worker->hybrid);
+	}
+	*data = (const unsigned char *)worker->block;
+	return size * sizeof(struct BGR);
+}
 
+/* keeps the bytes of a block of the key frame, for the frames after it to be primed with */
+static void keepKeyBlock(ScreenVideo *video, int pos, const unsigned char *data, int length) 
+{
+	memcpy(video->keyBlocks + pos * video->rawSize, data, length);
+	video->keyLength[pos] = length;
+	video->keyAdler[pos] = adler32(adler32(0L, Z_NULL, 0), data, length);
+}
 
-	int size, ret;
-	unsigned long zSize;
-	zSize = video->blockSize * video->blockSize * 4;
+/*
+ * whether a v2 block is compressed with its key frame block as zlib
+ * dictionary, ZlibPrimeCompressPrevious. The decoder inflates that
+ * block again and goes on inflating this one in the same stream, so
+ * the block's zlib header is left out and its checksum covers both
+ */
+static inline int isPrimed(ScreenVideo *video, int pos) 
+{
+	return video->version == 2 && video->frame > 0 && video->keyLength[pos] > 0;
+}
+
+/* how a block's pixels are compressed, beside its level */
+static boost::uint64_t blockContext(ScreenVideo *video, int pos) 
+{
+	boost::uint64_t context = video->frameLevel;
 	
-	size = getImageBlock(video, row, col, src);
-	ret = compress2((Bytef *)dest, &zSize, (Bytef *)src, size * sizeof(struct BGR), 9);
+	if(video->version == 2)
+	{
+		context |= 0x10 | (video->hybrid << 5);
+		
+		/* a primed block depends on its position too */
+		if(isPrimed(video, pos))
+			context |= (boost::uint64_t)(pos + 1) << 8;
+	}
+	return context;
+}
 
-	if(ret != Z_OK) 
+/*
+ * compresses a block into its slot. Blocks are independent zlib streams,
+ * so any number may be compressed at once, each with its own worker.
+ * The worker's stream is reset rather than made again for each block,
+ * which gives the same output as compress2 without its allocations.
+ */
+static void compressBlock(ScreenVideo *video, int pos, struct BlockWorker *worker) 
+{
+	z_stream *stream = &worker->stream;
+	const unsigned char *data;
+	unsigned char *slot, *out;
+	unsigned long adler;
+	int length, ret, primed;
+	
+	if(worker->level != video->frameLevel)
+	{
+		if(worker->level >= 0)
+			deflateEnd(stream);
+		memset(stream, 0, sizeof(z_stream));
+		if(deflateInit(stream, video->frameLevel) != Z_OK)
+		{
+			printf("compression failed\n");
+			worker->level = -1;
+			video->slotLength[pos] = -1;
+			return;
+		}
+		worker->level = video->frameLevel;
+	}
+	else
+	{
+		deflateReset(stream);
+	}
+	
+	length = encodeBlock(video, pos, worker, &data);
+	slot = video->slots + pos * video->slotSize;
+	out = slot;
+	primed = 0;
+	
+	if(video->version == 2)
+	{
+		primed = isPrimed(video, pos);
+		*out++ = (video->hybrid ? FORMAT_HYBRID : 0) | (primed ? FORMAT_PRIME_PREVIOUS : 0);
+		
+		if(video->frame == 0)
+			keepKeyBlock(video, pos, data, length);
+	}
+	
+	if(primed)
+		deflateSetDictionary(stream, video->keyBlocks + pos * video->rawSize, video->keyLength[pos]);
+	
+	stream->next_in = (Bytef *)data;
+	stream->avail_in = length;
+	stream->next_out = out;
+	stream->avail_out = video->slotSize - (out - slot);
+	ret = deflate(stream, Z_FINISH);
+
+	if(ret != Z_STREAM_END) 
 	{
 		printf("compression failed %i\n", ret);
-		return -1;
+		video->slotLength[pos] = -1;
+		if(video->version == 2 && video->frame == 0)
+			video->keyLength[pos] = 0;
+		return;
+	}
+	
+	out = stream->next_out;
+	if(primed)
+	{
+		/* the zlib header, with the dictionary's id, is not sent */
+		memmove(slot + 1, slot + 1 + PRIMED_HEADER_SIZE, out - slot - 1 - PRIMED_HEADER_SIZE);
+		out -= PRIMED_HEADER_SIZE;
+		adler = adler32(video->keyAdler[pos], data, length);
+		out[-4] = (adler >> 24) & 0xff;
+		out[-3] = (adler >> 16) & 0xff;
+		out[-2] = (adler >> 8) & 0xff;
+		out[-1] = adler & 0xff;
+	}
+
+	video->slotLength[pos] = out - slot;
+}
+
+/*
+ * fills the slots of dirty blocks found in the cache and leaves only
+ * the others in video->dirty. Runs on the calling thread, as hashing
+ * costs little next to compressing
+ */
+static void findCachedBlocks(ScreenVideo *video) 
+{
+	struct BGR *block = video->worker.block;
+	const unsigned char *data;
+	boost::uint64_t context;
+	int i, pos, size, length, misses = 0;
+	
+	for(i = 0; i < video->dirtyCount; i++)
+	{
+		pos = video->dirty[i];
+		size = getImageBlock(video, pos / video->cols, pos % video->cols, block);
+		
+		/* the same pixels give other data at another level */
+		context = blockContext(video, pos);
+		video->blockHash[pos] = hashPixels(block, size, context);
+		video->slotLength[pos] = video->cache->find(video->blockHash[pos], context, block, size, 
+				video->slots + pos * video->slotSize);
+		if(video->slotLength[pos] < 0)
+		{
+			video->dirty[misses++] = pos;
+		}
+		else if(video->version == 2 && video->frame == 0)
+		{
+			length = encodeBlock(video, pos, &video->worker, &data);
+			keepKeyBlock(video, pos, data, length);
+		}
+	}
+	video->dirtyCount = misses;
+}
+
+/* keeps the blocks just compressed in the cache */
+static void cacheDirtyBlocks(ScreenVideo *video) 
+{
+	struct BGR *block = video->worker.block;
+	int i, pos, size;
+	
+	for(i = 0; i < video->dirtyCount; i++)
+	{
+		pos = video->dirty[i];
+		if(video->slotLength[pos] < 0)
+			continue;
+		size = getImageBlock(video, pos / video->cols, pos % video->cols, block);
+		video->cache->insert(video->blockHash[pos], blockContext(video, pos), block, size, 
+				video->slots + pos * video->slotSize, video->slotLength[pos]);
+	}
+}
+
+static void compressDirtyBlocks(ScreenVideo *video) 
+{
+	int i, threads;
+	
+	if(video->cache)
+	{
+		findCachedBlocks(video);
+	}
+	
+	threads = video->threads;
+	if(threads == 0)
+		threads = boost::thread::hardware_concurrency();
+	
+	if(threads > 1 && video->dirtyCount > 1)
+	{
+		if(!video->pool)
+			video->pool = new BlockPool(video, threads - 1);
+		video->pool->compress();
+	}
+	else
+	{
+		for(i = 0; i < video->dirtyCount; i++)
+		{
+			compressBlock(video, video->dirty[i], &video->worker);
+		}
+	}
+	
+	if(video->cache)
+	{
+		cacheDirtyBlocks(video);
 	}
+}
+
+static int writeImageBlock(ScreenVideo *video, int pos) 
+{
+	int zSize = video->slotLength[pos];
+	
+	/* a block that failed is left as it was */
+	if(zSize < 0)
+		return writeEmptyImageBlock(video);
 
 	writeDataSize(video, zSize);
-	memcpy(video->framebuf + video->frameSize, dest, zSize);
+	memcpy(video->framebuf + video->frameSize, video->slots + pos * video->slotSize, zSize);
 	video->frameSize += zSize;
 	return zSize + 2;
 }
@@ -225,6 +932,13 @@ static inline int writeVideoPacketHeader(ScreenVideo *video) {
 	c |= ( (video->imageHeight & 0x0f00) >> 8 ) & 0x0f;	/* UB[12] imageHeight */
 	__putChar(video->framebuf + video->frameSize++, c);
 	__putChar(video->framebuf + video->frameSize++, video->imageHeight);
+	
+	/* v2 flags: no IFrameImage, no PaletteInfo */
+	if(video->version == 2)
+	{
+		__putChar(video->framebuf + video->frameSize++, 0);
+		return 5;
+	}
 
 	return 4;
 }
@@ -237,6 +951,18 @@ static void writeVideoData(ScreenVideo *video, struct FLVDataTag *dataTag)
 	int row, col, pos;
 	
 	writeVideoPacketHeader(video);
+	
+	/* dirty blocks are compressed first, maybe in parallel, then written in raster order */
+	video->dirtyCount = 0;
+	for(pos = 0; pos < video->rows * video->cols; pos++) 
+	{
+		if(video->blockMap[pos] == BLOCK_DIRTY) 
+		{
+			video->dirty[video->dirtyCount++] = pos;
+		}
+	}
+	compressDirtyBlocks(video);
+	
 	for(row = 0; row < video->rows; row++) 
 	{
 		for(col = 0; col < video->cols; col++) 
@@ -244,7 +970,7 @@ static void writeVideoData(ScreenVideo *video, struct FLVDataTag *dataTag)
 			pos = row * video->cols + col;
 			if(video->blockMap[pos] == BLOCK_DIRTY) 
 			{
-				writeImageBlock(video, row, col);
+				writeImageBlock(video, pos);
 			}
 			else
 			{
@@ -259,18 +985,18 @@ static void writeVideoData(ScreenVideo *video, struct FLVDataTag *dataTag)
 
 
 
-struct FLVTag *getFLVTag(ScreenVideo *video, int timeStamp) 
+static struct FLVTag *getFLVTag(ScreenVideo *video, int timeStamp) 
 {	
 	struct FLVTag *tag;
 	struct FLVDataTag *dataTag;
 	
-	tag = (struct FLVTag *)malloc(sizeof(struct FLVTag));
+	tag = &video->tag;
 
 	dataTag = &(tag->tagData);
 	
 	tag->tagType = FLVTAGTYPE_VIDEO;
 	tag->timeStamp = timeStamp;
-	dataTag->codecId = FLVCODEC_SCREEN;
+	dataTag->codecId = video->version == 2 ? FLVCODEC_SCREEN2 : FLVCODEC_SCREEN;
 
 	if(video->frame == 0)
 	{
@@ -298,26 +1024,87 @@ static inline int clearFrame(ScreenVideo *video)
 	return video->frame;
 }
 
-int ScreenVideo_addFrame(ScreenVideo *video, FLVStream *flv, struct PixelData *pixelData, unsigned int timeStamp ) 
+/*
+ * copies the pixels of image rows y_l to y_h - 1 and columns x_l to
+ * x_h - 1 into image, marking the blocks that change. Each row is
+ * compared a block width at a time; blocks already dirty are only copied
+ */
+static void scanRegion(ScreenVideo *video, struct PixelData *pixelData, int x_l, int x_h, int y_l, int y_h)
+{
+	int y, x, col, row = 0;
+	const unsigned char *src;
+	unsigned char *dest;
+	char *blockRow;
+	int channels, rowstride, rowSize;
+	int col_l, col_h;
+	
+	channels = pixelData->n_channels;
+	rowstride = pixelData->width * channels + pixelData->rowPadding;
+	rowSize = pixelData->width * channels;
+	col_l = x_l / video->blockSize;
+	col_h = (x_h - 1) / video->blockSize;
+	
+	for( y = y_l; y < y_h; y++) 
+	{
+		if(pixelData->rowOrder == TOPDOWN)
+		{
+			row = (pixelData->height - y - 1) * rowstride;
+		}
+		else if (pixelData->rowOrder == BOTTOMUP) 
+		{
+			row = y * rowstride;
+		}
+		
+		src = pixelData->data + row + x_l * channels;
+		dest = video->image + y * rowSize + x_l * channels;
+		blockRow = video->blockMap + (y / video->blockSize) * video->cols;
+		x = x_l;
+		for( col = col_l; col <= col_h; col++) 
+		{	
+			int end = (col + 1) * video->blockSize;
+			int size = ((end < x_h ? end : x_h) - x) * channels;
+			
+			if(blockRow[col] == BLOCK_DIRTY) 
+			{
+				memcpy(dest, src, size);
+			}
+			else if(differs(src, dest, size, channels))
+			{
+				memcpy(dest, src, size);
+				blockRow[col] = BLOCK_DIRTY;
+			}
+			src += size;
+			dest += size;
+			x = end;
+		}
+	}
+}
+
+static int addFrame(ScreenVideo *video, FLVStream *flv, struct PixelData *pixelData, unsigned int timeStamp, 
+		const struct ScreenRect *rects, int count) 
 {
-	int x, y, row = 0;
 	struct FLVTag *tag;
 	int _timeStamp;
-	struct RGB *rgb;
-	struct BGR *bgr;
-	int size = 0;
-	int rowstride;
+	int i, x_l, x_h, y_l, y_h;
+	boost::posix_time::ptime start;
+	long elapsed;
 	
 	if(!pixelData || !video || !flv)
 	{
 		return -1;
 	}
 
+	if(video->frameBudget > 0)
+	{
+		start = boost::posix_time::microsec_clock::universal_time();
+	}
+
 	if(video->frame == 0) 
 	{
 		video->timeOffset = timeStamp;
 		_timeStamp = 0;
 		markAllBlocks(video);
+		count = -1;
 	}
 	else 
 	{
@@ -330,40 +1117,80 @@ int ScreenVideo_addFrame(ScreenVideo *video, FLVStream *flv, struct PixelData *p
 		return -1;
 	}	
 
+	if(pixelData->n_channels < 3 || pixelData->n_channels > MAX_CHANNELS)
+	{
+		printf("3 or 4 channels supported\n");
+		return -1;
+	}
+
+	/* image is kept as given, so a change of format redraws everything */
+	if(video->channels != pixelData->n_channels)
+	{
+		video->channels = pixelData->n_channels;
+		markAllBlocks(video);
+		count = -1;
+	}
 	
-	rowstride = pixelData->width * pixelData->n_channels + pixelData->rowPadding;
-	
-	for( y = 0; y < pixelData->height; y++) 
+	/* a count below zero stands for the whole frame */
+	if(count < 0)
 	{
-		if(pixelData->rowOrder == TOPDOWN)
-		{
-			row = (pixelData->height - y - 1) * rowstride;
-		}
-		else if (pixelData->rowOrder == BOTTOMUP) 
+		scanRegion(video, pixelData, 0, pixelData->width, 0, pixelData->height);
+	}
+	else
+	{
+		for(i = 0; i < count; i++)
 		{
-			row = y * rowstride;
-		}
-		
-		for( x = 0; x < pixelData->width; x++) 
-		{	
-			rgb = (struct RGB*)(pixelData->data + row + x * pixelData->n_channels);
-			bgr = video->image + size++;
+			/* clip to the screen; image rows count from the bottom */
+			x_l = rects[i].x < 0 ? 0 : rects[i].x;
+			x_h = rects[i].x + rects[i].width;
+			if(x_h > pixelData->width)
+				x_h = pixelData->width;
+			y_h = pixelData->height - (rects[i].y < 0 ? 0 : rects[i].y);
+			y_l = pixelData->height - (rects[i].y + rects[i].height);
+			if(y_l < 0)
+				y_l = 0;
 			
-			if(compareRGB_BGR(rgb, bgr)) 
+			if(x_l < x_h && y_l < y_h)
 			{
-				RGB2GBR(rgb, bgr);
-				markBlock(video, x, y);
+				scanRegion(video, pixelData, x_l, x_h, y_l, y_h);
 			}
 		}
 	}
 	
 	tag = getFLVTag(video, _timeStamp);
 	FLV_writeTag(flv, tag);
-	
-	if(tag != NULL)
+
+	/* 
+	 * a frame over budget halves the level of the next; one well
+	 * within it raises the level again, up to the one set
+	 */
+	if(video->frameBudget > 0)
 	{
-		free(tag);
+		elapsed = (long)(boost::posix_time::microsec_clock::universal_time() - start).total_milliseconds();
+		if(elapsed > video->frameBudget && video->frameLevel > 1)
+		{
+			video->frameLevel /= 2;
+		}
+		else if(elapsed < video->frameBudget / 2 && video->frameLevel < video->level)
+		{
+			video->frameLevel++;
+		}
 	}
 
 	return clearFrame(video);
 }
+
+int ScreenVideo_addFrame(ScreenVideo *video, FLVStream *flv, struct PixelData *pixelData, unsigned int timeStamp ) 
+{
+	return addFrame(video, flv, pixelData, timeStamp, NULL, -1);
+}
+
+int ScreenVideo_addFrameRegions(ScreenVideo *video, FLVStream *flv, struct PixelData *pixelData, unsigned int timeStamp, 
+		const struct ScreenRect *rects, int count) 
+{
+	if(count < 0 || (!rects && count > 0))
+	{
+		return -1;
+	}
+	return addFrame(video, flv, pixelData, timeStamp, rects, count);
+}